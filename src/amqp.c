@@ -89,6 +89,7 @@ struct camqp_config_s
     char    *postfix;
     char    escape_char;
     unsigned int graphite_flags;
+    graphite_cache_t *name_cache;
 
     /* subscribe only */
     char   *exchange_type;
@@ -154,7 +155,7 @@ static void camqp_config_free (void *ptr) /* {{{ */
     sfree (conf->routing_key);
     sfree (conf->prefix);
     sfree (conf->postfix);
-
+    graphite_cache_destroy (conf->name_cache);
 
     sfree (conf);
 } /* }}} void camqp_config_free */
@@ -841,7 +842,11 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     }
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
     {
-        status = format_graphite (buffer, sizeof (buffer), ds, vl,
+        if (conf->name_cache != NULL)
+            status = format_graphite_cached (conf->name_cache,
+                    buffer, sizeof (buffer), ds, vl);
+        else
+            status = format_graphite (buffer, sizeof (buffer), ds, vl,
                     conf->prefix, conf->postfix, conf->escape_char,
                     conf->graphite_flags);
         if (status != 0)
@@ -930,6 +935,7 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     conf->prefix = NULL;
     conf->postfix = NULL;
     conf->escape_char = '_';
+    conf->name_cache = NULL;
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
@@ -1056,6 +1062,15 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
         ssnprintf (cbname, sizeof (cbname), "amqp/%s", conf->name);
 
+        if (conf->format == CAMQP_FORMAT_GRAPHITE)
+        {
+            conf->name_cache = graphite_cache_create (conf->prefix,
+                    conf->postfix, conf->escape_char, conf->graphite_flags,
+                    GRAPHITE_CACHE_SIZE_DEFAULT);
+            if (conf->name_cache == NULL)
+                WARNING ("amqp plugin: Creating the name cache failed.");
+        }
+
         status = plugin_register_write (cbname, camqp_write, &ud);
         if (status != 0)
         {
@@ -25,9 +25,59 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+/*
+ * The cgroups are the directories two levels below the mount point, e.g.
+ * "system.slice/ssh.service". Their names are used as plugin instance.
+ *
+ * The list of cgroups is kept in "cg_list" and the stat files of each cgroup
+ * are kept open between reads. If inotify is available, the mount point and
+ * the directories directly below it are watched and the list is updated
+ * incrementally. Otherwise (or if events were lost), the hierarchy is walked
+ * again.
+ */
+#define CG_BUFFER_SIZE 8192
+
+enum
+{
+	CG_FILE_CPU = 0,
+	CG_FILE_MEMORY,
+	CG_FILE_IO,
+	CG_FILE_MAX
+};
+
+/* cgroup v1 only provides "cpuacct.stat". */
+static char const *cg_files_v1[CG_FILE_MAX] = { "cpuacct.stat", NULL, NULL };
+static char const *cg_files_v2[CG_FILE_MAX] =
+	{ "cpu.stat", "memory.stat", "io.stat" };
+
+/* Values reported from "memory.stat" (cgroup v2 only). */
+static char const *cg_memory_keys[] =
+{
+	"anon",
+	"file",
+	"kernel_stack",
+	"slab",
+	"sock",
+	"shmem"
+};
+
+typedef struct cg_entry_s
+{
+	char *path;       /* relative to the mount point, e.g. "parent/name" */
+	char const *name; /* points into "path" */
+	_Bool ignored;
+	int fd[CG_FILE_MAX];
+	unsigned int generation;
+} cg_entry_t;
+
 static char const *config_keys[] =
 {
 	"CGroup",
@@ -37,88 +87,648 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *il_cgroup = NULL;
 
+static char *cg_root = NULL;
+static char const **cg_files = NULL;
+static long cg_clock_ticks = 0;
+
+static c_avl_tree_t *cg_list = NULL; /* cg_entry_t, keyed by path */
+static unsigned int cg_generation = 0;
+static _Bool cg_rescan = 1;
+
+#if HAVE_SYS_INOTIFY_H
+# define CG_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_MODIFY | IN_ONLYDIR)
+
+static int cg_inotify = -1;
+static int cg_root_wd = -1;
+/* Names of the watched directories below the mount point, keyed by wd. */
+static c_avl_tree_t *cg_parents = NULL;
+#endif
+
 __attribute__ ((nonnull(1)))
 __attribute__ ((nonnull(2)))
-static void cgroups_submit_one (char const *plugin_instance,
-		char const *type_instance, value_t value)
+__attribute__ ((nonnull(3)))
+static void cgroups_submit (char const *plugin_instance, char const *type,
+		char const *type_instance, value_t *values, size_t values_len)
 {
 	value_list_t vl = VALUE_LIST_INIT;
 
-	vl.values = &value;
-	vl.values_len = 1;
+	vl.values = values;
+	vl.values_len = values_len;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "cgroups", sizeof (vl.plugin));
 	sstrncpy (vl.plugin_instance, plugin_instance,
 			sizeof (vl.plugin_instance));
-	sstrncpy (vl.type, "cpu", sizeof (vl.type));
+	sstrncpy (vl.type, type, sizeof (vl.type));
 	sstrncpy (vl.type_instance, type_instance,
 			sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
-} /* void cgroups_submit_one */
+} /* void cgroups_submit */
 
-/*
- * This callback reads the user/system CPU time for each cgroup.
- */
-static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
-    void *user_data)
+static int cg_compare (void const *a, void const *b) /* {{{ */
 {
-	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	char buf[1024];
+	return (strcmp (a, b));
+} /* }}} int cg_compare */
+
+#if HAVE_SYS_INOTIFY_H
+static int cg_compare_wd (void const *a, void const *b) /* {{{ */
+{
+	int wa = *((int const *) a);
+	int wb = *((int const *) b);
+
+	if (wa < wb)
+		return (-1);
+	else if (wa > wb)
+		return (1);
+	return (0);
+} /* }}} int cg_compare_wd */
+#endif
+
+/* Opens the stat files that are not open yet. Returns an errno value if the
+ * CPU statistics, which every cgroup has, cannot be opened. */
+static int cg_entry_open (cg_entry_t *cg) /* {{{ */
+{
+	size_t i;
+
+	for (i = 0; i < CG_FILE_MAX; i++)
+	{
+		char path[PATH_MAX];
+
+		if ((cg_files[i] == NULL) || (cg->fd[i] >= 0))
+			continue;
+
+		ssnprintf (path, sizeof (path), "%s/%s/%s",
+				cg_root, cg->path, cg_files[i]);
+		cg->fd[i] = open (path, O_RDONLY | O_CLOEXEC);
+
+		/* The memory and io files only exist if the controllers are
+		 * enabled for the parent. */
+		if ((cg->fd[i] < 0) && (i == CG_FILE_CPU))
+			return (errno);
+	}
+
+	return (0);
+} /* }}} int cg_entry_open */
+
+static void cg_entry_free (cg_entry_t *cg) /* {{{ */
+{
+	size_t i;
+
+	if (cg == NULL)
+		return;
+
+	for (i = 0; i < CG_FILE_MAX; i++)
+		if (cg->fd[i] >= 0)
+			close (cg->fd[i]);
+
+	sfree (cg->path);
+	sfree (cg);
+} /* }}} void cg_entry_free */
+
+/* Adds the cgroup "parent/name", or marks it as current if it is known
+ * already. The ignorelist is only consulted when a cgroup is added. */
+static int cg_entry_add (char const *parent, char const *name) /* {{{ */
+{
+	char path[PATH_MAX];
+	cg_entry_t *cg;
 	int status;
+	size_t i;
 
-	FILE *fh;
+	ssnprintf (path, sizeof (path), "%s/%s", parent, name);
 
-	if (ignorelist_match (il_cgroup, cgroup_name))
+	if (c_avl_get (cg_list, path, (void *) &cg) == 0)
+	{
+		cg->generation = cg_generation;
 		return (0);
+	}
+
+	cg = calloc (1, sizeof (*cg));
+	if (cg == NULL)
+		return (ENOMEM);
+	for (i = 0; i < CG_FILE_MAX; i++)
+		cg->fd[i] = -1;
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, cgroup_name);
+	cg->path = strdup (path);
+	if (cg->path == NULL)
+	{
+		cg_entry_free (cg);
+		return (ENOMEM);
+	}
+	cg->name = cg->path + strlen (parent) + 1;
+	cg->generation = cg_generation;
+	cg->ignored = (ignorelist_match (il_cgroup, cg->name) != 0);
 
-	status = lstat (abs_path, &statbuf);
-	if (status != 0)
+	if (!cg->ignored)
 	{
-		ERROR ("cgroups plugin: stat (\"%s\") failed.",
-				abs_path);
+		status = cg_entry_open (cg);
+		if (status != 0)
+		{
+			/* Most likely removed again already. */
+			DEBUG ("cgroups plugin: Opening the stat files of \"%s\" "
+					"failed with status %i.", cg->path, status);
+			cg_entry_free (cg);
+			return (status);
+		}
+	}
+
+	if (c_avl_insert (cg_list, cg->path, cg) != 0)
+	{
+		cg_entry_free (cg);
 		return (-1);
 	}
 
+	return (0);
+} /* }}} int cg_entry_add */
+
+static void cg_entry_remove (char const *path) /* {{{ */
+{
+	cg_entry_t *cg = NULL;
+
+	if (c_avl_remove (cg_list, path, NULL, (void *) &cg) == 0)
+		cg_entry_free (cg);
+} /* }}} void cg_entry_remove */
+
+/* Returns true if "cg" is below the directory "parent", or if "parent" is
+ * NULL and "cg" was not seen during the last walk. */
+static _Bool cg_entry_match (cg_entry_t const *cg, char const *parent) /* {{{ */
+{
+	size_t len;
+
+	if (parent == NULL)
+		return (cg->generation != cg_generation);
+
+	len = strlen (parent);
+	return ((strncmp (cg->path, parent, len) == 0) && (cg->path[len] == '/'));
+} /* }}} _Bool cg_entry_match */
+
+/* Removes all cgroups below "parent", or all outdated cgroups if "parent" is
+ * NULL. */
+static void cg_entry_remove_all (char const *parent) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	char *key;
+	cg_entry_t *cg;
+
+	char **remove = NULL;
+	size_t remove_num = 0;
+	size_t remove_size = 0;
+	size_t i;
+
+	iter = c_avl_get_iterator (cg_list);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
+	{
+		if (!cg_entry_match (cg, parent))
+			continue;
+
+		if (remove_num >= remove_size)
+		{
+			size_t new_size = (remove_size > 0) ? 2 * remove_size : 64;
+			char **tmp = realloc (remove, new_size * sizeof (*remove));
+
+			if (tmp == NULL)
+				break;
+			remove = tmp;
+			remove_size = new_size;
+		}
+		remove[remove_num++] = key;
+	}
+	c_avl_iterator_destroy (iter);
+
+	/* The keys are owned by the entries, so they stay valid until each
+	 * entry is removed. */
+	for (i = 0; i < remove_num; i++)
+		cg_entry_remove (remove[i]);
+	sfree (remove);
+} /* }}} void cg_entry_remove_all */
+
+/*
+ * Gets called for every file/folder in a directory below the mount point.
+ */
+static int cg_walk_child (const char *dirname, const char *filename, /* {{{ */
+		void *user_data)
+{
+	char const *parent = user_data;
+	char abs_path[PATH_MAX];
+	struct stat statbuf;
+
+	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+	if (lstat (abs_path, &statbuf) != 0)
+		return (0);
+
 	/* We are only interested in directories, so skip everything else. */
 	if (!S_ISDIR (statbuf.st_mode))
 		return (0);
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s/cpuacct.stat",
-			dirname, cgroup_name);
-	fh = fopen (abs_path, "r");
-	if (fh == NULL)
+	cg_entry_add (parent, filename);
+	return (0);
+} /* }}} int cg_walk_child */
+
+/* Starts watching the directory "name" below the mount point and adds the
+ * cgroups in it. The watch is added first, so no cgroup is missed. */
+static int cg_parent_add (char const *name) /* {{{ */
+{
+	char abs_path[PATH_MAX];
+
+	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", cg_root, name);
+
+#if HAVE_SYS_INOTIFY_H
+	if (cg_inotify >= 0)
+	{
+		int wd;
+		char *old_name = NULL;
+		char *new_name;
+
+		wd = inotify_add_watch (cg_inotify, abs_path, CG_WATCH_MASK);
+		if (wd < 0)
+		{
+			char errbuf[1024];
+			WARNING ("cgroups plugin: inotify_add_watch (\"%s\") failed: %s",
+					abs_path, sstrerror (errno, errbuf, sizeof (errbuf)));
+			cg_rescan = 1;
+		}
+		else if ((c_avl_get (cg_parents, &wd, (void *) &old_name) != 0)
+				|| (strcmp (old_name, name) != 0))
+		{
+			int *key = malloc (sizeof (*key));
+
+			new_name = strdup (name);
+			if ((key == NULL) || (new_name == NULL))
+			{
+				sfree (key);
+				sfree (new_name);
+				return (ENOMEM);
+			}
+			*key = wd;
+
+			if (old_name != NULL)
+			{
+				int *old_key = NULL;
+				c_avl_remove (cg_parents, &wd, (void *) &old_key,
+						(void *) &old_name);
+				sfree (old_key);
+				sfree (old_name);
+			}
+			c_avl_insert (cg_parents, key, new_name);
+		}
+	}
+#endif
+
+	return (walk_directory (abs_path, cg_walk_child,
+				/* user_data = */ (void *) name,
+				/* include_hidden = */ 0));
+} /* }}} int cg_parent_add */
+
+/*
+ * Gets called for every file/folder in /sys/fs/cgroup/cpu,cpuacct (or
+ * wherever cpuacct or the cgroup v2 hierarchy is mounted on the system), such
+ * as "system".
+ */
+static int cg_walk_root (const char *dirname, const char *filename, /* {{{ */
+		void __attribute__((unused)) *user_data)
+{
+	char abs_path[PATH_MAX];
+	struct stat statbuf;
+
+	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+	if (lstat (abs_path, &statbuf) != 0)
+	{
+		ERROR ("cgroups plugin: stat (%s) failed.", abs_path);
+		return (-1);
+	}
+
+	if (S_ISDIR (statbuf.st_mode))
+		cg_parent_add (filename);
+
+	return (0);
+} /* }}} int cg_walk_root */
+
+#if HAVE_SYS_INOTIFY_H
+static void cg_inotify_close (void) /* {{{ */
+{
+	if (cg_inotify >= 0)
+		close (cg_inotify);
+	cg_inotify = -1;
+	cg_root_wd = -1;
+
+	if (cg_parents != NULL)
+	{
+		int *key;
+		char *name;
+
+		while (c_avl_pick (cg_parents, (void *) &key, (void *) &name) == 0)
+		{
+			sfree (key);
+			sfree (name);
+		}
+	}
+} /* }}} void cg_inotify_close */
+
+static void cg_inotify_open (void) /* {{{ */
+{
+	cg_inotify_close ();
+
+	if (cg_parents == NULL)
+	{
+		cg_parents = c_avl_create (cg_compare_wd);
+		if (cg_parents == NULL)
+			return;
+	}
+
+	cg_inotify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (cg_inotify < 0)
 	{
 		char errbuf[1024];
-		ERROR ("cgroups plugin: fopen (\"%s\") failed: %s",
-				abs_path,
+		WARNING ("cgroups plugin: inotify_init1 failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	cg_root_wd = inotify_add_watch (cg_inotify, cg_root, CG_WATCH_MASK);
+	if (cg_root_wd < 0)
+	{
+		char errbuf[1024];
+		WARNING ("cgroups plugin: inotify_add_watch (\"%s\") failed: %s",
+				cg_root, sstrerror (errno, errbuf, sizeof (errbuf)));
+		cg_inotify_close ();
+	}
+} /* }}} void cg_inotify_open */
+
+/* Handles a change in the directory "parent" below the mount point. */
+static void cg_parent_event (char const *parent, /* {{{ */
+		struct inotify_event const *ev)
+{
+	char path[PATH_MAX];
+
+	if (ev->mask & IN_MODIFY)
+	{
+		c_avl_iterator_t *iter;
+		char *key;
+		cg_entry_t *cg;
+
+		/* Controllers were enabled or disabled for the children. */
+		if (strcmp (ev->name, "cgroup.subtree_control") != 0)
+			return;
+
+		iter = c_avl_get_iterator (cg_list);
+		while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
+			if (!cg->ignored && cg_entry_match (cg, parent))
+				cg_entry_open (cg);
+		c_avl_iterator_destroy (iter);
+		return;
+	}
+
+	if (!(ev->mask & IN_ISDIR))
+		return;
+
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+		cg_entry_add (parent, ev->name);
+	else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+	{
+		ssnprintf (path, sizeof (path), "%s/%s", parent, ev->name);
+		cg_entry_remove (path);
+	}
+} /* }}} void cg_parent_event */
+
+/* Handles a change directly below the mount point. */
+static void cg_root_event (struct inotify_event const *ev) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	int *wd = NULL;
+	char *name = NULL;
+
+	if (ev->mask & IN_IGNORED)
+	{
+		/* Unmounted. */
+		cg_rescan = 1;
+		sfree (cg_root);
+		return;
+	}
+
+	if (!(ev->mask & IN_ISDIR))
+		return;
+
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+	{
+		cg_parent_add (ev->name);
+		return;
+	}
+	else if (!(ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+		return;
+
+	cg_entry_remove_all (ev->name);
+
+	/* The watch is removed for deleted and renamed directories alike; a
+	 * renamed directory gets a new watch with its IN_MOVED_TO event. Removing
+	 * it right away also means a late IN_IGNORED cannot affect a new
+	 * directory of the same name. */
+	iter = c_avl_get_iterator (cg_parents);
+	while (c_avl_iterator_next (iter, (void *) &wd, (void *) &name) == 0)
+		if (strcmp (name, ev->name) == 0)
+			break;
+	c_avl_iterator_destroy (iter);
+
+	if ((wd != NULL) && (strcmp (name, ev->name) == 0))
+	{
+		int key = *wd;
+
+		inotify_rm_watch (cg_inotify, key);
+		if (c_avl_remove (cg_parents, &key, (void *) &wd,
+					(void *) &name) == 0)
+		{
+			sfree (wd);
+			sfree (name);
+		}
+	}
+} /* }}} void cg_root_event */
+
+/* Applies the changes since the last read. */
+static void cg_inotify_read (void) /* {{{ */
+{
+	char buffer[CG_BUFFER_SIZE]
+		__attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+	while (!cg_rescan)
+	{
+		ssize_t len;
+		char *ptr;
+
+		len = read (cg_inotify, buffer, sizeof (buffer));
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return;
+
+			ERROR ("cgroups plugin: Reading inotify events failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			cg_rescan = 1;
+			return;
+		}
+
+		for (ptr = buffer; ptr < buffer + len; )
+		{
+			struct inotify_event const *ev = (void *) ptr;
+			char *parent = NULL;
+
+			ptr += sizeof (*ev) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				cg_rescan = 1;
+				return;
+			}
+			else if (ev->wd == cg_root_wd)
+			{
+				cg_root_event (ev);
+				if (cg_rescan)
+					return;
+				continue;
+			}
+
+			if (c_avl_get (cg_parents, &ev->wd, (void *) &parent) != 0)
+				continue;
+
+			if (ev->mask & IN_IGNORED)
+			{
+				int *key = NULL;
+
+				cg_entry_remove_all (parent);
+				c_avl_remove (cg_parents, &ev->wd, (void *) &key,
+						(void *) &parent);
+				sfree (key);
+				sfree (parent);
+			}
+			else if (ev->len > 0)
+				cg_parent_event (parent, ev);
+
+			if (cg_rescan)
+				return;
+		}
+	}
+} /* }}} void cg_inotify_read */
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/* Finds the mount point to read from: the cgroup v1 hierarchy with the
+ * cpuacct controller or, if there is none, the cgroup v2 hierarchy. */
+static int cg_find_root (void) /* {{{ */
+{
+	cu_mount_t *mnt_list;
+	cu_mount_t *mnt_ptr;
+	char const *root = NULL;
+	char const **files = NULL;
+
+	mnt_list = NULL;
+	if (cu_mount_getlist (&mnt_list) == NULL)
+	{
+		ERROR ("cgroups plugin: cu_mount_getlist failed.");
 		return (-1);
 	}
 
-	while (fgets (buf, sizeof (buf), fh) != NULL)
+	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	{
+		/* It doesn't make sense to check other cpuacct mount-points
+		 * (if any), they contain the same data. */
+		if ((strcmp (mnt_ptr->type, "cgroup") == 0)
+				&& cu_mount_checkoption (mnt_ptr->options,
+					"cpuacct", /* full = */ 1))
+		{
+			root = mnt_ptr->dir;
+			files = cg_files_v1;
+			break;
+		}
+		else if ((strcmp (mnt_ptr->type, "cgroup2") == 0) && (root == NULL))
+		{
+			root = mnt_ptr->dir;
+			files = cg_files_v2;
+		}
+	}
+
+	if (root != NULL)
+	{
+		sfree (cg_root);
+		cg_root = strdup (root);
+		cg_files = files;
+	}
+
+	cu_mount_freelist (mnt_list);
+
+	if (cg_root == NULL)
+	{
+		WARNING ("cgroups plugin: Unable to find a cgroup v1 "
+				"mount-point with the \"cpuacct\" option or a "
+				"cgroup v2 (\"cgroup2\") mount-point.");
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int cg_find_root */
+
+/* Walks the whole hierarchy and drops the cgroups that no longer exist. */
+static void cg_scan (void) /* {{{ */
+{
+	cg_generation++;
+
+#if HAVE_SYS_INOTIFY_H
+	cg_inotify_open ();
+	/* Without inotify, the hierarchy is walked on every read. */
+	cg_rescan = (cg_inotify < 0);
+#endif
+
+	walk_directory (cg_root, cg_walk_root,
+			/* user_data = */ NULL,
+			/* include_hidden = */ 0);
+
+	cg_entry_remove_all (/* parent = */ NULL);
+} /* }}} void cg_scan */
+
+/* Reads a stat file into "buffer". Returns the number of bytes read or a
+ * negative errno value. */
+static ssize_t cg_read_fd (int fd, char *buffer, size_t buffer_size) /* {{{ */
+{
+	ssize_t len;
+
+	do
+		len = pread (fd, buffer, buffer_size - 1, 0);
+	while ((len < 0) && (errno == EINTR));
+
+	if (len < 0)
+		return (-errno);
+
+	buffer[len] = 0;
+	return (len);
+} /* }}} ssize_t cg_read_fd */
+
+/* Expected format of "cpuacct.stat":
+ *
+ *   user: 12345
+ *   system: 23456
+ *
+ * Or:
+ *
+ *   user 12345
+ *   system 23456
+ *
+ * "cpu.stat" of cgroup v2 has microseconds in "user_usec" and "system_usec",
+ * which are converted to USER_HZ for compatibility. */
+static void cg_parse_cpu (cg_entry_t const *cg, char *buffer) /* {{{ */
+{
+	char *line;
+	char *saveptr = NULL;
+
+	for (line = strtok_r (buffer, "\n", &saveptr); line != NULL;
+			line = strtok_r (NULL, "\n", &saveptr))
 	{
 		char *fields[8];
-		int numfields = 0;
+		int numfields;
 		char *key;
 		size_t key_len;
 		value_t value;
 
-		/* Expected format:
-		 *
-		 *   user: 12345
-		 *   system: 23456
-		 *
-		 * Or:
-		 *
-		 *   user 12345
-		 *   system 23456
-		 */
-		strstripnewline (buf);
-		numfields = strsplit (buf, fields, STATIC_ARRAY_SIZE (fields));
+		numfields = strsplit (line, fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields != 2)
 			continue;
 
@@ -131,60 +741,173 @@ static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
 		if (key[key_len - 1] == ':')
 			key[key_len - 1] = 0;
 
-		status = parse_value (fields[1], &value, DS_TYPE_DERIVE);
-		if (status != 0)
+		if (cg_files == cg_files_v2)
+		{
+			if ((strcmp (key, "user_usec") != 0)
+					&& (strcmp (key, "system_usec") != 0))
+				continue;
+
+			if (parse_value (fields[1], &value, DS_TYPE_DERIVE) != 0)
+				continue;
+
+			key[key_len - strlen ("_usec")] = 0;
+			value.derive = (derive_t) (((uint64_t) value.derive)
+					* cg_clock_ticks / 1000000);
+		}
+		else if (parse_value (fields[1], &value, DS_TYPE_DERIVE) != 0)
 			continue;
 
-		cgroups_submit_one (cgroup_name, key, value);
+		cgroups_submit (cg->name, "cpu", key, &value, 1);
 	}
+} /* }}} void cg_parse_cpu */
 
-	fclose (fh);
-	return (0);
-} /* int read_cpuacct_procs */
-
-/*
- * Gets called for every file/folder in /sys/fs/cgroup/cpu,cpuacct (or
- * wherever cpuacct is mounted on the system). Calls walk_directory with the
- * read_cpuacct_procs callback on every folder it finds, such as "system".
- */
-static int read_cpuacct_root (const char *dirname, const char *filename,
-		void *user_data)
+static void cg_parse_memory (cg_entry_t const *cg, char *buffer) /* {{{ */
 {
-	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	int status;
+	char *line;
+	char *saveptr = NULL;
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+	for (line = strtok_r (buffer, "\n", &saveptr); line != NULL;
+			line = strtok_r (NULL, "\n", &saveptr))
+	{
+		char *fields[4];
+		value_t value;
+		size_t i;
+
+		if (strsplit (line, fields, STATIC_ARRAY_SIZE (fields)) != 2)
+			continue;
+
+		for (i = 0; i < STATIC_ARRAY_SIZE (cg_memory_keys); i++)
+			if (strcmp (fields[0], cg_memory_keys[i]) == 0)
+				break;
+		if (i >= STATIC_ARRAY_SIZE (cg_memory_keys))
+			continue;
 
-	status = lstat (abs_path, &statbuf);
-	if (status != 0)
+		if (parse_value (fields[1], &value, DS_TYPE_GAUGE) != 0)
+			continue;
+
+		cgroups_submit (cg->name, "memory", fields[0], &value, 1);
+	}
+} /* }}} void cg_parse_memory */
+
+/* "io.stat" has one line per device:
+ *
+ *   8:0 rbytes=90112 wbytes=0 rios=3 wios=0 dbytes=0 dios=0
+ *
+ * The counters of all devices are added up. */
+static void cg_parse_io (cg_entry_t const *cg, char *buffer) /* {{{ */
+{
+	derive_t rbytes = 0;
+	derive_t wbytes = 0;
+	derive_t rios = 0;
+	derive_t wios = 0;
+	value_t values[2];
+	char *line;
+	char *saveptr = NULL;
+
+	for (line = strtok_r (buffer, "\n", &saveptr); line != NULL;
+			line = strtok_r (NULL, "\n", &saveptr))
 	{
-		ERROR ("cgroups plugin: stat (%s) failed.", abs_path);
-		return (-1);
+		char *fields[16];
+		int numfields;
+		int i;
+
+		numfields = strsplit (line, fields, STATIC_ARRAY_SIZE (fields));
+		for (i = 1; i < numfields; i++)
+		{
+			char *value = strchr (fields[i], '=');
+			derive_t *dst;
+
+			if (value == NULL)
+				continue;
+			*value = 0;
+			value++;
+
+			if (strcmp (fields[i], "rbytes") == 0)
+				dst = &rbytes;
+			else if (strcmp (fields[i], "wbytes") == 0)
+				dst = &wbytes;
+			else if (strcmp (fields[i], "rios") == 0)
+				dst = &rios;
+			else if (strcmp (fields[i], "wios") == 0)
+				dst = &wios;
+			else
+				continue;
+
+			*dst += (derive_t) strtoull (value, NULL, 10);
+		}
 	}
 
-	if (S_ISDIR (statbuf.st_mode))
+	values[0].derive = rbytes;
+	values[1].derive = wbytes;
+	cgroups_submit (cg->name, "disk_octets", "", values, 2);
+
+	values[0].derive = rios;
+	values[1].derive = wios;
+	cgroups_submit (cg->name, "disk_ops", "", values, 2);
+} /* }}} void cg_parse_io */
+
+/* Reads the stat files of one cgroup. Returns non-zero if the cgroup has been
+ * removed. */
+static int cg_entry_read (cg_entry_t *cg) /* {{{ */
+{
+	char buffer[CG_BUFFER_SIZE];
+	size_t i;
+
+	for (i = 0; i < CG_FILE_MAX; i++)
 	{
-		status = walk_directory (abs_path, read_cpuacct_procs,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		return (status);
+		ssize_t len;
+
+		if (cg->fd[i] < 0)
+			continue;
+
+		len = cg_read_fd (cg->fd[i], buffer, sizeof (buffer));
+		if (len < 0)
+		{
+			/* Once a cgroup is removed, reading its files fails with
+			 * ENODEV. The memory and io files are also removed when the
+			 * controller is disabled. */
+			if (i == CG_FILE_CPU)
+				return (-1);
+
+			close (cg->fd[i]);
+			cg->fd[i] = -1;
+			continue;
+		}
+
+		if (i == CG_FILE_CPU)
+			cg_parse_cpu (cg, buffer);
+		else if (i == CG_FILE_MEMORY)
+			cg_parse_memory (cg, buffer);
+		else if (i == CG_FILE_IO)
+			cg_parse_io (cg, buffer);
 	}
 
 	return (0);
-}
+} /* }}} int cg_entry_read */
 
 static int cgroups_init (void)
 {
 	if (il_cgroup == NULL)
 		il_cgroup = ignorelist_create (1);
 
+	if (cg_list == NULL)
+	{
+		cg_list = c_avl_create (cg_compare);
+		if (cg_list == NULL)
+			return (-1);
+	}
+
+	cg_clock_ticks = sysconf (_SC_CLK_TCK);
+	if (cg_clock_ticks <= 0)
+		cg_clock_ticks = 100;
+
 	return (0);
 }
 
 static int cgroups_config (const char *key, const char *value)
 {
-	cgroups_init ();
+	if (il_cgroup == NULL)
+		il_cgroup = ignorelist_create (1);
 
 	if (strcasecmp (key, "CGroup") == 0)
 	{
@@ -206,46 +929,84 @@ static int cgroups_config (const char *key, const char *value)
 
 static int cgroups_read (void)
 {
-	cu_mount_t *mnt_list;
-	cu_mount_t *mnt_ptr;
-	_Bool cgroup_found = 0;
+	c_avl_iterator_t *iter;
+	char *key;
+	cg_entry_t *cg;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
+	char **removed = NULL;
+	size_t removed_num = 0;
+	size_t removed_size = 0;
+	size_t i;
+
+	if (cg_root == NULL)
 	{
-		ERROR ("cgroups plugin: cu_mount_getlist failed.");
-		return (-1);
+		cg_rescan = 1;
+		if (cg_find_root () != 0)
+			return (-1);
 	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+#if HAVE_SYS_INOTIFY_H
+	if (!cg_rescan)
+		cg_inotify_read ();
+	/* The mount point may have gone away. */
+	if ((cg_root == NULL) && (cg_find_root () != 0))
+		return (-1);
+#endif
+
+	if (cg_rescan)
+		cg_scan ();
+
+	iter = c_avl_get_iterator (cg_list);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
 	{
-		/* Find the cgroup mountpoint which contains the cpuacct
-		 * controller. */
-		if ((strcmp(mnt_ptr->type, "cgroup") != 0)
-				|| !cu_mount_checkoption(mnt_ptr->options,
-					"cpuacct", /* full = */ 1))
+		if (cg->ignored || (cg_entry_read (cg) == 0))
 			continue;
 
-		walk_directory (mnt_ptr->dir, read_cpuacct_root,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		cgroup_found = 1;
-		/* It doesn't make sense to check other cpuacct mount-points
-		 * (if any), they contain the same data. */
-		break;
+		/* Removed, but the event has not been processed yet. */
+		if (removed_num >= removed_size)
+		{
+			size_t new_size = (removed_size > 0) ? 2 * removed_size : 16;
+			char **tmp = realloc (removed, new_size * sizeof (*removed));
+
+			if (tmp == NULL)
+				continue;
+			removed = tmp;
+			removed_size = new_size;
+		}
+		removed[removed_num++] = key;
 	}
+	c_avl_iterator_destroy (iter);
 
-	cu_mount_freelist (mnt_list);
+	for (i = 0; i < removed_num; i++)
+		cg_entry_remove (removed[i]);
+	sfree (removed);
+
+	return (0);
+} /* int cgroup_read */
 
-	if (!cgroup_found)
+static int cgroups_shutdown (void)
+{
+#if HAVE_SYS_INOTIFY_H
+	cg_inotify_close ();
+	if (cg_parents != NULL)
+		c_avl_destroy (cg_parents);
+	cg_parents = NULL;
+#endif
+
+	if (cg_list != NULL)
 	{
-		WARNING ("cgroups plugin: Unable to find cgroup "
-				"mount-point with the \"cpuacct\" option.");
-		return (-1);
+		char *key;
+		cg_entry_t *cg;
+
+		while (c_avl_pick (cg_list, (void *) &key, (void *) &cg) == 0)
+			cg_entry_free (cg);
+		c_avl_destroy (cg_list);
+		cg_list = NULL;
 	}
 
+	sfree (cg_root);
 	return (0);
-} /* int cgroup_read */
+}
 
 void module_register (void)
 {
@@ -253,4 +1014,5 @@ void module_register (void)
 			config_keys, config_keys_num);
 	plugin_register_init ("cgroups", cgroups_init);
 	plugin_register_read ("cgroups", cgroups_read);
+	plugin_register_shutdown ("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -30,6 +30,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #ifdef HAVE_MACH_KERN_RETURN_H
 # include <mach/kern_return.h>
@@ -134,7 +135,7 @@ static mach_msg_type_number_t cpu_list_len;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+static procfile_t *proc_stat = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -308,6 +309,28 @@ static int init (void)
 	return (0);
 } /* int init */
 
+#if KERNEL_LINUX
+/* Maps the "cpu<num>" lines of /proc/stat to the CPU number. */
+static int cpu_slot (char const *key, /* {{{ */
+		size_t __attribute__((unused)) line,
+		void __attribute__((unused)) *user_data)
+{
+	if (strncmp (key, "cpu", 3) != 0)
+		return (-1);
+	if ((key[3] < '0') || (key[3] > '9'))
+		return (-1);
+
+	return (atoi (key + 3));
+} /* }}} int cpu_slot */
+
+static int cpu_shutdown (void) /* {{{ */
+{
+	procfile_close (proc_stat);
+	proc_stat = NULL;
+	return (0);
+} /* }}} int cpu_shutdown */
+#endif /* KERNEL_LINUX */
+
 static void submit_value (int cpu_num, int cpu_state, const char *type, value_t value)
 {
 	value_t values[1];
@@ -597,33 +620,45 @@ static int cpu_read (void)
 
 #elif defined(KERNEL_LINUX) /* {{{ */
 	int cpu;
-	FILE *fh;
-	char buf[1024];
+	size_t i;
+	int status;
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	if (proc_stat == NULL)
+	{
+		proc_stat = procfile_open_indexed ("/proc/stat",
+				/* key field = */ 0, cpu_slot, /* user data = */ NULL);
+		if (proc_stat == NULL)
+		{
+			char errbuf[1024];
+			ERROR ("cpu plugin: open (/proc/stat) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	status = procfile_read (proc_stat);
+	if (status != 0)
 	{
 		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		ERROR ("cpu plugin: Reading /proc/stat failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	for (i = 0; i < procfile_lines_num (proc_stat); i++)
 	{
-		if (strncmp (buf, "cpu", 3))
-			continue;
-		if ((buf[3] < '0') || (buf[3] > '9'))
+		cpu = procfile_slot (proc_stat, i);
+		if (cpu < 0)
 			continue;
 
-		numfields = strsplit (buf, fields, 9);
+		numfields = procfile_split (procfile_line (proc_stat, i),
+				fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields < 5)
 			continue;
 
-		cpu = atoi (fields[0] + 3);
-
 		cpu_stage (cpu, COLLECTD_CPU_STATE_USER,   (derive_t) atoll(fields[1]), now);
 		cpu_stage (cpu, COLLECTD_CPU_STATE_NICE,   (derive_t) atoll(fields[2]), now);
 		cpu_stage (cpu, COLLECTD_CPU_STATE_SYSTEM, (derive_t) atoll(fields[3]), now);
@@ -639,7 +674,6 @@ static int cpu_read (void)
 				cpu_stage (cpu, COLLECTD_CPU_STATE_STEAL, (derive_t) atoll(fields[8]), now);
 		}
 	}
-	fclose (fh);
 /* }}} #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT) /* {{{ */
@@ -838,6 +872,9 @@ void module_register (void)
 	plugin_register_init ("cpu", init);
 	plugin_register_config ("cpu", cpu_config, config_keys, config_keys_num);
 	plugin_register_read ("cpu", cpu_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("cpu", cpu_shutdown);
+#endif
 } /* void module_register */
 
 /* vim: set sw=8 sts=8 noet fdm=marker : */
@@ -25,6 +25,30 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
+
+/*
+ * Private data types
+ */
+/* An open, locked file. Entries are kept in a tree for lookups and in a
+ * doubly linked list ordered by last use, so the least recently used file
+ * can be closed when "MaxOpenFiles" is exceeded. */
+struct csv_file_s;
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s
+{
+	char *filename;
+	FILE *fh;
+	_Bool dirty;
+	/* Identify the opened file, so a rotated file can be detected. */
+	dev_t dev;
+	ino_t ino;
+
+	csv_file_t *prev; /* used more recently */
+	csv_file_t *next; /* used less recently */
+};
 
 /*
  * Private variables
@@ -32,13 +56,33 @@
 static const char *config_keys[] =
 {
 	"DataDir",
-	"StoreRates"
+	"StoreRates",
+	"MaxOpenFiles",
+	"FlushInterval",
+	"SingleFile"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
+static int max_open_files = 0;
+static cdtime_t flush_interval = 0;
+static char *single_file = NULL;
+
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *files_tree = NULL;
+static csv_file_t *files_head = NULL;
+static csv_file_t *files_tail = NULL;
+static int files_num = 0;
+static char files_date[16] = "";
+static cdtime_t files_last_flush = 0;
+/* Set by csv_shutdown(); writes arriving afterwards are refused. */
+static _Bool files_shutdown = 0;
+
+static pthread_mutex_t date_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t date_time = 0;
+static char date_suffix[16] = "";
 
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
@@ -120,6 +164,42 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	return (0);
 } /* int value_list_to_string */
 
+/* Returns the "-YYYY-MM-DD" suffix for the current date. The result is cached
+ * for one second, because "localtime_r" is pretty expensive. */
+static int csv_date_suffix (char *buffer, size_t buffer_size) /* {{{ */
+{
+	time_t now;
+	struct tm struct_tm;
+	int status = 0;
+
+	now = time (NULL);
+
+	pthread_mutex_lock (&date_lock);
+	if ((now != date_time) || (date_suffix[0] == 0))
+	{
+		if (localtime_r (&now, &struct_tm) == NULL)
+		{
+			ERROR ("csv plugin: localtime_r failed");
+			status = -1;
+		}
+		/* yep, strftime returns zero on error. */
+		else if (strftime (date_suffix, sizeof (date_suffix),
+					"-%Y-%m-%d", &struct_tm) == 0)
+		{
+			ERROR ("csv plugin: strftime failed");
+			status = -1;
+		}
+		else
+			date_time = now;
+	}
+
+	if (status == 0)
+		sstrncpy (buffer, date_suffix, buffer_size);
+	pthread_mutex_unlock (&date_lock);
+
+	return (status);
+} /* }}} int csv_date_suffix */
+
 static int value_list_to_filename (char *buffer, size_t buffer_size,
 		value_list_t const *vl)
 {
@@ -127,8 +207,6 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 
 	char *ptr = buffer;
 	size_t ptr_size = buffer_size;
-	time_t now;
-	struct tm struct_tm;
 
 	if (datadir != NULL)
 	{
@@ -162,25 +240,11 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 		return (ENOMEM);
 	}
 
-	/* TODO: Find a way to minimize the calls to `localtime_r',
-	 * since they are pretty expensive.. */
-	now = time (NULL);
-	if (localtime_r (&now, &struct_tm) == NULL)
-	{
-		ERROR ("csv plugin: localtime_r failed");
-		return (-1);
-	}
-
-	status = strftime (ptr, ptr_size, "-%Y-%m-%d", &struct_tm);
-	if (status == 0) /* yep, it returns zero on error. */
-	{
-		ERROR ("csv plugin: strftime failed");
-		return (-1);
-	}
-
-	return (0);
+	return (csv_date_suffix (ptr, ptr_size));
 } /* int value_list_to_filename */
 
+/* Creates "filename" and writes the header line. With "ds" being NULL, the
+ * header for the "SingleFile" format is written. */
 static int csv_create_file (const char *filename, const data_set_t *ds)
 {
 	FILE *csv;
@@ -199,9 +263,14 @@ static int csv_create_file (const char *filename, const data_set_t *ds)
 		return (-1);
 	}
 
-	fprintf (csv, "epoch");
-	for (i = 0; i < ds->ds_num; i++)
-		fprintf (csv, ",%s", ds->ds[i].name);
+	if (ds == NULL)
+		fprintf (csv, "identifier,epoch,values");
+	else
+	{
+		fprintf (csv, "epoch");
+		for (i = 0; i < ds->ds_num; i++)
+			fprintf (csv, ",%s", ds->ds[i].name);
+	}
 
 	fprintf (csv, "\n");
 	fclose (csv);
@@ -251,6 +320,32 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if (strcasecmp ("MaxOpenFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			WARNING ("csv plugin: Invalid MaxOpenFiles %i.", tmp);
+			return (-1);
+		}
+		max_open_files = tmp;
+	}
+	else if (strcasecmp ("FlushInterval", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			WARNING ("csv plugin: Invalid FlushInterval %g.", tmp);
+			return (-1);
+		}
+		flush_interval = DOUBLE_TO_CDTIME_T (tmp);
+	}
+	else if (strcasecmp ("SingleFile", key) == 0)
+	{
+		sfree (single_file);
+		if (value[0] != 0)
+			single_file = strdup (value);
+	}
 	else
 	{
 		return (-1);
@@ -258,60 +353,21 @@ static int csv_config (const char *key, const char *value)
 	return (0);
 } /* int csv_config */
 
-static int csv_write (const data_set_t *ds, const value_list_t *vl,
-		user_data_t __attribute__((unused)) *user_data)
+/* Opens "filename" for appending, creating it if necessary, and locks it. */
+static FILE *csv_open_file (const char *filename, const data_set_t *ds) /* {{{ */
 {
 	struct stat  statbuf;
-	char         filename[512];
-	char         values[4096];
 	FILE        *csv;
 	int          csv_fd;
 	struct flock fl;
 	int          status;
 
-	if (0 != strcmp (ds->type, vl->type)) {
-		ERROR ("csv plugin: DS type does not match value list type");
-		return -1;
-	}
-
-	status = value_list_to_filename (filename, sizeof (filename), vl);
-	if (status != 0)
-		return (-1);
-
-	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
-
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
-		return (-1);
-
-	if (use_stdio)
-	{
-		size_t i;
-
-		escape_string (filename, sizeof (filename));
-
-		/* Replace commas by colons for PUTVAL compatible output. */
-		for (i = 0; i < sizeof (values); i++)
-		{
-			if (values[i] == 0)
-				break;
-			else if (values[i] == ',')
-				values[i] = ':';
-		}
-
-		fprintf (use_stdio == 1 ? stdout : stderr,
-			 "PUTVAL %s interval=%.3f %s\n",
-			 filename,
-			 CDTIME_T_TO_DOUBLE (vl->interval),
-			 values);
-		return (0);
-	}
-
 	if (stat (filename, &statbuf) == -1)
 	{
 		if (errno == ENOENT)
 		{
 			if (csv_create_file (filename, ds))
-				return (-1);
+				return (NULL);
 		}
 		else
 		{
@@ -319,14 +375,14 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 			ERROR ("stat(%s) failed: %s", filename,
 					sstrerror (errno, errbuf,
 						sizeof (errbuf)));
-			return (-1);
+			return (NULL);
 		}
 	}
 	else if (!S_ISREG (statbuf.st_mode))
 	{
 		ERROR ("stat(%s): Not a regular file!",
 				filename);
-		return (-1);
+		return (NULL);
 	}
 
 	csv = fopen (filename, "a");
@@ -335,7 +391,7 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		char errbuf[1024];
 		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		return (NULL);
 	}
 	csv_fd = fileno (csv);
 
@@ -353,9 +409,285 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		ERROR ("csv plugin: flock (%s) failed: %s", filename,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		fclose (csv);
+		return (NULL);
+	}
+
+	return (csv);
+} /* }}} FILE *csv_open_file */
+
+/*
+ * File handle cache. All functions below must be called with "files_lock"
+ * held.
+ */
+static void csv_file_unlink (csv_file_t *f) /* {{{ */
+{
+	if (f->prev != NULL)
+		f->prev->next = f->next;
+	else
+		files_head = f->next;
+
+	if (f->next != NULL)
+		f->next->prev = f->prev;
+	else
+		files_tail = f->prev;
+
+	f->prev = NULL;
+	f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+static void csv_file_push (csv_file_t *f) /* {{{ */
+{
+	f->prev = NULL;
+	f->next = files_head;
+	if (files_head != NULL)
+		files_head->prev = f;
+	files_head = f;
+	if (files_tail == NULL)
+		files_tail = f;
+} /* }}} void csv_file_push */
+
+static void csv_file_close (csv_file_t *f) /* {{{ */
+{
+	c_avl_remove (files_tree, f->filename, NULL, NULL);
+	csv_file_unlink (f);
+	files_num--;
+
+	/* Closing the file releases the lock, after flushing the buffer. */
+	fclose (f->fh);
+	sfree (f->filename);
+	sfree (f);
+} /* }}} void csv_file_close */
+
+static void csv_files_close_all (void) /* {{{ */
+{
+	while (files_head != NULL)
+		csv_file_close (files_head);
+} /* }}} void csv_files_close_all */
+
+/* Writes out buffered lines. Files which have been removed or replaced,
+ * e.g. by logrotate, are closed so the next write opens the new file. */
+static void csv_files_flush (void) /* {{{ */
+{
+	csv_file_t *f;
+	csv_file_t *next;
+
+	for (f = files_head; f != NULL; f = next)
+	{
+		struct stat statbuf;
+
+		next = f->next;
+
+		if (f->dirty && (fflush (f->fh) != 0))
+		{
+			char errbuf[1024];
+			ERROR ("csv plugin: fflush (%s) failed: %s", f->filename,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+		f->dirty = 0;
+
+		if ((stat (f->filename, &statbuf) != 0)
+				|| (statbuf.st_dev != f->dev)
+				|| (statbuf.st_ino != f->ino))
+		{
+			DEBUG ("csv plugin: %s has been rotated, closing it.",
+					f->filename);
+			csv_file_close (f);
+		}
+	}
+
+	files_last_flush = cdtime ();
+} /* }}} void csv_files_flush */
+
+/* Returns the cached handle for "filename", opening the file if required. */
+static csv_file_t *csv_file_get (const char *filename, /* {{{ */
+		const data_set_t *ds)
+{
+	csv_file_t *f = NULL;
+
+	if (c_avl_get (files_tree, filename, (void *) &f) == 0)
+	{
+		csv_file_unlink (f);
+		csv_file_push (f);
+		return (f);
+	}
+
+	f = malloc (sizeof (*f));
+	if (f == NULL)
+	{
+		ERROR ("csv plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (f, 0, sizeof (*f));
+
+	f->filename = strdup (filename);
+	if (f->filename == NULL)
+	{
+		ERROR ("csv plugin: strdup failed.");
+		sfree (f);
+		return (NULL);
+	}
+
+	f->fh = csv_open_file (filename, ds);
+	if (f->fh == NULL)
+	{
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+
+	{
+		struct stat statbuf;
+
+		if (fstat (fileno (f->fh), &statbuf) == 0)
+		{
+			f->dev = statbuf.st_dev;
+			f->ino = statbuf.st_ino;
+		}
+	}
+
+	if (c_avl_insert (files_tree, f->filename, f) != 0)
+	{
+		ERROR ("csv plugin: c_avl_insert (%s) failed.", filename);
+		fclose (f->fh);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+	csv_file_push (f);
+	files_num++;
+
+	while (files_num > max_open_files)
+		csv_file_close (files_tail);
+
+	return (f);
+} /* }}} csv_file_t *csv_file_get */
+
+static int csv_write_cached (const char *filename, /* {{{ */
+		const data_set_t *ds, const char *prefix, const char *values)
+{
+	char date[sizeof (files_date)];
+	csv_file_t *f;
+	int status;
+
+	if (csv_date_suffix (date, sizeof (date)) != 0)
+		return (-1);
+
+	pthread_mutex_lock (&files_lock);
+
+	if (files_shutdown)
+	{
+		pthread_mutex_unlock (&files_lock);
 		return (-1);
 	}
 
+	/* The date is part of the file names, so after midnight none of the
+	 * open files will be written to again. */
+	if (strcmp (date, files_date) != 0)
+	{
+		csv_files_close_all ();
+		sstrncpy (files_date, date, sizeof (files_date));
+	}
+
+	f = csv_file_get (filename, ds);
+	if (f == NULL)
+	{
+		pthread_mutex_unlock (&files_lock);
+		return (-1);
+	}
+
+	if (prefix != NULL)
+		status = fprintf (f->fh, "%s,%s\n", prefix, values);
+	else
+		status = fprintf (f->fh, "%s\n", values);
+	if (status < 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: Writing to %s failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		csv_file_close (f);
+		pthread_mutex_unlock (&files_lock);
+		return (-1);
+	}
+	f->dirty = 1;
+
+	if ((cdtime () - files_last_flush) >= flush_interval)
+		csv_files_flush ();
+
+	pthread_mutex_unlock (&files_lock);
+	return (0);
+} /* }}} int csv_write_cached */
+
+static int csv_write (const data_set_t *ds, const value_list_t *vl,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	char         filename[512];
+	char         identifier[512];
+	char         values[4096];
+	FILE        *csv;
+	int          status;
+
+	if (0 != strcmp (ds->type, vl->type)) {
+		ERROR ("csv plugin: DS type does not match value list type");
+		return -1;
+	}
+
+	status = value_list_to_filename (filename, sizeof (filename), vl);
+	if (status != 0)
+		return (-1);
+
+	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
+
+	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
+		return (-1);
+
+	if (use_stdio)
+	{
+		size_t i;
+
+		escape_string (filename, sizeof (filename));
+
+		/* Replace commas by colons for PUTVAL compatible output. */
+		for (i = 0; i < sizeof (values); i++)
+		{
+			if (values[i] == 0)
+				break;
+			else if (values[i] == ',')
+				values[i] = ':';
+		}
+
+		fprintf (use_stdio == 1 ? stdout : stderr,
+			 "PUTVAL %s interval=%.3f %s\n",
+			 filename,
+			 CDTIME_T_TO_DOUBLE (vl->interval),
+			 values);
+		return (0);
+	}
+
+	if (single_file != NULL)
+	{
+		char date[sizeof (files_date)];
+
+		status = FORMAT_VL (identifier, sizeof (identifier), vl);
+		if (status != 0)
+			return (-1);
+
+		if (csv_date_suffix (date, sizeof (date)) != 0)
+			return (-1);
+		ssnprintf (filename, sizeof (filename), "%s%s",
+				single_file, date);
+
+		return (csv_write_cached (filename, /* ds = */ NULL,
+					identifier, values));
+	}
+
+	if (max_open_files > 0)
+		return (csv_write_cached (filename, ds,
+					/* prefix = */ NULL, values));
+
+	csv = csv_open_file (filename, ds);
+	if (csv == NULL)
+		return (-1);
+
 	fprintf (csv, "%s\n", values);
 
 	/* The lock is implicitely released. I we don't release it explicitely
@@ -365,9 +697,78 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 	return (0);
 } /* int csv_write */
 
+static int csv_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+		__attribute__((unused)) const char *identifier,
+		__attribute__((unused)) user_data_t *user_data)
+{
+	pthread_mutex_lock (&files_lock);
+	csv_files_flush ();
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* }}} int csv_flush */
+
+/* Flushes buffered lines periodically even when no new values arrive. */
+static int csv_flush_read (__attribute__((unused)) user_data_t *ud) /* {{{ */
+{
+	return (csv_flush (/* timeout = */ 0, /* identifier = */ NULL,
+				/* user_data = */ NULL));
+} /* }}} int csv_flush_read */
+
+static int csv_init (void) /* {{{ */
+{
+	struct timespec interval;
+
+	if (use_stdio || ((max_open_files == 0) && (single_file == NULL)))
+		return (0);
+
+	/* All identifiers share one file in "SingleFile" mode. */
+	if (max_open_files == 0)
+		max_open_files = 1;
+
+	if (flush_interval == 0)
+		flush_interval = plugin_get_interval ();
+
+	if (files_tree == NULL)
+	{
+		files_tree = c_avl_create ((void *) strcmp);
+		if (files_tree == NULL)
+		{
+			ERROR ("csv plugin: c_avl_create failed.");
+			return (-1);
+		}
+	}
+
+	CDTIME_T_TO_TIMESPEC (flush_interval, &interval);
+	plugin_register_complex_read (/* group = */ NULL, "csv",
+			csv_flush_read, &interval, /* user_data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
+
+	return (0);
+} /* }}} int csv_init */
+
+static int csv_shutdown (void) /* {{{ */
+{
+	pthread_mutex_lock (&files_lock);
+	/* Write threads are stopped after the shutdown callbacks have run, so
+	 * values may still arrive. */
+	files_shutdown = 1;
+	if (files_tree != NULL)
+	{
+		csv_files_close_all ();
+		c_avl_destroy (files_tree);
+		files_tree = NULL;
+	}
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* }}} int csv_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("csv", csv_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
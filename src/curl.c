@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 #include "utils_match.h"
 #include "utils_time.h"
 
@@ -81,9 +82,11 @@ struct web_page_s /* {{{ */
 /*
  * Global variables;
  */
-/* static CURLM *curl = NULL; */
 static web_page_t *pages_g = NULL;
 
+static ucm_options_t ucm_options = UCM_OPTIONS_INIT;
+static ucm_t *ucm = NULL;
+
 /*
  * Private functions
  */
@@ -560,8 +563,11 @@ static int cc_config (oconfig_item_t *ci) /* {{{ */
     }
     else
     {
-      WARNING ("curl plugin: Option `%s' not allowed here.", child->key);
-      errors++;
+      status = ucm_config_option (&ucm_options, child);
+      if (status > 0)
+        WARNING ("curl plugin: Option `%s' not allowed here.", child->key);
+      if (status != 0)
+        errors++;
     }
   }
 
@@ -582,6 +588,14 @@ static int cc_init (void) /* {{{ */
     return (-1);
   }
   curl_global_init (CURL_GLOBAL_SSL);
+
+  if (ucm_options.enabled)
+  {
+    ucm = ucm_create ("curl plugin", &ucm_options);
+    if (ucm == NULL)
+      return (-1);
+  }
+
   return (0);
 } /* }}} int cc_init */
 
@@ -640,26 +654,34 @@ static void cc_submit_response_time (const web_page_t *wp, /* {{{ */
   plugin_dispatch_values (&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page (web_page_t *wp) /* {{{ */
+/* Empties the page's buffer for the next transfer. This happens once a
+ * transfer has been handled rather than before the next one is started, so
+ * a transfer that is still in flight in asynchronous mode is never disturbed
+ * by the read callback. */
+static void cc_page_reset (web_page_t *wp) /* {{{ */
 {
-  web_match_t *wm;
-  int status;
-  cdtime_t start = 0;
+  wp->buffer_fill = 0;
+  if (wp->buffer != NULL)
+    wp->buffer[0] = 0;
+} /* }}} void cc_page_reset */
 
-  if (wp->response_time)
-    start = cdtime ();
+/* Handles the result of a transfer, either after curl_easy_perform() returned
+ * or, in asynchronous mode, from the curl multi engine's callback. */
+static int cc_page_done (web_page_t *wp, CURLcode status, /* {{{ */
+    cdtime_t response_time)
+{
+  web_match_t *wm;
 
-  wp->buffer_fill = 0;
-  status = curl_easy_perform (wp->curl);
   if (status != CURLE_OK)
   {
     ERROR ("curl plugin: curl_easy_perform failed with staus %i: %s",
         status, wp->curl_errbuf);
+    cc_page_reset (wp);
     return (-1);
   }
 
   if (wp->response_time)
-    cc_submit_response_time (wp, cdtime() - start);
+    cc_submit_response_time (wp, response_time);
 
   if(wp->response_code)
   {
@@ -695,7 +717,41 @@ static int cc_read_page (web_page_t *wp) /* {{{ */
     match_value_reset (mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
 
+  cc_page_reset (wp);
   return (0);
+} /* }}} int cc_page_done */
+
+static void cc_page_callback (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
+{
+  double total_time = 0.0;
+
+  /* The time the request spent queued in the engine is not included. */
+  curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME, &total_time);
+  cc_page_done (user_data, status, DOUBLE_TO_CDTIME_T (total_time));
+} /* }}} void cc_page_callback */
+
+static int cc_read_page (web_page_t *wp) /* {{{ */
+{
+  int status;
+
+  if (ucm == NULL)
+  {
+    cdtime_t start = cdtime ();
+
+    status = curl_easy_perform (wp->curl);
+    return (cc_page_done (wp, status, cdtime () - start));
+  }
+
+  status = ucm_submit (ucm, wp->curl, wp->url, plugin_get_interval (),
+      cc_page_callback, wp);
+  if (status == EBUSY)
+  {
+    WARNING ("curl plugin: The previous request for \"%s\" is still in "
+        "progress. Skipping this interval.", wp->url);
+    return (0);
+  }
+  return (status);
 } /* }}} int cc_read_page */
 
 static int cc_read (void) /* {{{ */
@@ -710,6 +766,10 @@ static int cc_read (void) /* {{{ */
 
 static int cc_shutdown (void) /* {{{ */
 {
+  /* Stops all transfers, so the pages can be freed. */
+  ucm_destroy (ucm);
+  ucm = NULL;
+
   cc_web_page_free (pages_g);
   pages_g = NULL;
 
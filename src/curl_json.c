@@ -25,8 +25,8 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_curl_multi.h"
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -44,8 +44,6 @@
 #endif
 
 #define CJ_DEFAULT_HOST "localhost"
-#define CJ_KEY_MAGIC 0x43484b59UL /* CHKY */
-#define CJ_IS_KEY(key) ((key)->magic == CJ_KEY_MAGIC)
 #define CJ_ANY "*"
 #define COUCH_MIN(x,y) ((x) < (y) ? (x) : (y))
 
@@ -53,13 +51,35 @@ struct cj_key_s;
 typedef struct cj_key_s cj_key_t;
 struct cj_key_s /* {{{ */
 {
-  unsigned long magic;
   char *path;
   char *type;
   char *instance;
 };
 /* }}} */
 
+/* The configured keys are compiled into a tree of nodes mirroring the
+ * structure of the expected document, e.g. "httpd/requests/count" and
+ * "httpd/requests/current" become
+ *   "" -> "httpd" -> "requests" -> { "count" ($key), "current" ($key) }
+ * The parser tracks the node matching its position in the document. Maps and
+ * arrays without a matching node are skipped as a whole: the callbacks only
+ * count their nesting until they end. */
+struct cj_node_s;
+typedef struct cj_node_s cj_node_t;
+struct cj_node_s /* {{{ */
+{
+  char *name;
+  size_t name_len;
+  /* Dispatched if a number or string matches this node. */
+  cj_key_t *key;
+  /* Sorted by cj_name_cmp(). */
+  cj_node_t **children;
+  size_t children_num;
+  /* Matches all names without a child of their own. */
+  cj_node_t *any;
+};
+/* }}} */
+
 struct cj_s /* {{{ */
 {
   char *instance;
@@ -83,14 +103,15 @@ struct cj_s /* {{{ */
   char curl_errbuf[CURL_ERROR_SIZE];
 
   yajl_handle yajl;
-  c_avl_tree_t *tree;
-  cj_key_t *key;
+  cj_node_t *tree;
+  /* Node matching the next value within a map, set by the map key. */
+  cj_node_t *next;
+  /* Nesting level within a map or array that is being skipped. */
+  int skip;
   int depth;
   struct {
-    union {
-      c_avl_tree_t *tree;
-      cj_key_t *key;
-    };
+    /* Node matching the map or array at this depth. */
+    cj_node_t *node;
     _Bool in_array;
     int index;
     char name[DATA_MAX_NAME_LEN];
@@ -104,8 +125,12 @@ typedef size_t yajl_len_t;
 typedef unsigned int yajl_len_t;
 #endif
 
+static ucm_options_t ucm_options = UCM_OPTIONS_INIT;
+static ucm_t *ucm = NULL;
+
 static int cj_read (user_data_t *ud);
 static void cj_submit (cj_t *db, cj_key_t *key, value_t *value);
+static int cj_parse_begin (cj_t *db);
 
 static size_t cj_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
@@ -123,6 +148,11 @@ static size_t cj_curl_callback (void *buf, /* {{{ */
   if (db == NULL)
     return (0);
 
+  /* In asynchronous mode the parser is set up by the first chunk, i.e. in
+   * the curl multi engine's thread, once the transfer is under way. */
+  if ((db->yajl == NULL) && (cj_parse_begin (db) != 0))
+    return (0);
+
   status = yajl_parse(db->yajl, (unsigned char *)buf, len);
   if (status == yajl_status_ok)
     return (len);
@@ -177,27 +207,89 @@ static int cj_get_type (cj_key_t *key)
   return ds->ds[0].type;
 }
 
-static int cj_cb_map_key (void *ctx, const unsigned char *val,
-    yajl_len_t len);
-
-static void cj_cb_inc_array_index (void *ctx, _Bool update_key)
+static int cj_name_cmp (char const *a, size_t a_len, /* {{{ */
+    char const *b, size_t b_len)
 {
-  cj_t *db = (cj_t *)ctx;
+  int status;
 
-  if (!db->state[db->depth].in_array)
-    return;
+  status = memcmp (a, b, COUCH_MIN (a_len, b_len));
+  if (status != 0)
+    return (status);
 
-  db->state[db->depth].index++;
+  if (a_len == b_len)
+    return (0);
+  return ((a_len < b_len) ? -1 : 1);
+} /* }}} int cj_name_cmp */
+
+/* Binary search for "name" among the children of "node". If "ret_pos" is not
+ * NULL, it is set to the position of the child or, if there is no such child,
+ * to the position a child of this name would have to be inserted at. */
+static cj_node_t *cj_node_find (cj_node_t const *node, /* {{{ */
+    char const *name, size_t name_len, size_t *ret_pos)
+{
+  size_t lo = 0;
+  size_t hi = node->children_num;
 
-  if (update_key)
+  while (lo < hi)
   {
-    char name[DATA_MAX_NAME_LEN];
+    size_t mid = lo + (hi - lo) / 2;
+    cj_node_t *child = node->children[mid];
+    int status;
 
-    ssnprintf (name, sizeof (name), "%d", db->state[db->depth].index - 1);
-
-    cj_cb_map_key (ctx, (unsigned char *)name, (yajl_len_t) strlen (name));
+    status = cj_name_cmp (child->name, child->name_len, name, name_len);
+    if (status == 0)
+    {
+      if (ret_pos != NULL)
+        *ret_pos = mid;
+      return (child);
+    }
+    else if (status < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-}
+
+  if (ret_pos != NULL)
+    *ret_pos = lo;
+  return (NULL);
+} /* }}} cj_node_t *cj_node_find */
+
+/* Returns the child of "node" matching "name", falling back to the wildcard
+ * child. Returns NULL if neither exists. */
+static cj_node_t *cj_node_match (cj_node_t const *node, /* {{{ */
+    char const *name, size_t name_len)
+{
+  cj_node_t *child = NULL;
+
+  if (node->children_num > 0)
+    child = cj_node_find (node, name, name_len, /* ret_pos = */ NULL);
+
+  return ((child != NULL) ? child : node->any);
+} /* }}} cj_node_t *cj_node_match */
+
+/* Returns the node matching the value the parser is about to handle: Within
+ * a map, this is the node selected by the preceding key; within an array, the
+ * element's index is matched against the array's node. */
+static cj_node_t *cj_value_node (cj_t *db) /* {{{ */
+{
+  cj_node_t *node;
+  char name[DATA_MAX_NAME_LEN];
+  int index;
+  int len;
+
+  if (!db->state[db->depth].in_array)
+    return (db->next);
+
+  node = db->state[db->depth].node;
+  index = db->state[db->depth].index++;
+
+  /* Spare formatting the index if only the wildcard can match. */
+  if (node->children_num == 0)
+    return (node->any);
+
+  len = ssnprintf (name, sizeof (name), "%d", index);
+  return (cj_node_match (node, name, (size_t) len));
+} /* }}} cj_node_t *cj_value_node */
 
 /* yajl callbacks */
 #define CJ_CB_ABORT    0
@@ -205,101 +297,93 @@ static void cj_cb_inc_array_index (void *ctx, _Bool update_key)
 
 static int cj_cb_boolean (void * ctx, int boolVal)
 {
-  cj_cb_inc_array_index (ctx, /* update_key = */ 0);
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip == 0)
+    cj_value_node (db);
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_null (void * ctx)
 {
-  cj_cb_inc_array_index (ctx, /* update_key = */ 0);
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip == 0)
+    cj_value_node (db);
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_number (void *ctx,
     const char *number, yajl_len_t number_len)
 {
-  char buffer[number_len + 1];
-
   cj_t *db = (cj_t *)ctx;
-  cj_key_t *key = db->state[db->depth].key;
+  cj_node_t *node;
   value_t vt;
   int type;
   int status;
 
-  /* Create a null-terminated version of the string. */
-  memcpy (buffer, number, number_len);
-  buffer[sizeof (buffer) - 1] = 0;
-
-  if ((key == NULL) || !CJ_IS_KEY (key)) {
-    if (key != NULL && !db->state[db->depth].in_array/*can be inhomogeneous*/)
-      NOTICE ("curl_json plugin: Found \"%s\", but the configuration expects"
-              " a map.", buffer);
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-    key = db->state[db->depth].key;
-    if (key == NULL) {
+  if (db->skip > 0)
+    return (CJ_CB_CONTINUE);
+
+  node = cj_value_node (db);
+  if (node == NULL)
+    return (CJ_CB_CONTINUE);
+
+  {
+    char buffer[number_len + 1];
+
+    /* Create a null-terminated version of the string. */
+    memcpy (buffer, number, number_len);
+    buffer[sizeof (buffer) - 1] = 0;
+
+    if (node->key == NULL)
+    {
+      if (!db->state[db->depth].in_array/*can be inhomogeneous*/)
+        NOTICE ("curl_json plugin: Found \"%s\", but the configuration "
+            "expects a map.", buffer);
       return (CJ_CB_CONTINUE);
     }
-  }
-  else
-  {
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-  }
 
-  type = cj_get_type (key);
-  status = parse_value (buffer, &vt, type);
-  if (status != 0)
-  {
-    NOTICE ("curl_json plugin: Unable to parse number: \"%s\"", buffer);
-    return (CJ_CB_CONTINUE);
+    type = cj_get_type (node->key);
+    status = parse_value (buffer, &vt, type);
+    if (status != 0)
+    {
+      NOTICE ("curl_json plugin: Unable to parse number: \"%s\"", buffer);
+      return (CJ_CB_CONTINUE);
+    }
   }
 
-  cj_submit (db, key, &vt);
+  cj_submit (db, node->key, &vt);
   return (CJ_CB_CONTINUE);
 } /* int cj_cb_number */
 
-/* Queries the key-tree of the parent context for "in_name" and, if found,
- * updates the "key" field of the current context. Otherwise, "key" is set to
- * NULL. */
+/* Looks up "in_name" in the node of the current map and selects the matching
+ * node, if any, for the following value. */
 static int cj_cb_map_key (void *ctx,
     unsigned char const *in_name, yajl_len_t in_name_len)
 {
   cj_t *db = (cj_t *)ctx;
-  c_avl_tree_t *tree;
+  cj_node_t *node;
 
-  tree = db->state[db->depth-1].tree;
+  if (db->skip > 0)
+    return (CJ_CB_CONTINUE);
 
-  if (tree != NULL)
+  node = cj_node_match (db->state[db->depth].node,
+      (char const *) in_name, (size_t) in_name_len);
+  if (node != NULL)
   {
-    cj_key_t *value = NULL;
     char *name;
     size_t name_len;
 
-    /* Create a null-terminated version of the name. */
+    /* Remember the name for the type instance. */
     name = db->state[db->depth].name;
     name_len = COUCH_MIN ((size_t) in_name_len,
         sizeof (db->state[db->depth].name) - 1);
     memcpy (name, in_name, name_len);
     name[name_len] = 0;
-
-    if (c_avl_get (tree, name, (void *) &value) == 0) {
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    }
-    else if (c_avl_get (tree, CJ_ANY, (void *) &value) == 0)
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    else
-      db->state[db->depth].key = NULL;
   }
 
+  db->next = node;
   return (CJ_CB_CONTINUE);
 }
 
@@ -310,30 +394,57 @@ static int cj_cb_string (void *ctx, const unsigned char *val,
   return (cj_cb_number (ctx, (const char *) val, len));
 } /* int cj_cb_string */
 
-static int cj_cb_start (void *ctx)
+static int cj_cb_start (void *ctx, _Bool in_array)
 {
   cj_t *db = (cj_t *)ctx;
+  cj_node_t *node;
+
+  if (db->skip > 0)
+  {
+    db->skip++;
+    return (CJ_CB_CONTINUE);
+  }
+
+  node = cj_value_node (db);
+  if ((node == NULL) || ((node->children_num == 0) && (node->any == NULL)))
+  {
+    /* Nothing in this map or array is referenced by the configuration. */
+    db->skip = 1;
+    return (CJ_CB_CONTINUE);
+  }
+
   if (++db->depth >= YAJL_MAX_DEPTH)
   {
     ERROR ("curl_json plugin: %s depth exceeds max, aborting.",
            db->url ? db->url : db->sock);
     return (CJ_CB_ABORT);
   }
+
+  db->state[db->depth].node = node;
+  db->state[db->depth].in_array = in_array;
+  db->state[db->depth].index = 0;
+  db->next = NULL;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_end (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].tree = NULL;
+
+  if (db->skip > 0)
+  {
+    db->skip--;
+    return (CJ_CB_CONTINUE);
+  }
+
   --db->depth;
+  db->next = NULL;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_start_map (void *ctx)
 {
-  cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-  return cj_cb_start (ctx);
+  return cj_cb_start (ctx, /* in_array = */ 0);
 }
 
 static int cj_cb_end_map (void *ctx)
@@ -343,19 +454,11 @@ static int cj_cb_end_map (void *ctx)
 
 static int cj_cb_start_array (void * ctx)
 {
-  cj_t *db = (cj_t *)ctx;
-  cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-  if (db->depth+1 < YAJL_MAX_DEPTH) {
-    db->state[db->depth+1].in_array = 1;
-    db->state[db->depth+1].index = 0;
-  }
-  return cj_cb_start (ctx);
+  return cj_cb_start (ctx, /* in_array = */ 1);
 }
 
 static int cj_cb_end_array (void * ctx)
 {
-  cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].in_array = 0;
   return cj_cb_end (ctx);
 }
 
@@ -387,25 +490,22 @@ static void cj_key_free (cj_key_t *key) /* {{{ */
   sfree (key);
 } /* }}} void cj_key_free */
 
-static void cj_tree_free (c_avl_tree_t *tree) /* {{{ */
+static void cj_node_free (cj_node_t *node) /* {{{ */
 {
-  char *name;
-  void *value;
+  size_t i;
 
-  while (c_avl_pick (tree, (void *) &name, (void *) &value) == 0)
-  {
-    cj_key_t *key = (cj_key_t *)value;
-
-    if (CJ_IS_KEY(key))
-      cj_key_free (key);
-    else
-      cj_tree_free ((c_avl_tree_t *)value);
+  if (node == NULL)
+    return;
 
-    sfree (name);
-  }
+  for (i = 0; i < node->children_num; i++)
+    cj_node_free (node->children[i]);
+  sfree (node->children);
+  cj_node_free (node->any);
+  cj_key_free (node->key);
 
-  c_avl_destroy (tree);
-} /* }}} void cj_tree_free */
+  sfree (node->name);
+  sfree (node);
+} /* }}} void cj_node_free */
 
 static void cj_free (void *arg) /* {{{ */
 {
@@ -419,11 +519,19 @@ static void cj_free (void *arg) /* {{{ */
     return;
 
   if (db->curl != NULL)
+  {
+    /* Waits for a transfer in progress, which still references "db". */
+    if (ucm != NULL)
+      ucm_cancel (ucm, db->curl);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
 
-  if (db->tree != NULL)
-    cj_tree_free (db->tree);
+  if (db->yajl != NULL)
+    yajl_free (db->yajl);
+  db->yajl = NULL;
+
+  cj_node_free (db->tree);
   db->tree = NULL;
 
   sfree (db->instance);
@@ -444,10 +552,71 @@ static void cj_free (void *arg) /* {{{ */
 
 /* Configuration handling functions {{{ */
 
-static c_avl_tree_t *cj_avl_create(void)
+static cj_node_t *cj_node_create (char const *name, size_t name_len) /* {{{ */
 {
-  return c_avl_create ((int (*) (const void *, const void *)) strcmp);
-}
+  cj_node_t *node;
+
+  node = calloc (1, sizeof (*node));
+  if (node == NULL)
+  {
+    ERROR ("curl_json plugin: calloc failed.");
+    return (NULL);
+  }
+
+  node->name = malloc (name_len + 1);
+  if (node->name == NULL)
+  {
+    ERROR ("curl_json plugin: malloc failed.");
+    sfree (node);
+    return (NULL);
+  }
+  memcpy (node->name, name, name_len);
+  node->name[name_len] = 0;
+  node->name_len = name_len;
+
+  return (node);
+} /* }}} cj_node_t *cj_node_create */
+
+/* Returns the child of "parent" called "name", creating it if necessary. */
+static cj_node_t *cj_node_get (cj_node_t *parent, /* {{{ */
+    char const *name, size_t name_len)
+{
+  cj_node_t **tmp;
+  cj_node_t *node;
+  size_t pos;
+
+  if ((name_len == strlen (CJ_ANY))
+      && (memcmp (name, CJ_ANY, name_len) == 0))
+  {
+    if (parent->any == NULL)
+      parent->any = cj_node_create (name, name_len);
+    return (parent->any);
+  }
+
+  node = cj_node_find (parent, name, name_len, &pos);
+  if (node != NULL)
+    return (node);
+
+  tmp = realloc (parent->children,
+      (parent->children_num + 1) * sizeof (*parent->children));
+  if (tmp == NULL)
+  {
+    ERROR ("curl_json plugin: realloc failed.");
+    return (NULL);
+  }
+  parent->children = tmp;
+
+  node = cj_node_create (name, name_len);
+  if (node == NULL)
+    return (NULL);
+
+  memmove (parent->children + pos + 1, parent->children + pos,
+      (parent->children_num - pos) * sizeof (*parent->children));
+  parent->children[pos] = node;
+  parent->children_num++;
+
+  return (node);
+} /* }}} cj_node_t *cj_node_get */
 
 static int cj_config_append_string (const char *name, struct curl_slist **dest, /* {{{ */
     oconfig_item_t *ci)
@@ -487,7 +656,6 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
   memset (key, 0, sizeof (*key));
-  key->magic = CJ_KEY_MAGIC;
 
   if (strcasecmp ("Key", ci->key) == 0)
   {
@@ -535,61 +703,52 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     break;
   } /* while (status == 0) */
 
-  /* store path in a tree that will match the json map structure, example:
-   * "httpd/requests/count",
-   * "httpd/requests/current" ->
-   * { "httpd": { "requests": { "count": $key, "current": $key } } }
-   */
   if (status == 0)
   {
-    char *ptr;
-    char *name;
-    char ent[PATH_MAX];
-    c_avl_tree_t *tree;
+    cj_node_t *node;
+    char const *ptr;
 
     if (db->tree == NULL)
-      db->tree = cj_avl_create();
+      db->tree = cj_node_create ("", 0);
 
-    tree = db->tree;
-    name = key->path;
+    node = db->tree;
     ptr = key->path;
     if (*ptr == '/')
       ++ptr;
 
-    name = ptr;
-    while (*ptr)
+    while (node != NULL)
     {
-      if (*ptr == '/')
+      size_t len = strcspn (ptr, "/");
+
+      if (len == 0)
       {
-        c_avl_tree_t *value;
-        int len;
-
-        len = ptr-name;
-        if (len == 0)
-          break;
-        len = COUCH_MIN(len, sizeof (ent)-1);
-        sstrncpy (ent, name, len+1);
-
-        if (c_avl_get (tree, ent, (void *) &value) != 0)
-        {
-          value = cj_avl_create ();
-          c_avl_insert (tree, strdup (ent), value);
-        }
-
-        tree = value;
-        name = ptr+1;
+        ERROR ("curl_json plugin: invalid key: %s", key->path);
+        node = NULL;
+        break;
       }
-      ++ptr;
+
+      node = cj_node_get (node, ptr, len);
+      ptr += len;
+      if (*ptr == 0)
+        break;
+      ++ptr; /* skip the slash */
     }
-    if (*name)
-      c_avl_insert (tree, strdup(name), key);
-    else
+
+    if (node == NULL)
+      status = -1;
+    else if (node->key != NULL)
     {
-      ERROR ("curl_json plugin: invalid key: %s", key->path);
+      ERROR ("curl_json plugin: The key \"%s\" has been configured more "
+          "than once.", key->path);
       status = -1;
     }
+    else
+      node->key = key;
   }
 
+  if (status != 0)
+    cj_key_free (key);
+
   return (status);
 } /* }}} int cj_config_add_key */
 
@@ -804,8 +963,12 @@ static int cj_config (oconfig_item_t *ci) /* {{{ */
     }
     else
     {
-      WARNING ("curl_json plugin: Option `%s' not allowed here.", child->key);
-      errors++;
+      status = ucm_config_option (&ucm_options, child);
+      if (status > 0)
+        WARNING ("curl_json plugin: Option `%s' not allowed here.",
+            child->key);
+      if (status != 0)
+        errors++;
     }
   }
 
@@ -837,10 +1000,21 @@ static void cj_submit (cj_t *db, cj_key_t *key, value_t *value) /* {{{ */
 
   if (key->instance == NULL)
   {
-    int i, len = 0;
-    for (i = 0; i < db->depth; i++)
-      len += ssnprintf(vl.type_instance+len, sizeof(vl.type_instance)-len,
-                       i ? "-%s" : "%s", db->state[i+1].name);
+    int i;
+    size_t len = 0;
+
+    /* Array elements are named by their index. */
+    for (i = 1; (i <= db->depth) && (len < sizeof (vl.type_instance)); i++)
+    {
+      if (db->state[i].in_array)
+        len += ssnprintf (vl.type_instance + len,
+            sizeof (vl.type_instance) - len,
+            (i > 1) ? "-%d" : "%d", db->state[i].index - 1);
+      else
+        len += ssnprintf (vl.type_instance + len,
+            sizeof (vl.type_instance) - len,
+            (i > 1) ? "-%s" : "%s", db->state[i].name);
+    }
   }
   else
     sstrncpy (vl.type_instance, key->instance, sizeof (vl.type_instance));
@@ -894,14 +1068,14 @@ static int cj_sock_perform (cj_t *db) /* {{{ */
 } /* }}} int cj_sock_perform */
 
 
-static int cj_curl_perform(cj_t *db) /* {{{ */
+/* Checks the result of a transfer, either after curl_easy_perform() returned
+ * or, in asynchronous mode, in the curl multi engine's callback. */
+static int cj_curl_done (cj_t *db, CURLcode status) /* {{{ */
 {
-  int status;
   long rc;
   char *url;
   url = db->url;
 
-  status = curl_easy_perform (db->curl);
   if (status != CURLE_OK)
   {
     ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
@@ -920,12 +1094,20 @@ static int cj_curl_perform(cj_t *db) /* {{{ */
     return (-1);
   }
   return (0);
+} /* }}} int cj_curl_done */
+
+static int cj_curl_perform(cj_t *db) /* {{{ */
+{
+  return (cj_curl_done (db, curl_easy_perform (db->curl)));
 } /* }}} int cj_curl_perform */
 
-static int cj_perform (cj_t *db) /* {{{ */
+static int cj_parse_begin (cj_t *db) /* {{{ */
 {
-  int status;
-  yajl_handle yprev = db->yajl;
+  db->depth = 0;
+  db->state[db->depth].node = NULL;
+  db->state[db->depth].in_array = 0;
+  db->next = db->tree;
+  db->skip = 0;
 
   db->yajl = yajl_alloc (&ycallbacks,
 #if HAVE_YAJL_V2
@@ -937,20 +1119,22 @@ static int cj_perform (cj_t *db) /* {{{ */
   if (db->yajl == NULL)
   {
     ERROR ("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
     return (-1);
   }
 
-  if (db->url)
-    status = cj_curl_perform (db);
-  else
-    status = cj_sock_perform (db);
-  if (status < 0)
-  {
+  return (0);
+} /* }}} int cj_parse_begin */
+
+static void cj_parse_abort (cj_t *db) /* {{{ */
+{
+  if (db->yajl != NULL)
     yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
-  }
+  db->yajl = NULL;
+} /* }}} void cj_parse_abort */
+
+static int cj_parse_end (cj_t *db) /* {{{ */
+{
+  int status;
 
 #if HAVE_YAJL_V2
     status = yajl_complete_parse(db->yajl);
@@ -966,19 +1150,56 @@ static int cj_perform (cj_t *db) /* {{{ */
     ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
         (char *) errmsg);
     yajl_free_error (db->yajl, errmsg);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
+    cj_parse_abort (db);
     return (-1);
   }
 
-  yajl_free (db->yajl);
-  db->yajl = yprev;
+  cj_parse_abort (db);
   return (0);
+} /* }}} int cj_parse_end */
+
+static int cj_perform (cj_t *db) /* {{{ */
+{
+  int status;
+
+  if (cj_parse_begin (db) != 0)
+    return (-1);
+
+  if (db->url)
+    status = cj_curl_perform (db);
+  else
+    status = cj_sock_perform (db);
+  if (status < 0)
+  {
+    cj_parse_abort (db);
+    return (-1);
+  }
+
+  return (cj_parse_end (db));
 } /* }}} int cj_perform */
 
+static void cj_curl_callback_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
+{
+  cj_t *db = user_data;
+
+  if (cj_curl_done (db, status) != 0)
+  {
+    cj_parse_abort (db);
+    return;
+  }
+
+  /* Empty response: Let yajl decide whether that is valid. */
+  if ((db->yajl == NULL) && (cj_parse_begin (db) != 0))
+    return;
+
+  cj_parse_end (db);
+} /* }}} void cj_curl_callback_done */
+
 static int cj_read (user_data_t *ud) /* {{{ */
 {
   cj_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -988,12 +1209,18 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db = (cj_t *) ud->data;
 
-  db->depth = 0;
-  memset (&db->state, 0, sizeof(db->state));
-  db->state[db->depth].tree = db->tree;
-  db->key = NULL;
+  if ((ucm == NULL) || (db->url == NULL))
+    return cj_perform (db);
 
-  return cj_perform (db);
+  status = ucm_submit (ucm, db->curl, db->url, plugin_get_interval (),
+      cj_curl_callback_done, db);
+  if (status == EBUSY)
+  {
+    WARNING ("curl_json plugin: The previous request for \"%s\" is still "
+        "in progress. Skipping this interval.", db->url);
+    return (0);
+  }
+  return (status);
 } /* }}} int cj_read */
 
 static int cj_init (void) /* {{{ */
@@ -1001,13 +1228,31 @@ static int cj_init (void) /* {{{ */
   /* Call this while collectd is still single-threaded to avoid
    * initialization issues in libgcrypt. */
   curl_global_init (CURL_GLOBAL_SSL);
+
+  if (ucm_options.enabled)
+  {
+    ucm = ucm_create ("curl_json plugin", &ucm_options);
+    if (ucm == NULL)
+      return (-1);
+  }
+
   return (0);
 } /* }}} int cj_init */
 
+static int cj_shutdown (void) /* {{{ */
+{
+  /* The read callbacks, and with them all transfers, are gone by now. */
+  ucm_destroy (ucm);
+  ucm = NULL;
+
+  return (0);
+} /* }}} int cj_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_json", cj_config);
   plugin_register_init ("curl_json", cj_init);
+  plugin_register_shutdown ("curl_json", cj_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
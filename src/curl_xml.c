@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 #include "utils_llist.h"
 
 #include <libxml/parser.h>
@@ -88,14 +89,18 @@ struct cx_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
-  char *buffer;
-  size_t buffer_size;
-  size_t buffer_fill;
+  xmlParserCtxtPtr parser;
 
   llist_t *list; /* list of xpath blocks */
 };
 typedef struct cx_s cx_t; /* }}} */
 
+/*
+ * Global variables
+ */
+static ucm_options_t ucm_options = UCM_OPTIONS_INIT;
+static ucm_t *ucm = NULL;
+
 /*
  * Private functions
  */
@@ -104,6 +109,7 @@ static size_t cx_curl_callback (void *buf, /* {{{ */
 {
   size_t len = size * nmemb;
   cx_t *db;
+  int status;
 
   db = user_data;
   if (db == NULL)
@@ -113,31 +119,74 @@ static size_t cx_curl_callback (void *buf, /* {{{ */
     return (0);
   }
 
-   if (len <= 0)
+  if (len <= 0)
     return (len);
 
-  if ((db->buffer_fill + len) >= db->buffer_size)
+  /* The document is parsed as it arrives rather than collected first. The
+   * first chunk is handed to the parser's constructor so it can detect the
+   * encoding. */
+  if (db->parser == NULL)
   {
-    char *temp;
-
-    temp = (char *) realloc (db->buffer,
-                    db->buffer_fill + len + 1);
-    if (temp == NULL)
+    db->parser = xmlCreatePushParserCtxt (/* sax = */ NULL,
+        /* user_data = */ NULL, buf, (int) len, db->url);
+    if (db->parser == NULL)
     {
-      ERROR ("curl_xml plugin: realloc failed.");
+      ERROR ("curl_xml plugin: xmlCreatePushParserCtxt failed.");
       return (0);
     }
-    db->buffer = temp;
-    db->buffer_size = db->buffer_fill + len + 1;
+    return (len);
   }
 
-  memcpy (db->buffer + db->buffer_fill, (char *) buf, len);
-  db->buffer_fill += len;
-  db->buffer[db->buffer_fill] = 0;
+  status = xmlParseChunk (db->parser, buf, (int) len, /* terminate = */ 0);
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document (%s): "
+        "error %i", db->url, status);
+    return (0);
+  }
 
   return (len);
 } /* }}} size_t cx_curl_callback */
 
+static void cx_parser_reset (cx_t *db) /* {{{ */
+{
+  if (db->parser == NULL)
+    return;
+
+  if (db->parser->myDoc != NULL)
+    xmlFreeDoc (db->parser->myDoc);
+  xmlFreeParserCtxt (db->parser);
+  db->parser = NULL;
+} /* }}} void cx_parser_reset */
+
+/* Terminates the document fed to the push parser and returns it, or NULL if
+ * it is not well-formed. */
+static xmlDocPtr cx_parser_finish (cx_t *db) /* {{{ */
+{
+  xmlDocPtr doc;
+
+  if (db->parser == NULL)
+  {
+    ERROR ("curl_xml plugin: Received an empty document (%s).", db->url);
+    return (NULL);
+  }
+
+  xmlParseChunk (db->parser, NULL, 0, /* terminate = */ 1);
+  if (!db->parser->wellFormed)
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document (%s).",
+        db->url);
+    cx_parser_reset (db);
+    return (NULL);
+  }
+
+  doc = db->parser->myDoc;
+  db->parser->myDoc = NULL;
+  cx_parser_reset (db);
+
+  return (doc);
+} /* }}} xmlDocPtr cx_parser_finish */
+
 static void cx_xpath_free (cx_xpath_t *xpath) /* {{{ */
 {
   if (xpath == NULL)
@@ -185,13 +234,18 @@ static void cx_free (void *arg) /* {{{ */
     return;
 
   if (db->curl != NULL)
+  {
+    /* Waits for a transfer in progress, which still references "db". */
+    if (ucm != NULL)
+      ucm_cancel (ucm, db->curl);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
+  cx_parser_reset (db);
 
   if (db->list != NULL)
     cx_list_free (db->list);
 
-  sfree (db->buffer);
   sfree (db->instance);
   sfree (db->host);
 
@@ -557,21 +611,12 @@ static int cx_handle_parsed_xml(xmlDocPtr doc, /* {{{ */
   return status;
 } /* }}} cx_handle_parsed_xml */
 
-static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
+static int cx_parse_stats_xml(xmlDocPtr doc, cx_t *db) /* {{{ */
 {
   int status;
-  xmlDocPtr doc;
   xmlXPathContextPtr xpath_ctx;
   size_t i;
 
-  /* Load the XML */
-  doc = xmlParseDoc(xml);
-  if (doc == NULL)
-  {
-    ERROR ("curl_xml plugin: Failed to parse the xml document  - %s", xml);
-    return (-1);
-  }
-
   xpath_ctx = xmlXPathNewContext(doc);
   if(xpath_ctx == NULL)
   {
@@ -603,20 +648,20 @@ static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
   return status;
 } /* }}} cx_parse_stats_xml */
 
-static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
+/* Handles the result of a transfer, either after curl_easy_perform() returned
+ * or, in asynchronous mode, from the curl multi engine's callback. */
+static int cx_curl_done (cx_t *db, CURL *curl, CURLcode status) /* {{{ */
 {
-  int status;
   long rc;
-  char *ptr;
+  xmlDocPtr doc;
   char *url;
   url = db->url;
 
-  db->buffer_fill = 0; 
-  status = curl_easy_perform (curl);
   if (status != CURLE_OK)
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
            status, db->curl_errbuf, url);
+    cx_parser_reset (db);
     return (-1);
   }
 
@@ -628,15 +673,42 @@ static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
            rc, url);
+    cx_parser_reset (db);
     return (-1);
   }
 
-  ptr = db->buffer;
+  doc = cx_parser_finish (db);
+  if (doc == NULL)
+    return (-1);
 
-  status = cx_parse_stats_xml(BAD_CAST ptr, db);
-  db->buffer_fill = 0;
+  return cx_parse_stats_xml (doc, db);
+} /* }}} int cx_curl_done */
 
-  return status;
+static void cx_curl_callback_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
+{
+  cx_curl_done (user_data, curl, status);
+} /* }}} void cx_curl_callback_done */
+
+static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
+{
+  int status;
+
+  /* cx_curl_done() always releases the parser, so there is nothing to reset
+   * here. In particular, a transfer still in flight in asynchronous mode owns
+   * "db->parser" until its callback has returned. */
+  if (ucm == NULL)
+    return (cx_curl_done (db, curl, curl_easy_perform (curl)));
+
+  status = ucm_submit (ucm, curl, db->url, plugin_get_interval (),
+      cx_curl_callback_done, db);
+  if (status == EBUSY)
+  {
+    WARNING ("curl_xml plugin: The previous request for \"%s\" is still "
+        "in progress. Skipping this interval.", db->url);
+    return (0);
+  }
+  return (status);
 } /* }}} int cx_curl_perform */
 
 static int cx_read (user_data_t *ud) /* {{{ */
@@ -1032,8 +1104,12 @@ static int cx_config (oconfig_item_t *ci) /* {{{ */
     }
     else
     {
-      WARNING ("curl_xml plugin: Option `%s' not allowed here.", child->key);
-      errors++;
+      status = ucm_config_option (&ucm_options, child);
+      if (status > 0)
+        WARNING ("curl_xml plugin: Option `%s' not allowed here.",
+            child->key);
+      if (status != 0)
+        errors++;
     }
   }
 
@@ -1051,13 +1127,31 @@ static int cx_init (void) /* {{{ */
   /* Call this while collectd is still single-threaded to avoid
    * initialization issues in libgcrypt. */
   curl_global_init (CURL_GLOBAL_SSL);
+
+  if (ucm_options.enabled)
+  {
+    ucm = ucm_create ("curl_xml plugin", &ucm_options);
+    if (ucm == NULL)
+      return (-1);
+  }
+
   return (0);
 } /* }}} int cx_init */
 
+static int cx_shutdown (void) /* {{{ */
+{
+  /* The read callbacks, and with them all transfers, are gone by now. */
+  ucm_destroy (ucm);
+  ucm = NULL;
+
+  return (0);
+} /* }}} int cx_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_xml", cx_config);
   plugin_register_init ("curl_xml", cx_init);
+  plugin_register_shutdown ("curl_xml", cx_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -28,6 +28,10 @@
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#if KERNEL_LINUX
+# include <poll.h>
+#endif
+
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
 #  include <sys/statvfs.h>
@@ -56,7 +60,8 @@ static const char *config_keys[] =
 	"ReportReserved",
 	"ReportInodes",
 	"ValuesAbsolute",
-	"ValuesPercentage"
+	"ValuesPercentage",
+	"Timeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -69,6 +74,60 @@ static _Bool report_inodes = 0;
 static _Bool values_absolute = 1;
 static _Bool values_percentage = 0;
 
+/*
+ * The mounted file systems are cached in "df_mounts" and only re-read when
+ * the kernel signals a change of the mount table. The STATANYFS() calls are
+ * made by a pool of worker threads, so a file system that doesn't respond,
+ * e.g. a hung NFS mount, doesn't block the read thread. If a call doesn't
+ * return within "df_timeout", the file system is reported as stale and is not
+ * queried again until the call returns.
+ */
+#define DF_THREADS 4
+
+typedef enum
+{
+	DF_IDLE,
+	DF_QUEUED,
+	DF_RUNNING,
+	DF_DONE
+} df_state_t;
+
+typedef struct df_mount_s
+{
+	char *dir;
+	char name[DATA_MAX_NAME_LEN];
+
+	/* The fields below are protected by "df_lock". The mount list holds one
+	 * reference, a queued or running job another one. */
+	int refcount;
+	df_state_t state;
+	_Bool stale;
+	unsigned int round;
+	int status;
+	struct STATANYFS statbuf;
+	struct df_mount_s *next; /* in the job queue */
+} df_mount_t;
+
+static cdtime_t df_timeout = 0;
+
+static df_mount_t **df_mounts = NULL;
+static size_t df_mounts_num = 0;
+static _Bool df_mounts_valid = 0;
+#if KERNEL_LINUX
+static int df_mounts_fd = -1;
+#endif
+
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static df_mount_t *df_queue_head = NULL;
+static df_mount_t *df_queue_tail = NULL;
+static unsigned int df_round = 0;
+static size_t df_pending = 0;  /* jobs of the current round */
+static size_t df_running = 0;  /* jobs being worked on */
+static size_t df_workers = 0;  /* threads */
+static _Bool df_shutdown = 0;
+
 static int df_init (void)
 {
 	if (il_device == NULL)
@@ -153,6 +212,19 @@ static int df_config (const char *key, const char *value)
 
 		return (0);
 	}
+	else if (strcasecmp (key, "Timeout") == 0)
+	{
+		double tmp = atof (value);
+
+		if (tmp <= 0.0)
+		{
+			ERROR ("df plugin: The \"Timeout\" option requires a "
+					"positive number.");
+			return (1);
+		}
+		df_timeout = DOUBLE_TO_CDTIME_T (tmp);
+		return (0);
+	}
 
 	return (-1);
 }
@@ -182,31 +254,121 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+/* Must be called with "df_lock" held. */
+static void df_mount_release (df_mount_t *m) /* {{{ */
 {
-#if HAVE_STATVFS
-	struct statvfs statbuf;
-#elif HAVE_STATFS
-	struct statfs statbuf;
+	m->refcount--;
+	if (m->refcount > 0)
+		return;
+
+	sfree (m->dir);
+	sfree (m);
+} /* }}} void df_mount_release */
+
+/* Returns the plugin instance for a mount point in "buffer", or non-zero if
+ * the file system is not to be reported. */
+static int df_mount_name (cu_mount_t const *mnt, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	if (by_device)
+	{
+		char const *dev = (mnt->spec_device != NULL)
+			? mnt->spec_device : mnt->device;
+
+		if (dev == NULL)
+			return (-1);
+
+		/* eg, /dev/hda1  -- strip off the "/dev/" */
+		if (strncmp (dev, "/dev/", strlen ("/dev/")) == 0)
+			sstrncpy (buffer, dev + strlen ("/dev/"), buffer_size);
+		else
+			sstrncpy (buffer, dev, buffer_size);
+
+		if (strlen (buffer) < 1)
+		{
+			DEBUG ("df: no device name for mountpoint %s, skipping", mnt->dir);
+			return (-1);
+		}
+	}
+	else
+	{
+		if (strcmp (mnt->dir, "/") == 0)
+		{
+			if (strcmp (mnt->type, "rootfs") == 0)
+				return (-1);
+			sstrncpy (buffer, "root", buffer_size);
+		}
+		else
+		{
+			int i, len;
+
+			sstrncpy (buffer, mnt->dir + 1, buffer_size);
+			len = strlen (buffer);
+
+			for (i = 0; i < len; i++)
+				if (buffer[i] == '/')
+					buffer[i] = '-';
+		}
+	}
+
+	return (0);
+} /* }}} int df_mount_name */
+
+/* Returns true if the mount table may have changed since it was last read. */
+static _Bool df_mounts_changed (void) /* {{{ */
+{
+#if KERNEL_LINUX
+	struct pollfd pfd;
+
+	if (df_mounts_fd < 0)
+	{
+		/* The file signals changes of the mount table with POLLPRI. If it
+		 * cannot be opened, the mount table is read every time. */
+		df_mounts_fd = open ("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+		return (1);
+	}
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = df_mounts_fd;
+	pfd.events = POLLPRI;
+	if (poll (&pfd, 1, /* timeout = */ 0) != 0)
+		return (1);
+
+	return (!df_mounts_valid);
+#else
+	return (1);
 #endif
-	/* struct STATANYFS statbuf; */
+} /* }}} _Bool df_mounts_changed */
+
+/* Re-reads the mount table. Entries of mount points that are still mounted
+ * are kept, so a hung STATANYFS() call isn't repeated. */
+static int df_mounts_refresh (void) /* {{{ */
+{
 	cu_mount_t *mnt_list;
 	cu_mount_t *mnt_ptr;
+	df_mount_t **mounts = NULL;
+	size_t mounts_num = 0;
+	size_t mounts_size = 0;
+	size_t i;
 
 	mnt_list = NULL;
 	if (cu_mount_getlist (&mnt_list) == NULL)
 	{
 		ERROR ("df plugin: cu_mount_getlist failed.");
+		/* The change notification has been consumed; make sure the next
+		 * read tries again. */
+		pthread_mutex_lock (&df_lock);
+		df_mounts_valid = 0;
+		pthread_mutex_unlock (&df_lock);
 		return (-1);
 	}
 
+	pthread_mutex_lock (&df_lock);
+
 	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
 	{
-		unsigned long long blocksize;
-		char disk_name[256];
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		char name[DATA_MAX_NAME_LEN];
+		df_mount_t *m = NULL;
 
 		if (ignorelist_match (il_device,
 					(mnt_ptr->spec_device != NULL)
@@ -217,154 +379,416 @@ static int df_read (void)
 			continue;
 		if (ignorelist_match (il_fstype, mnt_ptr->type))
 			continue;
+		if (df_mount_name (mnt_ptr, name, sizeof (name)) != 0)
+			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
+		for (i = 0; i < df_mounts_num; i++)
 		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			continue;
+			if ((df_mounts[i] != NULL)
+					&& (strcmp (df_mounts[i]->dir, mnt_ptr->dir) == 0)
+					&& (strcmp (df_mounts[i]->name, name) == 0))
+			{
+				m = df_mounts[i];
+				df_mounts[i] = NULL;
+				break;
+			}
 		}
 
-		if (!statbuf.f_blocks)
-			continue;
-
-		if (by_device)
+		if (m == NULL)
 		{
-			/* eg, /dev/hda1  -- strip off the "/dev/" */
-			if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
-				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), sizeof (disk_name));
-			else
-				sstrncpy (disk_name, mnt_ptr->spec_device, sizeof (disk_name));
-
-			if (strlen(disk_name) < 1)
+			m = calloc (1, sizeof (*m));
+			if (m == NULL)
+				continue;
+			m->dir = strdup (mnt_ptr->dir);
+			if (m->dir == NULL)
 			{
-				DEBUG("df: no device name for mountpoint %s, skipping", mnt_ptr->dir);
+				sfree (m);
 				continue;
 			}
+			sstrncpy (m->name, name, sizeof (m->name));
+			m->refcount = 1;
+			m->state = DF_IDLE;
 		}
-		else
+
+		if (mounts_num >= mounts_size)
 		{
-			if (strcmp (mnt_ptr->dir, "/") == 0)
+			size_t new_size = (mounts_size > 0) ? 2 * mounts_size : 16;
+			df_mount_t **tmp = realloc (mounts, new_size * sizeof (*mounts));
+
+			if (tmp == NULL)
 			{
-				if (strcmp (mnt_ptr->type, "rootfs") == 0)
-					continue;
-				sstrncpy (disk_name, "root", sizeof (disk_name));
+				df_mount_release (m);
+				continue;
 			}
-			else
-			{
-				int i, len;
+			mounts = tmp;
+			mounts_size = new_size;
+		}
+		mounts[mounts_num++] = m;
+	}
 
-				sstrncpy (disk_name, mnt_ptr->dir + 1, sizeof (disk_name));
-				len = strlen (disk_name);
+	/* Unmounted file systems. */
+	for (i = 0; i < df_mounts_num; i++)
+		if (df_mounts[i] != NULL)
+			df_mount_release (df_mounts[i]);
+	sfree (df_mounts);
 
-				for (i = 0; i < len; i++)
-					if (disk_name[i] == '/')
-						disk_name[i] = '-';
-			}
+	df_mounts = mounts;
+	df_mounts_num = mounts_num;
+	df_mounts_valid = 1;
+
+	pthread_mutex_unlock (&df_lock);
+
+	cu_mount_freelist (mnt_list);
+	return (0);
+} /* }}} int df_mounts_refresh */
+
+static void *df_worker (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&df_lock);
+	while (!df_shutdown)
+	{
+		df_mount_t *m;
+		int status;
+
+		if (df_queue_head == NULL)
+		{
+			/* Threads that were started to replace ones stuck in a hung
+			 * file system exit once that file system has recovered. */
+			if (df_workers > DF_THREADS + df_running)
+				break;
+
+			pthread_cond_wait (&df_job_cond, &df_lock);
+			continue;
+		}
+
+		m = df_queue_head;
+		df_queue_head = m->next;
+		if (df_queue_head == NULL)
+			df_queue_tail = NULL;
+		m->next = NULL;
+
+		m->state = DF_RUNNING;
+		df_running++;
+		pthread_mutex_unlock (&df_lock);
+
+		/* Only this thread touches "statbuf" while the job is running. */
+		status = STATANYFS (m->dir, &m->statbuf);
+		if (status != 0)
+			status = errno;
+
+		pthread_mutex_lock (&df_lock);
+		df_running--;
+		m->status = status;
+		m->state = DF_DONE;
+		if (m->round == df_round)
+		{
+			df_pending--;
+			if (df_pending == 0)
+				pthread_cond_signal (&df_done_cond);
+		}
+		df_mount_release (m);
+	}
+
+	df_workers--;
+	pthread_mutex_unlock (&df_lock);
+	return (NULL);
+} /* }}} void *df_worker */
+
+/* Starts worker threads until there are DF_THREADS, not counting the ones
+ * stuck in a call. Must be called with "df_lock" held. */
+static void df_workers_start (void) /* {{{ */
+{
+	pthread_attr_t attr;
+
+	if (df_workers >= DF_THREADS + df_running)
+		return;
+
+	pthread_attr_init (&attr);
+	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+	while (df_workers < DF_THREADS + df_running)
+	{
+		pthread_t thread;
+		int status;
+
+		status = plugin_thread_create (&thread, &attr, df_worker,
+				/* arg = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("df plugin: Starting a worker thread failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
 		}
+		df_workers++;
+	}
 
-		blocksize = BLOCKSIZE(statbuf);
+	pthread_attr_destroy (&attr);
+} /* }}} void df_workers_start */
+
+static void df_notify (df_mount_t const *m, int severity, /* {{{ */
+		char const *message)
+{
+	notification_t n = { severity, cdtime (), "", "", "df",
+		"", "", "", NULL };
+
+	sstrncpy (n.host, hostname_g, sizeof (n.host));
+	sstrncpy (n.plugin_instance, m->name, sizeof (n.plugin_instance));
+	ssnprintf (n.message, sizeof (n.message), "File system at %s %s",
+			m->dir, message);
+
+	plugin_dispatch_notification (&n);
+} /* }}} void df_notify */
+
+static int df_submit_mount (char *disk_name, /* {{{ */
+		struct STATANYFS statbuf)
+{
+	unsigned long long blocksize;
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
+	if (!statbuf.f_blocks)
+		return (0);
+
+	blocksize = BLOCKSIZE(statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
 #if HAVE_STATVFS
-		/* Cast and temporary variable are needed to avoid
-		 * compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		int64_t signed_bavail = (int64_t) statbuf.f_bavail;
-		if (signed_bavail < 0)
-			statbuf.f_bavail = 0;
+	/* Cast and temporary variable are needed to avoid
+	 * compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	int64_t signed_bavail = (int64_t) statbuf.f_bavail;
+	if (signed_bavail < 0)
+		statbuf.f_bavail = 0;
 #elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
+	if (statbuf.f_bavail < 0)
+		statbuf.f_bavail = 0;
 #endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf.f_bfree < statbuf.f_bavail)
+		statbuf.f_bfree = statbuf.f_bavail;
+	if (statbuf.f_blocks < statbuf.f_bfree)
+		statbuf.f_blocks = statbuf.f_bfree;
 
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+	blk_free     = (uint64_t) statbuf.f_bavail;
+	blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
+	blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+
+	if (values_absolute)
+	{
+		df_submit_one (disk_name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+		df_submit_one (disk_name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+		df_submit_one (disk_name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+	}
+
+	if (values_percentage)
+	{
+		if (statbuf.f_blocks > 0)
+			{
+			df_submit_one (disk_name, "percent_bytes", "free",
+				(gauge_t) ((float_t)(blk_free) / statbuf.f_blocks * 100));
+			df_submit_one (disk_name, "percent_bytes", "reserved",
+				(gauge_t) ((float_t)(blk_reserved) / statbuf.f_blocks * 100));
+			df_submit_one (disk_name, "percent_bytes", "used",
+				(gauge_t) ((float_t)(blk_used) / statbuf.f_blocks * 100));
+			}
+		else return (-1);
+	}
 
+	/* inode handling */
+	if (report_inodes)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf.f_ffree < statbuf.f_favail)
+			statbuf.f_ffree = statbuf.f_favail;
+		if (statbuf.f_files < statbuf.f_ffree)
+			statbuf.f_files = statbuf.f_ffree;
+
+		inode_free = (uint64_t) statbuf.f_favail;
+		inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
+		inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+
+		if (values_percentage)
+		{
+			if (statbuf.f_files > 0)
+			{
+				df_submit_one (disk_name, "percent_inodes", "free",
+					(gauge_t) ((float_t)(inode_free) / statbuf.f_files * 100));
+				df_submit_one (disk_name, "percent_inodes", "reserved",
+					(gauge_t) ((float_t)(inode_reserved) / statbuf.f_files * 100));
+				df_submit_one (disk_name, "percent_inodes", "used",
+					(gauge_t) ((float_t)(inode_used) / statbuf.f_files * 100));
+			}
+			else return (-1);
+		}
 		if (values_absolute)
 		{
-			df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-			df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-			df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
+			df_submit_one (disk_name, "df_inodes", "free",
+					(gauge_t) inode_free);
+			df_submit_one (disk_name, "df_inodes", "reserved",
+					(gauge_t) inode_reserved);
+			df_submit_one (disk_name, "df_inodes", "used",
+					(gauge_t) inode_used);
 		}
+	}
 
-		if (values_percentage)
+	return (0);
+} /* }}} int df_submit_mount */
+
+static int df_read (void)
+{
+	cdtime_t timeout;
+	struct timespec deadline;
+	size_t i;
+	int ret = 0;
+
+	if (df_mounts_changed () && (df_mounts_refresh () != 0))
+		return (-1);
+
+	timeout = (df_timeout > 0) ? df_timeout : (plugin_get_interval () / 2);
+	CDTIME_T_TO_TIMESPEC (cdtime () + timeout, &deadline);
+
+	pthread_mutex_lock (&df_lock);
+
+	df_round++;
+	df_pending = 0;
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts[i];
+
+		/* The last call hasn't returned yet. */
+		if ((m->state == DF_QUEUED) || (m->state == DF_RUNNING))
+			continue;
+
+		m->state = DF_QUEUED;
+		m->round = df_round;
+		m->refcount++;
+		if (df_queue_tail == NULL)
+			df_queue_head = m;
+		else
+			df_queue_tail->next = m;
+		df_queue_tail = m;
+		df_pending++;
+	}
+
+	df_workers_start ();
+	pthread_cond_broadcast (&df_job_cond);
+
+	while (df_pending > 0)
+		if (pthread_cond_timedwait (&df_done_cond, &df_lock,
+					&deadline) == ETIMEDOUT)
+			break;
+
+	pthread_mutex_unlock (&df_lock);
+
+	/* The mount list is only modified by this thread, and "statbuf" is not
+	 * touched by the workers once a job is done. */
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts[i];
+		df_state_t state;
+		_Bool recovered = 0;
+
+		pthread_mutex_lock (&df_lock);
+		state = m->state;
+		if (state == DF_DONE)
 		{
-			if (statbuf.f_blocks > 0)
-				{
-				df_submit_one (disk_name, "percent_bytes", "free",
-					(gauge_t) ((float_t)(blk_free) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "reserved",
-					(gauge_t) ((float_t)(blk_reserved) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "used",
-					(gauge_t) ((float_t)(blk_used) / statbuf.f_blocks * 100));
-				}
-			else return (-1);
+			m->state = DF_IDLE;
+			recovered = m->stale;
+			m->stale = 0;
 		}
+		else if (m->stale)
+			state = DF_IDLE;
+		else
+			m->stale = 1;
+		pthread_mutex_unlock (&df_lock);
+
+		if (state == DF_IDLE)
+			continue;
 
-		/* inode handling */
-		if (report_inodes)
+		if (state != DF_DONE)
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
+			WARNING ("df plugin: " STATANYFS_STR "(%s) did not return "
+					"within %.3f seconds.", m->dir, CDTIME_T_TO_DOUBLE (timeout));
+			df_notify (m, NOTIF_WARNING, "is not responding");
+			continue;
+		}
 
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
+		if (recovered)
+		{
+			INFO ("df plugin: " STATANYFS_STR "(%s) returned again.", m->dir);
+			df_notify (m, NOTIF_OKAY, "is responding again");
+		}
 
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+		/* A call from an earlier read returned late. */
+		if (m->round != df_round)
+			continue;
 
-			if (values_percentage)
-			{
-				if (statbuf.f_files > 0)
-				{
-					df_submit_one (disk_name, "percent_inodes", "free",
-						(gauge_t) ((float_t)(inode_free) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "reserved",
-						(gauge_t) ((float_t)(inode_reserved) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "used",
-						(gauge_t) ((float_t)(inode_used) / statbuf.f_files * 100));
-				}
-				else return (-1);
-			}
-			if (values_absolute)
-			{
-				df_submit_one (disk_name, "df_inodes", "free",
-						(gauge_t) inode_free);
-				df_submit_one (disk_name, "df_inodes", "reserved",
-						(gauge_t) inode_reserved);
-				df_submit_one (disk_name, "df_inodes", "used",
-						(gauge_t) inode_used);
-			}
+		if (m->status != 0)
+		{
+			char errbuf[1024];
+			ERROR (STATANYFS_STR"(%s) failed: %s",
+					m->dir,
+					sstrerror (m->status, errbuf,
+						sizeof (errbuf)));
+			continue;
 		}
+
+		if (df_submit_mount (m->name, m->statbuf) != 0)
+			ret = -1;
 	}
 
-	cu_mount_freelist (mnt_list);
+	return (ret);
+} /* int df_read */
+
+static int df_shutdown_cb (void)
+{
+	size_t i;
+
+	pthread_mutex_lock (&df_lock);
+
+	/* Workers stuck in a call exit when it returns. */
+	df_shutdown = 1;
+	pthread_cond_broadcast (&df_job_cond);
+
+	while (df_queue_head != NULL)
+	{
+		df_mount_t *m = df_queue_head;
+		df_queue_head = m->next;
+		m->state = DF_IDLE;
+		df_mount_release (m);
+	}
+	df_queue_tail = NULL;
+
+	for (i = 0; i < df_mounts_num; i++)
+		df_mount_release (df_mounts[i]);
+	sfree (df_mounts);
+	df_mounts_num = 0;
+	df_mounts_valid = 0;
+
+	pthread_mutex_unlock (&df_lock);
+
+#if KERNEL_LINUX
+	if (df_mounts_fd >= 0)
+		close (df_mounts_fd);
+	df_mounts_fd = -1;
+#endif
 
 	return (0);
-} /* int df_read */
+} /* int df_shutdown_cb */
 
 void module_register (void)
 {
@@ -372,4 +796,5 @@ void module_register (void)
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown_cb);
 } /* void module_register */
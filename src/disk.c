@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if HAVE_MACH_MACH_TYPES_H
 #  include <mach/mach_types.h>
@@ -106,6 +107,13 @@ typedef struct diskstats
 } diskstats_t;
 
 static diskstats_t *disklist;
+
+static procfile_t *proc_diskstats = NULL;
+/* 1 if reading /proc/partitions (Linux 2.4), 0 otherwise. */
+static int fieldshift = 0;
+/* Maps the lines of proc_diskstats to their disklist entry. */
+static diskstats_t **disk_slots = NULL;
+static size_t disk_slots_num = 0;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -196,6 +204,49 @@ static int disk_config (const char *key, const char *value)
   return (0);
 } /* int disk_config */
 
+#if KERNEL_LINUX
+/* Remembers the disklist entry of each line. Lines of disks that haven't been
+ * seen before get a slot, too; the entry is created in disk_read() once the
+ * line has been validated. */
+static int disk_slot (char const *key, size_t line, /* {{{ */
+		void __attribute__((unused)) *user_data)
+{
+	diskstats_t *ds;
+
+	if (key[0] == 0)
+		return (-1);
+
+	if (line >= disk_slots_num)
+	{
+		size_t new_num = (disk_slots_num > 0) ? (2 * disk_slots_num) : 64;
+		diskstats_t **tmp;
+
+		while (new_num <= line)
+			new_num *= 2;
+
+		tmp = realloc (disk_slots, new_num * sizeof (*disk_slots));
+		if (tmp == NULL)
+			return (-1);
+		disk_slots = tmp;
+		disk_slots_num = new_num;
+	}
+
+	for (ds = disklist; ds != NULL; ds = ds->next)
+		if (strcmp (key, ds->name) == 0)
+			break;
+
+	disk_slots[line] = ds;
+	return ((int) line);
+} /* }}} int disk_slot */
+
+static int disk_shutdown (void) /* {{{ */
+{
+	procfile_close (proc_diskstats);
+	proc_diskstats = NULL;
+	return (0);
+} /* }}} int disk_shutdown */
+#endif /* KERNEL_LINUX */
+
 static int disk_init (void)
 {
 #if HAVE_IOKIT_IOKITLIB_H
@@ -563,12 +614,8 @@ static int disk_read (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-	
 	char *fields[32];
 	int numfields;
-	int fieldshift = 0;
 
 	int minor = 0;
 
@@ -587,31 +634,55 @@ static int disk_read (void)
 	int is_disk = 0;
 
 	diskstats_t *ds, *pre_ds;
+	size_t i;
+	int status;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
+	if (proc_diskstats == NULL)
 	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
+		fieldshift = 0;
+		proc_diskstats = procfile_open_indexed ("/proc/diskstats",
+				/* key field = */ 2, disk_slot, /* user data = */ NULL);
+		if (proc_diskstats == NULL)
+		{
+			/* Kernel is 2.4.* */
+			fieldshift = 1;
+			proc_diskstats = procfile_open_indexed ("/proc/partitions",
+					/* key field = */ 3, disk_slot, /* user data = */ NULL);
+		}
+		if (proc_diskstats == NULL)
 		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
+			ERROR ("disk plugin: open (/proc/{diskstats,partitions}) failed.");
 			return (-1);
 		}
+	}
 
-		/* Kernel is 2.4.* */
-		fieldshift = 1;
+	status = procfile_read (proc_diskstats);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("disk plugin: Reading %s failed: %s",
+				procfile_path (proc_diskstats),
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
 #if HAVE_LIBUDEV
 	handle_udev = udev_new();
 #endif
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	for (i = 0; i < procfile_lines_num (proc_diskstats); i++)
 	{
 		char *disk_name;
 		char *output_name;
 		char *alt_name;
+		int slot;
 
-		numfields = strsplit (buffer, fields, 32);
+		slot = procfile_slot (proc_diskstats, i);
+		if (slot < 0)
+			continue;
+
+		numfields = procfile_split (procfile_line (proc_diskstats, i),
+				fields, STATIC_ARRAY_SIZE (fields));
 
 		if ((numfields != (14 + fieldshift)) && (numfields != 7))
 			continue;
@@ -620,10 +691,7 @@ static int disk_read (void)
 
 		disk_name = fields[2 + fieldshift];
 
-		for (ds = disklist, pre_ds = disklist; ds != NULL; pre_ds = ds, ds = ds->next)
-			if (strcmp (disk_name, ds->name) == 0)
-				break;
-
+		ds = disk_slots[slot];
 		if (ds == NULL)
 		{
 			if ((ds = (diskstats_t *) calloc (1, sizeof (diskstats_t))) == NULL)
@@ -635,10 +703,15 @@ static int disk_read (void)
 				continue;
 			}
 
+			for (pre_ds = disklist; (pre_ds != NULL) && (pre_ds->next != NULL); pre_ds = pre_ds->next)
+				/* find the end of the list */;
+
 			if (pre_ds == NULL)
 				disklist = ds;
 			else
 				pre_ds->next = ds;
+
+			disk_slots[slot] = ds;
 		}
 
 		is_disk = 0;
@@ -799,13 +872,11 @@ static int disk_read (void)
 
 		/* release udev-based alternate name, if allocated */
 		free(alt_name);
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
+	} /* for (i = 0; i < procfile_lines_num (proc_diskstats); i++) */
 
 #if HAVE_LIBUDEV
 	udev_unref(handle_udev);
 #endif
-
-	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -940,4 +1011,7 @@ void module_register (void)
       config_keys, config_keys_num);
   plugin_register_init ("disk", disk_init);
   plugin_register_read ("disk", disk_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown ("disk", disk_shutdown);
+#endif
 } /* void module_register */
@@ -26,7 +26,10 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -48,6 +51,10 @@
 #if HAVE_IFADDRS_H
 #  include <ifaddrs.h>
 #endif
+#if HAVE_LINUX_RTNETLINK_H
+#  include <linux/netlink.h>
+#  include <linux/rtnetlink.h>
+#endif
 
 #if HAVE_STATGRAB_H
 # include <statgrab.h>
@@ -80,6 +87,20 @@ static int pnif;
 # error "No applicable input method."
 #endif
 
+#if KERNEL_LINUX && !HAVE_GETIFADDRS && HAVE_LINUX_RTNETLINK_H
+# define IF_HAVE_NETLINK 1
+#else
+# define IF_HAVE_NETLINK 0
+#endif
+
+/* RTM_GETSTATS dumps only the counters and is much cheaper than RTM_GETLINK.
+ * It was added in Linux 4.7. */
+#if IF_HAVE_NETLINK && defined(RTM_GETSTATS) && HAVE_RTNL_LINK_STATS64
+# define IF_HAVE_GETSTATS 1
+#else
+# define IF_HAVE_GETSTATS 0
+#endif
+
 /*
  * (Module-)Global variables
  */
@@ -87,9 +108,10 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSelected",
+	"UseNetlink",
 	NULL
 };
-static int config_keys_num = 2;
+static int config_keys_num = 3;
 
 static ignorelist_t *ignorelist = NULL;
 
@@ -100,6 +122,41 @@ static kstat_t *ksp[MAX_NUMIF];
 static int numif = 0;
 #endif /* HAVE_LIBKSTAT */
 
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+static procfile_t *proc_net_dev = NULL;
+#endif
+
+#if IF_HAVE_NETLINK
+#define IF_NETLINK_BUFFER_SIZE 32768
+
+/* Per-link state, keyed by the interface index. The ignorelist is only
+ * evaluated when a link is first seen or renamed. */
+typedef struct if_link_s
+{
+	int ifindex;
+	char name[DATA_MAX_NAME_LEN];
+	_Bool up;
+	_Bool ignored;
+	unsigned int generation;
+} if_link_t;
+
+static _Bool use_netlink = 0;
+static int nl_sock = -1;    /* requests and dumps */
+static int nl_monitor = -1; /* link notifications */
+static unsigned int nl_seq = 0;
+static char *nl_buffer = NULL;
+/* Set if the link table must be re-read with RTM_GETLINK. */
+static _Bool nl_resync = 1;
+/* Cleared if the kernel doesn't support RTM_GETSTATS. */
+static _Bool nl_getstats = IF_HAVE_GETSTATS;
+/* Number of interfaces dispatched by the current read. */
+static size_t nl_dispatched = 0;
+static c_complain_t nl_complaint = C_COMPLAIN_INIT_STATIC;
+
+static c_avl_tree_t *if_links = NULL;
+static unsigned int if_links_generation = 0;
+#endif /* IF_HAVE_NETLINK */
+
 static int interface_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
@@ -116,6 +173,15 @@ static int interface_config (const char *key, const char *value)
 			invert = 0;
 		ignorelist_set_invert (ignorelist, invert);
 	}
+	else if (strcasecmp (key, "UseNetlink") == 0)
+	{
+#if IF_HAVE_NETLINK
+		use_netlink = IS_TRUE (value) ? 1 : 0;
+#else
+		WARNING ("interface plugin: The \"UseNetlink\" option is only "
+				"supported on Linux and will be ignored.");
+#endif
+	}
 	else
 	{
 		return (-1);
@@ -154,16 +220,35 @@ static int interface_init (void)
 } /* int interface_init */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit (const char *dev, const char *type,
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+/* Maps the lines of /proc/net/dev to slot zero if the interface is selected.
+ * The key of a line is the interface name followed by a colon. */
+static int if_slot (char const *key, /* {{{ */
+		size_t __attribute__((unused)) line,
+		void __attribute__((unused)) *user_data)
+{
+	char device[DATA_MAX_NAME_LEN];
+	size_t len = strlen (key);
+
+	if ((len < 2) || (len > sizeof (device)) || (key[len - 1] != ':'))
+		return (-1);
+
+	memcpy (device, key, len - 1);
+	device[len - 1] = 0;
+
+	if (ignorelist_match (ignorelist, device) != 0)
+		return (-1);
+	return (0);
+} /* }}} int if_slot */
+#endif /* KERNEL_LINUX && !HAVE_GETIFADDRS */
+
+static void if_dispatch (const char *dev, const char *type,
 		derive_t rx,
 		derive_t tx)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, dev) != 0)
-		return;
-
 	values[0].derive = rx;
 	values[1].derive = tx;
 
@@ -175,7 +260,519 @@ static void if_submit (const char *dev, const char *type,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void if_dispatch */
+
+#if !KERNEL_LINUX || HAVE_GETIFADDRS
+static void if_submit (const char *dev, const char *type,
+		derive_t rx,
+		derive_t tx)
+{
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	if_dispatch (dev, type, rx, tx);
 } /* void if_submit */
+#endif /* !KERNEL_LINUX || HAVE_GETIFADDRS */
+
+#if IF_HAVE_NETLINK
+static int if_link_compare (void const *a, void const *b) /* {{{ */
+{
+	int ia = *((int const *) a);
+	int ib = *((int const *) b);
+
+	if (ia < ib)
+		return (-1);
+	else if (ia > ib)
+		return (1);
+	return (0);
+} /* }}} int if_link_compare */
+
+static void if_link_remove (int ifindex) /* {{{ */
+{
+	if_link_t *link = NULL;
+
+	if (c_avl_remove (if_links, &ifindex, NULL, (void *) &link) == 0)
+		sfree (link);
+} /* }}} void if_link_remove */
+
+/* Removes links that were not part of the last RTM_GETLINK dump. */
+static void if_link_expire (void) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	int *key;
+	if_link_t *link;
+
+	int *expired = NULL;
+	size_t expired_num = 0;
+	size_t expired_size = 0;
+	size_t i;
+
+	iter = c_avl_get_iterator (if_links);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &link) == 0)
+	{
+		if (link->generation == if_links_generation)
+			continue;
+
+		if (expired_num >= expired_size)
+		{
+			size_t new_size = (expired_size > 0) ? 2 * expired_size : 64;
+			int *tmp = realloc (expired, new_size * sizeof (*expired));
+
+			if (tmp == NULL)
+				break;
+			expired = tmp;
+			expired_size = new_size;
+		}
+		expired[expired_num++] = link->ifindex;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+		if_link_remove (expired[i]);
+	sfree (expired);
+} /* }}} void if_link_expire */
+
+static void if_netlink_close (void) /* {{{ */
+{
+	if (nl_sock >= 0)
+		close (nl_sock);
+	nl_sock = -1;
+
+	if (nl_monitor >= 0)
+		close (nl_monitor);
+	nl_monitor = -1;
+} /* }}} void if_netlink_close */
+
+static int if_netlink_socket (unsigned int groups, int flags) /* {{{ */
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | flags, NETLINK_ROUTE);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: socket (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: bind (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
+
+	return (fd);
+} /* }}} int if_netlink_socket */
+
+static int if_netlink_open (void) /* {{{ */
+{
+	if (nl_buffer == NULL)
+	{
+		nl_buffer = malloc (IF_NETLINK_BUFFER_SIZE);
+		if (nl_buffer == NULL)
+			return (-1);
+	}
+
+	if (if_links == NULL)
+	{
+		if_links = c_avl_create (if_link_compare);
+		if (if_links == NULL)
+			return (-1);
+	}
+
+	nl_sock = if_netlink_socket (/* groups = */ 0, /* flags = */ 0);
+	if (nl_sock < 0)
+		return (-1);
+
+	/* The link table is kept up to date with notifications, so only the
+	 * counters need to be dumped on every read. */
+	nl_monitor = if_netlink_socket (RTMGRP_LINK, SOCK_NONBLOCK);
+	if (nl_monitor < 0)
+	{
+		if_netlink_close ();
+		return (-1);
+	}
+
+	nl_resync = 1;
+	return (0);
+} /* }}} int if_netlink_open */
+
+/* Updates the link table from an RTM_NEWLINK message. If "ret_stats64" and
+ * "ret_stats" are not NULL, they are set to the link's counters, if present. */
+static if_link_t *if_netlink_update (struct nlmsghdr *nlh, /* {{{ */
+		void const **ret_stats64, void const **ret_stats)
+{
+	struct ifinfomsg *ifm;
+	struct rtattr *rta;
+	int rta_len;
+	char const *name = NULL;
+	if_link_t *link = NULL;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*ifm)))
+		return (NULL);
+	ifm = NLMSG_DATA (nlh);
+
+	rta_len = IFLA_PAYLOAD (nlh);
+	for (rta = IFLA_RTA (ifm); RTA_OK (rta, rta_len);
+			rta = RTA_NEXT (rta, rta_len))
+	{
+		if (rta->rta_type == IFLA_IFNAME)
+		{
+			char const *tmp = RTA_DATA (rta);
+			if (memchr (tmp, 0, RTA_PAYLOAD (rta)) != NULL)
+				name = tmp;
+		}
+		else if (ret_stats64 == NULL)
+			continue;
+#ifdef HAVE_RTNL_LINK_STATS64
+		else if (rta->rta_type == IFLA_STATS64)
+		{
+			if (RTA_PAYLOAD (rta) >= sizeof (struct rtnl_link_stats64))
+				*ret_stats64 = RTA_DATA (rta);
+		}
+#endif
+		else if (rta->rta_type == IFLA_STATS)
+		{
+			if (RTA_PAYLOAD (rta) >= sizeof (struct rtnl_link_stats))
+				*ret_stats = RTA_DATA (rta);
+		}
+	}
+
+	if ((name == NULL) || (name[0] == 0))
+		return (NULL);
+
+	if (c_avl_get (if_links, &ifm->ifi_index, (void *) &link) != 0)
+	{
+		link = calloc (1, sizeof (*link));
+		if (link == NULL)
+			return (NULL);
+		link->ifindex = ifm->ifi_index;
+
+		if (c_avl_insert (if_links, &link->ifindex, link) != 0)
+		{
+			sfree (link);
+			return (NULL);
+		}
+	}
+
+	/* New or renamed link. */
+	if (strcmp (link->name, name) != 0)
+	{
+		sstrncpy (link->name, name, sizeof (link->name));
+		link->ignored = (ignorelist_match (ignorelist, link->name) != 0);
+	}
+
+	link->up = (ifm->ifi_flags & IFF_UP) ? 1 : 0;
+	link->generation = if_links_generation;
+	return (link);
+} /* }}} if_link_t *if_netlink_update */
+
+static void if_netlink_submit (if_link_t const *link, /* {{{ */
+		void const *stats64, void const *stats)
+{
+	/* Attributes are only four byte aligned, so copy the counters. */
+#ifdef HAVE_RTNL_LINK_STATS64
+	if (stats64 != NULL)
+	{
+		struct rtnl_link_stats64 s;
+
+		memcpy (&s, stats64, sizeof (s));
+		nl_dispatched++;
+		if_dispatch (link->name, "if_octets",
+				(derive_t) s.rx_bytes, (derive_t) s.tx_bytes);
+		if_dispatch (link->name, "if_packets",
+				(derive_t) s.rx_packets, (derive_t) s.tx_packets);
+		if_dispatch (link->name, "if_errors",
+				(derive_t) s.rx_errors, (derive_t) s.tx_errors);
+		return;
+	}
+#endif
+
+	if (stats != NULL)
+	{
+		struct rtnl_link_stats s;
+
+		memcpy (&s, stats, sizeof (s));
+		nl_dispatched++;
+		if_dispatch (link->name, "if_octets",
+				(derive_t) s.rx_bytes, (derive_t) s.tx_bytes);
+		if_dispatch (link->name, "if_packets",
+				(derive_t) s.rx_packets, (derive_t) s.tx_packets);
+		if_dispatch (link->name, "if_errors",
+				(derive_t) s.rx_errors, (derive_t) s.tx_errors);
+	}
+} /* }}} void if_netlink_submit */
+
+/* Handles the RTM_NEWLINK messages of an RTM_GETLINK dump. */
+static void if_netlink_link_cb (struct nlmsghdr *nlh) /* {{{ */
+{
+	void const *stats64 = NULL;
+	void const *stats = NULL;
+	if_link_t *link;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return;
+
+	link = if_netlink_update (nlh, &stats64, &stats);
+	if ((link == NULL) || !link->up || link->ignored)
+		return;
+
+	/* The counters are only used if RTM_GETSTATS is not available. */
+	if (!nl_getstats)
+		if_netlink_submit (link, stats64, stats);
+} /* }}} void if_netlink_link_cb */
+
+#if IF_HAVE_GETSTATS
+/* Handles the RTM_NEWSTATS messages of an RTM_GETSTATS dump. Links that are
+ * down or ignored are skipped before their counters are looked at. */
+static void if_netlink_stats_cb (struct nlmsghdr *nlh) /* {{{ */
+{
+	struct if_stats_msg *ifsm;
+	struct rtattr *rta;
+	int rta_len;
+	if_link_t *link = NULL;
+
+	if ((nlh->nlmsg_type != RTM_NEWSTATS)
+			|| (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*ifsm))))
+		return;
+	ifsm = NLMSG_DATA (nlh);
+
+	if (c_avl_get (if_links, &ifsm->ifindex, (void *) &link) != 0)
+	{
+		/* Missed a notification. */
+		nl_resync = 1;
+		return;
+	}
+	if (!link->up || link->ignored)
+		return;
+
+	rta_len = (int) (nlh->nlmsg_len - NLMSG_LENGTH (sizeof (*ifsm)));
+	for (rta = (struct rtattr *) (((char *) ifsm)
+				+ NLMSG_ALIGN (sizeof (*ifsm)));
+			RTA_OK (rta, rta_len); rta = RTA_NEXT (rta, rta_len))
+	{
+		if ((rta->rta_type == IFLA_STATS_LINK_64)
+				&& (RTA_PAYLOAD (rta) >= sizeof (struct rtnl_link_stats64)))
+		{
+			if_netlink_submit (link, RTA_DATA (rta), NULL);
+			return;
+		}
+	}
+} /* }}} void if_netlink_stats_cb */
+#endif /* IF_HAVE_GETSTATS */
+
+/* Sends a dump request and passes each reply to "callback". Returns zero on
+ * success, the error reported by the kernel, or -1 if the socket failed. */
+static int if_netlink_dump (int type, void const *payload, /* {{{ */
+		size_t payload_size, void (*callback) (struct nlmsghdr *))
+{
+	char req[NLMSG_SPACE (sizeof (struct ifinfomsg) + 32)];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) req;
+
+	assert (NLMSG_SPACE (payload_size) <= sizeof (req));
+	memset (req, 0, sizeof (req));
+	nlh->nlmsg_len = NLMSG_LENGTH (payload_size);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	nlh->nlmsg_seq = ++nl_seq;
+	memcpy (NLMSG_DATA (nlh), payload, payload_size);
+
+	if (send (nl_sock, req, nlh->nlmsg_len, 0) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: Sending a netlink request failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	while (42)
+	{
+		ssize_t len;
+
+		len = recv (nl_sock, nl_buffer, IF_NETLINK_BUFFER_SIZE, 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("interface plugin: Receiving from the netlink socket "
+					"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		for (nlh = (struct nlmsghdr *) nl_buffer; NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			/* Left over from an earlier, aborted dump. */
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return (0);
+			else if (nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				struct nlmsgerr *err = NLMSG_DATA (nlh);
+				return ((err->error < 0) ? -err->error : EPROTO);
+			}
+
+			(*callback) (nlh);
+		}
+	}
+} /* }}} int if_netlink_dump */
+
+/* Applies the link notifications received since the last read. */
+static int if_netlink_monitor (void) /* {{{ */
+{
+	while (42)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv (nl_monitor, nl_buffer, IF_NETLINK_BUFFER_SIZE, 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (0);
+			else if (errno == ENOBUFS)
+			{
+				/* Notifications were lost. */
+				nl_resync = 1;
+				continue;
+			}
+
+			ERROR ("interface plugin: Receiving link notifications "
+					"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		for (nlh = (struct nlmsghdr *) nl_buffer; NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			if (nlh->nlmsg_type == RTM_NEWLINK)
+				if_netlink_update (nlh, NULL, NULL);
+			else if ((nlh->nlmsg_type == RTM_DELLINK)
+					&& (nlh->nlmsg_len >= NLMSG_LENGTH (sizeof (struct ifinfomsg))))
+			{
+				struct ifinfomsg *ifm = NLMSG_DATA (nlh);
+				if_link_remove (ifm->ifi_index);
+			}
+		}
+	}
+} /* }}} int if_netlink_monitor */
+
+/* Reads the interface counters via rtnetlink. Returns zero on success; on
+ * failure the sockets are closed, so the next call starts over. */
+static int if_netlink_read (void) /* {{{ */
+{
+	int status;
+
+	if ((nl_sock < 0) && (if_netlink_open () != 0))
+		return (-1);
+
+	if (if_netlink_monitor () != 0)
+	{
+		if_netlink_close ();
+		return (-1);
+	}
+
+	/* Without RTM_GETSTATS, the counters come with the link dump. */
+	if (nl_resync || !nl_getstats)
+	{
+		struct ifinfomsg ifm;
+
+		memset (&ifm, 0, sizeof (ifm));
+		ifm.ifi_family = AF_UNSPEC;
+
+		if_links_generation++;
+		status = if_netlink_dump (RTM_GETLINK, &ifm, sizeof (ifm),
+				if_netlink_link_cb);
+		if (status != 0)
+		{
+			if (status > 0)
+			{
+				char errbuf[1024];
+				ERROR ("interface plugin: The RTM_GETLINK request failed: %s",
+						sstrerror (status, errbuf, sizeof (errbuf)));
+			}
+			if_netlink_close ();
+			return (-1);
+		}
+		if_link_expire ();
+		nl_resync = 0;
+
+		if (!nl_getstats)
+			return (0);
+	}
+
+#if IF_HAVE_GETSTATS
+	{
+		struct if_stats_msg ifsm;
+
+		memset (&ifsm, 0, sizeof (ifsm));
+		ifsm.family = AF_UNSPEC;
+		ifsm.filter_mask = IFLA_STATS_FILTER_BIT (IFLA_STATS_LINK_64);
+
+		status = if_netlink_dump (RTM_GETSTATS, &ifsm, sizeof (ifsm),
+				if_netlink_stats_cb);
+		if (status > 0)
+		{
+			/* Kernels before 4.7 don't know RTM_GETSTATS. */
+			INFO ("interface plugin: RTM_GETSTATS is not supported, "
+					"dumping links instead.");
+			nl_getstats = 0;
+			return (if_netlink_read ());
+		}
+		else if (status < 0)
+		{
+			if_netlink_close ();
+			return (-1);
+		}
+	}
+#endif
+
+	return (0);
+} /* }}} int if_netlink_read */
+#endif /* IF_HAVE_NETLINK */
+
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+static int interface_shutdown (void) /* {{{ */
+{
+	procfile_close (proc_net_dev);
+	proc_net_dev = NULL;
+
+#if IF_HAVE_NETLINK
+	if_netlink_close ();
+	sfree (nl_buffer);
+
+	if (if_links != NULL)
+	{
+		int *key;
+		if_link_t *link;
+
+		while (c_avl_pick (if_links, (void *) &key, (void *) &link) == 0)
+			sfree (link);
+		c_avl_destroy (if_links);
+		if_links = NULL;
+	}
+#endif
+
+	return (0);
+} /* }}} int interface_shutdown */
+#endif /* KERNEL_LINUX && !HAVE_GETIFADDRS */
 
 static int interface_read (void)
 {
@@ -232,8 +829,8 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	size_t i;
+	int status;
 	derive_t incoming, outgoing;
 	char *device;
 
@@ -241,47 +838,84 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+#if IF_HAVE_NETLINK
+	if (use_netlink)
+	{
+		nl_dispatched = 0;
+		if (if_netlink_read () == 0)
+		{
+			c_release (LOG_INFO, &nl_complaint, "interface plugin: "
+					"Reading the interface counters via netlink works again.");
+			return (0);
+		}
+
+		/* Reading /proc/net/dev now would dispatch some interfaces twice. */
+		if (nl_dispatched > 0)
+			return (-1);
+
+		c_complain (LOG_WARNING, &nl_complaint, "interface plugin: "
+				"Reading the interface counters via netlink failed. "
+				"Falling back to /proc/net/dev.");
+	}
+#endif
+
+	if (proc_net_dev == NULL)
+	{
+		proc_net_dev = procfile_open_indexed ("/proc/net/dev",
+				/* key field = */ 0, if_slot, /* user data = */ NULL);
+		if (proc_net_dev == NULL)
+		{
+			char errbuf[1024];
+			WARNING ("interface plugin: open (/proc/net/dev) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	status = procfile_read (proc_net_dev);
+	if (status != 0)
 	{
 		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		WARNING ("interface plugin: Reading /proc/net/dev failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	for (i = 0; i < procfile_lines_num (proc_net_dev); i++)
 	{
-		if (!(dummy = strchr(buffer, ':')))
+		/* Header lines and ignored interfaces don't have a slot. */
+		if (procfile_slot (proc_net_dev, i) < 0)
+			continue;
+
+		device = procfile_line (proc_net_dev, i);
+		if (!(dummy = strchr(device, ':')))
 			continue;
 		dummy[0] = '\0';
 		dummy++;
 
-		device = buffer;
 		while (device[0] == ' ')
 			device++;
 
 		if (device[0] == '\0')
 			continue;
 
-		numfields = strsplit (dummy, fields, 16);
+		numfields = procfile_split (dummy, fields, 16);
 
 		if (numfields < 11)
 			continue;
 
 		incoming = atoll (fields[0]);
 		outgoing = atoll (fields[8]);
-		if_submit (device, "if_octets", incoming, outgoing);
+		if_dispatch (device, "if_octets", incoming, outgoing);
 
 		incoming = atoll (fields[1]);
 		outgoing = atoll (fields[9]);
-		if_submit (device, "if_packets", incoming, outgoing);
+		if_dispatch (device, "if_packets", incoming, outgoing);
 
 		incoming = atoll (fields[2]);
 		outgoing = atoll (fields[10]);
-		if_submit (device, "if_errors", incoming, outgoing);
+		if_dispatch (device, "if_errors", incoming, outgoing);
 	}
-
-	fclose (fh);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -385,4 +1019,7 @@ void module_register (void)
 	plugin_register_init ("interface", interface_init);
 #endif
 	plugin_register_read ("interface", interface_read);
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+	plugin_register_shutdown ("interface", interface_shutdown);
+#endif
 } /* void module_register */
@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,8 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+static procfile_t *proc_interrupts = NULL;
+
 /*
  * Private functions
  */
@@ -70,14 +73,33 @@ static int irq_config (const char *key, const char *value)
 	return (0);
 }
 
+/* Maps the lines of /proc/interrupts to slot zero if the irq is selected.
+ * The key of a line is the irq name followed by a colon; the header line's
+ * key has no colon. */
+static int irq_slot (char const *key, /* {{{ */
+		size_t __attribute__((unused)) line,
+		void __attribute__((unused)) *user_data)
+{
+	char irq_name[DATA_MAX_NAME_LEN];
+	size_t irq_name_len = strlen (key);
+
+	if ((irq_name_len < 2) || (irq_name_len > sizeof (irq_name))
+			|| (key[irq_name_len - 1] != ':'))
+		return (-1);
+
+	memcpy (irq_name, key, irq_name_len - 1);
+	irq_name[irq_name_len - 1] = 0;
+
+	if (ignorelist_match (ignorelist, irq_name) != 0)
+		return (-1);
+	return (0);
+} /* }}} int irq_slot */
+
 static void irq_submit (const char *irq_name, derive_t value)
 {
 	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, irq_name) != 0)
-		return;
-
 	values[0].derive = value;
 
 	vl.values = values;
@@ -92,8 +114,8 @@ static void irq_submit (const char *irq_name, derive_t value)
 
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
+	size_t i;
+	int status;
 	int  cpu_count;
 	char *fields[256];
 
@@ -104,36 +126,53 @@ static int irq_read (void)
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if (proc_interrupts == NULL)
+	{
+		proc_interrupts = procfile_open_indexed ("/proc/interrupts",
+				/* key field = */ 0, irq_slot, /* user data = */ NULL);
+		if (proc_interrupts == NULL)
+		{
+			char errbuf[1024];
+			ERROR ("irq plugin: open (/proc/interrupts): %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	status = procfile_read (proc_interrupts);
+	if (status != 0)
 	{
 		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		ERROR ("irq plugin: Reading /proc/interrupts failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
 	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
+	if (procfile_lines_num (proc_interrupts) > 0) {
+		cpu_count = procfile_split (procfile_line (proc_interrupts, 0),
+				fields, STATIC_ARRAY_SIZE (fields));
 	} else {
 		ERROR ("irq plugin: unable to get CPU count from first line "
 				"of /proc/interrupts");
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	for (i = 1; i < procfile_lines_num (proc_interrupts); i++)
 	{
 		char *irq_name;
 		size_t irq_name_len;
 		derive_t irq_value;
-		int i;
+		int j;
 		int fields_num;
 		int irq_values_to_parse;
 
-		fields_num = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
+		/* Header lines and ignored irqs don't have a slot. */
+		if (procfile_slot (proc_interrupts, i) < 0)
+			continue;
+
+		fields_num = procfile_split (procfile_line (proc_interrupts, i),
+				fields, STATIC_ARRAY_SIZE (fields));
 		if (fields_num < 2)
 			continue;
 
@@ -159,34 +198,40 @@ static int irq_read (void)
 		irq_name_len--;
 
 		irq_value = 0;
-		for (i = 1; i <= irq_values_to_parse; i++)
+		for (j = 1; j <= irq_values_to_parse; j++)
 		{
 			/* Per-CPU value */
 			value_t v;
-			int status;
 
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
+			status = parse_value (fields[j], &v, DS_TYPE_DERIVE);
 			if (status != 0)
 				break;
 
 			irq_value += v.derive;
-		} /* for (i) */
+		} /* for (j) */
 
 		/* No valid fields -> do not submit anything. */
-		if (i <= 1)
+		if (j <= 1)
 			continue;
 
 		irq_submit (irq_name, irq_value);
 	}
 
-	fclose (fh);
-
 	return (0);
 } /* int irq_read */
 
+static int irq_shutdown (void)
+{
+	procfile_close (proc_interrupts);
+	proc_interrupts = NULL;
+
+	return (0);
+} /* int irq_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("irq", irq_config,
 			config_keys, config_keys_num);
 	plugin_register_read ("irq", irq_read);
+	plugin_register_shutdown ("irq", irq_shutdown);
 } /* void module_register */
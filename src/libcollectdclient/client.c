@@ -47,6 +47,7 @@
 #include <netdb.h>
 
 #include "collectd/client.h"
+#include "collectd/network_buffer.h"
 
 /* NI_MAXHOST has been obsoleted by RFC 3493 which is a reason for SunOS 5.11
  * to no longer define it. We'll use the old, RFC 2553 value here. */
@@ -91,6 +92,9 @@
   (c)->errbuf[sizeof ((c)->errbuf) - 1] = 0; \
 } while (0)
 
+/* Maximum size of one binary frame sent by lcc_putval_bulk(). */
+#define LCC_BULK_BUFFER_SIZE 65536
+
 #if COLLECT_DEBUG
 # define LCC_DEBUG(...) printf (__VA_ARGS__)
 #else
@@ -809,6 +813,116 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int lcc_putval */
 
+/* Sends the contents of "nb" as one PUTBULK frame and re-initializes the
+ * network buffer. */
+static int lcc_putbulk_send (lcc_connection_t *c, /* {{{ */
+    lcc_network_buffer_t *nb, char *buffer, size_t buffer_size)
+{
+  lcc_response_t res;
+  int status;
+
+  lcc_network_buffer_finalize (nb);
+  status = lcc_network_buffer_get (nb, buffer, &buffer_size);
+  lcc_network_buffer_initialize (nb);
+  if (status != 0)
+  {
+    lcc_set_errno (c, status);
+    return (-1);
+  }
+
+  if (buffer_size == 0)
+    return (0);
+
+  LCC_DEBUG ("send:    --> PUTBULK %zu\n", buffer_size);
+
+  if ((fprintf (c->fh, "PUTBULK %zu\r\n", buffer_size) < 0)
+      || (fwrite (buffer, 1, buffer_size, c->fh) != buffer_size))
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+  fflush (c->fh);
+
+  memset (&res, 0, sizeof (res));
+  status = lcc_receive (c, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_putbulk_send */
+
+int lcc_putval_bulk (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, size_t vl_num)
+{
+  lcc_network_buffer_t *nb;
+  char *buffer;
+  size_t i;
+  int status = 0;
+
+  if ((c == NULL) || ((vl == NULL) && (vl_num > 0)))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  nb = lcc_network_buffer_create (LCC_BULK_BUFFER_SIZE);
+  buffer = malloc (LCC_BULK_BUFFER_SIZE);
+  if ((nb == NULL) || (buffer == NULL))
+  {
+    lcc_network_buffer_destroy (nb);
+    free (buffer);
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+
+  for (i = 0; i < vl_num; i++)
+  {
+    if ((vl[i].values_len < 1) || (vl[i].values == NULL)
+        || (vl[i].values_types == NULL))
+    {
+      lcc_set_errno (c, EINVAL);
+      status = -1;
+      break;
+    }
+
+    if (lcc_network_buffer_add_value (nb, vl + i) == 0)
+      continue;
+
+    /* The buffer is full: send it and try again with an empty buffer. */
+    status = lcc_putbulk_send (c, nb, buffer, LCC_BULK_BUFFER_SIZE);
+    if (status != 0)
+      break;
+
+    if (lcc_network_buffer_add_value (nb, vl + i) != 0)
+    {
+      LCC_SET_ERRSTR (c, "Value list %zu does not fit into a frame.", i);
+      status = -1;
+      break;
+    }
+  }
+
+  if (status == 0)
+    status = lcc_putbulk_send (c, nb, buffer, LCC_BULK_BUFFER_SIZE);
+
+  lcc_network_buffer_destroy (nb);
+  free (buffer);
+  return (status);
+} /* }}} int lcc_putval_bulk */
+
 int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
     lcc_identifier_t *ident, int timeout)
 {
@@ -106,6 +106,12 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Submits "vl_num" value lists using the binary PUTBULK command, which avoids
+ * parsing the values as text on the server side. Multiple frames are sent if
+ * the value lists don't fit into one. */
+int lcc_putval_bulk (lcc_connection_t *c,
+    const lcc_value_list_t *vl, size_t vl_num);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
@@ -29,6 +29,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #include <unistd.h>
 
@@ -56,6 +57,10 @@
 
 static _Bool report_relative_load = 0;
 
+#if KERNEL_LINUX
+static procfile_t *proc_loadavg = NULL;
+#endif
+
 static const char *config_keys[] =
 {
 	"ReportRelative"
@@ -117,52 +122,40 @@ static void load_submit (gauge_t snum, gauge_t mnum, gauge_t lnum)
 
 static int load_read (void)
 {
-#if defined(HAVE_GETLOADAVG)
-	double load[3];
-
-	if (getloadavg (load, 3) == 3)
-                load_submit (load[LOADAVG_1MIN], load[LOADAVG_5MIN], load[LOADAVG_15MIN]);
-        else
-        {
-                char errbuf[1024];
-                WARNING ("load: getloadavg failed: %s",
-                         sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
-/* #endif HAVE_GETLOADAVG */
-
-#elif defined(KERNEL_LINUX)
+/* Prefer /proc/loadavg over getloadavg(3): glibc implements the latter by
+ * opening and reading that file on every call. */
+#if KERNEL_LINUX
         gauge_t snum, mnum, lnum;
-	FILE *loadavg;
-	char buffer[16];
+	int status;
 
 	char *fields[8];
 	int numfields;
 
-	if ((loadavg = fopen ("/proc/loadavg", "r")) == NULL)
+	if (proc_loadavg == NULL)
 	{
-		char errbuf[1024];
-		WARNING ("load: fopen: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		proc_loadavg = procfile_open ("/proc/loadavg");
+		if (proc_loadavg == NULL)
+		{
+			char errbuf[1024];
+			WARNING ("load: open (/proc/loadavg): %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
 	}
 
-	if (fgets (buffer, 16, loadavg) == NULL)
+	status = procfile_read (proc_loadavg);
+	if (status != 0)
 	{
 		char errbuf[1024];
-		WARNING ("load: fgets: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (loadavg);
+		WARNING ("load: Reading /proc/loadavg failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	if (fclose (loadavg))
-	{
-		char errbuf[1024];
-		WARNING ("load: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	if (procfile_lines_num (proc_loadavg) < 1)
+		return (-1);
 
-	numfields = strsplit (buffer, fields, 8);
+	numfields = procfile_split (procfile_line (proc_loadavg, 0), fields, 8);
 
 	if (numfields < 3)
 		return (-1);
@@ -174,6 +167,19 @@ static int load_read (void)
         load_submit(snum, mnum, lnum);
 /* #endif KERNEL_LINUX */
 
+#elif defined(HAVE_GETLOADAVG)
+	double load[3];
+
+	if (getloadavg (load, 3) == 3)
+                load_submit (load[LOADAVG_1MIN], load[LOADAVG_5MIN], load[LOADAVG_15MIN]);
+        else
+        {
+                char errbuf[1024];
+                WARNING ("load: getloadavg failed: %s",
+                         sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+/* #endif HAVE_GETLOADAVG */
+
 #elif HAVE_LIBSTATGRAB
         gauge_t snum, mnum, lnum;
 	sg_load_stats *ls;
@@ -212,8 +218,21 @@ static int load_read (void)
 	return (0);
 }
 
+#if KERNEL_LINUX
+static int load_shutdown (void)
+{
+	procfile_close (proc_loadavg);
+	proc_loadavg = NULL;
+
+	return (0);
+}
+#endif
+
 void module_register (void)
 {
 	plugin_register_config ("load", load_config, config_keys, config_keys_num);
 	plugin_register_read ("load", load_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("load", load_shutdown);
+#endif
 } /* void module_register */
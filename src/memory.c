@@ -26,6 +26,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
@@ -70,7 +71,30 @@ static vm_size_t pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+/* Slots of the /proc/meminfo lines we're interested in. */
+enum
+{
+	MEMINFO_TOTAL,
+	MEMINFO_FREE,
+	MEMINFO_BUFFERS,
+	MEMINFO_CACHED,
+	MEMINFO_SLAB,
+	MEMINFO_SRECLAIMABLE,
+	MEMINFO_SUNRECLAIM,
+	MEMINFO_MAX
+};
+static char const *meminfo_keys[MEMINFO_MAX] =
+{
+	"MemTotal:",
+	"MemFree:",
+	"Buffers:",
+	"Cached:",
+	"Slab:",
+	"SReclaimable:",
+	"SUnreclaim:"
+};
+
+static procfile_t *proc_meminfo = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -158,6 +182,28 @@ static int memory_init (void)
 	return (0);
 } /* int memory_init */
 
+#if KERNEL_LINUX
+static int memory_slot (char const *key, /* {{{ */
+		size_t __attribute__((unused)) line,
+		void __attribute__((unused)) *user_data)
+{
+	int i;
+
+	for (i = 0; i < MEMINFO_MAX; i++)
+		if (strcasecmp (key, meminfo_keys[i]) == 0)
+			return (i);
+
+	return (-1);
+} /* }}} int memory_slot */
+
+static int memory_shutdown (void) /* {{{ */
+{
+	procfile_close (proc_meminfo);
+	proc_meminfo = NULL;
+	return (0);
+} /* }}} int memory_shutdown */
+#endif /* KERNEL_LINUX */
+
 #define MEMORY_SUBMIT(...) do { \
 	if (values_absolute) \
 		plugin_dispatch_multivalue (vl, 0, DS_TYPE_GAUGE, __VA_ARGS__, NULL); \
@@ -275,69 +321,69 @@ static int memory_read_internal (value_list_t *vl)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	gauge_t values[MEMINFO_MAX] = { 0 };
+	size_t i;
+	int status;
 
 	char *fields[8];
 	int numfields;
 
 	_Bool detailed_slab_info = 0;
 
-	gauge_t mem_total = 0;
-	gauge_t mem_used = 0;
-	gauge_t mem_buffered = 0;
-	gauge_t mem_cached = 0;
-	gauge_t mem_free = 0;
-	gauge_t mem_slab_total = 0;
-	gauge_t mem_slab_reclaimable = 0;
-	gauge_t mem_slab_unreclaimable = 0;
+	gauge_t mem_total;
+	gauge_t mem_used;
+	gauge_t mem_buffered;
+	gauge_t mem_cached;
+	gauge_t mem_free;
+	gauge_t mem_slab_total;
+	gauge_t mem_slab_reclaimable;
+	gauge_t mem_slab_unreclaimable;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if (proc_meminfo == NULL)
+	{
+		proc_meminfo = procfile_open_indexed ("/proc/meminfo",
+				/* key field = */ 0, memory_slot, /* user data = */ NULL);
+		if (proc_meminfo == NULL)
+		{
+			char errbuf[1024];
+			WARNING ("memory: open (/proc/meminfo) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	status = procfile_read (proc_meminfo);
+	if (status != 0)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		WARNING ("memory: Reading /proc/meminfo failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	for (i = 0; i < procfile_lines_num (proc_meminfo); i++)
 	{
-		gauge_t *val = NULL;
-
-		if (strncasecmp (buffer, "MemTotal:", 9) == 0)
-			val = &mem_total;
-		else if (strncasecmp (buffer, "MemFree:", 8) == 0)
-			val = &mem_free;
-		else if (strncasecmp (buffer, "Buffers:", 8) == 0)
-			val = &mem_buffered;
-		else if (strncasecmp (buffer, "Cached:", 7) == 0)
-			val = &mem_cached;
-		else if (strncasecmp (buffer, "Slab:", 5) == 0)
-			val = &mem_slab_total;
-		else if (strncasecmp (buffer, "SReclaimable:", 13) == 0) {
-			val = &mem_slab_reclaimable;
-			detailed_slab_info = 1;
-		}
-		else if (strncasecmp (buffer, "SUnreclaim:", 11) == 0) {
-			val = &mem_slab_unreclaimable;
-			detailed_slab_info = 1;
-		}
-		else
+		int slot = procfile_slot (proc_meminfo, i);
+		if (slot < 0)
 			continue;
 
-		numfields = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+		numfields = procfile_split (procfile_line (proc_meminfo, i),
+				fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields < 2)
 			continue;
 
-		*val = 1024.0 * atof (fields[1]);
+		values[slot] = 1024.0 * atof (fields[1]);
+		if ((slot == MEMINFO_SRECLAIMABLE) || (slot == MEMINFO_SUNRECLAIM))
+			detailed_slab_info = 1;
 	}
 
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	mem_total = values[MEMINFO_TOTAL];
+	mem_free = values[MEMINFO_FREE];
+	mem_buffered = values[MEMINFO_BUFFERS];
+	mem_cached = values[MEMINFO_CACHED];
+	mem_slab_total = values[MEMINFO_SLAB];
+	mem_slab_reclaimable = values[MEMINFO_SRECLAIMABLE];
+	mem_slab_unreclaimable = values[MEMINFO_SUNRECLAIM];
 
 	if (mem_total < (mem_free + mem_buffered + mem_cached + mem_slab_total))
 		return (-1);
@@ -530,4 +576,7 @@ void module_register (void)
 	plugin_register_complex_config ("memory", memory_config);
 	plugin_register_init ("memory", memory_init);
 	plugin_register_read ("memory", memory_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("memory", memory_shutdown);
+#endif
 } /* void module_register */
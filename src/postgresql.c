@@ -56,6 +56,10 @@
 # define C_PSQL_DEFAULT_CONF PKGDATADIR "/postgresql_default.conf"
 #endif
 
+#ifndef C_PSQL_DEFAULT_BULK_SIZE
+# define C_PSQL_DEFAULT_BULK_SIZE 1000
+#endif
+
 /* Appends the (parameter, value) pair to the string
  * pointed to by 'buf' suitable to be used as argument
  * for PQconnectdb(). If value equals NULL, the pair
@@ -108,8 +112,22 @@ typedef struct {
 	char *name;
 	char *statement;
 	_Bool store_rates;
+
+	/* bulk mode: rows are sent using "COPY <table> FROM STDIN" */
+	char *table;
+	int   bulk_size;
 } c_psql_writer_t;
 
+/* Rows of a bulk writer waiting to be copied to the database, formatted
+ * according to the text format of the COPY command. */
+typedef struct {
+	char    *data;
+	size_t   size;
+	size_t   fill;
+	int      rows;
+	cdtime_t first_row;
+} c_psql_bulk_t;
+
 typedef struct {
 	PGconn      *conn;
 	c_complain_t conn_complaint;
@@ -127,6 +145,10 @@ typedef struct {
 	c_psql_writer_t **writers;
 	size_t            writers_num;
 
+	/* one buffer per writer; unused unless the writer is in bulk mode */
+	c_psql_bulk_t    *bulks;
+	cdtime_t          bulk_interval;
+
 	/* make sure we don't access the database object in parallel */
 	pthread_mutex_t   db_lock;
 
@@ -213,6 +235,146 @@ static int c_psql_commit (c_psql_database_t *db)
 	return status;
 } /* c_psql_commit */
 
+/* Appends a column to the COPY row in "bulk", escaping it according to the
+ * text format. A NULL value is stored as SQL NULL. */
+static int c_psql_bulk_append (c_psql_bulk_t *bulk, const char *value,
+		_Bool last)
+{
+	const char *ptr;
+	size_t need;
+
+	/* worst case: every character has to be escaped */
+	need = ((value != NULL) ? 2 * strlen (value) : 2) + 1;
+	if (bulk->fill + need > bulk->size) {
+		size_t size = (bulk->size > 0) ? bulk->size : 4096;
+		char *tmp;
+
+		while (bulk->fill + need > size)
+			size *= 2;
+
+		tmp = realloc (bulk->data, size);
+		if (tmp == NULL) {
+			log_err ("Out of memory.");
+			return -1;
+		}
+		bulk->data = tmp;
+		bulk->size = size;
+	}
+
+	if (value == NULL) {
+		bulk->data[bulk->fill++] = '\\';
+		bulk->data[bulk->fill++] = 'N';
+	}
+	else {
+		for (ptr = value; *ptr != '\0'; ++ptr) {
+			char c = *ptr;
+
+			if ((c == '\\') || (c == '\t') || (c == '\n') || (c == '\r')) {
+				bulk->data[bulk->fill++] = '\\';
+				if (c == '\t')
+					c = 't';
+				else if (c == '\n')
+					c = 'n';
+				else if (c == '\r')
+					c = 'r';
+			}
+			bulk->data[bulk->fill++] = c;
+		}
+	}
+
+	bulk->data[bulk->fill++] = last ? '\n' : '\t';
+	return 0;
+} /* c_psql_bulk_append */
+
+/* Sends all buffered rows of the bulk writer using a single COPY command.
+ * The rows are discarded even if sending them failed, like values which
+ * could not be inserted by a writer statement.
+ * db->db_lock must be locked when calling this function */
+static int c_psql_bulk_flush (c_psql_database_t *db, size_t idx)
+{
+	c_psql_writer_t *writer = db->writers[idx];
+	c_psql_bulk_t   *bulk   = db->bulks + idx;
+
+	char      query[1024];
+	PGresult *res;
+	int       status = 0;
+
+	if (bulk->rows == 0)
+		return 0;
+
+	ssnprintf (query, sizeof (query), "COPY %s FROM STDIN", writer->table);
+
+	res = PQexec (db->conn, query);
+	if (PGRES_COPY_IN != PQresultStatus (res)) {
+		log_err ("Failed to start copying to table %s: %s",
+				writer->table, PQerrorMessage (db->conn));
+		PQclear (res);
+		status = -1;
+	}
+	else {
+		PQclear (res);
+
+		if ((PQputCopyData (db->conn, bulk->data, (int) bulk->fill) != 1)
+				|| (PQputCopyEnd (db->conn, NULL) != 1)) {
+			log_err ("Failed to send %i rows to table %s: %s",
+					bulk->rows, writer->table, PQerrorMessage (db->conn));
+			status = -1;
+		}
+
+		/* the result of the COPY command; there may be several if the
+		 * connection broke while sending the data */
+		while ((res = PQgetResult (db->conn)) != NULL) {
+			if ((status == 0)
+					&& (PGRES_COMMAND_OK != PQresultStatus (res))) {
+				log_err ("Failed to copy %i rows to table %s: %s",
+						bulk->rows, writer->table,
+						PQerrorMessage (db->conn));
+				status = -1;
+			}
+			PQclear (res);
+		}
+	}
+
+	if (status != 0) {
+		/* this will abort any current transaction -> restart */
+		if (db->next_commit > 0)
+			c_psql_commit (db);
+	}
+	else
+		log_debug ("Copied %i rows to table %s.", bulk->rows, writer->table);
+
+	bulk->fill = 0;
+	bulk->rows = 0;
+	bulk->first_row = 0;
+	return status;
+} /* c_psql_bulk_flush */
+
+/* Flushes all bulk writers holding rows older than "timeout". A timeout of
+ * zero flushes unconditionally.
+ * db->db_lock must be locked when calling this function */
+static int c_psql_bulk_flush_all (c_psql_database_t *db, cdtime_t timeout)
+{
+	cdtime_t now = cdtime ();
+	int status = 0;
+	size_t i;
+
+	if ((db->bulks == NULL) || (CONNECTION_OK != PQstatus (db->conn)))
+		return 0;
+
+	for (i = 0; i < db->writers_num; ++i) {
+		c_psql_bulk_t *bulk = db->bulks + i;
+
+		if (bulk->rows == 0)
+			continue;
+		if ((timeout > 0) && ((bulk->first_row + timeout) > now))
+			continue;
+
+		if (c_psql_bulk_flush (db, i) != 0)
+			status = -1;
+	}
+	return status;
+} /* c_psql_bulk_flush_all */
+
 static c_psql_database_t *c_psql_database_new (const char *name)
 {
 	c_psql_database_t **tmp;
@@ -252,6 +414,9 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 	db->writers        = NULL;
 	db->writers_num    = 0;
 
+	db->bulks          = NULL;
+	db->bulk_interval  = 0;
+
 	pthread_mutex_init (&db->db_lock, /* attrs = */ NULL);
 
 	db->interval   = 0;
@@ -292,6 +457,8 @@ static void c_psql_database_delete (void *data)
 	/* wait for the lock to be released by the last writer */
 	pthread_mutex_lock (&db->db_lock);
 
+	c_psql_bulk_flush_all (db, /* timeout = */ 0);
+
 	if (db->next_commit > 0)
 		c_psql_commit (db);
 
@@ -306,6 +473,11 @@ static void c_psql_database_delete (void *data)
 	sfree (db->queries);
 	db->queries_num = 0;
 
+	if (db->bulks)
+		for (i = 0; i < db->writers_num; ++i)
+			sfree (db->bulks[i].data);
+	sfree (db->bulks);
+
 	sfree (db->writers);
 	db->writers_num = 0;
 
@@ -909,6 +1081,37 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		params[7] = values_type_str;
 		params[8] = values_str;
 
+		if (writer->table != NULL) {
+			c_psql_bulk_t *bulk = db->bulks + i;
+			size_t fill = bulk->fill;
+			size_t j;
+
+			for (j = 0; j < STATIC_ARRAY_SIZE (params); ++j) {
+				if (c_psql_bulk_append (bulk, params[j],
+							/* last = */ j == STATIC_ARRAY_SIZE (params) - 1)
+						!= 0) {
+					/* Don't leave half a row behind, it would break the
+					 * COPY of all the other rows. */
+					bulk->fill = fill;
+					pthread_mutex_unlock (&db->db_lock);
+					return -1;
+				}
+			}
+
+			if (bulk->rows == 0)
+				bulk->first_row = cdtime ();
+			++bulk->rows;
+
+			if ((bulk->rows >= writer->bulk_size)
+					&& (c_psql_bulk_flush (db, (size_t) i) != 0)) {
+				pthread_mutex_unlock (&db->db_lock);
+				return -1;
+			}
+
+			success = 1;
+			continue;
+		}
+
 		res = PQexecParams (db->conn, writer->statement,
 				STATIC_ARRAY_SIZE (params), NULL,
 				(const char *const *)params,
@@ -954,6 +1157,8 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		success = 1;
 	}
 
+	c_psql_bulk_flush_all (db, db->bulk_interval);
+
 	if ((db->next_commit > 0)
 			&& (cdtime () > db->next_commit))
 		c_psql_commit (db);
@@ -984,6 +1189,12 @@ static int c_psql_flush (cdtime_t timeout,
 	for (i = 0; i < dbs_num; ++i) {
 		c_psql_database_t *db = dbs[i];
 
+		if (db->bulks != NULL) {
+			pthread_mutex_lock (&db->db_lock);
+			c_psql_bulk_flush_all (db, timeout);
+			pthread_mutex_unlock (&db->db_lock);
+		}
+
 		/* don't commit if the timeout is larger than the regular commit
 		 * interval as in that case all requested data has already been
 		 * committed */
@@ -993,6 +1204,37 @@ static int c_psql_flush (cdtime_t timeout,
 	return 0;
 } /* c_psql_flush */
 
+/* Sends rows of bulk writers which have been waiting for longer than
+ * "BulkInterval", even if no new values are being written. */
+static int c_psql_bulk_read (user_data_t *ud)
+{
+	c_psql_database_t *db;
+	int status;
+
+	if ((ud == NULL) || (ud->data == NULL)) {
+		log_err ("c_psql_bulk_read: Invalid user data.");
+		return -1;
+	}
+
+	db = ud->data;
+
+	pthread_mutex_lock (&db->db_lock);
+
+	if (0 != c_psql_check_connection (db)) {
+		pthread_mutex_unlock (&db->db_lock);
+		return -1;
+	}
+
+	status = c_psql_bulk_flush_all (db, db->bulk_interval);
+
+	if ((db->next_commit > 0)
+			&& (cdtime () > db->next_commit))
+		c_psql_commit (db);
+
+	pthread_mutex_unlock (&db->db_lock);
+	return status;
+} /* c_psql_bulk_read */
+
 static int c_psql_shutdown (void)
 {
 	size_t i = 0;
@@ -1169,6 +1411,8 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 	writer->name = sstrdup (ci->values[0].value.string);
 	writer->statement = NULL;
 	writer->store_rates = 1;
+	writer->table = NULL;
+	writer->bulk_size = C_PSQL_DEFAULT_BULK_SIZE;
 
 	for (i = 0; i < ci->children_num; ++i) {
 		oconfig_item_t *c = ci->children + i;
@@ -1177,14 +1421,37 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 			status = cf_util_get_string (c, &writer->statement);
 		else if (strcasecmp ("StoreRates", c->key) == 0)
 			status = cf_util_get_boolean (c, &writer->store_rates);
+		else if (strcasecmp ("Table", c->key) == 0)
+			status = cf_util_get_string (c, &writer->table);
+		else if (strcasecmp ("BulkSize", c->key) == 0) {
+			status = cf_util_get_int (c, &writer->bulk_size);
+			if ((status == 0) && (writer->bulk_size < 1)) {
+				log_err ("Writer %s: `BulkSize' must be at least 1.",
+						writer->name);
+				status = -1;
+			}
+		}
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
 
+	if ((status == 0) && (writer->statement == NULL)
+			&& (writer->table == NULL)) {
+		log_err ("Writer %s: Either `Statement' or `Table' is required.",
+				writer->name);
+		status = -1;
+	}
+	else if ((status == 0) && (writer->statement != NULL)
+			&& (writer->table != NULL)) {
+		log_warn ("Writer %s: Both `Statement' and `Table' specified; "
+				"ignoring `Statement'.", writer->name);
+	}
+
 	if (status != 0) {
 		sfree (writer->statement);
+		sfree (writer->table);
 		sfree (writer->name);
-		sfree (writer);
+		--writers_num;
 		return status;
 	}
 
@@ -1246,6 +1513,8 @@ static int c_psql_config_database (oconfig_item_t *ci)
 			cf_util_get_cdtime (c, &db->commit_interval);
 		else if (strcasecmp ("ExpireDelay", c->key) == 0)
 			cf_util_get_cdtime (c, &db->expire_delay);
+		else if (strcasecmp ("BulkInterval", c->key) == 0)
+			cf_util_get_cdtime (c, &db->bulk_interval);
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
@@ -1285,6 +1554,24 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		}
 	}
 
+	for (i = 0; (size_t)i < db->writers_num; ++i) {
+		if (db->writers[i]->table == NULL)
+			continue;
+
+		db->bulks = (c_psql_bulk_t *) calloc (db->writers_num,
+				sizeof (*db->bulks));
+		if (db->bulks == NULL) {
+			log_err ("Out of memory.");
+			c_psql_database_delete (db);
+			return -1;
+		}
+		break;
+	}
+
+	if (db->bulk_interval == 0)
+		db->bulk_interval = (db->interval > 0)
+			? db->interval : plugin_get_interval ();
+
 	ud.data = db;
 	ud.free_func = c_psql_database_delete;
 
@@ -1312,6 +1599,19 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		/* flush this connection only */
 		++db->ref_cnt;
 		plugin_register_flush (cb_name, c_psql_flush, &ud);
+
+		if (db->bulks != NULL) {
+			char bulk_name[DATA_MAX_NAME_LEN];
+			struct timespec bulk_interval = { 0, 0 };
+
+			ssnprintf (bulk_name, sizeof (bulk_name), "postgresql-%s-bulk",
+					db->instance);
+			CDTIME_T_TO_TIMESPEC (db->bulk_interval, &bulk_interval);
+
+			++db->ref_cnt;
+			plugin_register_complex_read ("postgresql", bulk_name,
+					c_psql_bulk_read, &bulk_interval, &ud);
+		}
 	}
 	else if (db->commit_interval > 0) {
 		log_warn ("Database '%s': You do not have any writers assigned to "
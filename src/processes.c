@@ -92,6 +92,15 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include "utils_avltree.h"
+#  if HAVE_LINUX_CN_PROC_H
+#    include <pthread.h>
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <linux/netlink.h>
+#    include <linux/connector.h>
+#    include <linux/cn_proc.h>
+#  endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -212,6 +221,60 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* Per-process state kept between reads. A process is identified by its PID
+ * and start time, so a recycled PID is never mistaken for the process which
+ * used it before. Which `Process' and `ProcessMatch' entries a process
+ * belongs to is determined once; "comm" is compared on every read to notice
+ * an exec(2), which may change the result. Only processes which match
+ * anything keep their files open. */
+typedef struct ps_pid_s
+{
+	pid_t pid;
+	unsigned long long starttime;
+	char comm[32];
+	unsigned long generation;
+
+	procstat_t **matches;
+	size_t matches_num;
+
+	int stat_fd;
+	int status_fd;
+	int io_fd;
+} ps_pid_t;
+
+static c_avl_tree_t *pids_g = NULL;
+static unsigned long pids_generation_g = 0;
+
+#if HAVE_LINUX_CN_PROC_H
+/* With "ProcConnector" enabled, a thread receives fork, exec and exit
+ * events from the kernel's process events connector and queues them. The
+ * read callback applies them to "pids_g", so /proc only has to be scanned
+ * completely once, or after events have been lost. */
+#ifndef PS_CN_QUEUE_MAX
+# define PS_CN_QUEUE_MAX 65536
+#endif
+
+typedef struct ps_cn_event_s
+{
+	int   what; /* PROC_EVENT_FORK, PROC_EVENT_EXEC or PROC_EVENT_EXIT */
+	pid_t pid;
+} ps_cn_event_t;
+
+static _Bool ps_cn_enabled = 0;
+static int   ps_cn_sock = -1;
+
+static pthread_t ps_cn_thread;
+static _Bool     ps_cn_thread_running = 0;
+static int       ps_cn_thread_loop = 0;
+
+static pthread_mutex_t ps_cn_lock = PTHREAD_MUTEX_INITIALIZER;
+static ps_cn_event_t  *ps_cn_events = NULL;
+static size_t          ps_cn_events_num = 0;
+static size_t          ps_cn_events_size = 0;
+static _Bool           ps_cn_rescan = 1;
+static derive_t        ps_cn_forks = 0;
+#endif /* HAVE_LINUX_CN_PROC_H */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -335,143 +398,155 @@ static int ps_list_match (const char *name, const char *cmdline, procstat_t *ps)
 	return (0);
 } /* int ps_list_match */
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to 'instances' of process 'ps' (or refresh it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		procstat_entry_t *new;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
+		if (new == NULL)
+			return;
+		memset (new, 0, sizeof (procstat_entry_t));
+		new->id = entry->id;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
+		pse = new;
+	}
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	if ((entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0))
+	{
+		pse->vmem_minflt_counter += entry->vmem_minflt;
+		pse->vmem_minflt = entry->vmem_minflt;
 
-			pse = new;
+		pse->vmem_majflt_counter += entry->vmem_majflt;
+		pse->vmem_majflt = entry->vmem_majflt;
+	}
+	else
+	{
+		if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
+		{
+			pse->vmem_minflt = entry->vmem_minflt_counter
+				+ (ULONG_MAX - pse->vmem_minflt_counter);
 		}
-
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
+		else
 		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+			pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
+		}
+		pse->vmem_minflt_counter = entry->vmem_minflt_counter;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
+		if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
+		{
+			pse->vmem_majflt = entry->vmem_majflt_counter
+				+ (ULONG_MAX - pse->vmem_majflt_counter);
 		}
 		else
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
-			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+			pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
 		}
+		pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+	}
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
+	ps->vmem_minflt_counter += pse->vmem_minflt;
+	ps->vmem_majflt_counter += pse->vmem_majflt;
 
-		if ((entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0))
-		{
-			pse->cpu_user_counter += entry->cpu_user;
-			pse->cpu_user = entry->cpu_user;
+	if ((entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0))
+	{
+		pse->cpu_user_counter += entry->cpu_user;
+		pse->cpu_user = entry->cpu_user;
 
-			pse->cpu_system_counter += entry->cpu_system;
-			pse->cpu_system = entry->cpu_system;
+		pse->cpu_system_counter += entry->cpu_system;
+		pse->cpu_system = entry->cpu_system;
+	}
+	else
+	{
+		if (entry->cpu_user_counter < pse->cpu_user_counter)
+		{
+			pse->cpu_user = entry->cpu_user_counter
+				+ (ULONG_MAX - pse->cpu_user_counter);
 		}
 		else
 		{
-			if (entry->cpu_user_counter < pse->cpu_user_counter)
-			{
-				pse->cpu_user = entry->cpu_user_counter
-					+ (ULONG_MAX - pse->cpu_user_counter);
-			}
-			else
-			{
-				pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
-			}
-			pse->cpu_user_counter = entry->cpu_user_counter;
+			pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
+		}
+		pse->cpu_user_counter = entry->cpu_user_counter;
 
-			if (entry->cpu_system_counter < pse->cpu_system_counter)
-			{
-				pse->cpu_system = entry->cpu_system_counter
-					+ (ULONG_MAX - pse->cpu_system_counter);
-			}
-			else
-			{
-				pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
-			}
-			pse->cpu_system_counter = entry->cpu_system_counter;
+		if (entry->cpu_system_counter < pse->cpu_system_counter)
+		{
+			pse->cpu_system = entry->cpu_system_counter
+				+ (ULONG_MAX - pse->cpu_system_counter);
+		}
+		else
+		{
+			pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
 		}
+		pse->cpu_system_counter = entry->cpu_system_counter;
+	}
+
+	ps->cpu_user_counter   += pse->cpu_user;
+	ps->cpu_system_counter += pse->cpu_system;
+} /* void ps_list_add_entry */
+
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of all processes matching 'name' */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
+
+	if (entry->id == 0)
+		return;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
 
-		ps->cpu_user_counter   += pse->cpu_user;
-		ps->cpu_system_counter += pse->cpu_system;
+		ps_list_add_entry (ps, entry);
 	}
-}
+} /* void ps_list_add */
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -577,6 +652,15 @@ static int ps_config (oconfig_item_t *ci)
 			ps_list_register (c->values[0].value.string,
 					c->values[1].value.string);
 		}
+		else if (strcasecmp (c->key, "ProcConnector") == 0)
+		{
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+			cf_util_get_boolean (c, &ps_cn_enabled);
+#else
+			WARNING ("processes plugin: The `ProcConnector' option is "
+					"only available on Linux and will be ignored.");
+#endif
+		}
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -790,31 +874,93 @@ static int ps_read_tasks (int pid)
 	return ((count >= 1) ? count : 1);
 } /* int *ps_read_tasks */
 
+/* Reads /proc/<pid>/<file> into "buffer". If "fd" is not NULL, the file is
+ * kept open and read again with a single pread(2) next time. Returns the
+ * number of bytes read or -1 on error, e.g. when the process has exited. */
+static ssize_t ps_read_file (pid_t pid, const char *file, int *fd,
+		char *buffer, size_t buffer_size)
+{
+	int tmp_fd = -1;
+	ssize_t status;
+
+	if (fd == NULL)
+		fd = &tmp_fd;
+
+	if (*fd < 0)
+	{
+		char filename[64];
+
+		ssnprintf (filename, sizeof (filename), "/proc/%i/%s",
+				(int) pid, file);
+		*fd = open (filename, O_RDONLY);
+		if (*fd < 0)
+			return (-1);
+	}
+
+	do
+		status = pread (*fd, buffer, buffer_size - 1, /* offset = */ 0);
+	while ((status < 0) && (errno == EINTR));
+
+	if ((status <= 0) || (fd == &tmp_fd))
+	{
+		close (*fd);
+		*fd = -1;
+	}
+
+	if (status < 0)
+		return (-1);
+
+	buffer[status] = 0;
+	return (status);
+} /* ssize_t ps_read_file */
+
+/* Returns the next line of "buffer", which is modified in place, and
+ * advances "*next" beyond it. Returns NULL at the end of the buffer. */
+static char *ps_next_line (char **next)
+{
+	char *line = *next;
+	char *eol;
+
+	if ((line == NULL) || (line[0] == 0))
+		return (NULL);
+
+	eol = strchr (line, '\n');
+	if (eol != NULL)
+	{
+		*eol = 0;
+		*next = eol + 1;
+	}
+	else
+		*next = NULL;
+
+	return (line);
+} /* char *ps_next_line */
+
 /* Read advanced virtual memory data from /proc/pid/status */
-static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
+static procstat_t *ps_read_vmem (int pid, procstat_t *ps, int *fd)
 {
-	FILE *fh;
-	char buffer[1024];
-	char filename[64];
+	char buffer[4096];
+	char *next;
+	char *line;
 	unsigned long long lib = 0;
 	unsigned long long exe = 0;
 	unsigned long long data = 0;
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file (pid, "status", fd, buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof(buffer), fh) != NULL)
+	next = buffer;
+	while ((line = ps_next_line (&next)) != NULL)
 	{
 		long long tmp;
 		char *endptr;
 
-		if (strncmp (buffer, "Vm", 2) != 0)
+		if (strncmp (line, "Vm", 2) != 0)
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -825,27 +971,20 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 		tmp = strtoll (fields[1], &endptr, /* base = */ 10);
 		if ((errno == 0) && (endptr != fields[1]))
 		{
-			if (strncmp (buffer, "VmData", 6) == 0)
+			if (strncmp (line, "VmData", 6) == 0)
 			{
 				data = tmp;
 			}
-			else if (strncmp (buffer, "VmLib", 5) == 0)
+			else if (strncmp (line, "VmLib", 5) == 0)
 			{
 				lib = tmp;
 			}
-			else if  (strncmp(buffer, "VmExe", 5) == 0)
+			else if  (strncmp(line, "VmExe", 5) == 0)
 			{
 				exe = tmp;
 			}
 		}
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (ps_next_line) */
 
 	ps->vmem_data = data * 1024;
 	ps->vmem_code = (exe + lib) * 1024;
@@ -853,37 +992,37 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_vmem */
 
-static procstat_t *ps_read_io (int pid, procstat_t *ps)
+static procstat_t *ps_read_io (int pid, procstat_t *ps, int *fd)
 {
-	FILE *fh;
 	char buffer[1024];
-	char filename[64];
+	char *next;
+	char *line;
 
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/io", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file (pid, "io", fd, buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	next = buffer;
+	while ((line = ps_next_line (&next)) != NULL)
 	{
 		derive_t *val = NULL;
 		long long tmp;
 		char *endptr;
 
-		if (strncasecmp (buffer, "rchar:", 6) == 0)
+		if (strncasecmp (line, "rchar:", 6) == 0)
 			val = &(ps->io_rchar);
-		else if (strncasecmp (buffer, "wchar:", 6) == 0)
+		else if (strncasecmp (line, "wchar:", 6) == 0)
 			val = &(ps->io_wchar);
-		else if (strncasecmp (buffer, "syscr:", 6) == 0)
+		else if (strncasecmp (line, "syscr:", 6) == 0)
 			val = &(ps->io_syscr);
-		else if (strncasecmp (buffer, "syscw:", 6) == 0)
+		else if (strncasecmp (line, "syscw:", 6) == 0)
 			val = &(ps->io_syscw);
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -896,21 +1035,17 @@ static procstat_t *ps_read_io (int pid, procstat_t *ps)
 			*val = -1;
 		else
 			*val = (derive_t) tmp;
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (ps_next_line) */
 
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-int ps_read_process (int pid, procstat_t *ps, char *state)
+/* Reads and parses /proc/<pid>/stat. The memory and I/O statistics from the
+ * "status" and "io" files are read separately by ps_read_vmem() and
+ * ps_read_io(), and only for processes which are actually reported. */
+static int ps_read_process (int pid, procstat_t *ps, char *state,
+		unsigned long long *starttime, int *fd)
 {
-	char  filename[64];
 	char  buffer[1024];
 
 	char *fields[64];
@@ -931,13 +1066,10 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 	memset (ps, 0, sizeof (procstat_t));
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", pid);
-
-	buffer_len = read_file_contents (filename,
-			buffer, sizeof(buffer) - 1);
+	buffer_len = (int) ps_read_file (pid, "stat", fd,
+			buffer, sizeof (buffer));
 	if (buffer_len <= 0)
 		return (-1);
-	buffer[buffer_len] = 0;
 
 	/* The name of the process is enclosed in parens. Since the name can
 	 * contain parens itself, spaces, numbers and pretty much everything
@@ -977,12 +1109,13 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	if (fields_len < 22)
 	{
 		DEBUG ("processes plugin: ps_read_process (pid = %i):"
-				" `%s' has only %i fields..",
-				(int) pid, filename, fields_len);
+				" `/proc/%i/stat' has only %i fields..",
+				(int) pid, (int) pid, fields_len);
 		return (-1);
 	}
 
 	*state = fields[0][0];
+	*starttime = strtoull (fields[19], /* endptr = */ NULL, /* base = */ 10);
 
 	if (*state == 'Z')
 	{
@@ -991,11 +1124,13 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 	else
 	{
-		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
-		{
-			/* returns -1 => kernel 2.4 */
+		/* "num_threads" is zero on kernel 2.4 */
+		ps->num_lwp = strtoul (fields[17], /* endptr = */ NULL,
+				/* base = */ 10);
+		if (ps->num_lwp < 1)
+			ps->num_lwp = ps_read_tasks (pid);
+		if ((int) ps->num_lwp < 1)
 			ps->num_lwp = 1;
-		}
 		ps->num_proc = 1;
 	}
 
@@ -1028,31 +1163,12 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	cpu_system_counter = cpu_system_counter * 1000000 / CONFIG_HZ;
 	vmem_rss = vmem_rss * pagesize_g;
 
-	if ( (ps_read_vmem(pid, ps)) == NULL)
-	{
-		/* No VMem data */
-		ps->vmem_data = -1;
-		ps->vmem_code = -1;
-		DEBUG("ps_read_process: did not get vmem data for pid %i",pid);
-	}
-
 	ps->cpu_user_counter = cpu_user_counter;
 	ps->cpu_system_counter = cpu_system_counter;
 	ps->vmem_size = (unsigned long) vmem_size;
 	ps->vmem_rss = (unsigned long) vmem_rss;
 	ps->stack_size = (unsigned long) stack_size;
 
-	if ( (ps_read_io (pid, ps)) == NULL)
-	{
-		/* no io data */
-		ps->io_rchar = -1;
-		ps->io_wchar = -1;
-		ps->io_syscr = -1;
-		ps->io_syscw = -1;
-
-		DEBUG("ps_read_process: not get io data for pid %i",pid);
-	}
-
 	/* success */
 	return (0);
 } /* int ps_read_process (...) */
@@ -1152,6 +1268,577 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 	return buf;
 } /* char *ps_get_cmdline (...) */
 
+static int ps_pid_compare (const void *a, const void *b)
+{
+	pid_t pa = *((const pid_t *) a);
+	pid_t pb = *((const pid_t *) b);
+
+	if (pa < pb)
+		return (-1);
+	else if (pa > pb)
+		return (1);
+	return (0);
+} /* int ps_pid_compare */
+
+static void ps_pid_close (ps_pid_t *entry)
+{
+	if (entry->stat_fd >= 0)
+		close (entry->stat_fd);
+	if (entry->status_fd >= 0)
+		close (entry->status_fd);
+	if (entry->io_fd >= 0)
+		close (entry->io_fd);
+	entry->stat_fd = entry->status_fd = entry->io_fd = -1;
+} /* void ps_pid_close */
+
+static void ps_pid_free (ps_pid_t *entry)
+{
+	if (entry == NULL)
+		return;
+
+	ps_pid_close (entry);
+	sfree (entry->matches);
+	sfree (entry);
+} /* void ps_pid_free */
+
+/* Determines the `Process' and `ProcessMatch' entries the process belongs
+ * to. The command line is only read if a regular expression needs it. */
+static void ps_pid_classify (ps_pid_t *entry, const char *name)
+{
+	char cmdline_buffer[CMDLINE_BUFFER_SIZE];
+	const char *cmdline = NULL;
+	_Bool have_cmdline = 0;
+	procstat_t *ps;
+
+	ps_pid_close (entry);
+	sfree (entry->matches);
+	entry->matches_num = 0;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+#if HAVE_REGEX_H
+		if ((ps->re != NULL) && !have_cmdline)
+		{
+			cmdline = ps_get_cmdline (entry->pid, (char *) name,
+					cmdline_buffer, sizeof (cmdline_buffer));
+			have_cmdline = 1;
+		}
+#endif
+
+		if (ps_list_match (name, cmdline, ps) == 0)
+			continue;
+
+		tmp = realloc (entry->matches,
+				(entry->matches_num + 1) * sizeof (*entry->matches));
+		if (tmp == NULL)
+		{
+			ERROR ("processes plugin: realloc failed.");
+			break;
+		}
+		entry->matches = tmp;
+		entry->matches[entry->matches_num] = ps;
+		entry->matches_num++;
+	}
+} /* void ps_pid_classify */
+
+/* Returns the cached state of process "pid", creating or resetting it if
+ * the process is new, has been replaced by another one with the same PID or
+ * has executed another program. */
+static ps_pid_t *ps_pid_get (pid_t pid, unsigned long long starttime,
+		const char *name, ps_pid_t *entry)
+{
+	if ((entry != NULL)
+			&& (entry->starttime == starttime)
+			&& (strncmp (entry->comm, name, sizeof (entry->comm) - 1) == 0))
+		return (entry);
+
+	if (entry == NULL)
+	{
+		entry = calloc (1, sizeof (*entry));
+		if (entry == NULL)
+		{
+			ERROR ("processes plugin: calloc failed.");
+			return (NULL);
+		}
+		entry->pid = pid;
+		entry->stat_fd = entry->status_fd = entry->io_fd = -1;
+
+		if (c_avl_insert (pids_g, &entry->pid, entry) != 0)
+		{
+			ERROR ("processes plugin: c_avl_insert failed.");
+			sfree (entry);
+			return (NULL);
+		}
+	}
+
+	entry->starttime = starttime;
+	sstrncpy (entry->comm, name, sizeof (entry->comm));
+	ps_pid_classify (entry, name);
+
+	return (entry);
+} /* ps_pid_t *ps_pid_get */
+
+/* Removes all processes which have not been seen during the current
+ * read. */
+static void ps_pid_expire (void)
+{
+	c_avl_iterator_t *iter;
+	pid_t *key;
+	ps_pid_t *entry;
+
+	pid_t *expired = NULL;
+	size_t expired_num = 0;
+	size_t expired_size = 0;
+	size_t i;
+
+	iter = c_avl_get_iterator (pids_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &entry) == 0)
+	{
+		if (entry->generation == pids_generation_g)
+			continue;
+
+		if (expired_num >= expired_size)
+		{
+			size_t new_size = (expired_size > 0) ? 2 * expired_size : 64;
+			pid_t *tmp = realloc (expired, new_size * sizeof (*expired));
+
+			if (tmp == NULL)
+				break;
+			expired = tmp;
+			expired_size = new_size;
+		}
+		expired[expired_num++] = entry->pid;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+	{
+		entry = NULL;
+		if (c_avl_remove (pids_g, &expired[i], NULL, (void *) &entry) == 0)
+			ps_pid_free (entry);
+	}
+	sfree (expired);
+} /* void ps_pid_expire */
+
+/* Reads the memory and I/O statistics of a matching process and adds it to
+ * the `Process' and `ProcessMatch' entries it belongs to. "ps" holds the
+ * data already read from /proc/<pid>/stat. */
+static void ps_pid_submit (ps_pid_t *entry, procstat_t *ps)
+{
+	procstat_entry_t pse;
+	size_t i;
+
+	if (ps->num_proc > 0)
+	{
+		if (ps_read_vmem (entry->pid, ps, &entry->status_fd) == NULL)
+		{
+			/* No VMem data */
+			ps->vmem_data = -1;
+			ps->vmem_code = -1;
+			DEBUG("ps_read_process: did not get vmem data for pid %i",entry->pid);
+		}
+
+		if (ps_read_io (entry->pid, ps, &entry->io_fd) == NULL)
+		{
+			/* no io data */
+			ps->io_rchar = -1;
+			ps->io_wchar = -1;
+			ps->io_syscr = -1;
+			ps->io_syscw = -1;
+
+			DEBUG("ps_read_process: not get io data for pid %i",entry->pid);
+		}
+	}
+
+	pse.id       = entry->pid;
+	pse.age      = 0;
+
+	pse.num_proc   = ps->num_proc;
+	pse.num_lwp    = ps->num_lwp;
+	pse.vmem_size  = ps->vmem_size;
+	pse.vmem_rss   = ps->vmem_rss;
+	pse.vmem_data  = ps->vmem_data;
+	pse.vmem_code  = ps->vmem_code;
+	pse.stack_size = ps->stack_size;
+
+	pse.vmem_minflt = 0;
+	pse.vmem_minflt_counter = ps->vmem_minflt_counter;
+	pse.vmem_majflt = 0;
+	pse.vmem_majflt_counter = ps->vmem_majflt_counter;
+
+	pse.cpu_user = 0;
+	pse.cpu_user_counter = ps->cpu_user_counter;
+	pse.cpu_system = 0;
+	pse.cpu_system_counter = ps->cpu_system_counter;
+
+	pse.io_rchar = ps->io_rchar;
+	pse.io_wchar = ps->io_wchar;
+	pse.io_syscr = ps->io_syscr;
+	pse.io_syscw = ps->io_syscw;
+
+	for (i = 0; i < entry->matches_num; i++)
+		ps_list_add_entry (entry->matches[i], &pse);
+} /* void ps_pid_submit */
+
+/* Reads every process that is reported, without scanning /proc. Processes
+ * which have vanished are removed by the next ps_pid_expire(). */
+static void ps_pid_read_matched (void)
+{
+	c_avl_iterator_t *iter;
+	pid_t *key;
+	ps_pid_t *entry;
+
+	iter = c_avl_get_iterator (pids_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &entry) == 0)
+	{
+		procstat_t ps;
+		char state;
+		unsigned long long starttime;
+
+		if (entry->matches_num == 0)
+		{
+			entry->generation = pids_generation_g;
+			continue;
+		}
+
+		if ((ps_read_process (entry->pid, &ps, &state, &starttime,
+						&entry->stat_fd) != 0)
+				&& (ps_read_process (entry->pid, &ps, &state, &starttime,
+						/* fd = */ NULL) != 0))
+			continue;
+
+		/* does not insert into the tree, so iterating is still safe */
+		if (ps_pid_get (entry->pid, starttime, ps.name, entry) == NULL)
+			continue;
+		entry->generation = pids_generation_g;
+
+		if (entry->matches_num > 0)
+			ps_pid_submit (entry, &ps);
+	}
+	c_avl_iterator_destroy (iter);
+} /* void ps_pid_read_matched */
+
+#if HAVE_LINUX_CN_PROC_H
+/* Called by the connector thread with ps_cn_lock held. */
+static void ps_cn_queue (int what, pid_t pid)
+{
+	if (ps_cn_rescan)
+		return;
+
+	if (ps_cn_events_num >= ps_cn_events_size)
+	{
+		size_t new_size = (ps_cn_events_size > 0)
+			? 2 * ps_cn_events_size : 1024;
+		ps_cn_event_t *tmp;
+
+		if (new_size > PS_CN_QUEUE_MAX)
+		{
+			/* Give up on this batch and read everything instead. */
+			ps_cn_rescan = 1;
+			ps_cn_events_num = 0;
+			return;
+		}
+
+		tmp = realloc (ps_cn_events, new_size * sizeof (*ps_cn_events));
+		if (tmp == NULL)
+		{
+			ps_cn_rescan = 1;
+			ps_cn_events_num = 0;
+			return;
+		}
+		ps_cn_events = tmp;
+		ps_cn_events_size = new_size;
+	}
+
+	ps_cn_events[ps_cn_events_num].what = what;
+	ps_cn_events[ps_cn_events_num].pid = pid;
+	ps_cn_events_num++;
+} /* void ps_cn_queue */
+
+static void *ps_cn_thread_main (void __attribute__((unused)) *arg)
+{
+	/* netlink messages are aligned to 4 bytes */
+	uint32_t buffer[2048];
+
+	while (ps_cn_thread_loop != 0)
+	{
+		struct pollfd pfd;
+		struct nlmsghdr *nlh;
+		ssize_t len;
+		int status;
+
+		memset (&pfd, 0, sizeof (pfd));
+		pfd.fd = ps_cn_sock;
+		pfd.events = POLLIN;
+
+		/* wake up once a second to notice the shutdown */
+		status = poll (&pfd, 1, /* timeout = */ 1000);
+		if (status <= 0)
+			continue;
+
+		len = recv (ps_cn_sock, buffer, sizeof (buffer), /* flags = */ 0);
+		if (len < 0)
+		{
+			/* ENOBUFS: the socket's buffer overflowed, events are lost */
+			if (errno == ENOBUFS)
+			{
+				pthread_mutex_lock (&ps_cn_lock);
+				ps_cn_rescan = 1;
+				ps_cn_events_num = 0;
+				pthread_mutex_unlock (&ps_cn_lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock (&ps_cn_lock);
+		for (nlh = (struct nlmsghdr *) buffer;
+				NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			struct cn_msg *cn;
+			struct proc_event event;
+			struct proc_event *ev = &event;
+
+			if ((nlh->nlmsg_type == NLMSG_ERROR)
+					|| (nlh->nlmsg_type == NLMSG_OVERRUN))
+			{
+				ps_cn_rescan = 1;
+				ps_cn_events_num = 0;
+				continue;
+			}
+			if (nlh->nlmsg_type != NLMSG_DONE)
+				continue;
+
+			cn = NLMSG_DATA (nlh);
+			if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+				continue;
+			/* cn->data is not suitably aligned for struct proc_event */
+			memset (&event, 0, sizeof (event));
+			memcpy (&event, cn->data, (cn->len < sizeof (event))
+					? cn->len : sizeof (event));
+
+			switch (ev->what)
+			{
+				case PROC_EVENT_FORK:
+					/* like the "processes" line of /proc/stat, this
+					 * counts new threads, too */
+					ps_cn_forks++;
+					if (ev->event_data.fork.child_pid
+							== ev->event_data.fork.child_tgid)
+						ps_cn_queue (PROC_EVENT_FORK,
+								ev->event_data.fork.child_tgid);
+					break;
+
+				case PROC_EVENT_EXEC:
+					ps_cn_queue (PROC_EVENT_EXEC,
+							ev->event_data.exec.process_tgid);
+					break;
+
+				case PROC_EVENT_EXIT:
+					if (ev->event_data.exit.process_pid
+							== ev->event_data.exit.process_tgid)
+						ps_cn_queue (PROC_EVENT_EXIT,
+								ev->event_data.exit.process_tgid);
+					break;
+
+				default:
+					break;
+			}
+		}
+		pthread_mutex_unlock (&ps_cn_lock);
+	} /* while (ps_cn_thread_loop != 0) */
+
+	return ((void *) 0);
+} /* void *ps_cn_thread_main */
+
+static int ps_cn_send_op (enum proc_cn_mcast_op op)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct cn_msg msg;
+		enum proc_cn_mcast_op op;
+	} __attribute__((packed)) req;
+
+	memset (&req, 0, sizeof (req));
+	req.hdr.nlmsg_len = sizeof (req);
+	req.hdr.nlmsg_type = NLMSG_DONE;
+	req.hdr.nlmsg_pid = getpid ();
+	req.msg.id.idx = CN_IDX_PROC;
+	req.msg.id.val = CN_VAL_PROC;
+	req.msg.len = sizeof (req.op);
+	req.op = op;
+
+	if (send (ps_cn_sock, &req, sizeof (req), /* flags = */ 0) < 0)
+		return (-1);
+	return (0);
+} /* int ps_cn_send_op */
+
+static int ps_cn_start (void)
+{
+	struct sockaddr_nl addr;
+	char errbuf[1024];
+	int status;
+
+	ps_cn_sock = socket (PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+			NETLINK_CONNECTOR);
+	if (ps_cn_sock < 0)
+	{
+		ERROR ("processes plugin: Opening the netlink connector socket "
+				"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
+
+	if ((bind (ps_cn_sock, (struct sockaddr *) &addr, sizeof (addr)) != 0)
+			|| (ps_cn_send_op (PROC_CN_MCAST_LISTEN) != 0))
+	{
+		ERROR ("processes plugin: Subscribing to process events failed "
+				"(this requires CAP_NET_ADMIN): %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (ps_cn_sock);
+		ps_cn_sock = -1;
+		return (-1);
+	}
+
+	ps_cn_thread_loop = 1;
+	status = plugin_thread_create (&ps_cn_thread, /* attr = */ NULL,
+			ps_cn_thread_main, /* arg = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("processes plugin: plugin_thread_create failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		ps_cn_thread_loop = 0;
+		close (ps_cn_sock);
+		ps_cn_sock = -1;
+		return (-1);
+	}
+	ps_cn_thread_running = 1;
+
+	return (0);
+} /* int ps_cn_start */
+
+static void ps_cn_stop (void)
+{
+	if (ps_cn_thread_running)
+	{
+		ps_cn_thread_loop = 0;
+		pthread_join (ps_cn_thread, /* retval = */ NULL);
+		ps_cn_thread_running = 0;
+	}
+
+	if (ps_cn_sock >= 0)
+	{
+		ps_cn_send_op (PROC_CN_MCAST_IGNORE);
+		close (ps_cn_sock);
+		ps_cn_sock = -1;
+	}
+
+	sfree (ps_cn_events);
+	ps_cn_events_num = 0;
+	ps_cn_events_size = 0;
+} /* void ps_cn_stop */
+
+/* Applies the queued process events to "pids_g". Returns non-zero if events
+ * have been lost and /proc has to be scanned instead. */
+static int ps_cn_apply (derive_t *forks)
+{
+	ps_cn_event_t *events;
+	size_t events_num;
+	size_t i;
+
+	pthread_mutex_lock (&ps_cn_lock);
+	*forks = ps_cn_forks;
+	if (ps_cn_rescan)
+	{
+		/* Events arriving from now on are newer than the scan. */
+		ps_cn_rescan = 0;
+		ps_cn_events_num = 0;
+		pthread_mutex_unlock (&ps_cn_lock);
+		return (-1);
+	}
+	events = ps_cn_events;
+	events_num = ps_cn_events_num;
+	ps_cn_events = NULL;
+	ps_cn_events_num = 0;
+	ps_cn_events_size = 0;
+	pthread_mutex_unlock (&ps_cn_lock);
+
+	for (i = 0; i < events_num; i++)
+	{
+		pid_t pid = events[i].pid;
+		ps_pid_t *entry = NULL;
+		procstat_t ps;
+		char state;
+		unsigned long long starttime;
+
+		c_avl_get (pids_g, &pid, (void *) &entry);
+
+		if (events[i].what == PROC_EVENT_EXIT)
+		{
+			if ((entry != NULL)
+					&& (c_avl_remove (pids_g, &pid, NULL, NULL) == 0))
+				ps_pid_free (entry);
+			continue;
+		}
+
+		/* PROC_EVENT_FORK or PROC_EVENT_EXEC. The process may be gone
+		 * already; its exit event follows. */
+		if (ps_read_process (pid, &ps, &state, &starttime,
+					/* fd = */ NULL) != 0)
+			continue;
+
+		entry = ps_pid_get (pid, starttime, ps.name, entry);
+
+		/* The command line changes on exec(2), even if the name doesn't. */
+		if ((entry != NULL) && (events[i].what == PROC_EVENT_EXEC))
+			ps_pid_classify (entry, ps.name);
+	}
+
+	sfree (events);
+	return (0);
+} /* int ps_cn_apply */
+
+/* Submits the states which can be determined without reading every process.
+ * Note that the kernel counts threads here, not processes. */
+static void ps_cn_submit_states (void)
+{
+	char buffer[8192];
+	char *next;
+	char *line;
+	ssize_t len;
+
+	len = read_file_contents ("/proc/stat", buffer, sizeof (buffer) - 1);
+	if (len <= 0)
+		return;
+	buffer[len] = 0;
+
+	next = buffer;
+	while ((line = ps_next_line (&next)) != NULL)
+	{
+		char *fields[3];
+		value_t value;
+
+		if (strncmp (line, "procs_", 6) != 0)
+			continue;
+
+		if ((strsplit (line, fields, STATIC_ARRAY_SIZE (fields)) != 2)
+				|| (parse_value (fields[1], &value, DS_TYPE_GAUGE) != 0))
+			continue;
+
+		if (strcmp (fields[0], "procs_running") == 0)
+			ps_submit_state ("running", value.gauge);
+		else if (strcmp (fields[0], "procs_blocked") == 0)
+			ps_submit_state ("blocked", value.gauge);
+	}
+} /* void ps_cn_submit_states */
+#endif /* HAVE_LINUX_CN_PROC_H */
+
 static int read_fork_rate ()
 {
 	FILE *proc_stat;
@@ -1690,18 +2377,56 @@ static int ps_read (void)
 	DIR           *proc;
 	int            pid;
 
-	char cmdline[CMDLINE_BUFFER_SIZE];
-
 	int        status;
 	procstat_t ps;
-	procstat_entry_t pse;
 	char       state;
+	unsigned long long starttime;
 
 	procstat_t *ps_ptr;
 
 	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
 
+	if (pids_g == NULL)
+	{
+		pids_g = c_avl_create (ps_pid_compare);
+		if (pids_g == NULL)
+		{
+			ERROR ("processes plugin: c_avl_create failed.");
+			return (-1);
+		}
+	}
+	pids_generation_g++;
+
+#if HAVE_LINUX_CN_PROC_H
+	/* Started here rather than in ps_init, so the first read scans /proc
+	 * completely while events are already being received. */
+	if (ps_cn_enabled && !ps_cn_thread_running && (ps_cn_start () != 0))
+	{
+		WARNING ("processes plugin: Falling back to reading /proc "
+				"without process events.");
+		ps_cn_enabled = 0;
+	}
+
+	if (ps_cn_enabled)
+	{
+		derive_t forks = 0;
+
+		if (ps_cn_apply (&forks) == 0)
+		{
+			ps_pid_read_matched ();
+			ps_pid_expire ();
+
+			ps_cn_submit_states ();
+			for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+				ps_submit_proc_list (ps_ptr);
+			ps_submit_fork_rate (forks);
+			return (0);
+		}
+		/* else: events have been lost, fall through to read everything */
+	}
+#endif
+
 	if ((proc = opendir ("/proc")) == NULL)
 	{
 		char errbuf[1024];
@@ -1712,45 +2437,29 @@ static int ps_read (void)
 
 	while ((ent = readdir (proc)) != NULL)
 	{
+		ps_pid_t *entry = NULL;
+
 		if (!isdigit (ent->d_name[0]))
 			continue;
 
 		if ((pid = atoi (ent->d_name)) < 1)
 			continue;
 
-		status = ps_read_process (pid, &ps, &state);
+		/* Only processes which are reported keep their files open. */
+		c_avl_get (pids_g, &pid, (void *) &entry);
+		status = ps_read_process (pid, &ps, &state, &starttime,
+				((entry != NULL) && (entry->matches_num > 0))
+				? &entry->stat_fd : NULL);
+		/* The file descriptor kept open belongs to a process which has
+		 * exited. The PID may have been reused already. */
+		if ((status != 0) && (entry != NULL) && (entry->matches_num > 0))
+			status = ps_read_process (pid, &ps, &state, &starttime, NULL);
 		if (status != 0)
 		{
 			DEBUG ("ps_read_process failed: %i", status);
 			continue;
 		}
 
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
-
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
-
 		switch (state)
 		{
 			case 'R': running++;  break;
@@ -1761,13 +2470,37 @@ static int ps_read (void)
 			case 'W': paging++;   break;
 		}
 
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
+		entry = ps_pid_get (pid, starttime, ps.name, entry);
+		if (entry == NULL)
+			continue;
+		entry->generation = pids_generation_g;
+
+		if (entry->matches_num > 0)
+			ps_pid_submit (entry, &ps);
 	}
 
 	closedir (proc);
 
+	ps_pid_expire ();
+
+#if HAVE_LINUX_CN_PROC_H
+	if (ps_cn_enabled)
+	{
+		derive_t forks;
+
+		/* Report the same set of values as when applying events. */
+		ps_cn_submit_states ();
+		for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+			ps_submit_proc_list (ps_ptr);
+
+		pthread_mutex_lock (&ps_cn_lock);
+		forks = ps_cn_forks;
+		pthread_mutex_unlock (&ps_cn_lock);
+		ps_submit_fork_rate (forks);
+		return (0);
+	}
+#endif
+
 	ps_submit_state ("running",  running);
 	ps_submit_state ("sleeping", sleeping);
 	ps_submit_state ("zombies",  zombies);
@@ -2305,9 +3038,34 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+#if KERNEL_LINUX
+static int ps_shutdown (void)
+{
+	pid_t *key;
+	ps_pid_t *entry;
+
+#if HAVE_LINUX_CN_PROC_H
+	ps_cn_stop ();
+#endif
+
+	if (pids_g == NULL)
+		return (0);
+
+	while (c_avl_pick (pids_g, (void *) &key, (void *) &entry) == 0)
+		ps_pid_free (entry);
+	c_avl_destroy (pids_g);
+	pids_g = NULL;
+
+	return (0);
+} /* int ps_shutdown */
+#endif /* KERNEL_LINUX */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("processes", ps_shutdown);
+#endif
 } /* void module_register */
@@ -28,6 +28,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -48,6 +49,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *values_list = NULL;
 
+static procfile_t *snmp_file = NULL;
+static procfile_t *netstat_file = NULL;
+
 /* 
  * Functions
  */
@@ -77,57 +81,53 @@ static void submit (const char *protocol_name,
   plugin_dispatch_values (&vl);
 } /* void submit */
 
-static int read_file (const char *path)
+static int read_file (procfile_t **pf, const char *path)
 {
-  FILE *fh;
-  char key_buffer[4096];
-  char value_buffer[4096];
+  char *key_buffer;
+  char *value_buffer;
   char *key_ptr;
   char *value_ptr;
   char *key_fields[256];
   char *value_fields[256];
   int key_fields_num;
   int value_fields_num;
+  size_t lines_num;
+  size_t line;
   int status;
   int i;
 
-  fh = fopen (path, "r");
-  if (fh == NULL)
+  if (*pf == NULL)
   {
-    ERROR ("protocols plugin: fopen (%s) failed: %s.",
-        path, sstrerror (errno, key_buffer, sizeof (key_buffer)));
-    return (-1);
+    *pf = procfile_open (path);
+    if (*pf == NULL)
+    {
+      char errbuf[1024];
+      ERROR ("protocols plugin: open (%s) failed: %s.",
+          path, sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
   }
 
-  status = -1;
-  while (42)
+  status = procfile_read (*pf);
+  if (status != 0)
   {
-    clearerr (fh);
-    key_ptr = fgets (key_buffer, sizeof (key_buffer), fh);
-    if (key_ptr == NULL)
-    {
-      if (feof (fh) != 0)
-      {
-        status = 0;
-        break;
-      }
-      else if (ferror (fh) != 0)
-      {
-        ERROR ("protocols plugin: Reading from %s failed.", path);
-        break;
-      }
-      else
-      {
-        ERROR ("protocols plugin: fgets failed for an unknown reason.");
-        break;
-      }
-    } /* if (key_ptr == NULL) */
+    char errbuf[1024];
+    ERROR ("protocols plugin: Reading from %s failed: %s.",
+        path, sstrerror (status, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
 
-    value_ptr = fgets (value_buffer, sizeof (value_buffer), fh);
-    if (value_ptr == NULL)
+  lines_num = procfile_lines_num (*pf);
+  status = 0;
+  for (line = 0; line < lines_num; line += 2)
+  {
+    key_buffer = procfile_line (*pf, line);
+    value_buffer = procfile_line (*pf, line + 1);
+    if (value_buffer == NULL)
     {
       ERROR ("protocols plugin: read_file (%s): Could not read values line.",
           path);
+      status = -1;
       break;
     }
 
@@ -135,6 +135,7 @@ static int read_file (const char *path)
     if (key_ptr == NULL)
     {
       ERROR ("protocols plugin: Could not find protocol name in keys line.");
+      status = -1;
       break;
     }
     *key_ptr = 0;
@@ -145,6 +146,7 @@ static int read_file (const char *path)
     {
       ERROR ("protocols plugin: Could not find protocol name "
           "in values line.");
+      status = -1;
       break;
     }
     *value_ptr = 0;
@@ -155,13 +157,14 @@ static int read_file (const char *path)
       ERROR ("protocols plugin: Protocol names in keys and values lines "
           "don't match: `%s' vs. `%s'.",
           key_buffer, value_buffer);
+      status = -1;
       break;
     }
 
 
-    key_fields_num = strsplit (key_ptr,
+    key_fields_num = procfile_split (key_ptr,
         key_fields, STATIC_ARRAY_SIZE (key_fields));
-    value_fields_num = strsplit (value_ptr,
+    value_fields_num = procfile_split (value_ptr,
         value_fields, STATIC_ARRAY_SIZE (value_fields));
 
     if (key_fields_num != value_fields_num)
@@ -169,6 +172,7 @@ static int read_file (const char *path)
       ERROR ("protocols plugin: Number of fields in keys and values lines "
           "don't match: %i vs %i.",
           key_fields_num, value_fields_num);
+      status = -1;
       break;
     }
 
@@ -187,9 +191,7 @@ static int read_file (const char *path)
 
       submit (key_buffer, key_fields[i], value_fields[i]);
     } /* for (i = 0; i < key_fields_num; i++) */
-  } /* while (42) */
-
-  fclose (fh);
+  } /* for (line = 0; line < lines_num; line += 2) */
 
   return (status);
 } /* int read_file */
@@ -199,11 +201,11 @@ static int protocols_read (void)
   int status;
   int success = 0;
 
-  status = read_file (SNMP_FILE);
+  status = read_file (&snmp_file, SNMP_FILE);
   if (status == 0)
     success++;
 
-  status = read_file (NETSTAT_FILE);
+  status = read_file (&netstat_file, NETSTAT_FILE);
   if (status == 0)
     success++;
 
@@ -213,6 +215,16 @@ static int protocols_read (void)
   return (0);
 } /* int protocols_read */
 
+static int protocols_shutdown (void)
+{
+  procfile_close (snmp_file);
+  snmp_file = NULL;
+  procfile_close (netstat_file);
+  netstat_file = NULL;
+
+  return (0);
+} /* int protocols_shutdown */
+
 static int protocols_config (const char *key, const char *value)
 {
   if (values_list == NULL)
@@ -242,6 +254,7 @@ void module_register (void)
   plugin_register_config ("protocols", protocols_config,
       config_keys, config_keys_num);
   plugin_register_read ("protocols", protocols_read);
+  plugin_register_shutdown ("protocols", protocols_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et : */
@@ -27,8 +27,14 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "configfile.h"
 #include "utils_rrdcreate.h"
 
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
@@ -72,7 +78,13 @@ static int value_list_to_string (char *buffer, int buffer_len,
   int i;
   time_t t;
 
-  assert (0 == strcmp (ds->type, vl->type));
+  if (0 != strcmp (ds->type, vl->type))
+  {
+    ERROR ("rrdcached plugin: value_list_to_string: "
+        "Data set type (%s) and value list type (%s) differ.",
+        ds->type, vl->type);
+    return (-1);
+  }
 
   memset (buffer, '\0', buffer_len);
 
@@ -146,7 +158,8 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
     return (status);
 
   len = strlen (buffer);
-  assert (len < buffer_size);
+  if (len >= buffer_size)
+    return (ENOMEM);
   buffer += len;
   buffer_size -= len;
 
@@ -157,6 +170,594 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
   return (0);
 } /* int value_list_to_filename */
 
+/*
+ * Pipelined client
+ *
+ * When "BatchSize" is set, updates are not sent with "rrdc_update" one at a
+ * time but collected in a buffer and sent as one "BATCH" command over a
+ * connection of our own. The buffer always starts with the "BATCH" line so it
+ * can be written with a single call; rrdcached answers with one line
+ * acknowledging the command and one summary line, followed by one line per
+ * failed update.
+ */
+#define RC_BATCH_HEADER "BATCH\n"
+#define RC_BATCH_FOOTER ".\n"
+#define RC_DEFAULT_PORT "42217"
+
+/* Batches waiting for the connection; older batches are dropped beyond
+ * this. */
+#define RC_BATCH_QUEUE_MAX 16
+
+/* rrdcached's rejection of an update that isn't newer than the last one.
+ * Sending such an update again would fail the same way. */
+#define RC_TOO_OLD_MESSAGE "illegal attempt to update"
+
+struct rc_batch_s;
+typedef struct rc_batch_s rc_batch_t;
+struct rc_batch_s
+{
+  char *buffer;
+  size_t size;
+  size_t fill;
+  int updates_num;
+
+  rc_batch_t *next;
+};
+
+static int batch_size = 0;
+static cdtime_t batch_timeout = 0;
+static _Bool batch_is_local = 0;
+static char batch_cwd[PATH_MAX];
+
+/* Updates are collected in "batch". Full batches are moved to the queue and
+ * sent by whichever thread holds "send_lock", so writers are not held up by
+ * a slow or unreachable daemon. */
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static rc_batch_t batch = { NULL, 0, 0, 0, NULL };
+static cdtime_t batch_first_update = 0;
+static rc_batch_t *batch_queue_head = NULL;
+static rc_batch_t *batch_queue_tail = NULL;
+static int batch_queue_len = 0;
+
+/* Protects the connection. */
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+static int batch_fd = -1;
+static FILE *batch_fh = NULL;
+
+static void rc_batch_disconnect (void) /* {{{ */
+{
+  if (batch_fh != NULL)
+    fclose (batch_fh); /* also closes batch_fd */
+  else if (batch_fd >= 0)
+    close (batch_fd);
+
+  batch_fh = NULL;
+  batch_fd = -1;
+} /* }}} void rc_batch_disconnect */
+
+static int rc_batch_connect_unix (const char *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  int fd;
+
+  if (strlen (path) >= sizeof (sa.sun_path))
+  {
+    ERROR ("rrdcached plugin: Socket path \"%s\" is too long.", path);
+    return (-1);
+  }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, path, sizeof (sa.sun_path));
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return (-1);
+
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: connect (%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+
+  return (fd);
+} /* }}} int rc_batch_connect_unix */
+
+static int rc_batch_connect_inet (const char *address) /* {{{ */
+{
+  char host[NI_MAXHOST];
+  const char *port = RC_DEFAULT_PORT;
+  char *ptr;
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  int fd = -1;
+  int status;
+
+  /* Accepted forms are "host", "host:port", "[v6addr]" and "[v6addr]:port",
+   * just like librrd's client. */
+  if (address[0] == '[')
+  {
+    sstrncpy (host, address + 1, sizeof (host));
+    ptr = strchr (host, ']');
+    if (ptr == NULL)
+    {
+      ERROR ("rrdcached plugin: Unable to parse address \"%s\".", address);
+      return (-1);
+    }
+    *ptr = 0;
+    ptr = strchr (address, ']') + 1;
+    if (*ptr == ':')
+      port = ptr + 1;
+  }
+  else
+  {
+    sstrncpy (host, address, sizeof (host));
+    ptr = strchr (host, ':');
+    if ((ptr != NULL) && (strchr (ptr + 1, ':') == NULL))
+    {
+      *ptr = 0;
+      port = ptr + 1;
+    }
+  }
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_flags = AI_ADDRCONFIG;
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  status = getaddrinfo (host, port, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: getaddrinfo (%s, %s) failed: %s",
+        host, port, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+      break;
+
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (fd < 0)
+    ERROR ("rrdcached plugin: Connecting to %s:%s failed.", host, port);
+
+  return (fd);
+} /* }}} int rc_batch_connect_inet */
+
+static int rc_batch_connect (void) /* {{{ */
+{
+  if (batch_fd >= 0)
+    return (0);
+
+  if (strncmp ("unix:", daemon_address, strlen ("unix:")) == 0)
+    batch_fd = rc_batch_connect_unix (daemon_address + strlen ("unix:"));
+  else if (daemon_address[0] == '/')
+    batch_fd = rc_batch_connect_unix (daemon_address);
+  else
+    batch_fd = rc_batch_connect_inet (daemon_address);
+
+  if (batch_fd < 0)
+    return (-1);
+
+  batch_fh = fdopen (batch_fd, "r");
+  if (batch_fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: fdopen failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    rc_batch_disconnect ();
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_batch_connect */
+
+/* Reads one response line and returns its numeric status. */
+static int rc_batch_read_response (char *buffer, size_t buffer_size) /* {{{ */
+{
+  char *endptr = NULL;
+  long status;
+
+  if (fgets (buffer, (int) buffer_size, batch_fh) == NULL)
+  {
+    ERROR ("rrdcached plugin: Reading the response from %s failed.",
+        daemon_address);
+    return (-1);
+  }
+  strstripnewline (buffer);
+
+  errno = 0;
+  status = strtol (buffer, &endptr, 10);
+  if ((errno != 0) || (endptr == buffer))
+  {
+    ERROR ("rrdcached plugin: Unable to parse response \"%s\".", buffer);
+    return (-1);
+  }
+
+  return ((int) status);
+} /* }}} int rc_batch_read_response */
+
+/* Writes the updates of "b" and reads the results. Returns zero if the batch
+ * was processed, even if rrdcached rejected some of the updates. The numbers
+ * of the rejected updates are reported as "<line> <message>", starting at
+ * one; if "failed" is not NULL, the corresponding elements are set to one,
+ * unless the update was rejected for being too old. Returns EAGAIN if the
+ * daemon did not acknowledge the BATCH command, i.e. none of the updates
+ * have been applied and the batch may be sent again, and -1 if the
+ * connection failed after the daemon started processing updates. Must be
+ * called with "send_lock" held. */
+static int rc_batch_send_once (rc_batch_t const *b, char *failed) /* {{{ */
+{
+  char response[1024];
+  _Bool write_failed = 0;
+  int errors_num;
+  int status;
+  int i;
+
+  if (rc_batch_connect () != 0)
+    return (EAGAIN);
+
+  status = (int) swrite (batch_fd, b->buffer, b->fill);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: Sending the batch to %s failed: %s",
+        daemon_address, sstrerror (errno, errbuf, sizeof (errbuf)));
+    write_failed = 1;
+  }
+
+  /* "0 Go ahead.  End with dot '.' on its own line." rrdcached sends this
+   * before reading any of the updates, so even if writing failed, the
+   * acknowledgement tells us whether some of them may have been applied. */
+  status = rc_batch_read_response (response, sizeof (response));
+  if (status < 0)
+    return (EAGAIN);
+  else if (status > 0)
+  {
+    ERROR ("rrdcached plugin: BATCH command failed: %s", response);
+    return (-1);
+  }
+
+  if (write_failed)
+    return (-1);
+
+  /* "<N> errors", followed by "<line> <message>" for each failed update. */
+  errors_num = rc_batch_read_response (response, sizeof (response));
+  if (errors_num < 0)
+    return (-1);
+
+  for (i = 0; i < errors_num; i++)
+  {
+    char *message = NULL;
+    long line;
+
+    if (fgets (response, sizeof (response), batch_fh) == NULL)
+      return (-1);
+    strstripnewline (response);
+
+    if (i == 0)
+      WARNING ("rrdcached plugin: %i of %i updates failed. "
+          "First error: %s", errors_num, b->updates_num, response);
+
+    line = strtol (response, &message, 10);
+    if ((failed != NULL) && (line > 0) && (line <= b->updates_num)
+        && (strstr (message, RC_TOO_OLD_MESSAGE) == NULL))
+      failed[line - 1] = 1;
+  }
+
+  return (0);
+} /* }}} int rc_batch_send_once */
+
+/* Removes all updates from "b" for which "failed" is not set and returns the
+ * number of remaining updates. Expects the footer to be in place. */
+static int rc_batch_keep_failed (rc_batch_t *b, char const *failed) /* {{{ */
+{
+  size_t read_pos = strlen (RC_BATCH_HEADER);
+  size_t write_pos = read_pos;
+  size_t end = b->fill - strlen (RC_BATCH_FOOTER);
+  int updates_num = 0;
+  int i;
+
+  for (i = 0; (i < b->updates_num) && (read_pos < end); i++)
+  {
+    char *eol = memchr (b->buffer + read_pos, '\n', end - read_pos);
+    size_t len = (eol != NULL)
+      ? (size_t) (eol - (b->buffer + read_pos)) + 1
+      : end - read_pos;
+
+    if (failed[i])
+    {
+      memmove (b->buffer + write_pos, b->buffer + read_pos, len);
+      write_pos += len;
+      updates_num++;
+    }
+    read_pos += len;
+  }
+
+  memcpy (b->buffer + write_pos, RC_BATCH_FOOTER, strlen (RC_BATCH_FOOTER));
+  b->fill = write_pos + strlen (RC_BATCH_FOOTER);
+  b->updates_num = updates_num;
+
+  return (updates_num);
+} /* }}} int rc_batch_keep_failed */
+
+/* Sends the updates of "b". Must be called with "send_lock" held. */
+static int rc_batch_send (rc_batch_t *b) /* {{{ */
+{
+  char *failed;
+  int status;
+
+  /* If this fails, rejected updates are simply not retried. */
+  failed = calloc ((size_t) b->updates_num, sizeof (*failed));
+
+  status = rc_batch_send_once (b, failed);
+  if (status == EAGAIN)
+  {
+    /* The daemon may have closed an idle connection. None of the updates
+     * have been applied, so try once more with a fresh one. */
+    rc_batch_disconnect ();
+    status = rc_batch_send_once (b, failed);
+  }
+
+  if (status != 0)
+  {
+    if (status == EAGAIN)
+      ERROR ("rrdcached plugin: Dropping %i updates.", b->updates_num);
+    else
+      ERROR ("rrdcached plugin: Dropping %i updates, some of which may have "
+          "been applied.", b->updates_num);
+    rc_batch_disconnect ();
+  }
+  else if ((failed != NULL) && (rc_batch_keep_failed (b, failed) > 0))
+  {
+    /* Give the rejected updates a second chance. The ones that were
+     * accepted must not be sent again, since rrdcached would either apply
+     * them twice or reject them as being too old. */
+    status = rc_batch_send_once (b, /* failed = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("rrdcached plugin: Dropping %i updates.", b->updates_num);
+      rc_batch_disconnect ();
+    }
+  }
+
+  sfree (failed);
+  return ((status == 0) ? 0 : -1);
+} /* }}} int rc_batch_send */
+
+static void rc_batch_free (rc_batch_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
+  sfree (b->buffer);
+  sfree (b);
+} /* }}} void rc_batch_free */
+
+/* Moves the pending updates to the send queue. Must be called with
+ * "batch_lock" held. */
+static void rc_batch_enqueue (void) /* {{{ */
+{
+  rc_batch_t *b;
+
+  if (batch.updates_num == 0)
+    return;
+
+  /* rc_batch_append() leaves room for the footer. */
+  if ((batch.size - batch.fill) < strlen (RC_BATCH_FOOTER))
+  {
+    ERROR ("rrdcached plugin: No room for the end of the batch. "
+        "Dropping %i updates.", batch.updates_num);
+    sfree (batch.buffer);
+    memset (&batch, 0, sizeof (batch));
+    batch_first_update = 0;
+    return;
+  }
+  memcpy (batch.buffer + batch.fill, RC_BATCH_FOOTER,
+      strlen (RC_BATCH_FOOTER));
+  batch.fill += strlen (RC_BATCH_FOOTER);
+
+  b = malloc (sizeof (*b));
+  if (b == NULL)
+  {
+    ERROR ("rrdcached plugin: malloc failed. Dropping %i updates.",
+        batch.updates_num);
+    sfree (batch.buffer);
+  }
+  else
+  {
+    *b = batch;
+    b->next = NULL;
+    if (batch_queue_tail == NULL)
+      batch_queue_head = b;
+    else
+      batch_queue_tail->next = b;
+    batch_queue_tail = b;
+    batch_queue_len++;
+  }
+  memset (&batch, 0, sizeof (batch));
+  batch_first_update = 0;
+
+  while (batch_queue_len > RC_BATCH_QUEUE_MAX)
+  {
+    b = batch_queue_head;
+    batch_queue_head = b->next;
+    batch_queue_len--;
+
+    ERROR ("rrdcached plugin: Too many batches are waiting for %s. "
+        "Dropping %i updates.", daemon_address, b->updates_num);
+    rc_batch_free (b);
+  }
+} /* }}} void rc_batch_enqueue */
+
+/* Sends the queued batches in order. Only one thread sends at a time: unless
+ * "wait" is true, the call returns right away if another thread is sending,
+ * since that thread will send the queued batches, too. */
+static int rc_batch_send_queued (_Bool wait) /* {{{ */
+{
+  int status = 0;
+  _Bool empty;
+
+  do
+  {
+    if (wait)
+      pthread_mutex_lock (&send_lock);
+    else if (pthread_mutex_trylock (&send_lock) != 0)
+      return (0);
+
+    while (42)
+    {
+      rc_batch_t *b;
+
+      pthread_mutex_lock (&batch_lock);
+      b = batch_queue_head;
+      if (b != NULL)
+      {
+        batch_queue_head = b->next;
+        if (batch_queue_head == NULL)
+          batch_queue_tail = NULL;
+        batch_queue_len--;
+      }
+      pthread_mutex_unlock (&batch_lock);
+
+      if (b == NULL)
+        break;
+
+      if (rc_batch_send (b) != 0)
+        status = -1;
+      rc_batch_free (b);
+    }
+
+    pthread_mutex_unlock (&send_lock);
+
+    /* A batch queued after the queue was found empty, but before
+     * "send_lock" was released, would be left behind otherwise. */
+    pthread_mutex_lock (&batch_lock);
+    empty = (batch_queue_head == NULL);
+    pthread_mutex_unlock (&batch_lock);
+  } while (!empty);
+
+  return (status);
+} /* }}} int rc_batch_send_queued */
+
+/* Appends "str" to the batch, escaping spaces and backslashes if "escape" is
+ * true. Leaves room for the footer. Must be called with "batch_lock"
+ * held. */
+static int rc_batch_append (const char *str, _Bool escape) /* {{{ */
+{
+  size_t len = strlen (str);
+  size_t i;
+
+  /* Worst case: every character needs to be escaped. */
+  if (batch.fill + 2 * len + strlen (RC_BATCH_FOOTER) > batch.size)
+  {
+    size_t new_size = (batch.size > 0) ? batch.size : 4096;
+    char *tmp;
+
+    while (batch.fill + 2 * len + strlen (RC_BATCH_FOOTER) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (batch.buffer, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    batch.buffer = tmp;
+    batch.size = new_size;
+  }
+
+  for (i = 0; i < len; i++)
+  {
+    if (escape && ((str[i] == ' ') || (str[i] == '\\')))
+      batch.buffer[batch.fill++] = '\\';
+    batch.buffer[batch.fill++] = str[i];
+  }
+
+  return (0);
+} /* }}} int rc_batch_append */
+
+static int rc_batch_update (const char *filename, const char *values) /* {{{ */
+{
+  size_t fill_orig;
+  _Bool do_send = 0;
+  int status = 0;
+
+  pthread_mutex_lock (&batch_lock);
+
+  if (batch.fill == 0)
+    status = rc_batch_append (RC_BATCH_HEADER, /* escape = */ 0);
+
+  fill_orig = batch.fill;
+  if (status == 0)
+    status = rc_batch_append ("update ", /* escape = */ 0);
+  if ((status == 0) && batch_is_local && (filename[0] != '/')
+      && (batch_cwd[0] != 0))
+  {
+    status = rc_batch_append (batch_cwd, /* escape = */ 1);
+    if (status == 0)
+      status = rc_batch_append ("/", /* escape = */ 0);
+  }
+  if (status == 0)
+    status = rc_batch_append (filename, /* escape = */ 1);
+  if (status == 0)
+    status = rc_batch_append (" ", /* escape = */ 0);
+  if (status == 0)
+    status = rc_batch_append (values, /* escape = */ 0);
+  if (status == 0)
+    status = rc_batch_append ("\n", /* escape = */ 0);
+
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: Adding an update to the batch failed.");
+    if (batch.fill > 0)
+      batch.fill = fill_orig;
+    pthread_mutex_unlock (&batch_lock);
+    return (-1);
+  }
+
+  if (batch.updates_num == 0)
+    batch_first_update = cdtime ();
+  batch.updates_num++;
+
+  if ((batch.updates_num >= batch_size)
+      || ((batch_timeout > 0)
+        && ((cdtime () - batch_first_update) >= batch_timeout)))
+  {
+    rc_batch_enqueue ();
+    do_send = 1;
+  }
+
+  pthread_mutex_unlock (&batch_lock);
+
+  if (do_send)
+    status = rc_batch_send_queued (/* wait = */ 0);
+  return (status);
+} /* }}} int rc_batch_update */
+
+/* Read callback making sure updates don't linger in the buffer when only few
+ * values are being written. */
+static int rc_batch_timeout (__attribute__((unused)) user_data_t *ud) /* {{{ */
+{
+  pthread_mutex_lock (&batch_lock);
+  if ((batch.updates_num > 0)
+      && ((cdtime () - batch_first_update) >= batch_timeout))
+    rc_batch_enqueue ();
+  pthread_mutex_unlock (&batch_lock);
+
+  return (rc_batch_send_queued (/* wait = */ 0));
+} /* }}} int rc_batch_timeout */
+
 static int rc_config_get_int_positive (oconfig_item_t const *ci, int *ret)
 {
   int status;
@@ -271,6 +872,10 @@ static int rc_config (oconfig_item_t *ci)
     }
     else if (strcasecmp ("XFF", key) == 0)
       status = rc_config_get_xff (child, &rrdcreate_config.xff);
+    else if (strcasecmp ("BatchSize", key) == 0)
+      status = rc_config_get_int_positive (child, &batch_size);
+    else if (strcasecmp ("BatchTimeout", key) == 0)
+      status = cf_util_get_cdtime (child, &batch_timeout);
     else
     {
       WARNING ("rrdcached plugin: Ignoring invalid option %s.", key);
@@ -404,6 +1009,26 @@ static int rc_init (void)
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  if ((daemon_address != NULL) && (batch_size > 0))
+  {
+    struct timespec interval;
+
+    batch_is_local = ((strncmp ("unix:", daemon_address,
+            strlen ("unix:")) == 0) || (daemon_address[0] == '/'));
+
+    /* librrd sends absolute paths to a local daemon, so relative file names
+     * are resolved against our working directory, not rrdcached's. */
+    if (batch_is_local && (getcwd (batch_cwd, sizeof (batch_cwd)) == NULL))
+      batch_cwd[0] = 0;
+
+    if (batch_timeout == 0)
+      batch_timeout = plugin_get_interval ();
+    CDTIME_T_TO_TIMESPEC (batch_timeout, &interval);
+
+    plugin_register_complex_read (/* group = */ NULL, "rrdcached-batch",
+        rc_batch_timeout, &interval, /* user_data = */ NULL);
+  }
+
   return (0);
 } /* int rc_init */
 
@@ -470,6 +1095,9 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     }
   }
 
+  if (batch_size > 0)
+    return (rc_batch_update (filename, values));
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -497,6 +1125,19 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
   char filename[PATH_MAX + 1];
   int status;
 
+  /* Pending updates have to reach the daemon before it can flush them. */
+  if (batch_size > 0)
+  {
+    pthread_mutex_lock (&batch_lock);
+    rc_batch_enqueue ();
+    pthread_mutex_unlock (&batch_lock);
+
+    status = rc_batch_send_queued (/* wait = */ 1);
+
+    if (identifier == NULL)
+      return (status);
+  }
+
   if (identifier == NULL)
     return (EINVAL);
 
@@ -527,6 +1168,16 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  pthread_mutex_lock (&batch_lock);
+  rc_batch_enqueue ();
+  pthread_mutex_unlock (&batch_lock);
+
+  rc_batch_send_queued (/* wait = */ 1);
+
+  pthread_mutex_lock (&send_lock);
+  rc_batch_disconnect ();
+  pthread_mutex_unlock (&send_lock);
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_avltree.h"
+#include "utils_latency.h"
 #include "utils_random.h"
 #include "utils_rrdcreate.h"
 
@@ -69,6 +70,26 @@ struct rrd_queue_s
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
+ * ALWAYS lock `cache_lock' first! */
+struct rrd_shard_s
+{
+	c_avl_tree_t   *cache;
+	cdtime_t        cache_flush_last;
+	pthread_mutex_t cache_lock;
+
+	rrd_queue_t    *queue_head;
+	rrd_queue_t    *queue_tail;
+	rrd_queue_t    *flushq_head;
+	rrd_queue_t    *flushq_tail;
+	size_t          queue_length;
+	pthread_t       queue_thread;
+	int             queue_thread_running;
+	pthread_mutex_t queue_lock;
+	pthread_cond_t  queue_cond;
+};
+typedef struct rrd_shard_s rrd_shard_t;
+
 /*
  * Private variables
  */
@@ -84,7 +105,9 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"ReportStats",
+	"WriteThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -109,23 +132,17 @@ static rrdcreate_config_t rrdcreate_config =
 	/* async = */ 0
 };
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
 static cdtime_t    cache_timeout = 0;
 static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
-static cdtime_t    cache_flush_last;
-static c_avl_tree_t *cache = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static rrd_queue_t    *queue_head = NULL;
-static rrd_queue_t    *queue_tail = NULL;
-static rrd_queue_t    *flushq_head = NULL;
-static rrd_queue_t    *flushq_tail = NULL;
-static pthread_t       queue_thread;
-static int             queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* The RRD files are distributed over "shards_num" shards by a hash of the
+ * file name. Each shard has its own cache, queues and queue thread. */
+static rrd_shard_t *shards = NULL;
+static size_t       shards_num = 1;
+/* Protects "shards" itself: held for reading while a shard is used outside of
+ * the queue threads and for writing while the shards are freed. */
+static pthread_rwlock_t shards_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -133,6 +150,12 @@ static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int do_shutdown = 0;
 
+/* Statistics about the queue thread, reported if "ReportStats" is enabled. */
+static _Bool              report_stats = 0;
+static derive_t           stats_updates = 0;
+static latency_counter_t *stats_latency = NULL;
+static pthread_mutex_t    stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
 #if HAVE_THREADSAFE_LIBRRD
 static int srrd_update (char *filename, char *template,
 		int argc, const char **argv)
@@ -321,8 +344,59 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 	return (0);
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread (void __attribute__((unused)) *data)
+static rrd_shard_t *rrd_get_shard (const char *filename) /* {{{ */
 {
+	uint32_t hash = 5381;
+	const unsigned char *ptr;
+
+	if (shards_num == 1)
+		return (shards);
+
+	for (ptr = (const unsigned char *) filename; *ptr != 0; ptr++)
+		hash = ((hash << 5) + hash) + (uint32_t) *ptr;
+
+	return (shards + (hash % shards_num));
+} /* }}} rrd_shard_t *rrd_get_shard */
+
+/* Writes the values of one queue entry to its RRD file and frees it. */
+static void rrd_queue_write (rrd_queue_t *queue_entry, /* {{{ */
+		char **values, int values_num)
+{
+	cdtime_t start;
+	int i;
+
+	start = cdtime ();
+
+	/* Write the values to the RRD-file */
+	srrd_update (queue_entry->filename, NULL,
+			values_num, (const char **)values);
+	DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
+			values_num, (values_num == 1) ? "" : "s",
+			queue_entry->filename);
+
+	if (report_stats)
+	{
+		cdtime_t latency = cdtime () - start;
+
+		pthread_mutex_lock (&stats_lock);
+		stats_updates++;
+		latency_counter_add (stats_latency, latency);
+		pthread_mutex_unlock (&stats_lock);
+	}
+
+	for (i = 0; i < values_num; i++)
+	{
+		sfree (values[i]);
+	}
+	sfree (values);
+	sfree (queue_entry->filename);
+	sfree (queue_entry);
+} /* }}} void rrd_queue_write */
+
+static void *rrd_queue_thread (void *data)
+{
+	rrd_shard_t *shard = data;
+
         struct timeval tv_next_update;
         struct timeval tv_now;
 
@@ -335,26 +409,25 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		char **values;
 		int    values_num;
 		int    status;
-		int    i;
 
 		values = NULL;
 		values_num = 0;
 
-                pthread_mutex_lock (&queue_lock);
+                pthread_mutex_lock (&shard->queue_lock);
                 /* Wait for values to arrive */
                 while (42)
                 {
                   struct timespec ts_wait;
 
-                  while ((flushq_head == NULL) && (queue_head == NULL)
+                  while ((shard->flushq_head == NULL) && (shard->queue_head == NULL)
                       && (do_shutdown == 0))
-                    pthread_cond_wait (&queue_cond, &queue_lock);
+                    pthread_cond_wait (&shard->queue_cond, &shard->queue_lock);
 
-                  if ((flushq_head == NULL) && (queue_head == NULL))
+                  if ((shard->flushq_head == NULL) && (shard->queue_head == NULL))
                     break;
 
                   /* Don't delay if there's something to flush */
-                  if (flushq_head != NULL)
+                  if (shard->flushq_head != NULL)
                     break;
 
                   /* Don't delay if we're shutting down */
@@ -377,49 +450,50 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   ts_wait.tv_sec = tv_next_update.tv_sec;
                   ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-                  status = pthread_cond_timedwait (&queue_cond, &queue_lock,
+                  status = pthread_cond_timedwait (&shard->queue_cond, &shard->queue_lock,
                       &ts_wait);
                   if (status == ETIMEDOUT)
                     break;
                 } /* while (42) */
 
                 /* XXX: If you need to lock both, cache_lock and queue_lock, at
-                 * the same time, ALWAYS lock `cache_lock' first! */
+                 * the same time, ALWAYS lock `shard->cache_lock' first! */
 
                 /* We're in the shutdown phase */
-                if ((flushq_head == NULL) && (queue_head == NULL))
+                if ((shard->flushq_head == NULL) && (shard->queue_head == NULL))
                 {
-                  pthread_mutex_unlock (&queue_lock);
+                  pthread_mutex_unlock (&shard->queue_lock);
                   break;
                 }
 
-                if (flushq_head != NULL)
+                if (shard->flushq_head != NULL)
                 {
                   /* Dequeue the first flush entry */
-                  queue_entry = flushq_head;
-                  if (flushq_head == flushq_tail)
-                    flushq_head = flushq_tail = NULL;
+                  queue_entry = shard->flushq_head;
+                  if (shard->flushq_head == shard->flushq_tail)
+                    shard->flushq_head = shard->flushq_tail = NULL;
                   else
-                    flushq_head = flushq_head->next;
+                    shard->flushq_head = shard->flushq_head->next;
                 }
-                else /* if (queue_head != NULL) */
+                else /* if (shard->queue_head != NULL) */
                 {
                   /* Dequeue the first regular entry */
-                  queue_entry = queue_head;
-                  if (queue_head == queue_tail)
-                    queue_head = queue_tail = NULL;
+                  queue_entry = shard->queue_head;
+                  if (shard->queue_head == shard->queue_tail)
+                    shard->queue_head = shard->queue_tail = NULL;
                   else
-                    queue_head = queue_head->next;
+                    shard->queue_head = shard->queue_head->next;
                 }
+                shard->queue_length--;
 
 		/* Unlock the queue again */
-		pthread_mutex_unlock (&queue_lock);
+		pthread_mutex_unlock (&shard->queue_lock);
 
 		/* We now need the cache lock so the entry isn't updated while
 		 * we make a copy of it's values */
-		pthread_mutex_lock (&cache_lock);
+		pthread_mutex_lock (&shard->cache_lock);
 
-		status = c_avl_get (cache, queue_entry->filename,
+		status = c_avl_get (shard->cache, queue_entry->filename,
 				(void *) &cache_entry);
 
 		if (status == 0)
@@ -432,7 +506,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			cache_entry->flags = FLAG_NONE;
 		}
 
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 
 		if (status != 0)
 		{
@@ -441,13 +515,15 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			continue;
 		}
 
-		/* Update `tv_next_update' */
+		/* Update `tv_next_update'. The configured rate applies to all
+		 * shards together. */
 		if (write_rate > 0.0) 
                 {
                   gettimeofday (&tv_now, /* timezone = */ NULL);
                   tv_next_update.tv_sec = tv_now.tv_sec;
                   tv_next_update.tv_usec = tv_now.tv_usec
-                    + ((suseconds_t) (1000000 * write_rate));
+                    + ((suseconds_t) (1000000 * write_rate
+                          * ((double) shards_num)));
                   while (tv_next_update.tv_usec > 1000000)
                   {
                     tv_next_update.tv_sec++;
@@ -455,27 +531,14 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   }
                 }
 
-		/* Write the values to the RRD-file */
-		srrd_update (queue_entry->filename, NULL,
-				values_num, (const char **)values);
-		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
-				values_num, (values_num == 1) ? "" : "s",
-				queue_entry->filename);
-
-		for (i = 0; i < values_num; i++)
-		{
-			sfree (values[i]);
-		}
-		sfree (values);
-		sfree (queue_entry->filename);
-		sfree (queue_entry);
+		rrd_queue_write (queue_entry, values, values_num);
 	} /* while (42) */
 
 	pthread_exit ((void *) 0);
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue (const char *filename,
+static int rrd_queue_enqueue (rrd_shard_t *shard, const char *filename,
     rrd_queue_t **head, rrd_queue_t **tail)
 {
   rrd_queue_t *queue_entry;
@@ -493,27 +556,28 @@ static int rrd_queue_enqueue (const char *filename,
 
   queue_entry->next = NULL;
 
-  pthread_mutex_lock (&queue_lock);
+  pthread_mutex_lock (&shard->queue_lock);
 
   if (*tail == NULL)
     *head = queue_entry;
   else
     (*tail)->next = queue_entry;
   *tail = queue_entry;
+  shard->queue_length++;
 
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
+  pthread_cond_signal (&shard->queue_cond);
+  pthread_mutex_unlock (&shard->queue_lock);
 
   return (0);
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue (const char *filename,
+static int rrd_queue_dequeue (rrd_shard_t *shard, const char *filename,
     rrd_queue_t **head, rrd_queue_t **tail)
 {
   rrd_queue_t *this;
   rrd_queue_t *prev;
 
-  pthread_mutex_lock (&queue_lock);
+  pthread_mutex_lock (&shard->queue_lock);
 
   prev = NULL;
   this = *head;
@@ -529,7 +593,7 @@ static int rrd_queue_dequeue (const char *filename,
 
   if (this == NULL)
   {
-    pthread_mutex_unlock (&queue_lock);
+    pthread_mutex_unlock (&shard->queue_lock);
     return (-1);
   }
 
@@ -541,7 +605,8 @@ static int rrd_queue_dequeue (const char *filename,
   if (this->next == NULL)
     *tail = prev;
 
-  pthread_mutex_unlock (&queue_lock);
+  shard->queue_length--;
+  pthread_mutex_unlock (&shard->queue_lock);
 
   sfree (this->filename);
   sfree (this);
@@ -549,8 +614,8 @@ static int rrd_queue_dequeue (const char *filename,
   return (0);
 } /* int rrd_queue_dequeue */
 
-/* XXX: You must hold "cache_lock" when calling this function! */
-static void rrd_cache_flush (cdtime_t timeout)
+/* XXX: You must hold "shard->cache_lock" when calling this function! */
+static void rrd_cache_flush (rrd_shard_t *shard, cdtime_t timeout)
 {
 	rrd_cache_t *rc;
 	cdtime_t     now;
@@ -569,7 +634,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 	timeout = TIME_T_TO_CDTIME_T (timeout);
 
 	/* Build a list of entries to be flushed */
-	iter = c_avl_get_iterator (cache);
+	iter = c_avl_get_iterator (shard->cache);
 	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
 	{
 		if (rc->flags != FLAG_NONE)
@@ -582,7 +647,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 		{
 			int status;
 
-			status = rrd_queue_enqueue (key, &queue_head,  &queue_tail);
+			status = rrd_queue_enqueue (shard, key, &shard->queue_head,  &shard->queue_tail);
 			if (status == 0)
 				rc->flags = FLAG_QUEUED;
 		}
@@ -610,7 +675,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 	
 	for (i = 0; i < keys_num; i++)
 	{
-		if (c_avl_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
+		if (c_avl_remove (shard->cache, keys[i], (void *) &key, (void *) &rc) != 0)
 		{
 			DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
 			continue;
@@ -626,34 +691,20 @@ static void rrd_cache_flush (cdtime_t timeout)
 
 	sfree (keys);
 
-	cache_flush_last = now;
+	shard->cache_flush_last = now;
 } /* void rrd_cache_flush */
 
-static int rrd_cache_flush_identifier (cdtime_t timeout,
-    const char *identifier)
+/* XXX: You must hold "shard->cache_lock" when calling this function! */
+static int rrd_cache_flush_identifier (rrd_shard_t *shard, cdtime_t timeout,
+    const char *key)
 {
   rrd_cache_t *rc;
   cdtime_t now;
   int status;
-  char key[2048];
-
-  if (identifier == NULL)
-  {
-    rrd_cache_flush (timeout);
-    return (0);
-  }
 
   now = cdtime ();
 
-  if (datadir == NULL)
-    snprintf (key, sizeof (key), "%s.rrd",
-        identifier);
-  else
-    snprintf (key, sizeof (key), "%s/%s.rrd",
-        datadir, identifier);
-  key[sizeof (key) - 1] = 0;
-
-  status = c_avl_get (cache, key, (void *) &rc);
+  status = c_avl_get (shard->cache, key, (void *) &rc);
   if (status != 0)
   {
     INFO ("rrdtool plugin: rrd_cache_flush_identifier: "
@@ -668,8 +719,8 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->flags == FLAG_QUEUED)
   {
-    rrd_queue_dequeue (key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue (shard, key, &shard->queue_head, &shard->queue_tail);
+    status = rrd_queue_enqueue (shard, key, &shard->flushq_head, &shard->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -679,7 +730,7 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->values_num > 0)
   {
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue (shard, key, &shard->flushq_head, &shard->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -712,22 +763,30 @@ static int64_t rrd_get_random_variation (void)
 static int rrd_cache_insert (const char *filename,
 		const char *value, cdtime_t value_time)
 {
+	rrd_shard_t *shard;
 	rrd_cache_t *rc = NULL;
 	int new_rc = 0;
 	char **values_new;
 
-	pthread_mutex_lock (&cache_lock);
+	if (shards == NULL)
+	{
+		WARNING ("rrdtool plugin: shards == NULL.");
+		return (-1);
+	}
+	shard = rrd_get_shard (filename);
+
+	pthread_mutex_lock (&shard->cache_lock);
 
 	/* This shouldn't happen, but it did happen at least once, so we'll be
 	 * careful. */
-	if (cache == NULL)
+	if (shard->cache == NULL)
 	{
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 		WARNING ("rrdtool plugin: cache == NULL.");
 		return (-1);
 	}
 
-	c_avl_get (cache, filename, (void *) &rc);
+	c_avl_get (shard->cache, filename, (void *) &rc);
 
 	if (rc == NULL)
 	{
@@ -745,7 +804,7 @@ static int rrd_cache_insert (const char *filename,
 
 	if (rc->last_value >= value_time)
 	{
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
 				rc->last_value, value_time);
@@ -761,8 +820,8 @@ static int rrd_cache_insert (const char *filename,
 
 		sstrerror (errno, errbuf, sizeof (errbuf));
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
-		pthread_mutex_unlock (&cache_lock);
+		c_avl_remove (shard->cache, filename, &cache_key, NULL);
+		pthread_mutex_unlock (&shard->cache_lock);
 
 		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
 
@@ -791,7 +850,7 @@ static int rrd_cache_insert (const char *filename,
 			char errbuf[1024];
 			sstrerror (errno, errbuf, sizeof (errbuf));
 
-			pthread_mutex_unlock (&cache_lock);
+			pthread_mutex_unlock (&shard->cache_lock);
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
@@ -801,7 +860,7 @@ static int rrd_cache_insert (const char *filename,
 			return (-1);
 		}
 
-		c_avl_insert (cache, cache_key, rc);
+		c_avl_insert (shard->cache, cache_key, rc);
 	}
 
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
@@ -812,12 +871,12 @@ static int rrd_cache_insert (const char *filename,
 	if ((rc->last_value - rc->first_value) >= (cache_timeout + rc->random_variation))
 	{
 		/* XXX: If you need to lock both, cache_lock and queue_lock, at
-		 * the same time, ALWAYS lock `cache_lock' first! */
+		 * the same time, ALWAYS lock `shard->cache_lock' first! */
 		if (rc->flags == FLAG_NONE)
 		{
 			int status;
 
-			status = rrd_queue_enqueue (filename, &queue_head, &queue_tail);
+			status = rrd_queue_enqueue (shard, filename, &shard->queue_head, &shard->queue_tail);
 			if (status == 0)
 				rc->flags = FLAG_QUEUED;
 
@@ -830,30 +889,30 @@ static int rrd_cache_insert (const char *filename,
 	}
 
 	if ((cache_timeout > 0) &&
-			((cdtime () - cache_flush_last) > cache_flush_timeout))
-		rrd_cache_flush (cache_flush_timeout);
+			((cdtime () - shard->cache_flush_last) > cache_flush_timeout))
+		rrd_cache_flush (shard, cache_flush_timeout);
 
-	pthread_mutex_unlock (&cache_lock);
+	pthread_mutex_unlock (&shard->cache_lock);
 
 	return (0);
 } /* int rrd_cache_insert */
 
-static int rrd_cache_destroy (void) /* {{{ */
+static int rrd_cache_destroy (rrd_shard_t *shard) /* {{{ */
 {
   void *key = NULL;
   void *value = NULL;
 
   int non_empty = 0;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->cache_lock);
 
-  if (cache == NULL)
+  if (shard->cache == NULL)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->cache_lock);
     return (0);
   }
 
-  while (c_avl_pick (cache, &key, &value) == 0)
+  while (c_avl_pick (shard->cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
     int i;
@@ -873,8 +932,8 @@ static int rrd_cache_destroy (void) /* {{{ */
     sfree (rc);
   }
 
-  c_avl_destroy (cache);
-  cache = NULL;
+  c_avl_destroy (shard->cache);
+  shard->cache = NULL;
 
   if (non_empty > 0)
   {
@@ -887,7 +946,7 @@ static int rrd_cache_destroy (void) /* {{{ */
         "when destroying the cache.");
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->cache_lock);
   return (0);
 } /* }}} int rrd_cache_destroy */
 
@@ -953,25 +1012,71 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		return (-1);
 	}
 
+	pthread_rwlock_rdlock (&shards_lock);
 	status = rrd_cache_insert (filename, values, vl->time);
+	pthread_rwlock_unlock (&shards_lock);
 
 	return (status);
 } /* int rrd_write */
 
-static int rrd_flush (cdtime_t timeout, const char *identifier,
-		__attribute__((unused)) user_data_t *user_data)
+static int rrd_flush_shards (cdtime_t timeout, const char *identifier)
 {
-	pthread_mutex_lock (&cache_lock);
+	rrd_shard_t *shard;
+	char key[2048];
+
+	if (shards == NULL)
+		return (0);
+
+	if (identifier == NULL)
+	{
+		size_t i;
+
+		for (i = 0; i < shards_num; i++)
+		{
+			shard = shards + i;
+
+			pthread_mutex_lock (&shard->cache_lock);
+			if (shard->cache != NULL)
+				rrd_cache_flush (shard, timeout);
+			pthread_mutex_unlock (&shard->cache_lock);
+		}
 
-	if (cache == NULL) {
-		pthread_mutex_unlock (&cache_lock);
 		return (0);
 	}
 
-	rrd_cache_flush_identifier (timeout, identifier);
+	if (datadir == NULL)
+		snprintf (key, sizeof (key), "%s.rrd",
+				identifier);
+	else
+		snprintf (key, sizeof (key), "%s/%s.rrd",
+				datadir, identifier);
+	key[sizeof (key) - 1] = 0;
+
+	shard = rrd_get_shard (key);
+
+	pthread_mutex_lock (&shard->cache_lock);
+
+	if (shard->cache == NULL) {
+		pthread_mutex_unlock (&shard->cache_lock);
+		return (0);
+	}
 
-	pthread_mutex_unlock (&cache_lock);
+	rrd_cache_flush_identifier (shard, timeout, key);
+
+	pthread_mutex_unlock (&shard->cache_lock);
 	return (0);
+} /* int rrd_flush_shards */
+
+static int rrd_flush (cdtime_t timeout, const char *identifier,
+		__attribute__((unused)) user_data_t *user_data)
+{
+	int status;
+
+	pthread_rwlock_rdlock (&shards_lock);
+	status = rrd_flush_shards (timeout, identifier);
+	pthread_rwlock_unlock (&shards_lock);
+
+	return (status);
 } /* int rrd_flush */
 
 static int rrd_config (const char *key, const char *value)
@@ -1142,6 +1247,33 @@ static int rrd_config (const char *key, const char *value)
 			random_timeout = DOUBLE_TO_CDTIME_T (tmp);
 		}
 	}
+	else if (strcasecmp ("WriteThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			fprintf (stderr, "rrdtool: `WriteThreads' must "
+					"be at least 1.\n");
+			ERROR ("rrdtool: `WriteThreads' must "
+					"be at least 1.");
+			return (1);
+		}
+		shards_num = (size_t) tmp;
+#if !HAVE_THREADSAFE_LIBRRD
+		if (shards_num > 1)
+			WARNING ("rrdtool plugin: This librrd is not thread-safe, so all "
+					"RRD updates are serialized by a global lock. "
+					"`WriteThreads %zu' will not write files in parallel.",
+					shards_num);
+#endif
+	}
+	else if (strcasecmp ("ReportStats", key) == 0)
+	{
+		if (IS_TRUE (value))
+			report_stats = 1;
+		else
+			report_stats = 0;
+	}
 	else
 	{
 		return (-1);
@@ -1149,38 +1281,141 @@ static int rrd_config (const char *key, const char *value)
 	return (0);
 } /* int rrd_config */
 
+static int rrd_stats_read (void) /* {{{ */
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	gauge_t copy_queue_length;
+	gauge_t copy_latency;
+	derive_t copy_updates;
+	size_t i;
+
+	copy_queue_length = 0.0;
+	pthread_rwlock_rdlock (&shards_lock);
+	for (i = 0; (shards != NULL) && (i < shards_num); i++)
+	{
+		pthread_mutex_lock (&shards[i].queue_lock);
+		copy_queue_length += (gauge_t) shards[i].queue_length;
+		pthread_mutex_unlock (&shards[i].queue_lock);
+	}
+	pthread_rwlock_unlock (&shards_lock);
+
+	pthread_mutex_lock (&stats_lock);
+	copy_updates = stats_updates;
+	if (latency_counter_get_num (stats_latency) > 0)
+		copy_latency = CDTIME_T_TO_DOUBLE (
+				latency_counter_get_average (stats_latency));
+	else
+		copy_latency = NAN;
+	latency_counter_reset (stats_latency);
+	pthread_mutex_unlock (&stats_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "rrdtool", sizeof (vl.plugin));
+
+	/* Number of files waiting to be updated */
+	values[0].gauge = copy_queue_length;
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	plugin_dispatch_values (&vl);
+
+	/* Average time spent in one update, in seconds */
+	values[0].gauge = copy_latency;
+	sstrncpy (vl.type, "latency", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "update", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Number of updates */
+	values[0].derive = copy_updates;
+	sstrncpy (vl.type, "total_operations", sizeof (vl.type));
+	plugin_dispatch_values (&vl);
+
+	return (0);
+} /* }}} int rrd_stats_read */
+
 static int rrd_shutdown (void)
 {
-	pthread_mutex_lock (&cache_lock);
-	rrd_cache_flush (0);
-	pthread_mutex_unlock (&cache_lock);
+	size_t queued = 0;
+	size_t running = 0;
+	size_t i;
+
+	if (shards == NULL)
+		return (0);
+
+	for (i = 0; i < shards_num; i++)
+	{
+		rrd_shard_t *shard = shards + i;
+
+		pthread_mutex_lock (&shard->cache_lock);
+		if (shard->cache != NULL)
+			rrd_cache_flush (shard, 0);
+		pthread_mutex_unlock (&shard->cache_lock);
+	}
+
+	/* Hold all queue locks while setting "do_shutdown", which is checked by
+	 * the queue threads with their shard's queue lock held. */
+	for (i = 0; i < shards_num; i++)
+		pthread_mutex_lock (&shards[i].queue_lock);
 
-	pthread_mutex_lock (&queue_lock);
 	do_shutdown = 1;
-	pthread_cond_signal (&queue_cond);
-	pthread_mutex_unlock (&queue_lock);
 
-	if ((queue_thread_running != 0)
-			&& ((queue_head != NULL) || (flushq_head != NULL)))
+	for (i = 0; i < shards_num; i++)
+	{
+		rrd_shard_t *shard = shards + i;
+
+		pthread_cond_signal (&shard->queue_cond);
+		queued += shard->queue_length;
+		pthread_mutex_unlock (&shard->queue_lock);
+
+		if (shard->queue_thread_running != 0)
+			running++;
+	}
+
+	if ((running > 0) && (queued > 0))
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread. "
-				"This may take a while.");
+		INFO ("rrdtool plugin: Shutting down the queue thread%s. "
+				"This may take a while.", (running == 1) ? "" : "s");
 	}
-	else if (queue_thread_running != 0)
+	else if (running > 0)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread.");
+		INFO ("rrdtool plugin: Shutting down the queue thread%s.",
+				(running == 1) ? "" : "s");
 	}
 
-	/* Wait for all the values to be written to disk before returning. */
-	if (queue_thread_running != 0)
+	for (i = 0; i < shards_num; i++)
 	{
-		pthread_join (queue_thread, NULL);
-		memset (&queue_thread, 0, sizeof (queue_thread));
-		queue_thread_running = 0;
-		DEBUG ("rrdtool plugin: queue_thread exited.");
+		rrd_shard_t *shard = shards + i;
+
+		/* Wait for all the values to be written to disk before returning. */
+		if (shard->queue_thread_running != 0)
+		{
+			pthread_join (shard->queue_thread, NULL);
+			memset (&shard->queue_thread, 0, sizeof (shard->queue_thread));
+			shard->queue_thread_running = 0;
+			DEBUG ("rrdtool plugin: queue_thread #%zu exited.", i);
+		}
+
+		rrd_cache_destroy (shard);
+	}
+
+	/* Write threads may still be running and call rrd_write() until the
+	 * daemon has stopped them. */
+	pthread_rwlock_wrlock (&shards_lock);
+	for (i = 0; i < shards_num; i++)
+	{
+		pthread_mutex_destroy (&shards[i].cache_lock);
+		pthread_mutex_destroy (&shards[i].queue_lock);
+		pthread_cond_destroy (&shards[i].queue_cond);
 	}
+	sfree (shards);
+	shards_num = 1;
+	pthread_rwlock_unlock (&shards_lock);
 
-	rrd_cache_destroy ();
+	pthread_mutex_lock (&stats_lock);
+	latency_counter_destroy (stats_latency);
+	stats_latency = NULL;
+	pthread_mutex_unlock (&stats_lock);
 
 	return (0);
 } /* int rrd_shutdown */
@@ -1189,6 +1424,7 @@ static int rrd_init (void)
 {
 	static int init_once = 0;
 	int status;
+	size_t i;
 
 	if (init_once != 0)
 		return (0);
@@ -1197,42 +1433,72 @@ static int rrd_init (void)
 	if (rrdcreate_config.heartbeat <= 0)
 		rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
-	/* Set the cache up */
-	pthread_mutex_lock (&cache_lock);
+	if (cache_timeout == 0)
+	{
+		cache_flush_timeout = 0;
+	}
+	else if (cache_flush_timeout < cache_timeout)
+		cache_flush_timeout = 10 * cache_timeout;
 
-	cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
-	if (cache == NULL)
+	/* Set the shards up */
+	shards = calloc (shards_num, sizeof (*shards));
+	if (shards == NULL)
 	{
-		ERROR ("rrdtool plugin: c_avl_create failed.");
+		ERROR ("rrdtool plugin: calloc failed.");
 		return (-1);
 	}
 
-	cache_flush_last = cdtime ();
-	if (cache_timeout == 0)
+	for (i = 0; i < shards_num; i++)
 	{
-		cache_flush_timeout = 0;
+		rrd_shard_t *shard = shards + i;
+
+		pthread_mutex_init (&shard->cache_lock, /* attr = */ NULL);
+		pthread_mutex_init (&shard->queue_lock, /* attr = */ NULL);
+		pthread_cond_init (&shard->queue_cond, /* attr = */ NULL);
+
+		shard->cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		if (shard->cache == NULL)
+		{
+			ERROR ("rrdtool plugin: c_avl_create failed.");
+			return (-1);
+		}
+		shard->cache_flush_last = cdtime ();
 	}
-	else if (cache_flush_timeout < cache_timeout)
-		cache_flush_timeout = 10 * cache_timeout;
 
-	pthread_mutex_unlock (&cache_lock);
+	if (report_stats)
+	{
+		stats_latency = latency_counter_create ();
+		if (stats_latency == NULL)
+		{
+			ERROR ("rrdtool plugin: latency_counter_create failed.");
+			return (-1);
+		}
+		plugin_register_read ("rrdtool", rrd_stats_read);
+	}
 
-	status = plugin_thread_create (&queue_thread, /* attr = */ NULL,
-			rrd_queue_thread, /* args = */ NULL);
-	if (status != 0)
+	for (i = 0; i < shards_num; i++)
 	{
-		ERROR ("rrdtool plugin: Cannot create queue-thread.");
-		return (-1);
+		rrd_shard_t *shard = shards + i;
+
+		status = plugin_thread_create (&shard->queue_thread, /* attr = */ NULL,
+				rrd_queue_thread, /* args = */ shard);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot create queue-thread.");
+			return (-1);
+		}
+		shard->queue_thread_running = 1;
 	}
-	queue_thread_running = 1;
 
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-			" heartbeat = %i; rrarows = %i; xff = %lf;",
+			" heartbeat = %i; rrarows = %i; xff = %lf;"
+			" write_threads = %zu;",
 			(datadir == NULL) ? "(null)" : datadir,
 			rrdcreate_config.stepsize,
 			rrdcreate_config.heartbeat,
 			rrdcreate_config.rrarows,
-			rrdcreate_config.xff);
+			rrdcreate_config.xff,
+			shards_num);
 
 	return (0);
 } /* int rrd_init */
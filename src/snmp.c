@@ -28,8 +28,10 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_complain.h"
+#include "utils_heap.h"
 
 #include <pthread.h>
+#include <poll.h>
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
@@ -71,6 +73,8 @@ struct data_definition_s
 };
 typedef struct data_definition_s data_definition_t;
 
+struct csnmp_job_s;
+
 struct host_definition_s
 {
   char *name;
@@ -91,11 +95,28 @@ struct host_definition_s
   int security_level;
   char *context;
 
+  /* Number of rows requested with each GETBULK request. If zero, tables are
+   * walked using GETNEXT. */
+  int bulk_repetitions;
+  /* Maximum number of requests in flight (asynchronous engine only). */
+  int max_pending;
+
   void *sess_handle;
   c_complain_t complaint;
   cdtime_t interval;
   data_definition_t **data_list;
   int data_list_len;
+
+  /* State of the asynchronous engine. One job per entry in data_list. */
+  struct csnmp_job_s *jobs;
+  int jobs_next;
+  int jobs_done;
+  int pending;
+  int fd;
+  _Bool reopen;
+  cdtime_t next_read;
+  cdtime_t read_start;
+  cdtime_t timeout_at;
 };
 typedef struct host_definition_s host_definition_t;
 
@@ -117,15 +138,61 @@ struct csnmp_table_values_s
 };
 typedef struct csnmp_table_values_s csnmp_table_values_t;
 
+/* State of reading one data definition from one host. The table members are
+ * only used if "data->is_table" is true. */
+struct csnmp_job_s
+{
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+
+  /* Holds the last OID returned by the device for each column, the instance
+   * column last. We use this in the GETNEXT / GETBULK request to proceed. */
+  oid_t *oid_list;
+  /* Set to false when an OID has left its subtree so we don't re-request it
+   * again. */
+  _Bool *oid_list_todo;
+  uint32_t oid_list_len;
+  /* Indices into "oid_list" of the columns in the last request. */
+  uint32_t *req_list;
+  uint32_t req_list_len;
+  int bulk_repetitions;
+
+  /* `value_list_head' and `value_list_tail' implement a linked list for each
+   * value. `instance_list_head' and `instance_list_tail' implement a linked
+   * list of instance names. This is used to jump gaps in the table. */
+  csnmp_list_instances_t *instance_list_head;
+  csnmp_list_instances_t *instance_list_tail;
+  csnmp_table_values_t **value_list_head;
+  csnmp_table_values_t **value_list_tail;
+};
+typedef struct csnmp_job_s csnmp_job_t;
+
+#define CSNMP_BULK_REPETITIONS_DEFAULT 10
+#define CSNMP_MAX_PENDING_DEFAULT 4
+
 /*
  * Private variables
  */
 static data_definition_t *data_head = NULL;
 
+/* Asynchronous engine: all hosts are read by one thread. */
+static _Bool async_enabled = 0;
+static _Bool have_hosts = 0;
+static host_definition_t **async_hosts = NULL;
+static size_t async_hosts_num = 0;
+static c_heap_t *async_heap = NULL;
+static netsnmp_large_fd_set async_fdset;
+static int async_fdset_size = 0;
+static int async_pipe[2] = { -1, -1 };
+static pthread_t async_thread;
+static _Bool async_thread_running = 0;
+
 /*
  * Prototypes
  */
 static int csnmp_read_host (user_data_t *ud);
+static void csnmp_job_destroy (csnmp_job_t *job);
 
 /*
  * Private functions
@@ -204,6 +271,15 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
 
   csnmp_host_close_session (hd);
 
+  if (hd->jobs != NULL)
+  {
+    int i;
+
+    for (i = 0; i < hd->data_list_len; i++)
+      csnmp_job_destroy (hd->jobs + i);
+    sfree (hd->jobs);
+  }
+
   sfree (hd->name);
   sfree (hd->address);
   sfree (hd->community);
@@ -224,6 +300,7 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
  * Callgraph for the config stuff:
  *  csnmp_config
  *  +-> call_snmp_init_once
+ *  +-> csnmp_config_set_async
  *  +-> csnmp_config_add_data
  *  !   +-> csnmp_config_add_data_instance
  *  !   +-> csnmp_config_add_data_instance_prefix
@@ -234,6 +311,7 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
  *      +-> csnmp_config_add_host_auth_protocol
  *      +-> csnmp_config_add_host_priv_protocol
  *      +-> csnmp_config_add_host_security_level
+ *      +-> csnmp_async_add_host
  */
 static void call_snmp_init_once (void)
 {
@@ -637,6 +715,31 @@ static int csnmp_config_add_host_security_level (host_definition_t *hd, oconfig_
   return (0);
 } /* int csnmp_config_add_host_security_level */
 
+static int csnmp_async_add_host (host_definition_t *hd)
+{
+  host_definition_t **tmp;
+
+  hd->jobs = calloc ((size_t) hd->data_list_len + 1, sizeof (*hd->jobs));
+  tmp = realloc (async_hosts, (async_hosts_num + 1) * sizeof (*async_hosts));
+  if ((hd->jobs == NULL) || (tmp == NULL))
+  {
+    ERROR ("snmp plugin: malloc failed.");
+    csnmp_host_definition_destroy (hd);
+    return (-1);
+  }
+  async_hosts = tmp;
+
+  /* The host is idle until it is started by the engine. */
+  hd->jobs_next = hd->data_list_len;
+  hd->jobs_done = hd->data_list_len;
+  hd->fd = -1;
+
+  async_hosts[async_hosts_num] = hd;
+  async_hosts_num++;
+
+  return (0);
+} /* int csnmp_async_add_host */
+
 static int csnmp_config_add_host (oconfig_item_t *ci)
 {
   host_definition_t *hd;
@@ -661,6 +764,8 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
 
   hd->sess_handle = NULL;
   hd->interval = 0;
+  hd->bulk_repetitions = -1;
+  hd->max_pending = CSNMP_MAX_PENDING_DEFAULT;
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -691,6 +796,10 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       status = csnmp_config_add_host_security_level (hd, option);
     else if (strcasecmp ("Context", option->key) == 0)
       status = cf_util_get_string(option, &hd->context);
+    else if (strcasecmp ("MaxRepetitions", option->key) == 0)
+      status = cf_util_get_int (option, &hd->bulk_repetitions);
+    else if (strcasecmp ("MaxPendingRequests", option->key) == 0)
+      status = cf_util_get_int (option, &hd->max_pending);
     else
     {
       WARNING ("snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.", option->key);
@@ -715,6 +824,13 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       status = -1;
       break;
     }
+    if (hd->max_pending < 1)
+    {
+      WARNING ("snmp plugin: `MaxPendingRequests' must be at least one "
+          "for host `%s'", hd->name);
+      status = -1;
+      break;
+    }
     if (hd->version == 3)
     {
       if (hd->username == NULL)
@@ -770,9 +886,19 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
     return (-1);
   }
 
+  /* GETBULK has been introduced with SNMPv2. */
+  if (hd->version == 1)
+    hd->bulk_repetitions = 0;
+  else if (hd->bulk_repetitions < 0)
+    hd->bulk_repetitions = async_enabled ? CSNMP_BULK_REPETITIONS_DEFAULT : 0;
+
   DEBUG ("snmp plugin: hd = { name = %s, address = %s, community = %s, version = %i }",
       hd->name, hd->address, hd->community, hd->version);
 
+  have_hosts = 1;
+  if (async_enabled)
+    return (csnmp_async_add_host (hd));
+
   ssnprintf (cb_name, sizeof (cb_name), "snmp-%s", hd->name);
 
   memset (&cb_data, 0, sizeof (cb_data));
@@ -794,6 +920,26 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
   return (0);
 } /* int csnmp_config_add_host */
 
+static int csnmp_config_set_async (oconfig_item_t *ci)
+{
+  _Bool value = async_enabled;
+  int status;
+
+  status = cf_util_get_boolean (ci, &value);
+  if (status != 0)
+    return (status);
+
+  if (have_hosts && (value != async_enabled))
+  {
+    WARNING ("snmp plugin: `Asynchronous' must be set before the first "
+        "`Host' block. The option is ignored.");
+    return (-1);
+  }
+
+  async_enabled = value;
+  return (0);
+} /* int csnmp_config_set_async */
+
 static int csnmp_config (oconfig_item_t *ci)
 {
   int i;
@@ -805,6 +951,8 @@ static int csnmp_config (oconfig_item_t *ci)
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("Data", child->key) == 0)
       csnmp_config_add_data (child);
+    else if (strcasecmp ("Asynchronous", child->key) == 0)
+      csnmp_config_set_async (child);
     else if (strcasecmp ("Host", child->key) == 0)
       csnmp_config_add_host (child);
     else
@@ -1121,24 +1269,15 @@ static int csnmp_strvbcopy (char *dst, /* {{{ */
 
 static int csnmp_instance_list_add (csnmp_list_instances_t **head,
     csnmp_list_instances_t **tail,
-    const struct snmp_pdu *res,
+    struct variable_list *vb,
     const host_definition_t *hd, const data_definition_t *dd)
 {
   csnmp_list_instances_t *il;
-  struct variable_list *vb;
   oid_t vb_name;
   int status;
   uint32_t i;
   uint32_t is_matched;
 
-  /* Set vb on the last variable */
-  for (vb = res->variables;
-      (vb != NULL) && (vb->next_variable != NULL);
-      vb = vb->next_variable)
-    /* do nothing */;
-  if (vb == NULL)
-    return (-1);
-
   csnmp_oid_init (&vb_name, vb->name, vb->name_length);
 
   il = malloc (sizeof (*il));
@@ -1373,42 +1512,46 @@ static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *dat
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+static void csnmp_job_destroy (csnmp_job_t *job) /* {{{ */
 {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res;
-  struct variable_list *vb;
+  uint32_t i;
 
-  const data_set_t *ds;
+  while (job->instance_list_head != NULL)
+  {
+    csnmp_list_instances_t *next = job->instance_list_head->next;
+    sfree (job->instance_list_head);
+    job->instance_list_head = next;
+  }
 
-  uint32_t oid_list_len = (uint32_t) (data->values_len + 1);
-  /* Holds the last OID returned by the device. We use this in the GETNEXT
-   * request to proceed. */
-  oid_t oid_list[oid_list_len];
-  /* Set to false when an OID has left its subtree so we don't re-request it
-   * again. */
-  _Bool oid_list_todo[oid_list_len];
+  if (job->value_list_head != NULL)
+  {
+    for (i = 0; i < (uint32_t) job->data->values_len; i++)
+    {
+      while (job->value_list_head[i] != NULL)
+      {
+        csnmp_table_values_t *next = job->value_list_head[i]->next;
+        sfree (job->value_list_head[i]);
+        job->value_list_head[i] = next;
+      }
+    }
+  }
 
-  int status;
-  int i;
-  uint32_t j;
+  sfree (job->value_list_head);
+  sfree (job->value_list_tail);
+  sfree (job->oid_list);
+  sfree (job->oid_list_todo);
+  sfree (job->req_list);
 
-  /* `value_list_head' and `value_list_tail' implement a linked list for each
-   * value. `instance_list_head' and `instance_list_tail' implement a linked list of
-   * instance names. This is used to jump gaps in the table. */
-  csnmp_list_instances_t *instance_list_head;
-  csnmp_list_instances_t *instance_list_tail;
-  csnmp_table_values_t **value_list_head;
-  csnmp_table_values_t **value_list_tail;
+  memset (job, 0, sizeof (*job));
+} /* }}} void csnmp_job_destroy */
 
-  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
-      host->name, data->name);
+static int csnmp_job_init (csnmp_job_t *job, /* {{{ */
+    host_definition_t *host, data_definition_t *data)
+{
+  const data_set_t *ds;
+  uint32_t j;
 
-  if (host->sess_handle == NULL)
-  {
-    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return (-1);
-  }
+  memset (job, 0, sizeof (*job));
 
   ds = plugin_get_ds (data->type);
   if (!ds)
@@ -1424,63 +1567,245 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
     return (-1);
   }
 
-  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  memcpy (oid_list, data->values, data->values_len * sizeof (oid_t));
-  if (data->instance.oid.oid_len > 0)
-    memcpy (oid_list + data->values_len, &data->instance.oid, sizeof (oid_t));
-  else /* no InstanceFrom option specified. */
-    oid_list_len--;
+  job->host = host;
+  job->data = data;
+  job->ds = ds;
+
+  if (!data->is_table)
+    return (0);
 
-  for (j = 0; j < oid_list_len; j++)
-    oid_list_todo[j] = 1;
+  job->oid_list_len = (uint32_t) (data->values_len + 1);
+  job->oid_list = calloc (job->oid_list_len, sizeof (*job->oid_list));
+  job->oid_list_todo = calloc (job->oid_list_len, sizeof (*job->oid_list_todo));
+  job->req_list = calloc (job->oid_list_len, sizeof (*job->req_list));
 
   /* We're going to construct n linked lists, one for each "value".
    * value_list_head will contain pointers to the heads of these linked lists,
    * value_list_tail will contain pointers to the tail of the lists. */
-  value_list_head = calloc (data->values_len, sizeof (*value_list_head));
-  value_list_tail = calloc (data->values_len, sizeof (*value_list_tail));
-  if ((value_list_head == NULL) || (value_list_tail == NULL))
+  job->value_list_head = calloc (data->values_len, sizeof (*job->value_list_head));
+  job->value_list_tail = calloc (data->values_len, sizeof (*job->value_list_tail));
+
+  if ((job->oid_list == NULL) || (job->oid_list_todo == NULL)
+      || (job->req_list == NULL)
+      || (job->value_list_head == NULL) || (job->value_list_tail == NULL))
   {
-    ERROR ("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree (value_list_head);
-    sfree (value_list_tail);
+    ERROR ("snmp plugin: csnmp_job_init: calloc failed.");
+    csnmp_job_destroy (job);
     return (-1);
   }
 
-  instance_list_head = NULL;
-  instance_list_tail = NULL;
+  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
+  memcpy (job->oid_list, data->values, data->values_len * sizeof (oid_t));
+  if (data->instance.oid.oid_len > 0)
+    memcpy (job->oid_list + data->values_len, &data->instance.oid, sizeof (oid_t));
+  else /* no InstanceFrom option specified. */
+    job->oid_list_len--;
+
+  for (j = 0; j < job->oid_list_len; j++)
+    job->oid_list_todo[j] = 1;
 
-  status = 0;
-  while (status == 0)
+  job->bulk_repetitions = host->bulk_repetitions;
+
+  return (0);
+} /* }}} int csnmp_job_init */
+
+/* Creates the next request of a table walk. Stores NULL in "ret_req" if all
+ * columns have left their subtree. */
+static int csnmp_table_request (csnmp_job_t *job, /* {{{ */
+    struct snmp_pdu **ret_req)
+{
+  struct snmp_pdu *req;
+  uint32_t j;
+
+  *ret_req = NULL;
+
+  job->req_list_len = 0;
+  for (j = 0; j < job->oid_list_len; j++)
+  {
+    /* Do not rerequest already finished OIDs */
+    if (!job->oid_list_todo[j])
+      continue;
+    job->req_list[job->req_list_len] = j;
+    job->req_list_len++;
+  }
+
+  if (job->req_list_len == 0)
   {
-    int oid_list_todo_num;
+    /* The request would be empty - so we are finished */
+    DEBUG ("snmp plugin: all variables have left their subtree");
+    return (0);
+  }
 
-    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
-    if (req == NULL)
+  if (job->bulk_repetitions > 0)
+  {
+    req = snmp_pdu_create (SNMP_MSG_GETBULK);
+    if (req != NULL)
     {
-      ERROR ("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
+      req->non_repeaters = 0;
+      req->max_repetitions = job->bulk_repetitions;
     }
+  }
+  else
+    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
+
+  if (req == NULL)
+  {
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
+    return (-1);
+  }
+
+  for (j = 0; j < job->req_list_len; j++)
+  {
+    oid_t *o = job->oid_list + job->req_list[j];
+    snmp_add_null_var (req, o->oid, o->oid_len);
+  }
+
+  *ret_req = req;
+  return (0);
+} /* }}} int csnmp_table_request */
+
+static int csnmp_table_response (csnmp_job_t *job, /* {{{ */
+    const struct snmp_pdu *res)
+{
+  host_definition_t *host = job->host;
+  data_definition_t *data = job->data;
+  struct variable_list *vb;
+  uint32_t k;
+
+  /* Some agents answer "tooBig" instead of returning fewer rows. Retry with
+   * smaller requests. */
+  if ((res->errstat == SNMP_ERR_TOOBIG) && (job->bulk_repetitions > 1))
+  {
+    job->bulk_repetitions /= 2;
+    return (0);
+  }
+
+  if (res->variables == NULL)
+    return (-1);
 
-    oid_list_todo_num = 0;
-    for (j = 0; j < oid_list_len; j++)
+  /* With GETNEXT there is one variable per requested column. With GETBULK
+   * the columns are repeated for each row. */
+  for (vb = res->variables, k = 0; vb != NULL; vb = vb->next_variable, k++)
+  {
+    uint32_t i = job->req_list[k % job->req_list_len];
+
+    /* The column may have left its subtree in a previous row. */
+    if (!job->oid_list_todo[i])
+      continue;
+
+    /* An instance is configured and the res variable we process is the
+     * instance value (last index) */
+    if ((data->instance.oid.oid_len > 0) && (i == (uint32_t) data->values_len))
     {
-      /* Do not rerequest already finished OIDs */
-      if (!oid_list_todo[j])
+      if ((vb->type == SNMP_ENDOFMIBVIEW)
+          || (snmp_oid_ncompare (data->instance.oid.oid,
+              data->instance.oid.oid_len,
+              vb->name, vb->name_length,
+              data->instance.oid.oid_len) != 0))
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; Instance left its subtree.",
+            host->name, data->name);
+        job->oid_list_todo[i] = 0;
         continue;
-      oid_list_todo_num++;
-      snmp_add_null_var (req, oid_list[j].oid, oid_list[j].oid_len);
-    }
+      }
 
-    if (oid_list_todo_num == 0)
+      /* Allocate a new `csnmp_list_instances_t', insert the instance name and
+       * add it to the list */
+      if (csnmp_instance_list_add (&job->instance_list_head,
+            &job->instance_list_tail, vb, host, data) != 0)
+      {
+        ERROR ("snmp plugin: csnmp_instance_list_add failed.");
+        return (-1);
+      }
+    }
+    else /* The variable we are processing is a normal value */
     {
-      /* The request is still empty - so we are finished */
-      DEBUG ("snmp plugin: all variables have left their subtree");
-      status = 0;
-      break;
+      csnmp_table_values_t *vt;
+      oid_t vb_name;
+      oid_t suffix;
+      int ret;
+
+      csnmp_oid_init (&vb_name, vb->name, vb->name_length);
+
+      /* Calculate the current suffix. This is later used to check that the
+       * suffix is increasing. This also checks if we left the subtree */
+      ret = csnmp_oid_suffix (&suffix, &vb_name, data->values + i);
+      if (ret != 0)
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; i = %"PRIu32"; "
+            "Value probably left its subtree.",
+            host->name, data->name, i);
+        job->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Make sure the OIDs returned by the agent are increasing. Otherwise our
+       * table matching algorithm will get confused. */
+      if ((job->value_list_tail[i] != NULL)
+          && (csnmp_oid_compare (&suffix, &job->value_list_tail[i]->suffix) <= 0))
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; i = %"PRIu32"; "
+            "Suffix is not increasing.",
+            host->name, data->name, i);
+        job->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      vt = malloc (sizeof (*vt));
+      if (vt == NULL)
+      {
+        ERROR ("snmp plugin: malloc failed.");
+        return (-1);
+      }
+      memset (vt, 0, sizeof (*vt));
+
+      vt->value = csnmp_value_list_to_value (vb, job->ds->ds[i].type,
+          data->scale, data->shift, host->name, data->name);
+      memcpy (&vt->suffix, &suffix, sizeof (vt->suffix));
+      vt->next = NULL;
+
+      if (job->value_list_tail[i] == NULL)
+        job->value_list_head[i] = vt;
+      else
+        job->value_list_tail[i]->next = vt;
+      job->value_list_tail[i] = vt;
     }
 
+    /* Copy OID to oid_list[i] */
+    memcpy (job->oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
+    job->oid_list[i].oid_len = vb->name_length;
+  } /* for (vb = res->variables ...) */
+
+  return (0);
+} /* }}} int csnmp_table_response */
+
+static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+{
+  csnmp_job_t job;
+  struct snmp_pdu *req;
+  struct snmp_pdu *res;
+  int status;
+
+  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
+      host->name, data->name);
+
+  if (host->sess_handle == NULL)
+  {
+    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
+    return (-1);
+  }
+
+  status = csnmp_job_init (&job, host, data);
+  if (status != 0)
+    return (-1);
+
+  while (status == 0)
+  {
+    req = NULL;
+    status = csnmp_table_request (&job, &req);
+    if ((status != 0) || (req == NULL))
+      break;
+
     res = NULL;
     status = snmp_sess_synch_response (host->sess_handle, req, &res);
     if ((status != STAT_SUCCESS) || (res == NULL))
@@ -1497,8 +1822,6 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
         snmp_free_pdu (res);
       res = NULL;
 
-      /* snmp_synch_response already freed our PDU */
-      req = NULL;
       sfree (errstr);
       csnmp_host_close_session (host);
 
@@ -1506,185 +1829,54 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
       break;
     }
 
-    status = 0;
-    assert (res != NULL);
     c_release (LOG_INFO, &host->complaint,
         "snmp plugin: host %s: snmp_sess_synch_response successful.",
         host->name);
 
-    vb = res->variables;
-    if (vb == NULL)
-    {
-      status = -1;
-      break;
-    }
-
-    for (vb = res->variables, i = 0; (vb != NULL); vb = vb->next_variable, i++)
-    {
-      /* Calculate value index from todo list */
-      while (!oid_list_todo[i] && (i < oid_list_len))
-        i++;
-
-      /* An instance is configured and the res variable we process is the
-       * instance value (last index) */
-      if ((data->instance.oid.oid_len > 0) && (i == data->values_len))
-      {
-        if ((vb->type == SNMP_ENDOFMIBVIEW)
-            || (snmp_oid_ncompare (data->instance.oid.oid,
-                data->instance.oid.oid_len,
-                vb->name, vb->name_length,
-                data->instance.oid.oid_len) != 0))
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; Instance left its subtree.",
-              host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Allocate a new `csnmp_list_instances_t', insert the instance name and
-         * add it to the list */
-        if (csnmp_instance_list_add (&instance_list_head, &instance_list_tail,
-              res, host, data) != 0)
-        {
-          ERROR ("snmp plugin: csnmp_instance_list_add failed.");
-          status = -1;
-          break;
-        }
-      }
-      else /* The variable we are processing is a normal value */
-      {
-        csnmp_table_values_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init (&vb_name, vb->name, vb->name_length);
-
-        /* Calculate the current suffix. This is later used to check that the
-         * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix (&suffix, &vb_name, data->values + i);
-        if (ret != 0)
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; i = %i; "
-              "Value probably left its subtree.",
-              host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise our
-         * table matching algorithm will get confused. */
-        if ((value_list_tail[i] != NULL)
-            && (csnmp_oid_compare (&suffix, &value_list_tail[i]->suffix) <= 0))
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; i = %i; "
-              "Suffix is not increasing.",
-              host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        vt = malloc (sizeof (*vt));
-        if (vt == NULL)
-        {
-          ERROR ("snmp plugin: malloc failed.");
-          status = -1;
-          break;
-        }
-        memset (vt, 0, sizeof (*vt));
-
-        vt->value = csnmp_value_list_to_value (vb, ds->ds[i].type,
-            data->scale, data->shift, host->name, data->name);
-        memcpy (&vt->suffix, &suffix, sizeof (vt->suffix));
-        vt->next = NULL;
-
-        if (value_list_tail[i] == NULL)
-          value_list_head[i] = vt;
-        else
-          value_list_tail[i]->next = vt;
-        value_list_tail[i] = vt;
-      }
-
-      /* Copy OID to oid_list[i] */
-      memcpy (oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
-
-    } /* for (vb = res->variables ...) */
+    status = csnmp_table_response (&job, res);
 
-    if (res != NULL)
-      snmp_free_pdu (res);
+    snmp_free_pdu (res);
     res = NULL;
   } /* while (status == 0) */
 
-  if (res != NULL)
-    snmp_free_pdu (res);
-  res = NULL;
-
-  if (req != NULL)
-    snmp_free_pdu (req);
-  req = NULL;
-
   if (status == 0)
-    csnmp_dispatch_table (host, data, instance_list_head, value_list_head);
+    csnmp_dispatch_table (host, data, job.instance_list_head,
+        job.value_list_head);
 
   /* Free all allocated variables here */
-  while (instance_list_head != NULL)
-  {
-    csnmp_list_instances_t *next = instance_list_head->next;
-    sfree (instance_list_head);
-    instance_list_head = next;
-  }
-
-  for (i = 0; i < data->values_len; i++)
-  {
-    while (value_list_head[i] != NULL)
-    {
-      csnmp_table_values_t *next = value_list_head[i]->next;
-      sfree (value_list_head[i]);
-      value_list_head[i] = next;
-    }
-  }
-
-  sfree (value_list_head);
-  sfree (value_list_tail);
+  csnmp_job_destroy (&job);
 
   return (0);
 } /* int csnmp_read_table */
 
-static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+static struct snmp_pdu *csnmp_value_request (csnmp_job_t *job) /* {{{ */
 {
   struct snmp_pdu *req;
-  struct snmp_pdu *res;
-  struct variable_list *vb;
-
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
-
-  int status;
   int i;
 
-  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
-      host->name, data->name);
-
-  if (host->sess_handle == NULL)
+  req = snmp_pdu_create (SNMP_MSG_GET);
+  if (req == NULL)
   {
-    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return (-1);
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
+    return (NULL);
   }
 
-  ds = plugin_get_ds (data->type);
-  if (!ds)
-  {
-    ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
-    return (-1);
-  }
+  for (i = 0; i < job->data->values_len; i++)
+    snmp_add_null_var (req, job->data->values[i].oid,
+        job->data->values[i].oid_len);
 
-  if (ds->ds_num != data->values_len)
-  {
-    ERROR ("snmp plugin: DataSet `%s' requires %i values, but config talks about %i",
-        data->type, ds->ds_num, data->values_len);
-    return (-1);
-  }
+  return (req);
+} /* }}} struct snmp_pdu *csnmp_value_request */
+
+static int csnmp_value_response (csnmp_job_t *job, /* {{{ */
+    const struct snmp_pdu *res)
+{
+  host_definition_t *host = job->host;
+  data_definition_t *data = job->data;
+  const data_set_t *ds = job->ds;
+  struct variable_list *vb;
+  value_list_t vl = VALUE_LIST_INIT;
+  int i;
 
   vl.values_len = ds->ds_num;
   vl.values = (value_t *) malloc (sizeof (value_t) * vl.values_len);
@@ -1705,16 +1897,52 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
 
   vl.interval = host->interval;
 
-  req = snmp_pdu_create (SNMP_MSG_GET);
-  if (req == NULL)
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
   {
-    ERROR ("snmp plugin: snmp_pdu_create failed.");
-    sfree (vl.values);
+#if COLLECT_DEBUG
+    char buffer[1024];
+    snprint_variable (buffer, sizeof (buffer),
+        vb->name, vb->name_length, vb);
+    DEBUG ("snmp plugin: Got this variable: %s", buffer);
+#endif /* COLLECT_DEBUG */
+
+    for (i = 0; i < data->values_len; i++)
+      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
+            vb->name, vb->name_length) == 0)
+        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
+            data->scale, data->shift, host->name, data->name);
+  } /* for (res->variables) */
+
+  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
+  plugin_dispatch_values (&vl);
+  sfree (vl.values);
+
+  return (0);
+} /* }}} int csnmp_value_response */
+
+static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+{
+  csnmp_job_t job;
+  struct snmp_pdu *req;
+  struct snmp_pdu *res;
+  int status;
+
+  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
+      host->name, data->name);
+
+  if (host->sess_handle == NULL)
+  {
+    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
     return (-1);
   }
 
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var (req, data->values[i].oid, data->values[i].oid_len);
+  status = csnmp_job_init (&job, host, data);
+  if (status != 0)
+    return (-1);
+
+  req = csnmp_value_request (&job);
+  if (req == NULL)
+    return (-1);
 
   res = NULL;
   status = snmp_sess_synch_response (host->sess_handle, req, &res);
@@ -1737,32 +1965,12 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
     return (-1);
   }
 
+  status = csnmp_value_response (&job, res);
 
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
-  {
-#if COLLECT_DEBUG
-    char buffer[1024];
-    snprint_variable (buffer, sizeof (buffer),
-        vb->name, vb->name_length, vb);
-    DEBUG ("snmp plugin: Got this variable: %s", buffer);
-#endif /* COLLECT_DEBUG */
-
-    for (i = 0; i < data->values_len; i++)
-      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
-            vb->name, vb->name_length) == 0)
-        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
-            data->scale, data->shift, host->name, data->name);
-  } /* for (res->variables) */
-
-  if (res != NULL)
-    snmp_free_pdu (res);
+  snmp_free_pdu (res);
   res = NULL;
 
-  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
-  plugin_dispatch_values (&vl);
-  sfree (vl.values);
-
-  return (0);
+  return (status);
 } /* int csnmp_read_value */
 
 static int csnmp_read_host (user_data_t *ud)
@@ -1817,10 +2025,466 @@ static int csnmp_read_host (user_data_t *ud)
   return (0);
 } /* int csnmp_read_host */
 
+/* Asynchronous engine {{{
+ *
+ * Instead of one read callback per host, one thread reads all hosts. Each
+ * data definition of a host is a "job" with at most one request in flight.
+ * Up to "max_pending" jobs of a host run at the same time and all requests
+ * are sent using snmp_sess_async_send(), so a slow or unreachable host does
+ * not delay the others.
+ *
+ * Callgraph:
+ *  csnmp_async_thread
+ *  +-> csnmp_async_host_start
+ *  !   +-> csnmp_async_host_fill
+ *  !       +-> csnmp_async_job_send
+ *  !       +-> csnmp_async_job_finish
+ *  +-> snmp_sess_read2 / snmp_sess_timeout
+ *  !   +-> csnmp_async_callback
+ *  !       +-> csnmp_async_job_send
+ *  !       +-> csnmp_async_job_finish
+ *  !       +-> csnmp_async_host_fill
+ *  +-> csnmp_async_host_update
+ */
+static int csnmp_async_callback (int operation, netsnmp_session *session,
+    int reqid, netsnmp_pdu *res, void *magic);
+
+/* Returns zero if a request has been sent, greater than zero if the job is
+ * complete and less than zero on error. */
+static int csnmp_async_job_send (csnmp_job_t *job) /* {{{ */
+{
+  host_definition_t *host = job->host;
+  struct snmp_pdu *req;
+
+  if (job->data->is_table)
+  {
+    req = NULL;
+    if (csnmp_table_request (job, &req) != 0)
+      return (-1);
+    if (req == NULL)
+      return (1);
+  }
+  else
+  {
+    req = csnmp_value_request (job);
+    if (req == NULL)
+      return (-1);
+  }
+
+  if (snmp_sess_async_send (host->sess_handle, req,
+        csnmp_async_callback, job) == 0)
+  {
+    char *errstr = NULL;
+
+    snmp_sess_error (host->sess_handle, NULL, NULL, &errstr);
+    c_complain (LOG_ERR, &host->complaint,
+        "snmp plugin: host %s: snmp_sess_async_send failed: %s",
+        host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+    sfree (errstr);
+
+    snmp_free_pdu (req);
+    host->reopen = 1;
+    return (-1);
+  }
+
+  host->pending++;
+  return (0);
+} /* }}} int csnmp_async_job_send */
+
+static void csnmp_async_job_finish (csnmp_job_t *job, int status) /* {{{ */
+{
+  host_definition_t *host = job->host;
+  cdtime_t now;
+
+  if ((status == 0) && job->data->is_table)
+    csnmp_dispatch_table (host, job->data, job->instance_list_head,
+        job->value_list_head);
+  csnmp_job_destroy (job);
+
+  host->jobs_done++;
+  if (host->jobs_done < host->data_list_len)
+    return;
+
+  now = cdtime ();
+  if ((now - host->read_start) > host->interval)
+  {
+    WARNING ("snmp plugin: Host `%s' should be queried every %.3f "
+        "seconds, but reading all values takes %.3f seconds.",
+        host->name,
+        CDTIME_T_TO_DOUBLE (host->interval),
+        CDTIME_T_TO_DOUBLE (now - host->read_start));
+  }
+} /* }}} void csnmp_async_job_finish */
+
+/* Starts jobs until "max_pending" requests are in flight. */
+static void csnmp_async_host_fill (host_definition_t *host) /* {{{ */
+{
+  while ((host->pending < host->max_pending)
+      && (host->jobs_next < host->data_list_len))
+  {
+    csnmp_job_t *job = host->jobs + host->jobs_next;
+    int status;
+
+    status = csnmp_job_init (job, host, host->data_list[host->jobs_next]);
+    host->jobs_next++;
+    if (status != 0)
+    {
+      /* csnmp_job_init() clears "job->host" on failure. */
+      job->host = host;
+      csnmp_async_job_finish (job, -1);
+      continue;
+    }
+
+    status = csnmp_async_job_send (job);
+    if (status != 0)
+      csnmp_async_job_finish (job, (status > 0) ? 0 : -1);
+  }
+} /* }}} void csnmp_async_host_fill */
+
+static int csnmp_async_callback (int operation, /* {{{ */
+    netsnmp_session __attribute__((unused)) *session,
+    int __attribute__((unused)) reqid,
+    netsnmp_pdu *res, void *magic)
+{
+  csnmp_job_t *job = magic;
+  host_definition_t *host = job->host;
+  int status;
+
+#ifdef NETSNMP_CALLBACK_OP_DISCONNECT
+  /* The session is being closed. */
+  if (operation == NETSNMP_CALLBACK_OP_DISCONNECT)
+    return (1);
+#endif
+
+  host->pending--;
+
+  if ((operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) || (res == NULL))
+  {
+    c_complain (LOG_ERR, &host->complaint,
+        "snmp plugin: host %s: No response to the request for `%s'.",
+        host->name, job->data->name);
+    host->reopen = 1;
+    status = -1;
+  }
+  else
+  {
+    c_release (LOG_INFO, &host->complaint,
+        "snmp plugin: host %s: Received a response again.", host->name);
+
+    if (job->data->is_table)
+    {
+      status = csnmp_table_response (job, res);
+      if (status == 0)
+        status = csnmp_async_job_send (job);
+      if (status == 0) /* walk continues */
+        return (1);
+    }
+    else
+      status = csnmp_value_response (job, res);
+  }
+
+  csnmp_async_job_finish (job, (status > 0) ? 0 : status);
+  csnmp_async_host_fill (host);
+
+  /* The response is freed by the library. */
+  return (1);
+} /* }}} int csnmp_async_callback */
+
+/* Updates the time of the host's next retransmission or timeout and closes
+ * the session after errors, once the host is idle. Must not be called from
+ * csnmp_async_callback(). */
+static void csnmp_async_host_update (host_definition_t *host) /* {{{ */
+{
+  struct timeval tv;
+  int numfds = 0;
+  int block = 1;
+
+  host->timeout_at = 0;
+
+  if ((host->pending == 0) && host->reopen
+      && (host->jobs_done == host->data_list_len))
+  {
+    csnmp_host_close_session (host);
+    host->fd = -1;
+    host->reopen = 0;
+  }
+
+  if ((host->pending == 0) || (host->sess_handle == NULL))
+    return;
+
+  memset (&tv, 0, sizeof (tv));
+  snmp_sess_select_info2 (host->sess_handle, &numfds, &async_fdset,
+      &tv, &block);
+  NETSNMP_LARGE_FD_CLR (host->fd, &async_fdset);
+
+  if (!block)
+    host->timeout_at = cdtime () + TIMEVAL_TO_CDTIME_T (&tv);
+} /* }}} void csnmp_async_host_update */
+
+static void csnmp_async_host_start (host_definition_t *host, /* {{{ */
+    cdtime_t now)
+{
+  netsnmp_transport *transport;
+
+  if (host->jobs_done < host->data_list_len)
+  {
+    WARNING ("snmp plugin: Host `%s': The previous read has not completed "
+        "yet. Skipping this interval.", host->name);
+    return;
+  }
+
+  if (host->sess_handle == NULL)
+    csnmp_host_open_session (host);
+
+  if (host->sess_handle == NULL)
+    return;
+
+  transport = snmp_sess_transport (host->sess_handle);
+  if ((transport == NULL) || (transport->sock < 0))
+  {
+    ERROR ("snmp plugin: host %s: The session has no socket.", host->name);
+    csnmp_host_close_session (host);
+    return;
+  }
+  host->fd = transport->sock;
+
+  if (host->fd >= async_fdset_size)
+  {
+    netsnmp_large_fd_set_resize (&async_fdset, host->fd + 1);
+    async_fdset_size = host->fd + 1;
+  }
+
+  host->read_start = now;
+  host->jobs_next = 0;
+  host->jobs_done = 0;
+  host->reopen = 0;
+
+  csnmp_async_host_fill (host);
+  csnmp_async_host_update (host);
+} /* }}} void csnmp_async_host_start */
+
+static void csnmp_async_host_read (host_definition_t *host) /* {{{ */
+{
+  NETSNMP_LARGE_FD_SET (host->fd, &async_fdset);
+  snmp_sess_read2 (host->sess_handle, &async_fdset);
+  NETSNMP_LARGE_FD_CLR (host->fd, &async_fdset);
+
+  csnmp_async_host_update (host);
+} /* }}} void csnmp_async_host_read */
+
+static int csnmp_async_compare (void const *a, void const *b) /* {{{ */
+{
+  host_definition_t const *h0 = a;
+  host_definition_t const *h1 = b;
+
+  if (h0->next_read < h1->next_read)
+    return (-1);
+  else if (h0->next_read > h1->next_read)
+    return (1);
+  return (0);
+} /* }}} int csnmp_async_compare */
+
+static void *csnmp_async_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  struct pollfd *fds;
+  host_definition_t **fds_hosts;
+
+  fds = calloc (async_hosts_num + 1, sizeof (*fds));
+  fds_hosts = calloc (async_hosts_num + 1, sizeof (*fds_hosts));
+  if ((fds == NULL) || (fds_hosts == NULL))
+  {
+    ERROR ("snmp plugin: csnmp_async_thread: calloc failed.");
+    sfree (fds);
+    sfree (fds_hosts);
+    return (NULL);
+  }
+
+  while (42)
+  {
+    host_definition_t *host;
+    cdtime_t now;
+    cdtime_t wakeup;
+    nfds_t fds_num;
+    int timeout_ms;
+    int status;
+    size_t i;
+
+    /* Start reading all hosts that are due. */
+    now = cdtime ();
+    while ((host = c_heap_get_root (async_heap)) != NULL)
+    {
+      if (host->next_read > now)
+      {
+        c_heap_insert (async_heap, host);
+        break;
+      }
+
+      csnmp_async_host_start (host, now);
+
+      host->next_read += host->interval;
+      /* Don't try to catch up if we fell behind. */
+      if (host->next_read <= now)
+        host->next_read = now + host->interval;
+      c_heap_insert (async_heap, host);
+    }
+
+    wakeup = (host != NULL) ? host->next_read : now + plugin_get_interval ();
+
+    fds[0].fd = async_pipe[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds_num = 1;
+
+    for (i = 0; i < async_hosts_num; i++)
+    {
+      host = async_hosts[i];
+      if (host->pending == 0)
+        continue;
+
+      fds[fds_num].fd = host->fd;
+      fds[fds_num].events = POLLIN;
+      fds[fds_num].revents = 0;
+      fds_hosts[fds_num] = host;
+      fds_num++;
+
+      if ((host->timeout_at != 0) && (host->timeout_at < wakeup))
+        wakeup = host->timeout_at;
+    }
+
+    timeout_ms = 0;
+    if (wakeup > now)
+      timeout_ms = (int) CDTIME_T_TO_MS (wakeup - now) + 1;
+
+    status = poll (fds, fds_num, timeout_ms);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR ("snmp plugin: poll(2) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+
+    /* csnmp_shutdown() has written to the pipe. */
+    if (fds[0].revents != 0)
+      break;
+
+    for (i = 1; i < fds_num; i++)
+      if (fds[i].revents != 0)
+        csnmp_async_host_read (fds_hosts[i]);
+
+    /* Let the library retransmit requests or report timeouts. */
+    now = cdtime ();
+    for (i = 1; i < fds_num; i++)
+    {
+      host = fds_hosts[i];
+      if ((host->timeout_at == 0) || (host->timeout_at > now))
+        continue;
+
+      snmp_sess_timeout (host->sess_handle);
+      csnmp_async_host_update (host);
+    }
+  } /* while (42) */
+
+  sfree (fds);
+  sfree (fds_hosts);
+  return (NULL);
+} /* }}} void *csnmp_async_thread */
+
+static int csnmp_async_start (void) /* {{{ */
+{
+  cdtime_t now;
+  size_t i;
+  int status;
+
+  async_heap = c_heap_create (csnmp_async_compare);
+  if (async_heap == NULL)
+  {
+    ERROR ("snmp plugin: c_heap_create failed.");
+    return (-1);
+  }
+
+  async_fdset_size = FD_SETSIZE;
+  netsnmp_large_fd_set_init (&async_fdset, async_fdset_size);
+
+  if (pipe (async_pipe) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("snmp plugin: pipe(2) failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  /* Spread the hosts over the interval to avoid bursts of requests. */
+  now = cdtime ();
+  for (i = 0; i < async_hosts_num; i++)
+  {
+    host_definition_t *host = async_hosts[i];
+
+    if (host->interval == 0)
+      host->interval = plugin_get_interval ();
+
+    host->next_read = now + (host->interval * i) / async_hosts_num;
+    c_heap_insert (async_heap, host);
+  }
+
+  status = plugin_thread_create (&async_thread, /* attr = */ NULL,
+      csnmp_async_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("snmp plugin: Starting the asynchronous engine failed.");
+    return (-1);
+  }
+  async_thread_running = 1;
+
+  INFO ("snmp plugin: Reading %zu hosts asynchronously.", async_hosts_num);
+  return (0);
+} /* }}} int csnmp_async_start */
+
+static void csnmp_async_stop (void) /* {{{ */
+{
+  size_t i;
+
+  if (async_thread_running)
+  {
+    if (write (async_pipe[1], "", 1) != 1)
+      pthread_cancel (async_thread);
+    pthread_join (async_thread, NULL);
+    async_thread_running = 0;
+  }
+
+  for (i = 0; i < async_hosts_num; i++)
+    csnmp_host_definition_destroy (async_hosts[i]);
+  sfree (async_hosts);
+  async_hosts_num = 0;
+
+  if (async_heap != NULL)
+  {
+    c_heap_destroy (async_heap);
+    async_heap = NULL;
+    netsnmp_large_fd_set_cleanup (&async_fdset);
+    async_fdset_size = 0;
+  }
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (async_pipe); i++)
+  {
+    if (async_pipe[i] >= 0)
+      close (async_pipe[i]);
+    async_pipe[i] = -1;
+  }
+} /* }}} void csnmp_async_stop */
+/* }}} End of the asynchronous engine */
+
 static int csnmp_init (void)
 {
   call_snmp_init_once ();
 
+  if ((async_hosts_num > 0) && !async_thread_running)
+    return (csnmp_async_start ());
+
   return (0);
 } /* int csnmp_init */
 
@@ -1831,6 +2495,8 @@ static int csnmp_shutdown (void)
 
   /* When we get here, the read threads have been stopped and all the
    * `host_definition_t' will be freed. */
+  csnmp_async_stop ();
+
   DEBUG ("snmp plugin: Destroying all data definitions.");
 
   data_this = data_head;
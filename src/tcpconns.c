@@ -77,6 +77,9 @@
 #if HAVE_LINUX_INET_DIAG_H
 # include <linux/inet_diag.h>
 #endif
+#if HAVE_LINUX_RTNETLINK_H
+# include <linux/rtnetlink.h>
+#endif
 # include <sys/socket.h>
 # include <arpa/inet.h>
 /* #endif KERNEL_LINUX */
@@ -266,6 +269,7 @@ typedef struct port_entry_s
   uint32_t count_local[TCP_STATE_MAX + 1];
   uint32_t count_remote[TCP_STATE_MAX + 1];
   struct port_entry_s *next;
+  struct port_entry_s *hash_next;
 } port_entry_t;
 
 static const char *config_keys[] =
@@ -282,14 +286,28 @@ static int port_collect_total = 0;
 static port_entry_t *port_list_head = NULL;
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
+/* Every connection is looked up twice, by local and by remote port, and most
+ * lookups fail. The bitmap marks the ports with an entry, so a failing lookup
+ * is a single test. */
+#define PORT_HASH_SIZE 256
+#define PORT_HASH(port) (((port) ^ ((port) >> 8)) & (PORT_HASH_SIZE - 1))
+static port_entry_t *port_hash[PORT_HASH_SIZE];
+static uint8_t port_bitmap[65536 / 8];
+
 #if KERNEL_LINUX
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
 /* This depends on linux inet_diag_req because if this structure is missing,
  * sequence_number is useless and we get a compilation warning.
  */
 static uint32_t sequence_number = 0;
-#endif
 
+/* The socket is kept open between reads. Large buffers let the kernel put
+ * more sockets into each message of a dump. */
+# define NETLINK_BUFFER_SIZE 65536
+# define NETLINK_RCVBUF_SIZE (1024 * 1024)
+static int nl_fd = -1;
+static char *nl_buffer = NULL;
+#endif
 enum
 {
   SRC_DUNNO,
@@ -382,12 +400,17 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
 {
   port_entry_t *ret;
 
-  ret = port_list_head;
-  while (ret != NULL)
+  if ((port_bitmap[port / 8] & (1 << (port % 8))) == 0)
   {
-    if (ret->port == port)
-      break;
-    ret = ret->next;
+    if (create == 0)
+      return (NULL);
+    ret = NULL;
+  }
+  else
+  {
+    for (ret = port_hash[PORT_HASH (port)]; ret != NULL; ret = ret->hash_next)
+      if (ret->port == port)
+	break;
   }
 
   if ((ret == NULL) && (create != 0))
@@ -400,11 +423,32 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
     ret->port = port;
     ret->next = port_list_head;
     port_list_head = ret;
+
+    ret->hash_next = port_hash[PORT_HASH (port)];
+    port_hash[PORT_HASH (port)] = ret;
+    port_bitmap[port / 8] |= (uint8_t) (1 << (port % 8));
   }
 
   return (ret);
 } /* port_entry_t *conn_get_port_entry */
 
+static void conn_remove_port_hash (port_entry_t *pe)
+{
+  port_entry_t **ptr;
+
+  for (ptr = &port_hash[PORT_HASH (pe->port)]; *ptr != NULL;
+      ptr = &(*ptr)->hash_next)
+  {
+    if (*ptr == pe)
+    {
+      *ptr = pe->hash_next;
+      break;
+    }
+  }
+
+  port_bitmap[pe->port / 8] &= (uint8_t) ~(1 << (pe->port % 8));
+} /* void conn_remove_port_hash */
+
 /* Removes ports that were added automatically due to the `ListeningPorts'
  * setting but which are no longer listening. */
 static void conn_reset_port_entry (void)
@@ -432,6 +476,7 @@ static void conn_reset_port_entry (void)
       else
 	prev->next = next;
 
+      conn_remove_port_hash (pe);
       sfree (pe);
       pe = next;
 
@@ -442,6 +487,7 @@ static void conn_reset_port_entry (void)
     memset (pe->count_remote, '\0', sizeof (pe->count_remote));
     pe->flags &= ~PORT_IS_LISTENING;
 
+    prev = pe;
     pe = pe->next;
   }
 } /* void conn_reset_port_entry */
@@ -486,101 +532,210 @@ static int conn_handle_ports (uint16_t port_local, uint16_t port_remote, uint8_t
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
-/* Returns zero on success, less than zero on socket error and greater than
- * zero on other errors. */
-static int conn_read_netlink (void)
-{
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
-  int fd;
-  struct sockaddr_nl nladdr;
-  struct nlreq req;
-  struct msghdr msg;
-  struct iovec iov;
-  struct inet_diag_msg *r;
-  char buf[8192];
+static void conn_netlink_close (void)
+{
+  if (nl_fd >= 0)
+    close (nl_fd);
+  nl_fd = -1;
+} /* void conn_netlink_close */
+
+static int conn_netlink_open (void)
+{
+  char errbuf[1024];
+  int rcvbuf = NETLINK_RCVBUF_SIZE;
+
+  if (nl_buffer == NULL)
+  {
+    nl_buffer = malloc (NETLINK_BUFFER_SIZE);
+    if (nl_buffer == NULL)
+      return (-1);
+  }
 
   /* If this fails, it's likely a permission problem. We'll fall back to
    * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0)
+  nl_fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+  if (nl_fd < 0)
   {
     ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
 	"NETLINK_INET_DIAG) failed: %s",
-	sstrerror (errno, buf, sizeof (buf)));
+	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  memset(&nladdr, 0, sizeof(nladdr));
-  nladdr.nl_family = AF_NETLINK;
+  /* SO_RCVBUFFORCE ignores rmem_max but requires CAP_NET_ADMIN. */
+  if (setsockopt (nl_fd, SOL_SOCKET, SO_RCVBUFFORCE,
+	&rcvbuf, sizeof (rcvbuf)) != 0)
+    setsockopt (nl_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+  return (0);
+} /* int conn_netlink_open */
+
+/* Appends a test for "port == value" to the bytecode at "bc". If the port
+ * matches, the test jumps to "accept"; otherwise to the next test. Both are
+ * given as offsets from the start of the bytecode. Returns the size of the
+ * test in bytes. */
+static size_t conn_bc_port_test (struct inet_diag_bc_op *bc, size_t offset,
+    int remote, uint16_t port, size_t next, size_t accept)
+{
+  struct inet_diag_bc_op *op = bc + (offset / sizeof (*op));
+
+  /* The "yes" branch of each operation must lead to the next one, so the
+   * "port >= value && port <= value" test is followed by an unconditional
+   * jump, which always takes the "no" branch. */
+  op[0].code = remote ? INET_DIAG_BC_D_GE : INET_DIAG_BC_S_GE;
+  op[0].yes = 2 * sizeof (*op);
+  op[0].no = (unsigned short) (next - offset);
+  op[1].no = port;
+
+  op[2].code = remote ? INET_DIAG_BC_D_LE : INET_DIAG_BC_S_LE;
+  op[2].yes = 2 * sizeof (*op);
+  op[2].no = (unsigned short) (next - (offset + 2 * sizeof (*op)));
+  op[3].no = port;
+
+  op[4].code = INET_DIAG_BC_JMP;
+  op[4].yes = sizeof (*op);
+  op[4].no = (unsigned short) (accept - (offset + 4 * sizeof (*op)));
+
+  return (5 * sizeof (*op));
+} /* size_t conn_bc_port_test */
+
+/* Builds a filter that only passes sockets whose local or remote port has an
+ * entry. Returns the size of the bytecode, or zero if there is no entry or
+ * the filter would be too large. */
+static size_t conn_bc_build (struct inet_diag_bc_op **ret_bc)
+{
+  struct inet_diag_bc_op *bc;
+  port_entry_t *pe;
+  size_t tests_num = 0;
+  size_t bc_len;
+  size_t offset = 0;
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING))
+      tests_num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      tests_num++;
+  }
+
+  bc_len = tests_num * 5 * sizeof (*bc);
+  /* Jumps are limited to 16 bits. */
+  if ((tests_num == 0) || (bc_len + sizeof (*bc) > 0xffff))
+    return (0);
 
-  memset(&req, 0, sizeof(req));
-  req.nlh.nlmsg_len = sizeof(req);
-  req.nlh.nlmsg_type = TCPDIAG_GETSOCK;
+  bc = calloc (1, bc_len);
+  if (bc == NULL)
+    return (0);
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    int remote;
+
+    for (remote = 0; remote < 2; remote++)
+    {
+      size_t next;
+
+      if (!remote && !(pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING)))
+	continue;
+      if (remote && !(pe->flags & PORT_COLLECT_REMOTE))
+	continue;
+
+      /* Jumping beyond the end rejects the socket. */
+      next = offset + 5 * sizeof (*bc);
+      if (next >= bc_len)
+	next = bc_len + sizeof (*bc);
+
+      offset += conn_bc_port_test (bc, offset, remote, pe->port,
+	  next, /* accept = */ bc_len);
+    }
+  }
+
+  *ret_bc = bc;
+  return (bc_len);
+} /* size_t conn_bc_build */
+
+/* Dumps the TCP sockets in "states", optionally filtered by "bc". Returns
+ * zero on success, less than zero on socket error and greater than zero on
+ * other errors. */
+static int conn_netlink_dump (uint32_t states,
+    struct inet_diag_bc_op const *bc, size_t bc_len, _Bool summary)
+{
+  char errbuf[1024];
+  struct sockaddr_nl nladdr;
+  struct nlreq *req;
+  struct rtattr *rta;
+  size_t req_len;
+  struct inet_diag_msg *r;
+
+  req_len = NLMSG_ALIGN (sizeof (*req));
+  if (bc_len > 0)
+    req_len += RTA_SPACE (bc_len);
+
+  req = calloc (1, req_len);
+  if (req == NULL)
+    return (1);
+
+  req->nlh.nlmsg_len = req_len;
+  req->nlh.nlmsg_type = TCPDIAG_GETSOCK;
   /* NLM_F_ROOT: return the complete table instead of a single entry.
    * NLM_F_MATCH: return all entries matching criteria (not implemented)
    * NLM_F_REQUEST: must be set on all request messages */
-  req.nlh.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
-  req.nlh.nlmsg_pid = 0;
+  req->nlh.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
+  req->nlh.nlmsg_pid = 0;
   /* The sequence_number is used to track our messages. Since netlink is not
    * reliable, we don't want to end up with a corrupt or incomplete old
    * message in case the system is/was out of memory. */
-  req.nlh.nlmsg_seq = ++sequence_number;
-  req.r.idiag_family = AF_INET;
-  req.r.idiag_states = 0xfff;
-  req.r.idiag_ext = 0;
-
-  memset(&iov, 0, sizeof(iov));
-  iov.iov_base = &req;
-  iov.iov_len = sizeof(req);
-
-  memset(&msg, 0, sizeof(msg));
-  msg.msg_name = (void*)&nladdr;
-  msg.msg_namelen = sizeof(nladdr);
-  msg.msg_iov = &iov;
-  msg.msg_iovlen = 1;
-
-  if (sendmsg (fd, &msg, 0) < 0)
+  req->nlh.nlmsg_seq = ++sequence_number;
+  /* This request returns IPv4 and IPv6 sockets alike. */
+  req->r.idiag_family = AF_INET;
+  req->r.idiag_states = states;
+  req->r.idiag_ext = 0;
+
+  if (bc_len > 0)
   {
-    ERROR ("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
-	sstrerror (errno, buf, sizeof (buf)));
-    close (fd);
-    return (-1);
+    rta = (struct rtattr *) (((char *) req) + NLMSG_ALIGN (sizeof (*req)));
+    rta->rta_type = INET_DIAG_REQ_BYTECODE;
+    rta->rta_len = RTA_LENGTH (bc_len);
+    memcpy (RTA_DATA (rta), bc, bc_len);
   }
 
-  iov.iov_base = buf;
-  iov.iov_len = sizeof(buf);
+  memset (&nladdr, 0, sizeof (nladdr));
+  nladdr.nl_family = AF_NETLINK;
+
+  if (sendto (nl_fd, req, req_len, 0,
+	(struct sockaddr *) &nladdr, sizeof (nladdr)) < 0)
+  {
+    ERROR ("tcpconns plugin: conn_read_netlink: sendto(2) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (req);
+    return (-1);
+  }
+  sfree (req);
 
   while (1)
   {
     int status;
     struct nlmsghdr *h;
 
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (void*)&nladdr;
-    msg.msg_namelen = sizeof(nladdr);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-
-    status = recvmsg(fd, (void *) &msg, /* flags = */ 0);
+    status = recv (nl_fd, nl_buffer, NETLINK_BUFFER_SIZE, /* flags = */ 0);
     if (status < 0)
     {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
-      ERROR ("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
-	  sstrerror (errno, buf, sizeof (buf)));
-      close (fd);
+      ERROR ("tcpconns plugin: conn_read_netlink: recv(2) failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
       return (-1);
     }
     else if (status == 0)
     {
-      close (fd);
       DEBUG ("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
 	  "reply from netlink socket.");
       return (0);
     }
 
-    h = (struct nlmsghdr*)buf;
+    h = (struct nlmsghdr *) nl_buffer;
     while (NLMSG_OK(h, status))
     {
       if (h->nlmsg_seq != sequence_number)
@@ -590,10 +745,7 @@ static int conn_read_netlink (void)
       }
 
       if (h->nlmsg_type == NLMSG_DONE)
-      {
-	close (fd);
 	return (0);
-      }
       else if (h->nlmsg_type == NLMSG_ERROR)
       {
 	struct nlmsgerr *msg_error;
@@ -601,17 +753,22 @@ static int conn_read_netlink (void)
 	msg_error = NLMSG_DATA(h);
 	WARNING ("tcpconns plugin: conn_read_netlink: Received error %i.",
 	    msg_error->error);
-
-	close (fd);
 	return (1);
       }
 
       r = NLMSG_DATA(h);
 
-      /* This code does not (need to) distinguish between IPv4 and IPv6. */
-      conn_handle_ports (ntohs(r->id.idiag_sport),
-	  ntohs(r->id.idiag_dport),
-	  r->idiag_state);
+      /* Only the totals are collected. */
+      if (summary)
+      {
+	if (r->idiag_state <= TCP_STATE_MAX)
+	  count_total[r->idiag_state]++;
+      }
+      else
+	/* This code does not (need to) distinguish between IPv4 and IPv6. */
+	conn_handle_ports (ntohs(r->id.idiag_sport),
+	    ntohs(r->id.idiag_dport),
+	    r->idiag_state);
 
       h = NLMSG_NEXT(h, status);
     } /* while (NLMSG_OK) */
@@ -619,6 +776,60 @@ static int conn_read_netlink (void)
 
   /* Not reached because the while() loop above handles the exit condition. */
   return (0);
+} /* int conn_netlink_dump */
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink (void)
+{
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  uint32_t states = 0xfff;
+  struct inet_diag_bc_op *bc = NULL;
+  size_t bc_len = 0;
+  int status;
+
+  if ((nl_fd < 0) && (conn_netlink_open () != 0))
+    return (-1);
+
+  /* Without per-port statistics, the sockets are only counted. */
+  if ((port_list_head == NULL) && (port_collect_listening == 0))
+  {
+    status = conn_netlink_dump (states, NULL, 0, /* summary = */ 1);
+    if (status < 0)
+      conn_netlink_close ();
+    return (status);
+  }
+
+  /* Find the listening ports first, so the other sockets can be filtered by
+   * port in the kernel. */
+  if (port_collect_listening != 0)
+  {
+    status = conn_netlink_dump (1 << TCP_STATE_LISTEN, NULL, 0,
+	/* summary = */ 0);
+    if (status != 0)
+    {
+      if (status < 0)
+	conn_netlink_close ();
+      return (status);
+    }
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  /* The summary needs to see all sockets. */
+  if (port_collect_total == 0)
+  {
+    bc_len = conn_bc_build (&bc);
+    /* Nothing to count. */
+    if ((bc_len == 0) && (port_list_head == NULL))
+      return (0);
+  }
+
+  status = conn_netlink_dump (states, bc, bc_len, /* summary = */ 0);
+  sfree (bc);
+  if (status < 0)
+    conn_netlink_close ();
+  return (status);
 #else
   return (1);
 #endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
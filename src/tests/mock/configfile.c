@@ -0,0 +1,100 @@
+/**
+ * collectd - src/tests/mock/configfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "configfile.h"
+
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string)
+{
+  char *string;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
+    return (-1);
+
+  string = strdup (ci->values[0].value.string);
+  if (string == NULL)
+    return (-1);
+
+  free (*ret_string);
+  *ret_string = string;
+  return (0);
+}
+
+int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer,
+    size_t buffer_size)
+{
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
+    return (-1);
+
+  snprintf (buffer, buffer_size, "%s", ci->values[0].value.string);
+  return (0);
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value)
+{
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+    return (-1);
+
+  *ret_value = (int) ci->values[0].value.number;
+  return (0);
+}
+
+int cf_util_get_port_number (const oconfig_item_t *ci)
+{
+  int port;
+
+  if (ci->values_num != 1)
+    return (-1);
+  if (ci->values[0].type == OCONFIG_TYPE_NUMBER)
+    port = (int) ci->values[0].value.number;
+  else if (ci->values[0].type == OCONFIG_TYPE_STRING)
+    port = atoi (ci->values[0].value.string);
+  else
+    return (-1);
+
+  if ((port < 1) || (port > 65535))
+    return (-1);
+  return (port);
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool)
+{
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_BOOLEAN))
+    return (-1);
+
+  *ret_bool = ci->values[0].value.boolean ? 1 : 0;
+  return (0);
+}
+
+int cf_util_get_cdtime (const oconfig_item_t *ci, cdtime_t *ret_value)
+{
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+    return (-1);
+
+  *ret_value = DOUBLE_TO_CDTIME_T (ci->values[0].value.number);
+  return (0);
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -38,4 +38,10 @@ void plugin_log (int level, char const *format, ...)
   printf ("plugin_log (%i, \"%s\");\n", level, buffer);
 }
 
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return (pthread_create (thread, attr, start_routine, arg));
+}
+
 /* vim: set sw=2 sts=2 et : */
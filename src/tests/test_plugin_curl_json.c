@@ -0,0 +1,423 @@
+/**
+ * collectd - src/tests/test_plugin_curl_json.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+/* The plugin is included rather than linked so its static parser functions
+ * can be driven directly, without a web server. */
+#include "curl_json.c"
+
+#include "tests/macros.h"
+
+/* Size of the generated document used by the benchmark. */
+#define BENCH_SIZE (50 * 1024 * 1024)
+/* Size of the chunks the document is handed to the parser in. libcurl calls
+ * the write callback with at most CURL_MAX_WRITE_SIZE bytes. */
+#define BENCH_CHUNK 16384
+
+char hostname_g[DATA_MAX_NAME_LEN] = "example.com";
+
+static char result[4096];
+static _Bool record_values = 1;
+static size_t dispatched_num = 0;
+
+static data_source_t ds_gauge = { "value", DS_TYPE_GAUGE, NAN, NAN };
+static data_source_t ds_derive = { "value", DS_TYPE_DERIVE, 0, NAN };
+static data_set_t set_gauge = { "gauge", 1, &ds_gauge };
+static data_set_t set_derive = { "derive", 1, &ds_derive };
+
+data_set_t const *plugin_get_ds (char const *name)
+{
+  if (strcmp ("gauge", name) == 0)
+    return (&set_gauge);
+  else if (strcmp ("derive", name) == 0)
+    return (&set_derive);
+  return (NULL);
+}
+
+/* Appends "<type instance>=<value>" to "result". */
+int plugin_dispatch_values (value_list_t const *vl)
+{
+  size_t len = strlen (result);
+
+  dispatched_num++;
+  if (!record_values)
+    return (0);
+
+  if (strcmp ("derive", vl->type) == 0)
+    ssnprintf (result + len, sizeof (result) - len, "%s%s=%"PRIi64,
+        (len > 0) ? " " : "", vl->type_instance, vl->values[0].derive);
+  else
+    ssnprintf (result + len, sizeof (result) - len, "%s%s=%g",
+        (len > 0) ? " " : "", vl->type_instance, vl->values[0].gauge);
+  return (0);
+}
+
+int plugin_register_complex_config (char const *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_init (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_shutdown (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_complex_read (char const *group, char const *name,
+    plugin_read_cb callback, struct timespec const *interval,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+static int add_key (cj_t *db, char const *path, char const *type,
+    char const *instance)
+{
+  oconfig_value_t path_value;
+  oconfig_value_t values[2];
+  oconfig_item_t children[2];
+  oconfig_item_t ci;
+
+  memset (&ci, 0, sizeof (ci));
+  memset (children, 0, sizeof (children));
+
+  path_value.type = OCONFIG_TYPE_STRING;
+  path_value.value.string = (char *) path;
+  ci.key = "Key";
+  ci.values = &path_value;
+  ci.values_num = 1;
+  ci.children = children;
+
+  values[0].type = OCONFIG_TYPE_STRING;
+  values[0].value.string = (char *) type;
+  children[0].key = "Type";
+  children[0].values = values;
+  children[0].values_num = 1;
+  ci.children_num = 1;
+
+  if (instance != NULL)
+  {
+    values[1].type = OCONFIG_TYPE_STRING;
+    values[1].value.string = (char *) instance;
+    children[1].key = "Instance";
+    children[1].values = values + 1;
+    children[1].values_num = 1;
+    ci.children_num = 2;
+  }
+
+  return (cj_config_add_key (db, &ci));
+}
+
+static cj_t *db_create (void)
+{
+  cj_t *db;
+
+  db = calloc (1, sizeof (*db));
+  if (db == NULL)
+    return (NULL);
+  db->instance = strdup ("test");
+  return (db);
+}
+
+/* Feeds "json" to the parser in chunks of "chunk_size" bytes. */
+static int parse (cj_t *db, char const *json, size_t json_len,
+    size_t chunk_size)
+{
+  size_t offset;
+
+  if (cj_parse_begin (db) != 0)
+    return (-1);
+
+  for (offset = 0; offset < json_len; offset += chunk_size)
+  {
+    size_t len = json_len - offset;
+
+    if (len > chunk_size)
+      len = chunk_size;
+    if (cj_curl_callback ((void *) (json + offset), 1, len, db) != len)
+    {
+      cj_parse_abort (db);
+      return (-1);
+    }
+  }
+
+  return (cj_parse_end (db));
+}
+
+DEF_TEST(config)
+{
+  cj_t *db;
+
+  CHECK_NOT_NULL(db = db_create ());
+  OK(add_key (db, "a/b/c", "gauge", NULL) == 0);
+  OK(add_key (db, "/a/b/d", "gauge", NULL) == 0);
+  OK(add_key (db, "a/*", "gauge", NULL) == 0);
+  /* Invalid paths and duplicate keys are rejected. */
+  OK(add_key (db, "a//c", "gauge", NULL) != 0);
+  OK(add_key (db, "a/", "gauge", NULL) != 0);
+  OK(add_key (db, "a/b/c", "gauge", NULL) != 0);
+
+  OK(db->tree != NULL);
+  OK(db->tree->children_num == 1);
+  OK(db->tree->children[0]->any != NULL);
+  OK(db->tree->children[0]->children_num == 1);
+  OK(db->tree->children[0]->children[0]->children_num == 2);
+
+  cj_free (db);
+  return (0);
+}
+
+DEF_TEST(parse)
+{
+  char const *json =
+    "{\"stats\": {\"count\": 42,"
+    "             \"nested\": {\"value\": 5},"
+    "             \"ignored\": {\"value\": 6, \"list\": [1, [2, {}], 3]},"
+    "             \"string\": \"17\","
+    "             \"map\": 8},"
+    " \"array\": [10, 20, {\"x\": 30}, null, true],"
+    " \"hosts\": {\"a\": {\"up\": 1}, \"b\": {\"up\": 0}, \"c\": {\"down\": 1}},"
+    " \"missing\": {\"stats\": {\"count\": 1}}}";
+  char const *expect =
+    "stats-count=42 stats-nested-value=5 stats-string=17 array-1=20 "
+    "array-2-x=30 hosts-a-up=1 b_up=0";
+  size_t chunk_size;
+  cj_t *db;
+
+  CHECK_NOT_NULL(db = db_create ());
+  OK(add_key (db, "stats/count", "gauge", NULL) == 0);
+  OK(add_key (db, "stats/nested/value", "derive", NULL) == 0);
+  OK(add_key (db, "stats/string", "gauge", NULL) == 0);
+  /* Expects a map; the number is reported and ignored. */
+  OK(add_key (db, "stats/map/value", "gauge", NULL) == 0);
+  OK(add_key (db, "array/1", "gauge", NULL) == 0);
+  OK(add_key (db, "array/2/x", "gauge", NULL) == 0);
+  /* Booleans are not numbers. */
+  OK(add_key (db, "array/4", "gauge", NULL) == 0);
+  /* Exact names take precedence over the wildcard. */
+  OK(add_key (db, "hosts/*/up", "gauge", NULL) == 0);
+  OK(add_key (db, "hosts/b/up", "gauge", "b_up") == 0);
+
+  /* The result must not depend on how the document is split up. */
+  for (chunk_size = 1; chunk_size <= 4096; chunk_size *= 8)
+  {
+    result[0] = 0;
+    OK(parse (db, json, strlen (json), chunk_size) == 0);
+    STREQ(expect, result);
+  }
+
+  OK(parse (db, "{\"stats\": ", strlen ("{\"stats\": "), 4096) != 0);
+  OK(db->yajl == NULL);
+
+  cj_free (db);
+  return (0);
+}
+
+/* Generates a document resembling Elasticsearch's "_nodes/stats" response
+ * for a large cluster: a map of nodes, each with a few hundred statistics of
+ * which only a handful are collected. */
+static char *bench_document (size_t size, size_t *ret_len, int *ret_nodes)
+{
+  char const *pools[] = { "bulk", "fetch_shard_started", "fetch_shard_store",
+    "flush", "force_merge", "generic", "get", "index", "listener",
+    "management", "percolate", "refresh", "search", "snapshot", "suggest",
+    "warmer" };
+  char const *sections[] = { "docs", "store", "indexing", "get", "search",
+    "merges", "refresh", "flush", "warmer", "query_cache", "fielddata",
+    "percolate", "completion", "segments", "translog", "request_cache",
+    "recovery" };
+  char *buffer;
+  size_t len = 0;
+  int nodes = 0;
+
+  buffer = malloc (size + 65536);
+  if (buffer == NULL)
+    return (NULL);
+
+#define APPEND(...) len += (size_t) snprintf (buffer + len, \
+    size + 65536 - len, __VA_ARGS__)
+
+  APPEND ("{\"cluster_name\":\"bench\",\"nodes\":{");
+  while (len < size)
+  {
+    size_t i;
+    int j;
+
+    APPEND ("%s\"node%08d\":{\"timestamp\":1444444444444,"
+        "\"name\":\"node%d\",\"transport_address\":\"10.0.%d.%d:9300\","
+        "\"host\":\"10.0.%d.%d\",\"ip\":[\"10.0.%d.%d:9300\",\"NONE\"],"
+        "\"attributes\":{\"master\":\"false\"},\"indices\":{",
+        (nodes > 0) ? "," : "", nodes, nodes,
+        nodes / 256, nodes % 256, nodes / 256, nodes % 256,
+        nodes / 256, nodes % 256);
+    for (i = 0; i < STATIC_ARRAY_SIZE (sections); i++)
+    {
+      APPEND ("%s\"%s\":{", (i > 0) ? "," : "", sections[i]);
+      for (j = 0; j < 8; j++)
+        APPEND ("%s\"%s_%d\":%d,\"%s_%d_in_millis\":%d",
+            (j > 0) ? "," : "", (j == 0) ? "count" : "total", j,
+            nodes * 31 + j, "time", j, nodes * 17 + j);
+      APPEND ("}");
+    }
+    APPEND ("},\"os\":{\"timestamp\":1444444444444,\"load_average\":[0.5,0.7,0.9],"
+        "\"mem\":{\"total_in_bytes\":67108864000,\"free_in_bytes\":%d,"
+        "\"used_percent\":42}},\"process\":{\"open_file_descriptors\":%d,"
+        "\"max_file_descriptors\":65536,\"cpu\":{\"percent\":3,"
+        "\"total_in_millis\":123456}},\"jvm\":{\"uptime_in_millis\":99999,"
+        "\"mem\":{\"heap_used_in_bytes\":%d,\"heap_used_percent\":33,"
+        "\"heap_committed_in_bytes\":2147483648,\"pools\":{"
+        "\"young\":{\"used_in_bytes\":1,\"max_in_bytes\":2},"
+        "\"survivor\":{\"used_in_bytes\":3,\"max_in_bytes\":4},"
+        "\"old\":{\"used_in_bytes\":5,\"max_in_bytes\":6}}},"
+        "\"gc\":{\"collectors\":{\"young\":{\"collection_count\":%d,"
+        "\"collection_time_in_millis\":7},\"old\":{\"collection_count\":1,"
+        "\"collection_time_in_millis\":8}}}},\"thread_pool\":{",
+        nodes, nodes % 1000, nodes * 1000, nodes);
+    for (i = 0; i < STATIC_ARRAY_SIZE (pools); i++)
+      APPEND ("%s\"%s\":{\"threads\":8,\"queue\":0,\"active\":%d,"
+          "\"rejected\":%d,\"largest\":8,\"completed\":%d}",
+          (i > 0) ? "," : "", pools[i], (int) i, nodes % 7, nodes);
+    APPEND ("},\"fs\":{\"data\":[{\"path\":\"/var/lib/elasticsearch\","
+        "\"mount\":\"/\",\"type\":\"ext4\",\"total_in_bytes\":1000000,"
+        "\"free_in_bytes\":500000,\"available_in_bytes\":%d}]},"
+        "\"breakers\":{\"request\":{\"limit_size_in_bytes\":1,"
+        "\"estimated_size_in_bytes\":0,\"overhead\":1.0,\"tripped\":0},"
+        "\"fielddata\":{\"limit_size_in_bytes\":1,"
+        "\"estimated_size_in_bytes\":0,\"overhead\":1.03,\"tripped\":0}}}",
+        nodes);
+    nodes++;
+  }
+  APPEND ("}}");
+
+#undef APPEND
+
+  *ret_len = len;
+  *ret_nodes = nodes;
+  return (buffer);
+}
+
+static double timespec_diff (struct timespec const *begin,
+    struct timespec const *end)
+{
+  return (((double) (end->tv_sec - begin->tv_sec))
+      + ((double) (end->tv_nsec - begin->tv_nsec)) / 1e9);
+}
+
+/* Not a correctness test: reports how long parsing a large document takes,
+ * once with yajl alone and once with the plugin collecting a few values per
+ * node. The difference is the cost of the plugin's callbacks. Skipped
+ * unless COLLECTD_BENCHMARK is set. */
+DEF_TEST(benchmark)
+{
+  yajl_callbacks no_callbacks;
+  yajl_handle yajl;
+  struct timespec begin;
+  struct timespec end;
+  double yajl_time;
+  double plugin_time;
+  char *json;
+  size_t json_len;
+  size_t offset;
+  int nodes;
+  cj_t *db;
+
+  CHECK_NOT_NULL(json = bench_document (BENCH_SIZE, &json_len, &nodes));
+
+  memset (&no_callbacks, 0, sizeof (no_callbacks));
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  yajl = yajl_alloc (&no_callbacks,
+#if HAVE_YAJL_V2
+      /* alloc funcs = */ NULL,
+#else
+      /* alloc funcs = */ NULL, NULL,
+#endif
+      /* context = */ NULL);
+  CHECK_NOT_NULL(yajl);
+  for (offset = 0; offset < json_len; offset += BENCH_CHUNK)
+  {
+    size_t len = json_len - offset;
+
+    if (len > BENCH_CHUNK)
+      len = BENCH_CHUNK;
+    yajl_parse (yajl, (unsigned char *) json + offset, len);
+  }
+#if HAVE_YAJL_V2
+  OK(yajl_complete_parse (yajl) == yajl_status_ok);
+#else
+  OK(yajl_parse_complete (yajl) == yajl_status_ok);
+#endif
+  yajl_free (yajl);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  yajl_time = timespec_diff (&begin, &end);
+
+  CHECK_NOT_NULL(db = db_create ());
+  OK(add_key (db, "nodes/*/indices/docs/count_0", "gauge", NULL) == 0);
+  OK(add_key (db, "nodes/*/jvm/mem/heap_used_in_bytes", "gauge", NULL) == 0);
+  OK(add_key (db, "nodes/*/jvm/gc/collectors/young/collection_count",
+        "derive", NULL) == 0);
+  OK(add_key (db, "nodes/*/process/open_file_descriptors", "gauge",
+        NULL) == 0);
+  OK(add_key (db, "nodes/*/thread_pool/*/rejected", "derive", NULL) == 0);
+  OK(add_key (db, "nodes/*/fs/data/0/available_in_bytes", "gauge",
+        NULL) == 0);
+
+  record_values = 0;
+  dispatched_num = 0;
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  OK(parse (db, json, json_len, BENCH_CHUNK) == 0);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  plugin_time = timespec_diff (&begin, &end);
+  OK(dispatched_num == (size_t) nodes * (5 + 16));
+
+  printf ("%.1f MiB, %i nodes: yajl %.3f s, curl_json %.3f s "
+      "(%zu values)\n", (double) json_len / (1024.0 * 1024.0), nodes,
+      yajl_time, plugin_time, dispatched_num);
+
+  cj_free (db);
+  sfree (json);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(config);
+  RUN_TEST(parse);
+  if (getenv ("COLLECTD_BENCHMARK") != NULL)
+    RUN_TEST(benchmark);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
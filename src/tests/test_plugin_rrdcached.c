@@ -0,0 +1,379 @@
+/**
+ * collectd - src/tests/test_plugin_rrdcached.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+/* The plugin is included rather than linked so the BATCH client can be
+ * driven directly against the fake daemon below. */
+#include "rrdcached.c"
+
+#include "tests/macros.h"
+
+char hostname_g[DATA_MAX_NAME_LEN] = "example.com";
+
+/*
+ * Fake rrdcached
+ *
+ * Accepts connections on a UNIX socket and speaks just enough of the
+ * protocol to handle "BATCH". Updates of files with "reject" in their name
+ * are rejected the first time they are seen, updates of files with "bad" in
+ * their name are always rejected and updates of files with "old" in their
+ * name are rejected as being too old. All accepted updates are appended to
+ * "accepted".
+ */
+static char socket_path[PATH_MAX];
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static char accepted[4096];
+static char rejected[4096];
+static int connections_num = 0;
+static int batches_num = 0;
+static _Bool drop_next_batch = 0;
+
+static struct timespec read_interval;
+
+/* Returns non-zero if the update of "line" is to be rejected. Must be called
+ * with "fake_lock" held. */
+static int fake_reject (char const *line)
+{
+  if (strstr (line, "bad") != NULL)
+    return (1);
+
+  if ((strstr (line, "reject") == NULL) || (strstr (rejected, line) != NULL))
+    return (0);
+
+  sstrncpy (rejected + strlen (rejected), line,
+      sizeof (rejected) - strlen (rejected));
+  return (1);
+}
+
+static void fake_handle (int fd)
+{
+  FILE *fh = fdopen (fd, "r");
+  char line[1024];
+
+  while (fgets (line, sizeof (line), fh) != NULL)
+  {
+    char errors[1024] = "";
+    char response[1100];
+    int updates_num = 0;
+    int errors_num = 0;
+
+    if (strcmp ("BATCH\n", line) != 0)
+      break;
+
+    pthread_mutex_lock (&fake_lock);
+    if (drop_next_batch)
+    {
+      /* Like a daemon that timed out an idle connection. */
+      drop_next_batch = 0;
+      pthread_mutex_unlock (&fake_lock);
+      break;
+    }
+    batches_num++;
+    pthread_mutex_unlock (&fake_lock);
+
+    ssnprintf (response, sizeof (response),
+        "0 Go ahead.  End with dot '.' on its own line.\n");
+    swrite (fd, response, strlen (response));
+
+    while (fgets (line, sizeof (line), fh) != NULL)
+    {
+      if (strcmp (".\n", line) == 0)
+        break;
+      updates_num++;
+
+      pthread_mutex_lock (&fake_lock);
+      if (strstr (line, "old") != NULL)
+      {
+        errors_num++;
+        ssnprintf (errors + strlen (errors), sizeof (errors) - strlen (errors),
+            "%i illegal attempt to update using time 1 when last update "
+            "time is 1 (minimum one second step)\n", updates_num);
+      }
+      else if (fake_reject (line))
+      {
+        errors_num++;
+        ssnprintf (errors + strlen (errors), sizeof (errors) - strlen (errors),
+            "%i rejected\n", updates_num);
+      }
+      else
+        sstrncpy (accepted + strlen (accepted), line,
+            sizeof (accepted) - strlen (accepted));
+      pthread_mutex_unlock (&fake_lock);
+    }
+
+    ssnprintf (response, sizeof (response), "%i errors\n%s",
+        errors_num, errors);
+    swrite (fd, response, strlen (response));
+  }
+
+  fclose (fh);
+}
+
+static void *fake_rrdcached (void *arg)
+{
+  int listen_fd = *((int *) arg);
+
+  while (42)
+  {
+    int fd = accept (listen_fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    pthread_mutex_lock (&fake_lock);
+    connections_num++;
+    pthread_mutex_unlock (&fake_lock);
+
+    fake_handle (fd);
+  }
+
+  return (NULL);
+}
+
+static int fake_start (void)
+{
+  static int listen_fd;
+  struct sockaddr_un sa;
+  pthread_t thread;
+
+  ssnprintf (socket_path, sizeof (socket_path),
+      "/tmp/test_plugin_rrdcached.%i.sock", (int) getpid ());
+  unlink (socket_path);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, socket_path, sizeof (sa.sun_path));
+
+  listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return (-1);
+  if ((bind (listen_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (listen (listen_fd, 4) != 0))
+  {
+    close (listen_fd);
+    return (-1);
+  }
+
+  if (pthread_create (&thread, NULL, fake_rrdcached, &listen_fd) != 0)
+    return (-1);
+  pthread_detach (thread);
+  return (0);
+}
+
+static void fake_reset (void)
+{
+  pthread_mutex_lock (&fake_lock);
+  accepted[0] = 0;
+  rejected[0] = 0;
+  batches_num = 0;
+  pthread_mutex_unlock (&fake_lock);
+}
+
+/*
+ * Mocked plugin interface
+ */
+int plugin_register_complex_config (char const *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_init (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_shutdown (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_read (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_complex_read (char const *group, char const *name,
+    plugin_read_cb callback, struct timespec const *interval,
+    user_data_t *user_data)
+{
+  if (interval != NULL)
+    read_interval = *interval;
+  return (0);
+}
+
+int plugin_register_write (char const *name, plugin_write_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_register_flush (char const *name, plugin_flush_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_unregister_write (char const *name)
+{
+  return (0);
+}
+
+int plugin_dispatch_values (value_list_t const *vl)
+{
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+int cu_rrd_create_file (char const *filename, data_set_t const *ds,
+    value_list_t const *vl, rrdcreate_config_t const *cfg)
+{
+  return (0);
+}
+
+DEF_TEST(init)
+{
+  daemon_address = socket_path;
+  batch_size = 3;
+  batch_timeout = TIME_T_TO_CDTIME_T (5);
+
+  OK(rc_init () == 0);
+  /* The timeout callback has to run at the configured interval, not the
+   * global one. */
+  OK(read_interval.tv_sec == 5);
+  OK(read_interval.tv_nsec == 0);
+
+  return (0);
+}
+
+DEF_TEST(batch)
+{
+  fake_reset ();
+
+  OK(rc_batch_update ("/data/a.rrd", "1:1") == 0);
+  OK(rc_batch_update ("/data/b.rrd", "1:2") == 0);
+  OK(batches_num == 0);
+  /* Reaching "BatchSize" sends the batch. */
+  OK(rc_batch_update ("/data/c\\ d.rrd", "1:3") == 0);
+  OK(batches_num == 1);
+  STREQ("update /data/a.rrd 1:1\n"
+      "update /data/b.rrd 1:2\n"
+      "update /data/c\\\\\\ d.rrd 1:3\n", accepted);
+
+  /* Flushing sends incomplete batches. */
+  OK(rc_batch_update ("/data/a.rrd", "2:1") == 0);
+  OK(rc_flush (0, NULL, NULL) == 0);
+  OK(batches_num == 2);
+  OK(batch.updates_num == 0);
+
+  return (0);
+}
+
+DEF_TEST(partial_failure)
+{
+  fake_reset ();
+
+  OK(rc_batch_update ("/data/reject-1.rrd", "1:1") == 0);
+  OK(rc_batch_update ("/data/ok.rrd", "1:2") == 0);
+  OK(rc_batch_update ("/data/reject-2.rrd", "1:3") == 0);
+
+  /* Only the two rejected updates are sent again, in a batch of their
+   * own. */
+  OK(batches_num == 2);
+  STREQ("update /data/ok.rrd 1:2\n"
+      "update /data/reject-1.rrd 1:1\n"
+      "update /data/reject-2.rrd 1:3\n", accepted);
+
+  /* Updates that are rejected again are dropped, the others are not sent a
+   * second time. */
+  fake_reset ();
+  OK(rc_batch_update ("/data/bad.rrd", "2:1") == 0);
+  OK(rc_batch_update ("/data/ok.rrd", "2:2") == 0);
+  OK(rc_batch_update ("/data/reject-3.rrd", "2:3") == 0);
+  OK(batches_num == 2);
+  STREQ("update /data/ok.rrd 2:2\n"
+      "update /data/reject-3.rrd 2:3\n", accepted);
+  OK(batch.updates_num == 0);
+  OK(batch_queue_head == NULL);
+
+  /* Updates rejected as being too old are not sent again. */
+  fake_reset ();
+  OK(rc_batch_update ("/data/old.rrd", "1:1") == 0);
+  OK(rc_batch_update ("/data/ok.rrd", "3:2") == 0);
+  OK(rc_batch_update ("/data/old.rrd", "1:3") == 0);
+  OK(batches_num == 1);
+  STREQ("update /data/ok.rrd 3:2\n", accepted);
+
+  return (0);
+}
+
+DEF_TEST(reconnect)
+{
+  int connections_before = connections_num;
+
+  fake_reset ();
+  drop_next_batch = 1;
+
+  /* The daemon closes the connection without acknowledging the batch, so
+   * the entire batch is sent again on a new connection. */
+  OK(rc_batch_update ("/data/a.rrd", "3:1") == 0);
+  OK(rc_batch_update ("/data/b.rrd", "3:2") == 0);
+  OK(rc_batch_update ("/data/c.rrd", "3:3") == 0);
+  OK(connections_num == connections_before + 1);
+  OK(batches_num == 1);
+  STREQ("update /data/a.rrd 3:1\n"
+      "update /data/b.rrd 3:2\n"
+      "update /data/c.rrd 3:3\n", accepted);
+
+  return (0);
+}
+
+int main (void)
+{
+  /* Like the daemon, don't die when writing to a closed connection. */
+  signal (SIGPIPE, SIG_IGN);
+
+  if (fake_start () != 0)
+  {
+    printf ("Starting the fake rrdcached failed.\n");
+    return (1);
+  }
+
+  RUN_TEST(init);
+  RUN_TEST(batch);
+  RUN_TEST(partial_failure);
+  RUN_TEST(reconnect);
+
+  rc_shutdown ();
+  unlink (socket_path);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,433 @@
+/**
+ * collectd - src/tests/test_plugin_write_http.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+/* The plugin is included rather than linked so its callbacks can be driven
+ * directly against the HTTP server below. */
+#include "write_http.c"
+
+#include "tests/macros.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* Number of buffers sent by each test, one value each. */
+#define BATCHES_NUM 40
+/* Time the server takes to answer a request, in milliseconds. */
+#define RESPONSE_DELAY_MS 20
+
+char hostname_g[DATA_MAX_NAME_LEN] = "example.com";
+
+/*
+ * Fake HTTP server
+ *
+ * Accepts POST requests on a local port, with one thread per connection,
+ * and records the value found in each request body in the order the bodies
+ * arrive. If "fail_value" is set, the request carrying that value is
+ * answered with status 503 once. "in_flight_max" is the largest number of
+ * requests that were being answered at the same time.
+ */
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static int server_port = 0;
+static int received[4 * BATCHES_NUM];
+static int received_num = 0;
+static int fail_value = -1;
+static int in_flight = 0;
+static int in_flight_max = 0;
+
+static int server_read_request (int fd, char *buffer, size_t buffer_size,
+    char **ret_body, size_t *ret_body_len)
+{
+  size_t fill = 0;
+  size_t content_length = 0;
+  char *header_end = NULL;
+  char *ptr;
+
+  while (header_end == NULL)
+  {
+    ssize_t status;
+
+    if (fill >= buffer_size - 1)
+      return (-1);
+    status = read (fd, buffer + fill, buffer_size - 1 - fill);
+    if (status <= 0)
+      return (-1);
+    fill += (size_t) status;
+    buffer[fill] = 0;
+    header_end = strstr (buffer, "\r\n\r\n");
+  }
+
+  ptr = strstr (buffer, "Content-Length:");
+  if ((ptr != NULL) && (ptr < header_end))
+    content_length = (size_t) strtoul (ptr + strlen ("Content-Length:"),
+        NULL, 10);
+
+  *ret_body = header_end + 4;
+  if ((size_t) ((*ret_body) - buffer) + content_length >= buffer_size)
+    return (-1);
+  while ((size_t) ((buffer + fill) - (*ret_body)) < content_length)
+  {
+    ssize_t status = read (fd, buffer + fill, buffer_size - 1 - fill);
+    if (status <= 0)
+      return (-1);
+    fill += (size_t) status;
+  }
+  (*ret_body)[content_length] = 0;
+  *ret_body_len = content_length;
+
+  return (0);
+}
+
+static void *server_connection (void *arg)
+{
+  int fd = (int) (intptr_t) arg;
+  char buffer[8192];
+  char *body;
+  size_t body_len;
+
+  while (server_read_request (fd, buffer, sizeof (buffer),
+        &body, &body_len) == 0)
+  {
+    struct timespec ts_delay = { 0, RESPONSE_DELAY_MS * 1000000L };
+    char const *response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    char *ptr;
+    int value;
+
+    pthread_mutex_lock (&server_lock);
+    in_flight++;
+    if (in_flight_max < in_flight)
+      in_flight_max = in_flight;
+    pthread_mutex_unlock (&server_lock);
+
+    nanosleep (&ts_delay, NULL);
+
+    /* "PUTVAL <identifier> interval=<interval> <time>:<value>" */
+    ptr = strrchr (body, ':');
+    value = (ptr != NULL) ? atoi (ptr + 1) : -1;
+
+    pthread_mutex_lock (&server_lock);
+    in_flight--;
+    if (value == fail_value)
+    {
+      fail_value = -1;
+      response = "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Length: 0\r\n\r\n";
+    }
+    else if (received_num < (int) STATIC_ARRAY_SIZE (received))
+      received[received_num++] = value;
+    pthread_mutex_unlock (&server_lock);
+
+    if (swrite (fd, response, strlen (response)) != 0)
+      break;
+  }
+
+  close (fd);
+  return (NULL);
+}
+
+static void *server_thread (void *arg)
+{
+  int listen_fd = (int) (intptr_t) arg;
+
+  while (42)
+  {
+    pthread_t thread;
+    int fd;
+
+    fd = accept (listen_fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    if (pthread_create (&thread, NULL, server_connection,
+          (void *) (intptr_t) fd) != 0)
+    {
+      close (fd);
+      continue;
+    }
+    pthread_detach (thread);
+  }
+
+  return (NULL);
+}
+
+static int server_start (void)
+{
+  struct sockaddr_in sa;
+  socklen_t sa_len = sizeof (sa);
+  pthread_t thread;
+  int fd;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = 0;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return (-1);
+  if ((bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (listen (fd, 16) != 0)
+      || (getsockname (fd, (struct sockaddr *) &sa, &sa_len) != 0))
+  {
+    close (fd);
+    return (-1);
+  }
+  server_port = (int) ntohs (sa.sin_port);
+
+  if (pthread_create (&thread, NULL, server_thread,
+        (void *) (intptr_t) fd) != 0)
+    return (-1);
+  pthread_detach (thread);
+  return (0);
+}
+
+/*
+ * Mocked plugin interface
+ */
+static user_data_t write_user_data;
+
+int plugin_register_complex_config (char const *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_init (char const *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_flush (char const *name, plugin_flush_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_register_write (char const *name, plugin_write_cb callback,
+    user_data_t *user_data)
+{
+  write_user_data = *user_data;
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+static data_source_t ds_gauge = { "value", DS_TYPE_GAUGE, NAN, NAN };
+static data_set_t set_gauge = { "gauge", 1, &ds_gauge };
+
+/* Configures a node sending to the fake server with "max_requests"
+ * concurrent requests. */
+static int node_create (int max_requests)
+{
+  char url[256];
+  oconfig_value_t name_value;
+  oconfig_value_t values[3];
+  oconfig_item_t children[3];
+  oconfig_item_t ci;
+
+  ssnprintf (url, sizeof (url), "http://127.0.0.1:%i/", server_port);
+
+  memset (&ci, 0, sizeof (ci));
+  memset (children, 0, sizeof (children));
+
+  name_value.type = OCONFIG_TYPE_STRING;
+  name_value.value.string = "test";
+  ci.key = "Node";
+  ci.values = &name_value;
+  ci.values_num = 1;
+  ci.children = children;
+  ci.children_num = 3;
+
+  values[0].type = OCONFIG_TYPE_STRING;
+  values[0].value.string = url;
+  children[0].key = "URL";
+  children[0].values = values;
+  children[0].values_num = 1;
+
+  values[1].type = OCONFIG_TYPE_NUMBER;
+  values[1].value.number = (double) max_requests;
+  children[1].key = "MaxConcurrentRequests";
+  children[1].values = values + 1;
+  children[1].values_num = 1;
+
+  /* Large enough for all buffers to be queued at once. */
+  values[2].type = OCONFIG_TYPE_NUMBER;
+  values[2].value.number = (double) BATCHES_NUM;
+  children[2].key = "RetryQueueSize";
+  children[2].values = values + 2;
+  children[2].values_num = 1;
+
+  memset (&write_user_data, 0, sizeof (write_user_data));
+  return (wh_config_node (&ci));
+}
+
+/* Writes BATCHES_NUM values, flushing after each one so that every value is
+ * sent in a request of its own, waits for all of them to be delivered and
+ * returns the time this took. Buffers failing during shutdown are not
+ * retried, so the node is only freed once the server got everything. */
+static double send_batches (void)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[1];
+  struct timespec begin;
+  struct timespec end;
+  int i;
+
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 1;
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+
+  pthread_mutex_lock (&server_lock);
+  received_num = 0;
+  in_flight_max = 0;
+  pthread_mutex_unlock (&server_lock);
+
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  for (i = 0; i < BATCHES_NUM; i++)
+  {
+    values[0].gauge = (gauge_t) i;
+    vl.time = TIME_T_TO_CDTIME_T (1400000000 + i);
+    wh_write (&set_gauge, &vl, &write_user_data);
+    wh_flush (/* timeout = */ 0, /* identifier = */ NULL, &write_user_data);
+  }
+
+  for (i = 0; i < 1000; i++)
+  {
+    struct timespec ts_wait = { 0, 10000000L };
+    int num;
+
+    pthread_mutex_lock (&server_lock);
+    num = received_num;
+    pthread_mutex_unlock (&server_lock);
+    if (num >= BATCHES_NUM)
+      break;
+
+    nanosleep (&ts_wait, NULL);
+  }
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  wh_callback_free (write_user_data.data);
+
+  return (((double) (end.tv_sec - begin.tv_sec))
+      + ((double) (end.tv_nsec - begin.tv_nsec)) / 1e9);
+}
+
+/* Returns the number of values that arrived after a larger one, or -1 if
+ * values are missing or were received more than once. */
+static int count_reordered (void)
+{
+  _Bool seen[BATCHES_NUM];
+  int reordered = 0;
+  int i;
+
+  if (received_num != BATCHES_NUM)
+    return (-1);
+
+  memset (seen, 0, sizeof (seen));
+  for (i = 0; i < received_num; i++)
+  {
+    if ((received[i] < 0) || (received[i] >= BATCHES_NUM)
+        || seen[received[i]])
+      return (-1);
+    seen[received[i]] = 1;
+
+    if ((i > 0) && (received[i] < received[i - 1]))
+      reordered++;
+  }
+
+  return (reordered);
+}
+
+DEF_TEST(ordering)
+{
+  double duration;
+
+  CHECK_ZERO(node_create (/* max_requests = */ 1));
+  CHECK_NOT_NULL(write_user_data.data);
+
+  /* The failed request is retried after a second. The ones behind it wait
+   * for it, so everything arrives in order. */
+  fail_value = 3;
+  duration = send_batches ();
+  OK(fail_value == -1);
+  OK(count_reordered () == 0);
+
+  printf ("%i requests, one at a time, one retry: %.3f s\n",
+      BATCHES_NUM, duration);
+  return (0);
+}
+
+DEF_TEST(concurrency)
+{
+  double serial;
+  double concurrent;
+  int reordered;
+
+  CHECK_ZERO(node_create (/* max_requests = */ 1));
+  serial = send_batches ();
+  OK(count_reordered () == 0);
+  OK(in_flight_max == 1);
+
+  CHECK_ZERO(node_create (/* max_requests = */ 4));
+  concurrent = send_batches ();
+  /* Every value arrives exactly once, but not necessarily in order. */
+  reordered = count_reordered ();
+  OK(reordered >= 0);
+  OK(in_flight_max > 1);
+  OK(in_flight_max <= 4);
+
+  printf ("%i requests with a %i ms response time: one at a time %.3f s, "
+      "four at a time %.3f s (%i in flight at most, %i reordered)\n",
+      BATCHES_NUM, RESPONSE_DELAY_MS, serial, concurrent, in_flight_max,
+      reordered);
+
+  return (0);
+}
+
+int main (void)
+{
+  signal (SIGPIPE, SIG_IGN);
+
+  if (server_start () != 0)
+  {
+    printf ("Starting the HTTP server failed.\n");
+    return (1);
+  }
+  wh_init ();
+
+  RUN_TEST(ordering);
+  RUN_TEST(concurrency);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
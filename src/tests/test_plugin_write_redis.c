@@ -0,0 +1,518 @@
+/**
+ * collectd - src/tests/test_plugin_write_redis.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+/* The plugin is included rather than linked so the batches of its
+ * connection pool can be inspected. */
+#include "write_redis.c"
+
+#include "tests/macros.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+char hostname_g[DATA_MAX_NAME_LEN] = "example.com";
+
+/*
+ * Fake Redis server
+ *
+ * Accepts connections on a local port and parses the commands strictly
+ * according to the Redis protocol, i.e. as arrays of bulk strings. All data
+ * received at once is parsed and answered with a single write, and every
+ * such round trip is counted. ZADD commands for keys containing "bad" fail,
+ * all other commands succeed. MULTI and EXEC are handled like Redis does,
+ * with the replies of the queued commands returned by EXEC.
+ */
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static int server_port = 0;
+static char commands[8192];
+static int commands_num = 0;
+static int round_trips = 0;
+static int framing_errors = 0;
+
+/* Parses one command starting at "buffer" into "args". Returns the number
+ * of bytes used, zero if the command is incomplete, or -1 if it is not
+ * framed correctly. */
+static int server_parse (char *buffer, size_t size, char **args,
+    int *args_num, int args_max)
+{
+  char *ptr = buffer;
+  char *end = buffer + size;
+  char *eol;
+  int num;
+  int i;
+
+  eol = memchr (ptr, '\n', (size_t) (end - ptr));
+  if (eol == NULL)
+    return (0);
+  if ((ptr[0] != '*') || (eol[-1] != '\r'))
+    return (-1);
+  num = atoi (ptr + 1);
+  if ((num < 1) || (num > args_max))
+    return (-1);
+  ptr = eol + 1;
+
+  for (i = 0; i < num; i++)
+  {
+    long len;
+
+    eol = memchr (ptr, '\n', (size_t) (end - ptr));
+    if (eol == NULL)
+      return (0);
+    if ((ptr[0] != '$') || (eol[-1] != '\r'))
+      return (-1);
+    len = atol (ptr + 1);
+    if (len < 0)
+      return (-1);
+    ptr = eol + 1;
+
+    if ((end - ptr) < (len + 2))
+      return (0);
+    if ((ptr[len] != '\r') || (ptr[len + 1] != '\n'))
+      return (-1);
+    ptr[len] = 0;
+    args[i] = ptr;
+    ptr += len + 2;
+  }
+
+  *args_num = num;
+  return ((int) (ptr - buffer));
+}
+
+/* Appends the reply to the command in "args" to "reply". */
+static void server_execute (char **args, int args_num, _Bool *multi,
+    char *queued, int *queued_num, char *reply, size_t reply_size)
+{
+  char const *result;
+  size_t len = strlen (commands);
+
+  ssnprintf (commands + len, sizeof (commands) - len, "%s%s",
+      (len > 0) ? "\n" : "", args[0]);
+  commands_num++;
+
+  if (strcasecmp ("MULTI", args[0]) == 0)
+  {
+    *multi = 1;
+    *queued_num = 0;
+    queued[0] = 0;
+    result = "+OK\r\n";
+  }
+  else if (strcasecmp ("EXEC", args[0]) == 0)
+  {
+    len = strlen (reply);
+    ssnprintf (reply + len, reply_size - len, "*%i\r\n%s",
+        *queued_num, queued);
+    *multi = 0;
+    return;
+  }
+  else if ((strcasecmp ("ZADD", args[0]) == 0) && (args_num == 4)
+      && (strstr (args[1], "bad") != NULL))
+    result = "-ERR bad key\r\n";
+  else if (((strcasecmp ("ZADD", args[0]) == 0) && (args_num == 4))
+      || ((strcasecmp ("SADD", args[0]) == 0) && (args_num == 3)))
+    result = ":1\r\n";
+  else
+    result = "-ERR unexpected command\r\n";
+
+  if (*multi)
+  {
+    sstrncpy (queued + strlen (queued), result, 4096 - strlen (queued));
+    (*queued_num)++;
+    result = "+QUEUED\r\n";
+  }
+
+  sstrncpy (reply + strlen (reply), result, reply_size - strlen (reply));
+}
+
+static void *server_connection (void *arg)
+{
+  int fd = (int) (intptr_t) arg;
+  char buffer[16384];
+  size_t fill = 0;
+  char queued[4096];
+  int queued_num = 0;
+  _Bool multi = 0;
+
+  while (42)
+  {
+    char reply[8192] = "";
+    char *args[8];
+    int args_num = 0;
+    ssize_t status;
+    size_t pos = 0;
+
+    status = read (fd, buffer + fill, sizeof (buffer) - fill);
+    if (status <= 0)
+      break;
+    fill += (size_t) status;
+
+    pthread_mutex_lock (&server_lock);
+    while (pos < fill)
+    {
+      int len = server_parse (buffer + pos, fill - pos, args, &args_num,
+          STATIC_ARRAY_SIZE (args));
+      if (len < 0)
+      {
+        framing_errors++;
+        pos = fill;
+        break;
+      }
+      if (len == 0)
+        break;
+
+      server_execute (args, args_num, &multi, queued, &queued_num,
+          reply, sizeof (reply));
+      pos += (size_t) len;
+    }
+    if (reply[0] != 0)
+      round_trips++;
+    pthread_mutex_unlock (&server_lock);
+
+    memmove (buffer, buffer + pos, fill - pos);
+    fill -= pos;
+
+    if ((reply[0] != 0) && (swrite (fd, reply, strlen (reply)) != 0))
+      break;
+  }
+
+  close (fd);
+  return (NULL);
+}
+
+static void *server_thread (void *arg)
+{
+  int listen_fd = (int) (intptr_t) arg;
+
+  while (42)
+  {
+    pthread_t thread;
+    int fd;
+
+    fd = accept (listen_fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    if (pthread_create (&thread, NULL, server_connection,
+          (void *) (intptr_t) fd) != 0)
+    {
+      close (fd);
+      continue;
+    }
+    pthread_detach (thread);
+  }
+
+  return (NULL);
+}
+
+static int server_start (void)
+{
+  struct sockaddr_in sa;
+  socklen_t sa_len = sizeof (sa);
+  pthread_t thread;
+  int fd;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = 0;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return (-1);
+  if ((bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (listen (fd, 16) != 0)
+      || (getsockname (fd, (struct sockaddr *) &sa, &sa_len) != 0))
+  {
+    close (fd);
+    return (-1);
+  }
+  server_port = (int) ntohs (sa.sin_port);
+
+  if (pthread_create (&thread, NULL, server_thread,
+        (void *) (intptr_t) fd) != 0)
+    return (-1);
+  pthread_detach (thread);
+  return (0);
+}
+
+static void server_reset (void)
+{
+  pthread_mutex_lock (&server_lock);
+  commands[0] = 0;
+  commands_num = 0;
+  round_trips = 0;
+  framing_errors = 0;
+  pthread_mutex_unlock (&server_lock);
+}
+
+/*
+ * Mocked plugin interface
+ */
+static user_data_t write_user_data;
+static int warnings_num = 0;
+static int errors_num = 0;
+static char last_warning[1024];
+
+void plugin_log (int level, char const *format, ...)
+{
+  char buffer[1024];
+  va_list ap;
+
+  va_start (ap, format);
+  vsnprintf (buffer, sizeof (buffer), format, ap);
+  va_end (ap);
+
+  if (level == LOG_WARNING)
+  {
+    warnings_num++;
+    sstrncpy (last_warning, buffer, sizeof (last_warning));
+  }
+  else if (level == LOG_ERR)
+    errors_num++;
+
+  printf ("plugin_log (%i, \"%s\");\n", level, buffer);
+}
+
+int plugin_register_complex_config (char const *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_write (char const *name, plugin_write_cb callback,
+    user_data_t *user_data)
+{
+  write_user_data = *user_data;
+  return (0);
+}
+
+int plugin_register_flush (char const *name, plugin_flush_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_register_complex_read (char const *group, char const *name,
+    plugin_read_cb callback, struct timespec const *interval,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+static data_source_t ds_gauge = { "value", DS_TYPE_GAUGE, NAN, NAN };
+static data_set_t set_gauge = { "gauge", 1, &ds_gauge };
+
+/* Configures a node with a single connection, sending batches of three
+ * values to the fake server. */
+static wr_node_t *node_create (_Bool transaction)
+{
+  oconfig_value_t name_value;
+  oconfig_value_t values[6];
+  oconfig_item_t children[6];
+  oconfig_item_t ci;
+  size_t i;
+
+  memset (&ci, 0, sizeof (ci));
+  memset (children, 0, sizeof (children));
+
+  name_value.type = OCONFIG_TYPE_STRING;
+  name_value.value.string = "test";
+  ci.key = "Node";
+  ci.values = &name_value;
+  ci.values_num = 1;
+  ci.children = children;
+  ci.children_num = STATIC_ARRAY_SIZE (children);
+
+  values[0].type = OCONFIG_TYPE_STRING;
+  values[0].value.string = "127.0.0.1";
+  children[0].key = "Host";
+  values[1].type = OCONFIG_TYPE_NUMBER;
+  values[1].value.number = (double) server_port;
+  children[1].key = "Port";
+  values[2].type = OCONFIG_TYPE_NUMBER;
+  values[2].value.number = 1.0;
+  children[2].key = "PoolSize";
+  values[3].type = OCONFIG_TYPE_NUMBER;
+  values[3].value.number = 3.0;
+  children[3].key = "MaxBatchSize";
+  values[4].type = OCONFIG_TYPE_BOOLEAN;
+  values[4].value.boolean = transaction;
+  children[4].key = "Transaction";
+  /* The default of one millisecond is too tight for the server thread. */
+  values[5].type = OCONFIG_TYPE_NUMBER;
+  values[5].value.number = 999999.0;
+  children[5].key = "Timeout";
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (children); i++)
+  {
+    children[i].values = values + i;
+    children[i].values_num = 1;
+  }
+
+  memset (&write_user_data, 0, sizeof (write_user_data));
+  if (wr_config_node (&ci) != 0)
+    return (NULL);
+  return (write_user_data.data);
+}
+
+static int write_value (wr_node_t *node, char const *plugin, int value)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[1];
+
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 1;
+  vl.time = TIME_T_TO_CDTIME_T (1400000000 + value);
+  values[0].gauge = (gauge_t) value;
+
+  return (wr_write (&set_gauge, &vl, &write_user_data));
+}
+
+DEF_TEST(pipeline)
+{
+  wr_node_t *node;
+
+  CHECK_NOT_NULL(node = node_create (/* transaction = */ 0));
+  server_reset ();
+
+  /* Incomplete batches are only buffered. */
+  CHECK_ZERO(write_value (node, "a", 1));
+  CHECK_ZERO(write_value (node, "b", 2));
+  OK(commands_num == 0);
+  OK(node->pool[0].replies_num == 4);
+
+  /* The third value completes the batch, which is sent at once. */
+  CHECK_ZERO(write_value (node, "c", 3));
+  OK(framing_errors == 0);
+  OK(round_trips == 1);
+  OK(commands_num == 6);
+  STREQ("ZADD\nSADD\nZADD\nSADD\nZADD\nSADD", commands);
+
+  /* All replies have been consumed: the connection stays up and the next
+   * batch is answered in one round trip, too. */
+  OK(node->pool[0].conn != NULL);
+  OK(node->pool[0].replies_num == 0);
+  OK(node->pool[0].values_num == 0);
+
+  CHECK_ZERO(write_value (node, "a", 4));
+  OK(wr_flush (0, NULL, &write_user_data) == 0);
+  OK(round_trips == 2);
+  OK(commands_num == 8);
+  OK(node->pool[0].conn != NULL);
+  OK(warnings_num == 0);
+  OK(errors_num == 0);
+
+  wr_config_free (node);
+  return (0);
+}
+
+DEF_TEST(errors)
+{
+  wr_node_t *node;
+
+  CHECK_NOT_NULL(node = node_create (/* transaction = */ 0));
+  server_reset ();
+  warnings_num = 0;
+
+  CHECK_ZERO(write_value (node, "a", 1));
+  CHECK_ZERO(write_value (node, "bad", 2));
+  CHECK_ZERO(write_value (node, "c", 3));
+  OK(warnings_num == 1);
+  STREQ("write_redis plugin: 1 of 6 command(s) sent to node \"test\" failed. "
+      "The first error was: ERR bad key", last_warning);
+
+  /* The error reply was accounted for, so the next batch doesn't pick up a
+   * stale reply. */
+  CHECK_ZERO(write_value (node, "a", 4));
+  CHECK_ZERO(write_value (node, "b", 5));
+  CHECK_ZERO(write_value (node, "c", 6));
+  OK(warnings_num == 1);
+  OK(round_trips == 2);
+  OK(node->pool[0].conn != NULL);
+  OK(errors_num == 0);
+
+  wr_config_free (node);
+  return (0);
+}
+
+DEF_TEST(transaction)
+{
+  wr_node_t *node;
+
+  CHECK_NOT_NULL(node = node_create (/* transaction = */ 1));
+  server_reset ();
+  warnings_num = 0;
+
+  CHECK_ZERO(write_value (node, "a", 1));
+  CHECK_ZERO(write_value (node, "bad", 2));
+  CHECK_ZERO(write_value (node, "c", 3));
+  OK(framing_errors == 0);
+  OK(round_trips == 1);
+  STREQ("MULTI\nZADD\nSADD\nZADD\nSADD\nZADD\nSADD\nEXEC", commands);
+
+  /* The error is reported inside the reply to EXEC. */
+  OK(warnings_num == 1);
+  OK(node->pool[0].replies_num == 0);
+  OK(!node->pool[0].multi_sent);
+  OK(node->pool[0].conn != NULL);
+
+  CHECK_ZERO(write_value (node, "a", 4));
+  CHECK_ZERO(write_value (node, "b", 5));
+  CHECK_ZERO(write_value (node, "c", 6));
+  OK(warnings_num == 1);
+  OK(round_trips == 2);
+  OK(commands_num == 16);
+  OK(errors_num == 0);
+
+  wr_config_free (node);
+  return (0);
+}
+
+int main (void)
+{
+  signal (SIGPIPE, SIG_IGN);
+
+  if (server_start () != 0)
+  {
+    printf ("Starting the Redis server failed.\n");
+    return (1);
+  }
+
+  RUN_TEST(pipeline);
+  RUN_TEST(errors);
+  RUN_TEST(transaction);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,312 @@
+/**
+ * collectd - src/tests/test_utils_curl_multi.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "collectd.h"
+#include "tests/macros.h"
+#include "common.h"
+#include "utils_curl_multi.h"
+
+/* Transfers use file:// URLs, so no network is needed. A FIFO is used to
+ * keep a transfer in flight for as long as the test needs it to. */
+
+#define HANDLES_NUM 32
+
+static char test_dir[] = "/tmp/test_utils_curl_multi.XXXXXX";
+
+typedef struct
+{
+  CURL *curl;
+  char url[PATH_MAX + 16];
+  char data[64];
+  size_t data_len;
+
+  int done;
+  CURLcode status;
+} transfer_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int done_num = 0;
+
+static size_t write_cb (void *buf, size_t size, size_t nmemb, void *ud)
+{
+  transfer_t *t = ud;
+  size_t len = size * nmemb;
+
+  if (t->data_len + len >= sizeof (t->data))
+    return (0);
+
+  memcpy (t->data + t->data_len, buf, len);
+  t->data_len += len;
+  t->data[t->data_len] = 0;
+  return (len);
+}
+
+static void done_cb (CURL *curl, CURLcode status, void *ud)
+{
+  transfer_t *t = ud;
+
+  pthread_mutex_lock (&lock);
+  t->done++;
+  t->status = status;
+  done_num++;
+  pthread_cond_broadcast (&cond);
+  pthread_mutex_unlock (&lock);
+}
+
+/* Waits up to ten seconds for "num" transfers to complete. */
+static int wait_done (int num)
+{
+  struct timespec deadline;
+  int status = 0;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 10;
+
+  pthread_mutex_lock (&lock);
+  while ((done_num < num) && (status == 0))
+    status = pthread_cond_timedwait (&cond, &lock, &deadline);
+  status = (done_num >= num) ? 0 : -1;
+  pthread_mutex_unlock (&lock);
+
+  return (status);
+}
+
+/* A handle stays busy until its callback has returned, so a handle may be
+ * rejected briefly after done_cb() has run. */
+static int submit (ucm_t *ucm, transfer_t *t)
+{
+  int status;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+  {
+    status = ucm_submit (ucm, t->curl, t->url, 0, done_cb, t);
+    if (status != EBUSY)
+      break;
+    usleep (1000);
+  }
+
+  return (status);
+}
+
+static int transfer_init (transfer_t *t, char const *name,
+    char const *content)
+{
+  char path[PATH_MAX];
+
+  memset (t, 0, sizeof (*t));
+  ssnprintf (path, sizeof (path), "%s/%s", test_dir, name);
+  ssnprintf (t->url, sizeof (t->url), "file://%s", path);
+
+  if (content != NULL)
+  {
+    FILE *fh = fopen (path, "w");
+    if (fh == NULL)
+      return (-1);
+    fputs (content, fh);
+    fclose (fh);
+  }
+  else if (mkfifo (path, 0600) != 0)
+    return (-1);
+
+  t->curl = curl_easy_init ();
+  if (t->curl == NULL)
+    return (-1);
+
+  curl_easy_setopt (t->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt (t->curl, CURLOPT_URL, t->url);
+  curl_easy_setopt (t->curl, CURLOPT_WRITEFUNCTION, write_cb);
+  curl_easy_setopt (t->curl, CURLOPT_WRITEDATA, t);
+  return (0);
+}
+
+static void transfer_destroy (transfer_t *t)
+{
+  unlink (t->url + strlen ("file://"));
+  curl_easy_cleanup (t->curl);
+}
+
+DEF_TEST(config)
+{
+  ucm_options_t opts = UCM_OPTIONS_INIT;
+  oconfig_value_t value;
+  oconfig_item_t ci = { NULL, &value, 1, NULL, NULL, 0 };
+
+  ci.key = "Threads";
+  value.type = OCONFIG_TYPE_NUMBER;
+  value.value.number = 4;
+  OK(ucm_config_option (&opts, &ci) == 0);
+  OK(opts.threads == 4);
+
+  /* Out of range values are clamped. */
+  value.value.number = 0;
+  OK(ucm_config_option (&opts, &ci) == 0);
+  OK(opts.threads == 1);
+
+  ci.key = "MaxConnectionsPerHost";
+  value.value.number = 2;
+  OK(ucm_config_option (&opts, &ci) == 0);
+  OK(opts.max_host_connections == 2);
+
+  ci.key = "Asynchronous";
+  OK(ucm_config_option (&opts, &ci) < 0);
+  value.type = OCONFIG_TYPE_BOOLEAN;
+  value.value.boolean = 1;
+  OK(ucm_config_option (&opts, &ci) == 0);
+  OK(opts.enabled);
+
+  ci.key = "URL";
+  OK(ucm_config_option (&opts, &ci) > 0);
+
+  return (0);
+}
+
+DEF_TEST(submit)
+{
+  ucm_options_t opts = UCM_OPTIONS_INIT;
+  transfer_t t[HANDLES_NUM];
+  ucm_t *ucm;
+  int round;
+  int i;
+
+  for (i = 0; i < HANDLES_NUM; i++)
+  {
+    char name[16];
+    char content[16];
+
+    ssnprintf (name, sizeof (name), "file%i", i);
+    ssnprintf (content, sizeof (content), "content %i", i);
+    OK(transfer_init (t + i, name, content) == 0);
+  }
+
+  opts.threads = 4;
+  CHECK_NOT_NULL(ucm = ucm_create ("test", &opts));
+
+  done_num = 0;
+  for (round = 1; round <= 2; round++)
+  {
+    for (i = 0; i < HANDLES_NUM; i++)
+    {
+      t[i].data_len = 0;
+      OK(submit (ucm, t + i) == 0);
+    }
+    OK(wait_done (round * HANDLES_NUM) == 0);
+
+    for (i = 0; i < HANDLES_NUM; i++)
+    {
+      char content[16];
+
+      ssnprintf (content, sizeof (content), "content %i", i);
+      OK(t[i].done == round);
+      OK(t[i].status == CURLE_OK);
+      STREQ(content, t[i].data);
+    }
+  }
+
+  /* Canceling an idle handle forgets it; it may be submitted again. */
+  ucm_cancel (ucm, t[0].curl);
+  OK(submit (ucm, t) == 0);
+  OK(wait_done (2 * HANDLES_NUM + 1) == 0);
+  OK(t[0].done == 3);
+
+  ucm_destroy (ucm);
+
+  for (i = 0; i < HANDLES_NUM; i++)
+    transfer_destroy (t + i);
+
+  return (0);
+}
+
+DEF_TEST(busy)
+{
+  ucm_options_t opts = UCM_OPTIONS_INIT;
+  transfer_t fifo;
+  transfer_t file;
+  ucm_t *ucm;
+  int fd;
+
+  OK(transfer_init (&fifo, "fifo", NULL) == 0);
+  OK(transfer_init (&file, "file", "file") == 0);
+  CHECK_NOT_NULL(ucm = ucm_create ("test", &opts));
+
+  done_num = 0;
+  OK(ucm_submit (ucm, fifo.curl, fifo.url, 0, done_cb, &fifo) == 0);
+  /* The transfer cannot complete before something is written to the FIFO. */
+  OK(ucm_submit (ucm, fifo.curl, fifo.url, 0, done_cb, &fifo) == EBUSY);
+
+  /* Opening the FIFO succeeds once the worker has opened it for reading.
+   * From then on the (only) worker is blocked reading it. */
+  while (((fd = open (fifo.url + strlen ("file://"),
+              O_WRONLY | O_NONBLOCK)) < 0) && (errno == ENXIO))
+    usleep (1000);
+  OK(fd >= 0);
+
+  /* Queued behind the blocked worker, so canceling does not wait. */
+  OK(ucm_submit (ucm, file.curl, file.url, 0, done_cb, &file) == 0);
+  ucm_cancel (ucm, file.curl);
+
+  OK(write (fd, "fifo", 4) == 4);
+  close (fd);
+
+  OK(wait_done (1) == 0);
+  OK(fifo.done == 1);
+  OK(fifo.status == CURLE_OK);
+  STREQ("fifo", fifo.data);
+  OK(file.done == 0);
+
+  OK(ucm_submit (ucm, file.curl, file.url, 0, done_cb, &file) == 0);
+  OK(wait_done (2) == 0);
+  OK(file.done == 1);
+  STREQ("file", file.data);
+
+  ucm_destroy (ucm);
+  transfer_destroy (&fifo);
+  transfer_destroy (&file);
+
+  return (0);
+}
+
+int main (void)
+{
+  if (mkdtemp (test_dir) == NULL)
+  {
+    perror ("mkdtemp");
+    return (1);
+  }
+  curl_global_init (CURL_GLOBAL_ALL);
+
+  RUN_TEST(config);
+  RUN_TEST(submit);
+  RUN_TEST(busy);
+
+  curl_global_cleanup ();
+  rmdir (test_dir);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
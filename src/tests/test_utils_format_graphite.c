@@ -0,0 +1,160 @@
+/**
+ * collectd - src/tests/test_utils_format_graphite.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "collectd.h"
+#include "tests/macros.h"
+#include "common.h"
+#include "utils_format_graphite.h"
+
+static data_source_t load_dsrc[] = {
+  { "shortterm", DS_TYPE_GAUGE, 0, NAN },
+  { "midterm", DS_TYPE_GAUGE, 0, NAN },
+  { "longterm", DS_TYPE_GAUGE, 0, NAN }
+};
+static data_set_t load_ds = { "load", 3, load_dsrc };
+
+/* Same type and number of data sources as "load_ds", but different names,
+ * like after types.db has been changed and reloaded. */
+static data_source_t load_renamed_dsrc[] = {
+  { "one", DS_TYPE_GAUGE, 0, NAN },
+  { "five", DS_TYPE_GAUGE, 0, NAN },
+  { "fifteen", DS_TYPE_GAUGE, 0, NAN }
+};
+static data_set_t load_renamed_ds = { "load", 3, load_renamed_dsrc };
+
+static value_t values[3];
+
+static void set_vl (value_list_t *vl, char const *host)
+{
+  memset (vl, 0, sizeof (*vl));
+  vl->values = values;
+  vl->values_len = STATIC_ARRAY_SIZE (values);
+  vl->time = TIME_T_TO_CDTIME_T (1400000000);
+  sstrncpy (vl->host, host, sizeof (vl->host));
+  sstrncpy (vl->plugin, "load", sizeof (vl->plugin));
+  sstrncpy (vl->type, "load", sizeof (vl->type));
+
+  values[0].gauge = 0.5;
+  values[1].gauge = 1.0;
+  values[2].gauge = 2.0;
+}
+
+/* Formats "vl" with and without "cache" and checks that the results are the
+ * same. */
+static int check_cached (graphite_cache_t *cache, data_set_t const *ds,
+    value_list_t const *vl)
+{
+  char expect[1024];
+  char actual[1024];
+
+  memset (expect, 0, sizeof (expect));
+  memset (actual, 0, sizeof (actual));
+
+  CHECK_ZERO(format_graphite (expect, sizeof (expect), ds, vl,
+        "collectd.", NULL, '_', GRAPHITE_SEPARATE_INSTANCES));
+  CHECK_ZERO(format_graphite_cached (cache, actual, sizeof (actual), ds, vl));
+  STREQ(expect, actual);
+
+  return (0);
+}
+
+DEF_TEST(cached)
+{
+  graphite_cache_t *cache;
+  value_list_t vl;
+
+  CHECK_NOT_NULL(cache = graphite_cache_create ("collectd.", NULL, '_',
+        GRAPHITE_SEPARATE_INSTANCES, GRAPHITE_CACHE_SIZE_DEFAULT));
+
+  set_vl (&vl, "host.example.com");
+  CHECK_ZERO(check_cached (cache, &load_ds, &vl));
+  /* The second call is answered from the cache. */
+  values[0].gauge = 42.0;
+  CHECK_ZERO(check_cached (cache, &load_ds, &vl));
+
+  set_vl (&vl, "other.example.com");
+  CHECK_ZERO(check_cached (cache, &load_ds, &vl));
+
+  graphite_cache_destroy (cache);
+  return (0);
+}
+
+DEF_TEST(renamed_data_sources)
+{
+  graphite_cache_t *cache;
+  value_list_t vl;
+  char buffer[1024];
+
+  CHECK_NOT_NULL(cache = graphite_cache_create ("collectd.", NULL, '_',
+        GRAPHITE_SEPARATE_INSTANCES, GRAPHITE_CACHE_SIZE_DEFAULT));
+
+  set_vl (&vl, "host.example.com");
+  CHECK_ZERO(check_cached (cache, &load_ds, &vl));
+
+  /* Same identifier and number of data sources: the cached keys must not be
+   * used, since they contain the old names. */
+  CHECK_ZERO(check_cached (cache, &load_renamed_ds, &vl));
+
+  memset (buffer, 0, sizeof (buffer));
+  CHECK_ZERO(format_graphite_cached (cache, buffer, sizeof (buffer),
+        &load_renamed_ds, &vl));
+  OK(strstr (buffer, "shortterm") == NULL);
+  OK(strstr (buffer, "load.fifteen ") != NULL);
+
+  graphite_cache_destroy (cache);
+  return (0);
+}
+
+DEF_TEST(eviction)
+{
+  graphite_cache_t *cache;
+  value_list_t vl;
+  int i;
+
+  CHECK_NOT_NULL(cache = graphite_cache_create ("collectd.", NULL, '_',
+        GRAPHITE_SEPARATE_INSTANCES, /* max_size = */ 1));
+
+  /* Every call evicts the entry of the other host. */
+  for (i = 0; i < 4; i++)
+  {
+    set_vl (&vl, (i % 2) ? "a.example.com" : "b.example.com");
+    CHECK_ZERO(check_cached (cache, &load_ds, &vl));
+  }
+
+  graphite_cache_destroy (cache);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(cached);
+  RUN_TEST(renamed_data_sources);
+  RUN_TEST(eviction);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,352 @@
+/**
+ * collectd - src/tests/test_utils_format_json.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "collectd.h"
+#include "tests/macros.h"
+#include "common.h"
+#include "meta_data.h"
+#include "utils_format_json.h"
+
+#include <time.h>
+
+#define BENCH_NUM 1000000
+
+static data_source_t gauge_dsrc[] = {
+  { "value", DS_TYPE_GAUGE, NAN, NAN }
+};
+static data_set_t gauge_ds = { "gauge", 1, gauge_dsrc };
+
+static data_source_t mixed_dsrc[] = {
+  { "rx", DS_TYPE_DERIVE, 0, NAN },
+  { "tx", DS_TYPE_COUNTER, 0, NAN },
+  { "abs", DS_TYPE_ABSOLUTE, 0, NAN },
+  { "g", DS_TYPE_GAUGE, NAN, NAN }
+};
+static data_set_t mixed_ds = { "mixed", 4, mixed_dsrc };
+
+static double random_double (void)
+{
+  static double const scales[] = { 1e-7, 1e-4, 1e-2, 1.0, 1e3, 1e6, 1e9,
+    1e14, 1e20 };
+  double v = ((double) random ()) / ((double) RAND_MAX);
+
+  v *= scales[random () % STATIC_ARRAY_SIZE (scales)];
+  if ((random () % 8) == 0)
+    v = round (v);
+  if ((random () % 2) == 0)
+    v = -v;
+  return (v);
+}
+
+static int format_one (char *buffer, size_t buffer_size,
+    data_set_t const *ds, value_list_t const *vl)
+{
+  size_t fill = 0;
+  size_t bfree = buffer_size;
+  int status;
+
+  status = format_json_initialize (buffer, &fill, &bfree);
+  if (status == 0)
+    status = format_json_value_list (buffer, &fill, &bfree, ds, vl, 0);
+  if (status == 0)
+    status = format_json_finalize (buffer, &fill, &bfree);
+  return (status);
+}
+
+DEF_TEST(numbers)
+{
+  value_list_t vl = VALUE_LIST_STATIC;
+  value_t values[4];
+  char buffer[1024];
+  char expected[1024];
+  int errors = 0;
+  int i;
+
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 1;
+
+  for (i = 0; i < 200000; i++)
+  {
+    char gauge[64];
+
+    values[0].gauge = random_double ();
+    if (i == 0)
+      values[0].gauge = NAN;
+    else if (i == 1)
+      values[0].gauge = -0.0;
+    vl.time = (cdtime_t) (((uint64_t) random () << 31) ^ random ());
+    vl.interval = MS_TO_CDTIME_T (random () % 100000);
+
+    if (isfinite (values[0].gauge))
+      ssnprintf (gauge, sizeof (gauge), "%g", values[0].gauge);
+    else
+      sstrncpy (gauge, "null", sizeof (gauge));
+
+    ssnprintf (expected, sizeof (expected), "[{\"values\":[%s],"
+        "\"dstypes\":[\"gauge\"],\"dsnames\":[\"value\"],"
+        "\"time\":%.3f,\"interval\":%.3f,\"host\":\"example.com\","
+        "\"plugin\":\"test\",\"plugin_instance\":\"\",\"type\":\"gauge\","
+        "\"type_instance\":\"\"}]", gauge,
+        CDTIME_T_TO_DOUBLE (vl.time), CDTIME_T_TO_DOUBLE (vl.interval));
+
+    if ((format_one (buffer, sizeof (buffer), &gauge_ds, &vl) != 0)
+        || (strcmp (buffer, expected) != 0))
+    {
+      if (errors < 10)
+        printf ("got      %s\nexpected %s\n", buffer, expected);
+      errors++;
+    }
+  }
+  OK(errors == 0);
+
+  vl.values_len = 4;
+  values[0].derive = INT64_MIN;
+  values[1].counter = 18446744073709551615ULL;
+  values[2].absolute = 0;
+  values[3].gauge = 1234567.0;
+  CHECK_ZERO(format_one (buffer, sizeof (buffer), &mixed_ds, &vl));
+  OK(strstr (buffer, "\"values\":[-9223372036854775808,"
+        "18446744073709551615,0,1.23457e+06]") != NULL);
+  OK(strstr (buffer, "\"dstypes\":[\"derive\",\"counter\","
+        "\"absolute\",\"gauge\"],\"dsnames\":[\"rx\",\"tx\",\"abs\",\"g\"]")
+      != NULL);
+
+  return (0);
+}
+
+DEF_TEST(strings_and_meta)
+{
+  value_list_t vl = VALUE_LIST_STATIC;
+  value_t values[1] = { { .gauge = 42.0 } };
+  char buffer[1024];
+  size_t fill = 0;
+  size_t bfree = 200;
+
+  sstrncpy (vl.host, "a\"b\\c\td", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 1;
+  vl.time = TIME_T_TO_CDTIME_T (1400000000);
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+  CHECK_NOT_NULL(vl.meta = meta_data_create ());
+  CHECK_ZERO(meta_data_add_string (vl.meta, "str", "x\"y"));
+  CHECK_ZERO(meta_data_add_signed_int (vl.meta, "int", -3));
+  CHECK_ZERO(meta_data_add_boolean (vl.meta, "bool", 1));
+  CHECK_ZERO(meta_data_add_double (vl.meta, "dbl", 0.5));
+
+  CHECK_ZERO(format_one (buffer, sizeof (buffer), &gauge_ds, &vl));
+  OK(strncmp (buffer, "[{\"values\":[42],", strlen ("[{\"values\":[42],"))
+      == 0);
+  OK(strstr (buffer, ",\"time\":1400000000.000,\"interval\":10.000,"
+        "\"host\":\"a\\\"b\\\\c?d\",") != NULL);
+  OK(strstr (buffer, "\"meta\":{") != NULL);
+  OK(strstr (buffer, "\"str\":\"x\\\"y\"") != NULL);
+  OK(strstr (buffer, "\"int\":-3") != NULL);
+  OK(strstr (buffer, "\"bool\":true") != NULL);
+  OK(strstr (buffer, "\"dbl\":0.500000") != NULL);
+  OK(strcmp (buffer + strlen (buffer) - 3, "}}]") == 0);
+
+  /* A value list that doesn't fit leaves the buffer unchanged. */
+  memset (buffer, 'x', sizeof (buffer));
+  CHECK_ZERO(format_json_initialize (buffer, &fill, &bfree));
+  OK(format_json_value_list (buffer, &fill, &bfree, &gauge_ds, &vl, 0)
+      == -ENOMEM);
+  OK(fill == 0);
+  OK(bfree == 200);
+  OK(buffer[0] == 0);
+
+  meta_data_destroy (vl.meta);
+  return (0);
+}
+
+DEF_TEST(stream)
+{
+  format_json_stream_t s;
+  value_list_t vl = VALUE_LIST_STATIC;
+  value_t values[1];
+  char *fixed;
+  size_t fill = 0;
+  size_t bfree;
+  int i;
+
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 1;
+
+  bfree = 1000 * 256;
+  CHECK_NOT_NULL(fixed = malloc (bfree));
+  CHECK_ZERO(format_json_initialize (fixed, &fill, &bfree));
+
+  /* The stream grows and produces the same output as the fixed buffer. */
+  format_json_stream_init (&s);
+  for (i = 0; i < 1000; i++)
+  {
+    values[0].gauge = random_double ();
+    vl.time = TIME_T_TO_CDTIME_T (1400000000 + i);
+    if ((format_json_stream_value_list (&s, &gauge_ds, &vl, 0) != 0)
+        || (format_json_value_list (fixed, &fill, &bfree,
+            &gauge_ds, &vl, 0) != 0))
+      break;
+  }
+  OK(i == 1000);
+  CHECK_ZERO(format_json_stream_finalize (&s));
+  CHECK_ZERO(format_json_finalize (fixed, &fill, &bfree));
+  OK(s.fill == fill);
+  OK(strcmp (s.data, fixed) == 0);
+
+  format_json_stream_reset (&s);
+  OK(s.fill == 0);
+  OK(format_json_stream_finalize (&s) == -EINVAL);
+
+  format_json_stream_destroy (&s);
+  sfree (fixed);
+  return (0);
+}
+
+static double timespec_diff (struct timespec const *begin,
+    struct timespec const *end)
+{
+  return (((double) (end->tv_sec - begin->tv_sec))
+      + ((double) (end->tv_nsec - begin->tv_nsec)) / 1e9);
+}
+
+/* Sets the values and time of the i-th value list of the benchmark. */
+static void bench_value_list (int i, value_list_t *vl)
+{
+  vl->values[0].derive = 1000 * i;
+  vl->values[1].counter = 7 * i;
+  vl->values[2].absolute = i % 100;
+  vl->values[3].gauge = ((double) i) / 7.0;
+  vl->time = TIME_T_TO_CDTIME_T (1400000000) + MS_TO_CDTIME_T (i);
+}
+
+/* Not a correctness test: reports how long formatting one million value
+ * lists takes, once into a fixed buffer that is sent and reinitialized when
+ * it is full, like the write plugins used to do, and once with a reused
+ * stream. Only run if COLLECTD_BENCHMARK is set in the environment. */
+DEF_TEST(benchmark)
+{
+  format_json_stream_t s;
+  value_list_t vl = VALUE_LIST_STATIC;
+  value_t values[4];
+  struct timespec begin;
+  struct timespec end;
+  char fixed[65536];
+  size_t fixed_fill = 0;
+  size_t fixed_free = sizeof (fixed);
+  size_t fixed_bytes = 0;
+  size_t stream_bytes = 0;
+  double fixed_time;
+  double stream_time;
+  int i;
+  int j;
+
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, "eth0", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, "mixed", sizeof (vl.type));
+  vl.values = values;
+  vl.values_len = 4;
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  format_json_initialize (fixed, &fixed_fill, &fixed_free);
+  for (i = 0; i < BENCH_NUM; i++)
+  {
+    int status;
+
+    bench_value_list (i, &vl);
+
+    status = format_json_value_list (fixed, &fixed_fill, &fixed_free,
+        &mixed_ds, &vl, 0);
+    if (status == -ENOMEM)
+    {
+      format_json_finalize (fixed, &fixed_fill, &fixed_free);
+      fixed_bytes += fixed_fill;
+
+      fixed_fill = 0;
+      fixed_free = sizeof (fixed);
+      format_json_initialize (fixed, &fixed_fill, &fixed_free);
+      status = format_json_value_list (fixed, &fixed_fill, &fixed_free,
+          &mixed_ds, &vl, 0);
+    }
+    if (status != 0)
+      break;
+  }
+  format_json_finalize (fixed, &fixed_fill, &fixed_free);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  fixed_bytes += fixed_fill;
+  fixed_time = timespec_diff (&begin, &end);
+  OK(i == BENCH_NUM);
+
+  format_json_stream_init (&s);
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  for (j = 0; j < BENCH_NUM; j++)
+  {
+    bench_value_list (j, &vl);
+
+    if (format_json_stream_value_list (&s, &mixed_ds, &vl, 0) != 0)
+      break;
+    if (s.fill > sizeof (fixed))
+    {
+      format_json_stream_finalize (&s);
+      stream_bytes += s.fill;
+      format_json_stream_reset (&s);
+    }
+  }
+  if (s.fill > 0)
+    format_json_stream_finalize (&s);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  stream_bytes += s.fill;
+  stream_time = timespec_diff (&begin, &end);
+  format_json_stream_destroy (&s);
+  OK(j == BENCH_NUM);
+
+  printf ("%i value lists: format_json_value_list %.3f s (%zu bytes), "
+      "stream %.3f s (%zu bytes)\n", BENCH_NUM,
+      fixed_time, fixed_bytes, stream_time, stream_bytes);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(numbers);
+  RUN_TEST(strings_and_meta);
+  RUN_TEST(stream);
+  if (getenv ("COLLECTD_BENCHMARK") != NULL)
+    RUN_TEST(benchmark);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
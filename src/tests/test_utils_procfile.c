@@ -0,0 +1,350 @@
+/**
+ * collectd - src/tests/test_utils_procfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "collectd.h"
+#include "tests/macros.h"
+#include "common.h"
+#include "utils_procfile.h"
+
+#include <time.h>
+
+#define BENCH_NUM 2000
+
+static char test_file[] = "/tmp/test_utils_procfile.XXXXXX";
+
+static int write_file (char const *content)
+{
+  int fd;
+  size_t len = strlen (content);
+
+  /* Truncate and rewrite the same inode, like the kernel does. */
+  fd = open (test_file, O_WRONLY | O_TRUNC);
+  if (fd < 0)
+    return (-1);
+  if (write (fd, content, len) != (ssize_t) len)
+  {
+    close (fd);
+    return (-1);
+  }
+  close (fd);
+  return (0);
+}
+
+typedef struct
+{
+  int calls;
+  char keys[8][32];
+} slot_state_t;
+
+static int slot_cb (char const *key, size_t line, void *user_data)
+{
+  slot_state_t *state = user_data;
+
+  state->calls++;
+  if (line < STATIC_ARRAY_SIZE (state->keys))
+    sstrncpy (state->keys[line], key, sizeof (state->keys[line]));
+
+  if (strcmp (key, "skip:") == 0)
+    return (-1);
+  return (100 + (int) line);
+}
+
+DEF_TEST(split)
+{
+  char const *cases[] = {
+    "",
+    "   ",
+    "one",
+    "  one two\tthree  ",
+    "a b c d e f g h i j",
+    "cpu0 1 2 3 4 5 6 7 8 9 10\n",
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    char buffer1[64];
+    char buffer2[64];
+    char *fields1[4];
+    char *fields2[4];
+    int num1;
+    int num2;
+    int j;
+
+    sstrncpy (buffer1, cases[i], sizeof (buffer1));
+    sstrncpy (buffer2, cases[i], sizeof (buffer2));
+
+    num1 = strsplit (buffer1, fields1, STATIC_ARRAY_SIZE (fields1));
+    num2 = procfile_split (buffer2, fields2, STATIC_ARRAY_SIZE (fields2));
+    OK1(num1 == num2, cases[i]);
+    for (j = 0; (j < num1) && (j < num2); j++)
+      STREQ (fields1[j], fields2[j]);
+  }
+
+  return (0);
+}
+
+DEF_TEST(read)
+{
+  procfile_t *pf;
+  char *fields[4];
+
+  CHECK_ZERO(write_file ("first 1\nsecond 2\nthird"));
+  CHECK_NOT_NULL(pf = procfile_open (test_file));
+  STREQ (test_file, procfile_path (pf));
+
+  CHECK_ZERO(procfile_read (pf));
+  OK(procfile_lines_num (pf) == 3);
+  STREQ ("first 1", procfile_line (pf, 0));
+  STREQ ("third", procfile_line (pf, 2));
+  OK(procfile_line (pf, 3) == NULL);
+  OK(procfile_slot (pf, 0) == -1);
+
+  OK(procfile_split (procfile_line (pf, 1), fields, 4) == 2);
+  STREQ ("second", fields[0]);
+  STREQ ("2", fields[1]);
+
+  /* Reading again yields the current content, not the modified buffer. */
+  CHECK_ZERO(procfile_read (pf));
+  STREQ ("second 2", procfile_line (pf, 1));
+
+  /* Larger than the initial buffer. */
+  {
+    char big[20000];
+    size_t i;
+
+    for (i = 0; i < sizeof (big) - 1; i++)
+      big[i] = ((i % 100) == 99) ? '\n' : 'x';
+    big[sizeof (big) - 1] = 0;
+
+    CHECK_ZERO(write_file (big));
+    CHECK_ZERO(procfile_read (pf));
+    OK(procfile_lines_num (pf) == 200);
+    OK(strlen (procfile_line (pf, 199)) == 99);
+  }
+
+  CHECK_ZERO(write_file (""));
+  CHECK_ZERO(procfile_read (pf));
+  OK(procfile_lines_num (pf) == 0);
+
+  procfile_close (pf);
+
+  OK(procfile_open ("/nonexistent/procfile") == NULL);
+  OK(errno == ENOENT);
+
+  return (0);
+}
+
+DEF_TEST(index)
+{
+  procfile_t *pf;
+  slot_state_t state;
+
+  memset (&state, 0, sizeof (state));
+
+  CHECK_ZERO(write_file ("Inter-|   Receive\n"
+        "  eth0: 1 2 3\n"
+        "  skip: 4 5 6\n"
+        "  wlan0:7 8 9\n"));
+  CHECK_NOT_NULL(pf = procfile_open_indexed (test_file, 0, slot_cb, &state));
+
+  CHECK_ZERO(procfile_read (pf));
+  OK(state.calls == 4);
+  STREQ ("Inter-|", state.keys[0]);
+  STREQ ("eth0:", state.keys[1]);
+  STREQ ("wlan0:", state.keys[3]);
+  OK(procfile_slot (pf, 0) == 100);
+  OK(procfile_slot (pf, 1) == 101);
+  OK(procfile_slot (pf, 3) == 103);
+
+  /* Only the values changed: the index is kept. */
+  CHECK_ZERO(write_file ("Inter-|   Receive\n"
+        "  eth0: 10 20 30\n"
+        "  skip: 40 50 60\n"
+        "  wlan0:70 80 90\n"));
+  CHECK_ZERO(procfile_read (pf));
+  OK(state.calls == 4);
+  OK(procfile_slot (pf, 3) == 103);
+  STREQ ("  wlan0:70 80 90", procfile_line (pf, 3));
+
+  /* A new line: the index is rebuilt. */
+  CHECK_ZERO(write_file ("Inter-|   Receive\n"
+        "  eth0: 10 20 30\n"
+        "  eth1: 1 1 1\n"
+        "  skip: 40 50 60\n"
+        "  wlan0:70 80 90\n"));
+  CHECK_ZERO(procfile_read (pf));
+  OK(state.calls == 9);
+  STREQ ("eth1:", state.keys[2]);
+  OK(procfile_slot (pf, 3) == -1);
+  OK(procfile_slot (pf, 4) == 104);
+  OK(procfile_slot (pf, 5) == -1);
+
+  /* A renamed line: rebuilt, too. */
+  CHECK_ZERO(write_file ("Inter-|   Receive\n"
+        "  eth0: 10 20 30\n"
+        "  eth2: 1 1 1\n"
+        "  skip: 40 50 60\n"
+        "  wlan0:70 80 90\n"));
+  CHECK_ZERO(procfile_read (pf));
+  OK(state.calls == 14);
+  STREQ ("eth2:", state.keys[2]);
+
+  procfile_close (pf);
+
+  /* Keys in other columns, as in /proc/diskstats. */
+  memset (&state, 0, sizeof (state));
+  CHECK_ZERO(write_file ("   8       0 sda 1 2 3\n"
+        "   8       1 sda1 4 5 6\n"
+        "\n"));
+  CHECK_NOT_NULL(pf = procfile_open_indexed (test_file, 2, slot_cb, &state));
+  CHECK_ZERO(procfile_read (pf));
+  OK(procfile_lines_num (pf) == 3);
+  STREQ ("sda", state.keys[0]);
+  STREQ ("sda1", state.keys[1]);
+  STREQ ("", state.keys[2]);
+  procfile_close (pf);
+
+  return (0);
+}
+
+static double timespec_diff (struct timespec const *begin,
+    struct timespec const *end)
+{
+  return (((double) (end->tv_sec - begin->tv_sec))
+      + ((double) (end->tv_nsec - begin->tv_nsec)) / 1e9);
+}
+
+static int bench_slot (char const *key, size_t __attribute__((unused)) line,
+    void __attribute__((unused)) *user_data)
+{
+  return ((key[0] != 0) ? 0 : -1);
+}
+
+/* Not a correctness test: reports how long parsing some files in /proc takes,
+ * the way the plugins did it before (fopen, fgets and strsplit on every read)
+ * and with a procfile_t that is kept open. All lines are split in both cases;
+ * the plugins additionally skip the lines they don't need. Run with
+ * COLLECTD_BENCHMARK set to enable it. */
+DEF_TEST(benchmark)
+{
+  char const *files[] = {
+    "/proc/stat",
+    "/proc/meminfo",
+    "/proc/vmstat",
+    "/proc/net/dev",
+    "/proc/diskstats",
+    "/proc/interrupts",
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (files); i++)
+  {
+    struct timespec begin;
+    struct timespec end;
+    double old_time;
+    double new_time;
+    procfile_t *pf;
+    size_t old_fields = 0;
+    size_t new_fields = 0;
+    int j;
+
+    if (access (files[i], R_OK) != 0)
+      continue;
+
+    clock_gettime (CLOCK_MONOTONIC, &begin);
+    for (j = 0; j < BENCH_NUM; j++)
+    {
+      FILE *fh;
+      char buffer[1024];
+      char *fields[256];
+
+      fh = fopen (files[i], "r");
+      if (fh == NULL)
+        break;
+      while (fgets (buffer, sizeof (buffer), fh) != NULL)
+        old_fields += strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+      fclose (fh);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    old_time = timespec_diff (&begin, &end);
+
+    pf = procfile_open_indexed (files[i], 0, bench_slot, NULL);
+    CHECK_NOT_NULL(pf);
+
+    clock_gettime (CLOCK_MONOTONIC, &begin);
+    for (j = 0; j < BENCH_NUM; j++)
+    {
+      char *fields[256];
+      size_t k;
+
+      if (procfile_read (pf) != 0)
+        break;
+      for (k = 0; k < procfile_lines_num (pf); k++)
+      {
+        if (procfile_slot (pf, k) < 0)
+          continue;
+        new_fields += procfile_split (procfile_line (pf, k),
+            fields, STATIC_ARRAY_SIZE (fields));
+      }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    new_time = timespec_diff (&begin, &end);
+    procfile_close (pf);
+
+    printf ("%-17s %i reads: fgets/strsplit %.3f s (%zu fields), "
+        "procfile %.3f s (%zu fields)\n", files[i], BENCH_NUM,
+        old_time, old_fields, new_time, new_fields);
+    OK(j == BENCH_NUM);
+  }
+
+  return (0);
+}
+
+int main (void)
+{
+  int fd;
+
+  fd = mkstemp (test_file);
+  if (fd < 0)
+  {
+    perror ("mkstemp");
+    return (1);
+  }
+  close (fd);
+
+  RUN_TEST(split);
+  RUN_TEST(read);
+  RUN_TEST(index);
+  if (getenv ("COLLECTD_BENCHMARK") != NULL)
+    RUN_TEST(benchmark);
+
+  unlink (test_file);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
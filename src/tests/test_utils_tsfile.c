@@ -0,0 +1,198 @@
+/**
+ * collectd - src/tests/test_utils_tsfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ */
+
+#include "collectd.h"
+#include "tests/macros.h"
+#include "utils_tsfile.h"
+
+#include <sys/mman.h>
+
+#define POINTS_NUM 1000
+
+static int const ds_types[] = { DS_TYPE_GAUGE, DS_TYPE_DERIVE };
+
+static cdtime_t point_time (int i)
+{
+  /* Ten second interval with a bit of jitter and a gap. */
+  cdtime_t t = TIME_T_TO_CDTIME_T (1400000000) + TIME_T_TO_CDTIME_T (10 * i)
+    + MS_TO_CDTIME_T ((i * 7) % 13);
+  if (i >= 500)
+    t += TIME_T_TO_CDTIME_T (3600);
+  return (t);
+}
+
+static void point_values (int i, value_t *values)
+{
+  values[0].gauge = ((i % 10) == 0) ? NAN : 20.0 + ((double) (i % 17)) / 4.0;
+  values[1].derive = 1000 * (derive_t) i - 3;
+}
+
+typedef struct
+{
+  int count;
+  int errors;
+} read_state_t;
+
+static int read_cb (cdtime_t time, value_t const *values,
+    int const *types, size_t values_num, void *user_data)
+{
+  read_state_t *state = user_data;
+  int i = state->count;
+  value_t expected[2];
+
+  point_values (i, expected);
+  if ((values_num != 2) || (types[0] != DS_TYPE_GAUGE)
+      || (types[1] != DS_TYPE_DERIVE)
+      || (CDTIME_T_TO_MS (time) != CDTIME_T_TO_MS (point_time (i)))
+      || (values[1].derive != expected[1].derive)
+      || (isnan (expected[0].gauge)
+        ? !isnan (values[0].gauge)
+        : (values[0].gauge != expected[0].gauge)))
+    state->errors++;
+
+  state->count++;
+  return (0);
+}
+
+static int read_all (char const *dir, cdtime_t start, cdtime_t end,
+    read_state_t *state)
+{
+  memset (state, 0, sizeof (*state));
+  return (tsf_read (dir, "host/plugin/type", start, end, read_cb, state));
+}
+
+DEF_TEST(round_trip)
+{
+  char dir[] = "/tmp/test_utils_tsfile.XXXXXX";
+  char filename[PATH_MAX];
+  tsf_series_t *s;
+  tsf_series_t *other;
+  tsf_segment_t *seg;
+  read_state_t state;
+  value_t values[2];
+  cdtime_t first;
+  cdtime_t last;
+  _Bool compacted;
+  struct stat statbuf;
+  uint8_t const *map;
+  int fd;
+  int i;
+
+  CHECK_NOT_NULL(mkdtemp (dir));
+  snprintf (filename, sizeof (filename), "%s/1400000000%s", dir,
+      TSF_SEGMENT_SUFFIX);
+
+  CHECK_NOT_NULL(s = tsf_series_create ("host/plugin/type", ds_types, 2));
+  CHECK_NOT_NULL(other = tsf_series_create ("host/plugin/other",
+        ds_types, 1));
+  CHECK_NOT_NULL(seg = tsf_segment_open (filename));
+
+  for (i = 0; i < POINTS_NUM; i++)
+  {
+    point_values (i, values);
+    CHECK_ZERO(tsf_series_append (s, point_time (i), values));
+    CHECK_ZERO(tsf_series_append (other, point_time (i), values));
+
+    /* Interleave blocks of both series. */
+    if ((i % 300) == 299)
+    {
+      CHECK_ZERO(tsf_segment_write (seg, s));
+      CHECK_ZERO(tsf_segment_write (seg, other));
+      OK(tsf_series_points (s) == 0);
+    }
+  }
+  CHECK_ZERO(tsf_segment_write (seg, s));
+  CHECK_ZERO(tsf_segment_write (seg, other));
+
+  /* Without an index, the blocks are scanned. */
+  OK(tsf_segment_info (filename, &first, &last, &compacted) == ENOENT);
+  CHECK_ZERO(read_all (dir, 0, point_time (POINTS_NUM), &state));
+  OK(state.count == POINTS_NUM);
+  OK(state.errors == 0);
+
+  CHECK_ZERO(tsf_segment_close (seg));
+  CHECK_ZERO(tsf_segment_info (filename, &first, &last, &compacted));
+  OK(CDTIME_T_TO_MS (first) == CDTIME_T_TO_MS (point_time (0)));
+  OK(CDTIME_T_TO_MS (last) == CDTIME_T_TO_MS (point_time (POINTS_NUM - 1)));
+  OK(!compacted);
+
+  CHECK_ZERO(read_all (dir, 0, point_time (POINTS_NUM), &state));
+  OK(state.count == POINTS_NUM);
+  OK(state.errors == 0);
+
+  /* Only the points before the gap. */
+  CHECK_ZERO(read_all (dir, 0, point_time (499), &state));
+  OK(state.count == 500);
+
+  CHECK_ZERO(tsf_segment_compact (filename));
+  CHECK_ZERO(tsf_segment_info (filename, &first, &last, &compacted));
+  OK(compacted);
+
+  CHECK_ZERO(read_all (dir, 0, point_time (POINTS_NUM), &state));
+  OK(state.count == POINTS_NUM);
+  OK(state.errors == 0);
+
+  /* Map the segment like a concurrent reader would. */
+  fd = open (filename, O_RDONLY);
+  OK(fd >= 0);
+  CHECK_ZERO(fstat (fd, &statbuf));
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  OK(map != MAP_FAILED);
+  close (fd);
+
+  /* Reopening a closed segment continues appending to it. */
+  CHECK_NOT_NULL(seg = tsf_segment_open (filename));
+
+  /* The index has been dropped without shrinking the file the reader has
+   * mapped. Otherwise the reader would see zeros here, or get SIGBUS once
+   * whole pages are cut off. */
+  OK(map[statbuf.st_size - 1] != 0);
+  munmap ((void *) map, (size_t) statbuf.st_size);
+  point_values (POINTS_NUM, values);
+  CHECK_ZERO(tsf_series_append (s, point_time (POINTS_NUM), values));
+  CHECK_ZERO(tsf_segment_write (seg, s));
+  CHECK_ZERO(tsf_segment_close (seg));
+
+  CHECK_ZERO(read_all (dir, 0, point_time (POINTS_NUM), &state));
+  OK(state.count == POINTS_NUM + 1);
+  OK(state.errors == 0);
+
+  tsf_series_destroy (s);
+  tsf_series_destroy (other);
+  unlink (filename);
+  rmdir (dir);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(round_trip);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -34,6 +34,7 @@
 #include "utils_cmd_getthreshold.h"
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putval.h"
+#include "utils_cmd_putbulk.h"
 #include "utils_cmd_putnotif.h"
 
 /* Folks without pthread will need to disable this plugin. */
@@ -43,7 +44,9 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
 
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
@@ -51,6 +54,44 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+#define US_DEFAULT_WORKER_THREADS 4
+
+/* Minimum free space in a client's buffer before reading. */
+#define US_READ_SIZE 4096
+
+/* Lines and PUTBULK payloads longer than this are rejected and the
+ * connection is closed. */
+#define US_MAX_LINE_LENGTH (1024 * 1024)
+
+/* Seconds a client has to accept the response to a command. Clients which
+ * don't read their responses are disconnected, so they cannot block the
+ * worker threads. */
+#define US_SEND_TIMEOUT 10
+
+struct us_client_s;
+typedef struct us_client_s us_client_t;
+struct us_client_s
+{
+	int   fd;
+	/* Responses are buffered in memory and sent after each command, if
+	 * possible. */
+	FILE *fhout;
+	char  *output;
+	size_t output_size;
+
+	/* Data received but not yet handled, i.e. an incomplete line. */
+	char  *buffer;
+	size_t buffer_size;
+	size_t buffer_fill;
+
+	/* Protected by queue_lock. A busy client is owned by a worker thread and
+	 * is not polled by the server thread. */
+	_Bool busy;
+	_Bool dead;
+
+	us_client_t *next;
+};
+
 /*
  * Private variables
  */
@@ -60,7 +101,9 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"WorkerThreads",
+	"HistoryDataDir"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -73,8 +116,27 @@ static char *sock_group = NULL;
 static int   sock_perms = S_IRWXU | S_IRWXG;
 static _Bool delete_socket = 0;
 
+/* Data directory of the write_tsfile plugin, for GETVAL with a time range. */
+static char *history_dir = NULL;
+
 static pthread_t listen_thread = (pthread_t) 0;
 
+static int        worker_threads_num = US_DEFAULT_WORKER_THREADS;
+static pthread_t *worker_threads = NULL;
+
+/* Client list, owned by the server thread, and the queue of clients with
+ * pending input, consumed by the worker threads. */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+static us_client_t   **clients = NULL;
+static size_t          clients_num = 0;
+static us_client_t    *queue_head = NULL;
+static us_client_t    *queue_tail = NULL;
+
+/* Written to by the worker threads to make the server thread poll a client
+ * again. */
+static int wakeup_pipe[2] = { -1, -1 };
+
 /*
  * Functions
  */
@@ -180,171 +242,566 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+static us_client_t *us_client_create (int fd) /* {{{ */
 {
-	int fdin;
+	us_client_t *c;
+	struct timeval tv;
+#if !HAVE_OPEN_MEMSTREAM
 	int fdout;
-	FILE *fhin, *fhout;
-
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
+#endif
 
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+	c = malloc (sizeof (*c));
+	if (c == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (c, 0, sizeof (*c));
+	c->fd = fd;
 
-	fdout = dup (fdin);
-	if (fdout < 0)
+	memset (&tv, 0, sizeof (tv));
+	tv.tv_sec = US_SEND_TIMEOUT;
+	if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) != 0)
 	{
 		char errbuf[1024];
-		ERROR ("unixsock plugin: dup failed: %s",
+		WARNING ("unixsock plugin: setsockopt (SO_SNDTIMEO) failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
 	}
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+#if HAVE_OPEN_MEMSTREAM
+	c->fhout = open_memstream (&c->output, &c->output_size);
+	if (c->fhout == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
+		ERROR ("unixsock plugin: open_memstream failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		sfree (c);
+		return (NULL);
+	}
+#else
+	fdout = dup (fd);
+	if (fdout < 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: dup failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (c);
+		return (NULL);
 	}
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	c->fhout = fdopen (fdout, "w");
+	if (c->fhout == NULL)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: fdopen failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
 		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		sfree (c);
+		return (NULL);
 	}
 
 	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	if (setvbuf (c->fhout, NULL, _IOLBF, 0) != 0)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: setvbuf failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
-		return ((void *) 0);
+		fclose (c->fhout);
+		sfree (c);
+		return (NULL);
 	}
+#endif
 
-	while (42)
-	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+	return (c);
+} /* }}} us_client_t *us_client_create */
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
-		{
-			if ((errno == EINTR) || (errno == EAGAIN))
-				continue;
+static void us_client_destroy (us_client_t *c) /* {{{ */
+{
+	if (c == NULL)
+		return;
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", c->fd);
+
+	if (c->fhout != NULL)
+		fclose (c->fhout);
+	sfree (c->output);
+	close (c->fd);
+	sfree (c->buffer);
+	sfree (c);
+} /* }}} void us_client_destroy */
+
+/* Sends the response to the last command. Returns non-zero if the client
+ * didn't accept it within US_SEND_TIMEOUT seconds or the connection failed,
+ * in which case the connection is to be closed. */
+static int us_client_flush (us_client_t *c) /* {{{ */
+{
+#if HAVE_OPEN_MEMSTREAM
+	cdtime_t end;
+	size_t sent = 0;
 
-			if (errno != 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
-			break;
-		}
+	if (fflush (c->fhout) != 0)
+	{
+		ERROR ("unixsock plugin: Buffering the response failed.");
+		return (-1);
+	}
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+	/* Each send() blocks for at most US_SEND_TIMEOUT seconds, the deadline
+	 * catches clients reading very slowly. */
+	end = cdtime () + TIME_T_TO_CDTIME_T (US_SEND_TIMEOUT);
+	while (sent < c->output_size)
+	{
+		ssize_t status;
 
-		if (len == 0)
+		status = send (c->fd, c->output + sent, c->output_size - sent, 0);
+		if ((status < 0) && (errno == EINTR))
 			continue;
-
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
-
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
+		if (status < 0)
 		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
+			char errbuf[1024];
+			WARNING ("unixsock plugin: Writing to socket #%i failed: %s. "
+					"Closing connection.", c->fd,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
 
-		if (strcasecmp (fields[0], "getval") == 0)
+		sent += (size_t) status;
+		if ((sent < c->output_size) && (cdtime () >= end))
 		{
-			handle_getval (fhout, buffer);
+			WARNING ("unixsock plugin: Client on socket #%i doesn't read "
+					"its responses. Closing connection.", c->fd);
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "getthreshold") == 0)
-		{
-			handle_getthreshold (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+	}
+
+	rewind (c->fhout);
+	return (0);
+#else
+	/* The response has been written to the socket already; each write
+	 * blocked for at most US_SEND_TIMEOUT seconds. */
+	if ((fflush (c->fhout) != 0) || ferror (c->fhout))
+	{
+		WARNING ("unixsock plugin: Writing to socket #%i failed. "
+				"Closing connection.", c->fd);
+		return (-1);
+	}
+	return (0);
+#endif
+} /* }}} int us_client_flush */
+
+/* Handles one command line. Returns non-zero if writing to the client failed
+ * and the connection should be closed. */
+static int us_handle_command (FILE *fhout, char *line) /* {{{ */
+{
+	char command[32];
+	size_t command_len;
+
+	while ((*line == ' ') || (*line == '\t'))
+		line++;
+
+	command_len = strcspn (line, " \t");
+	if (command_len == 0)
+		return (0);
+	if (command_len >= sizeof (command))
+		command_len = sizeof (command) - 1;
+	memcpy (command, line, command_len);
+	command[command_len] = 0;
+
+	if (strcasecmp (command, "getval") == 0)
+		handle_getval (fhout, line, history_dir);
+	else if (strcasecmp (command, "getthreshold") == 0)
+		handle_getthreshold (fhout, line);
+	else if (strcasecmp (command, "putval") == 0)
+		handle_putval (fhout, line);
+	else if (strcasecmp (command, "listval") == 0)
+		handle_listval (fhout, line);
+	else if (strcasecmp (command, "putnotif") == 0)
+		handle_putnotif (fhout, line);
+	else if (strcasecmp (command, "flush") == 0)
+		handle_flush (fhout, line);
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", command) < 0)
 		{
-			handle_putval (fhout, buffer);
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+	}
+
+	return (0);
+} /* }}} int us_handle_command */
+
+/* Checks whether the line of "len" bytes at "line" is a "PUTBULK <size>"
+ * command. Returns zero and stores the size of the binary payload following
+ * the line in "ret_size" if it is, greater than zero if the line is some other
+ * command and less than zero if the size is invalid. */
+static int us_parse_bulk_header (const char *line, size_t len, /* {{{ */
+		size_t *ret_size)
+{
+	char tmp[64];
+	char *endptr = NULL;
+	unsigned long size;
+
+	while ((len > 0) && ((*line == ' ') || (*line == '\t')))
+	{
+		line++;
+		len--;
+	}
+
+	if ((len < 8) || (strncasecmp ("PUTBULK", line, 7) != 0)
+			|| ((line[7] != ' ') && (line[7] != '\t')))
+		return (1);
+
+	if (len >= sizeof (tmp))
+		return (-1);
+	memcpy (tmp, line + 8, len - 8);
+	tmp[len - 8] = 0;
+
+	errno = 0;
+	size = strtoul (tmp, &endptr, 10);
+	if ((errno != 0) || (endptr == tmp)
+			|| (size > US_MAX_LINE_LENGTH))
+		return (-1);
+
+	*ret_size = (size_t) size;
+	return (0);
+} /* }}} int us_parse_bulk_header */
+
+/* Executes all complete commands in the client's buffer and moves trailing,
+ * incomplete data to the beginning of the buffer. */
+static int us_client_process (us_client_t *c) /* {{{ */
+{
+	size_t offset = 0;
+
+	while (offset < c->buffer_fill)
+	{
+		char *line = c->buffer + offset;
+		char *eol;
+		size_t len;
+		size_t bulk_size = 0;
+		int status;
+
+		eol = memchr (line, '\n', c->buffer_fill - offset);
+		if (eol == NULL)
+			break;
+
+		len = (size_t) (eol - line);
+		while ((len > 0) && (line[len - 1] == '\r'))
+			len--;
+
+		/* "PUTBULK" is followed by a binary payload rather than a newline. */
+		status = us_parse_bulk_header (line, len, &bulk_size);
+		if (status < 0)
 		{
-			handle_listval (fhout, buffer);
+			fprintf (c->fhout, "-1 Invalid PUTBULK size.\n");
+			us_client_flush (c);
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+		else if (status == 0)
 		{
-			handle_putnotif (fhout, buffer);
+			size_t header_size = (size_t) (eol - line) + 1;
+
+			if ((c->buffer_fill - offset - header_size) < bulk_size)
+			{
+				/* Wait for the rest of the payload, making sure it
+				 * fits into the buffer. */
+				if ((c->buffer_size - offset) < (header_size + bulk_size))
+				{
+					size_t new_size = header_size + bulk_size + US_READ_SIZE;
+					char *tmp;
+
+					c->buffer_fill -= offset;
+					memmove (c->buffer, c->buffer + offset, c->buffer_fill);
+					offset = 0;
+
+					tmp = realloc (c->buffer, new_size);
+					if (tmp == NULL)
+					{
+						ERROR ("unixsock plugin: realloc failed.");
+						return (-1);
+					}
+					c->buffer = tmp;
+					c->buffer_size = new_size;
+				}
+				break;
+			}
+
+			offset += header_size + bulk_size;
+			handle_putbulk (c->fhout, eol + 1, bulk_size);
+			if (us_client_flush (c) != 0)
+				return (-1);
+			continue;
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+
+		*eol = 0;
+		offset += (size_t) (eol - line) + 1;
+		line[len] = 0;
+
+		if (len == 0)
+			continue;
+
+		status = us_handle_command (c->fhout, line);
+		if ((us_client_flush (c) != 0) || (status != 0))
+			return (-1);
+	}
+
+	if (offset > 0)
+	{
+		c->buffer_fill -= offset;
+		memmove (c->buffer, c->buffer + offset, c->buffer_fill);
+	}
+
+	if ((c->buffer_fill > US_MAX_LINE_LENGTH)
+			&& (memchr (c->buffer, '\n', c->buffer_fill) == NULL))
+	{
+		WARNING ("unixsock plugin: Client on socket #%i sent a line longer "
+				"than %i bytes. Closing connection.",
+				c->fd, US_MAX_LINE_LENGTH);
+		fprintf (c->fhout, "-1 Command too long.\n");
+		us_client_flush (c);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int us_client_process */
+
+/* Reads whatever is available from the client without blocking and handles
+ * all commands received so far. Returns non-zero if the connection is to be
+ * closed. */
+static int us_client_read (us_client_t *c) /* {{{ */
+{
+	ssize_t status;
+
+	if ((c->buffer_size - c->buffer_fill) < US_READ_SIZE)
+	{
+		size_t new_size;
+		char *tmp;
+
+		new_size = (c->buffer_size == 0) ? US_READ_SIZE : 2 * c->buffer_size;
+		tmp = realloc (c->buffer, new_size);
+		if (tmp == NULL)
 		{
-			handle_flush (fhout, buffer);
+			ERROR ("unixsock plugin: realloc failed.");
+			return (-1);
 		}
-		else
+		c->buffer = tmp;
+		c->buffer_size = new_size;
+	}
+
+	do
+	{
+		status = recv (c->fd, c->buffer + c->buffer_fill,
+				c->buffer_size - c->buffer_fill, MSG_DONTWAIT);
+	} while ((status < 0) && (errno == EINTR));
+
+	if (status < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			return (0);
+
+		WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+				c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	else if (status == 0)
+	{
+		/* End of file: Handle a final command lacking the newline. */
+		if ((c->buffer_fill > 0) && (c->buffer[c->buffer_fill - 1] != '\n'))
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			if (c->buffer_fill == c->buffer_size)
 			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
+				char *tmp = realloc (c->buffer, c->buffer_size + 1);
+				if (tmp == NULL)
+				{
+					ERROR ("unixsock plugin: realloc failed.");
+					return (-1);
+				}
+				c->buffer = tmp;
+				c->buffer_size++;
 			}
+			c->buffer[c->buffer_fill++] = '\n';
 		}
-	} /* while (fgets) */
+		us_client_process (c);
+		return (-1);
+	}
+
+	c->buffer_fill += (size_t) status;
+	return (us_client_process (c));
+} /* }}} int us_client_read */
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+static void us_wakeup_server (void) /* {{{ */
+{
+	/* The pipe is non-blocking; if it is full, the server will wake up
+	 * anyway. */
+	if (write (wakeup_pipe[1], "", 1) < 0)
+		DEBUG ("unixsock plugin: Writing to wakeup pipe failed.");
+} /* }}} void us_wakeup_server */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&queue_lock);
+	while (loop != 0)
+	{
+		us_client_t *c;
+		int status;
+
+		if (queue_head == NULL)
+		{
+			pthread_cond_wait (&queue_cond, &queue_lock);
+			continue;
+		}
+
+		c = queue_head;
+		queue_head = c->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		c->next = NULL;
+		pthread_mutex_unlock (&queue_lock);
+
+		status = us_client_read (c);
+
+		pthread_mutex_lock (&queue_lock);
+		c->busy = 0;
+		if (status != 0)
+			c->dead = 1;
+		us_wakeup_server ();
+	}
+	pthread_mutex_unlock (&queue_lock);
 
-	pthread_exit ((void *) 0);
 	return ((void *) 0);
-} /* void *us_handle_client */
+} /* }}} void *us_worker_thread */
 
-static void *us_server_thread (void __attribute__((unused)) *arg)
+/* Removes closed connections from the client list. Must be called with
+ * queue_lock held. */
+static void us_reap_clients (void) /* {{{ */
 {
-	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
+	size_t i;
+	size_t j;
 
-	pthread_attr_init (&th_attr);
-	pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0, j = 0; i < clients_num; i++)
+	{
+		if (clients[i]->dead && !clients[i]->busy)
+		{
+			us_client_destroy (clients[i]);
+			continue;
+		}
+		clients[j++] = clients[i];
+	}
+	clients_num = j;
+} /* }}} void us_reap_clients */
+
+static int us_accept_client (void) /* {{{ */
+{
+	us_client_t **tmp;
+	us_client_t *c;
+	int fd;
+
+	DEBUG ("unixsock plugin: Calling accept..");
+	fd = accept (sock_fd, NULL, NULL);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)
+				|| (errno == ECONNABORTED))
+			return (0);
+
+		ERROR ("unixsock plugin: accept failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	DEBUG ("unixsock plugin: Accepted connection on fd #%i", fd);
+
+	c = us_client_create (fd);
+	if (c == NULL)
+	{
+		close (fd);
+		return (0);
+	}
+
+	pthread_mutex_lock (&queue_lock);
+	tmp = realloc (clients, (clients_num + 1) * sizeof (*clients));
+	if (tmp == NULL)
+	{
+		pthread_mutex_unlock (&queue_lock);
+		ERROR ("unixsock plugin: realloc failed.");
+		us_client_destroy (c);
+		return (0);
+	}
+	clients = tmp;
+	clients[clients_num] = c;
+	clients_num++;
+	pthread_mutex_unlock (&queue_lock);
+
+	return (0);
+} /* }}} int us_accept_client */
+
+static void *us_server_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	struct pollfd *fds = NULL;
+	us_client_t **fds_clients = NULL;
+	size_t fds_size = 0;
+	int status;
 
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
 	while (loop != 0)
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
+		size_t fds_num;
+		size_t i;
+
+		pthread_mutex_lock (&queue_lock);
+		us_reap_clients ();
+
+		if (fds_size < (clients_num + 2))
+		{
+			struct pollfd *tmp_fds;
+			us_client_t **tmp_clients;
+
+			tmp_fds = realloc (fds, (clients_num + 2) * sizeof (*fds));
+			if (tmp_fds != NULL)
+				fds = tmp_fds;
+			tmp_clients = realloc (fds_clients,
+					(clients_num + 2) * sizeof (*fds_clients));
+			if (tmp_clients != NULL)
+				fds_clients = tmp_clients;
+
+			if ((tmp_fds == NULL) || (tmp_clients == NULL))
+			{
+				pthread_mutex_unlock (&queue_lock);
+				ERROR ("unixsock plugin: realloc failed.");
+				break;
+			}
+			fds_size = clients_num + 2;
+		}
+
+		memset (fds, 0, fds_size * sizeof (*fds));
+		fds[0].fd = sock_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = wakeup_pipe[0];
+		fds[1].events = POLLIN;
+		fds_num = 2;
+
+		/* Connections currently handled by a worker are not polled. */
+		for (i = 0; i < clients_num; i++)
+		{
+			if (clients[i]->busy || clients[i]->dead)
+				continue;
+
+			fds[fds_num].fd = clients[i]->fd;
+			fds[fds_num].events = POLLIN;
+			fds_clients[fds_num] = clients[i];
+			fds_num++;
+		}
+		pthread_mutex_unlock (&queue_lock);
+
+		status = poll (fds, (nfds_t) fds_num, /* timeout = */ -1);
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -352,43 +809,49 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 			if (errno == EINTR)
 				continue;
 
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (sock_fd);
-			sock_fd = -1;
-			pthread_attr_destroy (&th_attr);
-			pthread_exit ((void *) 1);
+			break;
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		if (fds[1].revents != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
+			char buffer[64];
+			while (read (wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+				/* drain */;
 		}
-		*remote_fd = status;
 
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
+		pthread_mutex_lock (&queue_lock);
+		for (i = 2; i < fds_num; i++)
+		{
+			us_client_t *c = fds_clients[i];
+
+			if (fds[i].revents == 0)
+				continue;
 
-		status = plugin_thread_create (&th, &th_attr,
-				us_handle_client, (void *) remote_fd);
-		if (status != 0)
+			c->busy = 1;
+			if (queue_tail == NULL)
+				queue_head = c;
+			else
+				queue_tail->next = c;
+			queue_tail = c;
+		}
+		pthread_cond_broadcast (&queue_cond);
+		pthread_mutex_unlock (&queue_lock);
+
+		if ((fds[0].revents & POLLIN) != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			status = us_accept_client ();
+			if (status != 0)
+				break;
 		}
 	} /* while (loop) */
 
+	sfree (fds);
+	sfree (fds_clients);
+
 	close (sock_fd);
 	sock_fd = -1;
-	pthread_attr_destroy (&th_attr);
 
 	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
@@ -400,7 +863,7 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 	}
 
 	return ((void *) 0);
-} /* void *us_server_thread */
+} /* }}} void *us_server_thread */
 
 static int us_config (const char *key, const char *val)
 {
@@ -433,6 +896,26 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: WorkerThreads must be at least 1. "
+					"Using the default of %i.", US_DEFAULT_WORKER_THREADS);
+			tmp = US_DEFAULT_WORKER_THREADS;
+		}
+		worker_threads_num = tmp;
+	}
+	else if (strcasecmp (key, "HistoryDataDir") == 0)
+	{
+		char *new_history_dir = strdup (val);
+		if (new_history_dir == NULL)
+			return (1);
+
+		sfree (history_dir);
+		history_dir = new_history_dir;
+	}
 	else
 	{
 		return (-1);
@@ -441,11 +924,14 @@ static int us_config (const char *key, const char *val)
 	return (0);
 } /* int us_config */
 
+static int us_shutdown (void);
+
 static int us_init (void)
 {
 	static int have_init = 0;
 
 	int status;
+	int i;
 
 	/* Initialize only once. */
 	if (have_init != 0)
@@ -454,6 +940,42 @@ static int us_init (void)
 
 	loop = 1;
 
+	if (pipe (wakeup_pipe) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wakeup_pipe[0], F_SETFL,
+			fcntl (wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wakeup_pipe[1], F_SETFL,
+			fcntl (wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	worker_threads = calloc ((size_t) worker_threads_num,
+			sizeof (*worker_threads));
+	if (worker_threads == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < worker_threads_num; i++)
+	{
+		status = plugin_thread_create (&worker_threads[i], NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			worker_threads[i] = (pthread_t) 0;
+			/* Stops the workers started so far. */
+			us_shutdown ();
+			return (-1);
+		}
+	}
+
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -461,6 +983,8 @@ static int us_init (void)
 		char errbuf[1024];
 		ERROR ("unixsock plugin: pthread_create failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
+		listen_thread = (pthread_t) 0;
+		us_shutdown ();
 		return (-1);
 	}
 
@@ -470,16 +994,49 @@ static int us_init (void)
 static int us_shutdown (void)
 {
 	void *ret;
+	size_t i;
 
+	pthread_mutex_lock (&queue_lock);
 	loop = 0;
+	pthread_cond_broadcast (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
 
 	if (listen_thread != (pthread_t) 0)
 	{
+		us_wakeup_server ();
 		pthread_kill (listen_thread, SIGTERM);
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	/* Workers may be blocked writing to a client. Shutting the connections
+	 * down makes these writes fail right away. */
+	pthread_mutex_lock (&queue_lock);
+	for (i = 0; i < clients_num; i++)
+		shutdown (clients[i]->fd, SHUT_RDWR);
+	pthread_mutex_unlock (&queue_lock);
+
+	if (worker_threads != NULL)
+	{
+		for (i = 0; i < (size_t) worker_threads_num; i++)
+			if (worker_threads[i] != (pthread_t) 0)
+				pthread_join (worker_threads[i], &ret);
+		sfree (worker_threads);
+	}
+
+	for (i = 0; i < clients_num; i++)
+		us_client_destroy (clients[i]);
+	sfree (clients);
+	clients_num = 0;
+	queue_head = queue_tail = NULL;
+
+	if (wakeup_pipe[0] >= 0)
+	{
+		close (wakeup_pipe[0]);
+		close (wakeup_pipe[1]);
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+	}
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
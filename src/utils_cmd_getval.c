@@ -30,6 +30,7 @@
 
 #include "utils_cache.h"
 #include "utils_parse_option.h"
+#include "utils_tsfile.h"
 
 #define print_to_socket(fh, ...) \
   do { \
@@ -42,7 +43,113 @@
     fflush(fh); \
   } while (0)
 
-int handle_getval (FILE *fh, char *buffer)
+typedef struct getval_history_s
+{
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_fill;
+  size_t values_num;
+} getval_history_t;
+
+/* Formats one stored point as "<time>:<value>[:<value>...]". */
+static int getval_history_cb (cdtime_t time, /* {{{ */
+    value_t const *values, int const *ds_types, size_t values_num,
+    void *user_data)
+{
+  getval_history_t *h = user_data;
+  char line[1024];
+  size_t line_len;
+  size_t offset;
+  size_t i;
+  int status;
+
+  status = ssnprintf (line, sizeof (line), "%.3f", CDTIME_T_TO_DOUBLE (time));
+  offset = (size_t) status;
+
+  for (i = 0; (i < values_num) && (offset < sizeof (line)); i++)
+  {
+    if (ds_types[i] == DS_TYPE_GAUGE)
+      status = ssnprintf (line + offset, sizeof (line) - offset, ":%g",
+          values[i].gauge);
+    else if (ds_types[i] == DS_TYPE_DERIVE)
+      status = ssnprintf (line + offset, sizeof (line) - offset,
+          ":%"PRIi64, values[i].derive);
+    else if (ds_types[i] == DS_TYPE_ABSOLUTE)
+      status = ssnprintf (line + offset, sizeof (line) - offset,
+          ":%"PRIu64, values[i].absolute);
+    else
+      status = ssnprintf (line + offset, sizeof (line) - offset,
+          ":%llu", values[i].counter);
+    offset += (size_t) status;
+  }
+
+  if (offset >= sizeof (line) - 1)
+    return (-1);
+  line[offset] = '\n';
+  line_len = offset + 1;
+
+  if ((h->buffer_fill + line_len) > h->buffer_size)
+  {
+    size_t new_size = (h->buffer_size > 0) ? (2 * h->buffer_size) : 4096;
+    char *tmp;
+
+    while ((h->buffer_fill + line_len) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (h->buffer, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    h->buffer = tmp;
+    h->buffer_size = new_size;
+  }
+
+  memcpy (h->buffer + h->buffer_fill, line, line_len);
+  h->buffer_fill += line_len;
+  h->values_num++;
+
+  return (0);
+} /* }}} int getval_history_cb */
+
+static int getval_history (FILE *fh, const char *history_dir, /* {{{ */
+    const char *identifier, cdtime_t start, cdtime_t end)
+{
+  getval_history_t h;
+  int status;
+
+  memset (&h, 0, sizeof (h));
+
+  status = tsf_read (history_dir, identifier, start, end,
+      getval_history_cb, &h);
+  if (status != 0)
+  {
+    sfree (h.buffer);
+    print_to_socket (fh, "-1 Reading the history failed.\n");
+    return (-1);
+  }
+
+  if (h.values_num == 0)
+  {
+    print_to_socket (fh, "-1 No such value\n");
+    return (-1);
+  }
+
+  if ((fprintf (fh, "%zu Value%s found\n", h.values_num,
+          (h.values_num == 1) ? "" : "s") < 0)
+      || (fwrite (h.buffer, 1, h.buffer_fill, fh) != h.buffer_fill))
+  {
+    char errbuf[1024];
+    WARNING ("handle_getval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (h.buffer);
+    return (-1);
+  }
+  fflush (fh);
+
+  sfree (h.buffer);
+  return (0);
+} /* }}} int getval_history */
+
+int handle_getval (FILE *fh, char *buffer, const char *history_dir)
 {
   char *command;
   char *identifier;
@@ -58,6 +165,10 @@ int handle_getval (FILE *fh, char *buffer)
 
   const data_set_t *ds;
 
+  _Bool history = 0;
+  cdtime_t start = 0;
+  cdtime_t end = 0;
+
   int   status;
   size_t i;
 
@@ -91,10 +202,58 @@ int handle_getval (FILE *fh, char *buffer)
   }
   assert (identifier != NULL);
 
-  if (*buffer != 0)
+  /* Options select values from the history instead of the cache. */
+  while (*buffer != 0)
   {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    return (-1);
+    char *key = NULL;
+    char *value = NULL;
+    char *endptr = NULL;
+    double tmp;
+
+    status = parse_option (&buffer, &key, &value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+      return (-1);
+    }
+
+    errno = 0;
+    tmp = strtod (value, &endptr);
+    if ((errno != 0) || (endptr == value) || (*endptr != 0) || (tmp < 0.0))
+    {
+      print_to_socket (fh, "-1 Invalid time: %s\n", value);
+      return (-1);
+    }
+
+    if (strcasecmp ("start", key) == 0)
+      start = DOUBLE_TO_CDTIME_T (tmp);
+    else if (strcasecmp ("end", key) == 0)
+      end = DOUBLE_TO_CDTIME_T (tmp);
+    else
+    {
+      print_to_socket (fh, "-1 Unknown option: %s\n", key);
+      return (-1);
+    }
+    history = 1;
+  }
+
+  if (history)
+  {
+    if (history_dir == NULL)
+    {
+      print_to_socket (fh, "-1 No history available.\n");
+      return (-1);
+    }
+
+    if (end == 0)
+      end = cdtime ();
+    if (start > end)
+    {
+      print_to_socket (fh, "-1 Start is after end.\n");
+      return (-1);
+    }
+
+    return (getval_history (fh, history_dir, identifier, start, end));
   }
 
   /* parse_identifier() modifies its first argument,
@@ -29,7 +29,9 @@
 
 #include <stdio.h>
 
-int handle_getval (FILE *fh, char *buffer);
+/* "history_dir" is the data directory of the write_tsfile plugin. If it is
+ * not NULL, the "start" and "end" options return the stored values. */
+int handle_getval (FILE *fh, char *buffer, const char *history_dir);
 
 #endif /* UTILS_CMD_GETVAL_H */
 
@@ -0,0 +1,290 @@
+/**
+ * collectd - src/utils_cmd_putbulk.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "network.h"
+#include "utils_cmd_putbulk.h"
+
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+#define print_to_socket(fh, ...) \
+    do { \
+        if (fprintf (fh, __VA_ARGS__) < 0) { \
+            char errbuf[1024]; \
+            WARNING ("handle_putbulk: failed to write to socket #%i: %s", \
+                    fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+            return -1; \
+        } \
+        fflush(fh); \
+    } while (0)
+
+#define PART_HEADER_SIZE (2 * sizeof (uint16_t))
+
+static int pb_parse_number (const char *buffer, size_t part_size, /* {{{ */
+		uint64_t *ret_value)
+{
+	uint64_t tmp;
+
+	if (part_size != (PART_HEADER_SIZE + sizeof (tmp)))
+		return (-1);
+
+	memcpy (&tmp, buffer + PART_HEADER_SIZE, sizeof (tmp));
+	*ret_value = ntohll (tmp);
+	return (0);
+} /* }}} int pb_parse_number */
+
+static int pb_parse_string (const char *buffer, size_t part_size, /* {{{ */
+		char *output, size_t output_size)
+{
+	size_t payload_size;
+
+	if (part_size <= PART_HEADER_SIZE)
+		return (-1);
+	payload_size = part_size - PART_HEADER_SIZE;
+
+	if (payload_size > output_size)
+		return (-1);
+
+	/* The string must be null-terminated. */
+	if (buffer[part_size - 1] != 0)
+		return (-1);
+
+	memcpy (output, buffer + PART_HEADER_SIZE, payload_size);
+	return (0);
+} /* }}} int pb_parse_string */
+
+/* Decodes a values part into vl->values, which must hold ds->ds_num
+ * elements. */
+static int pb_parse_values (const char *buffer, size_t part_size, /* {{{ */
+		const data_set_t *ds, value_list_t *vl)
+{
+	const uint8_t *types;
+	const char *values;
+	uint16_t tmp16;
+	size_t values_num;
+	size_t i;
+
+	if (part_size < (PART_HEADER_SIZE + sizeof (tmp16)))
+		return (-1);
+
+	memcpy (&tmp16, buffer + PART_HEADER_SIZE, sizeof (tmp16));
+	values_num = (size_t) ntohs (tmp16);
+
+	if (part_size != (PART_HEADER_SIZE + sizeof (tmp16)
+				+ values_num * (sizeof (uint8_t) + sizeof (value_t))))
+		return (-1);
+
+	if (values_num != ds->ds_num)
+		return (-1);
+
+	types = (const uint8_t *) (buffer + PART_HEADER_SIZE + sizeof (tmp16));
+	values = (const char *) (types + values_num);
+
+	for (i = 0; i < values_num; i++)
+	{
+		value_t v;
+
+		if ((int) types[i] != ds->ds[i].type)
+			return (-1);
+
+		memcpy (&v, values + i * sizeof (v), sizeof (v));
+		switch (types[i])
+		{
+			case DS_TYPE_COUNTER:
+				v.counter = (counter_t) ntohll (v.counter);
+				break;
+			case DS_TYPE_GAUGE:
+				v.gauge = (gauge_t) ntohd (v.gauge);
+				break;
+			case DS_TYPE_DERIVE:
+				v.derive = (derive_t) ntohll (v.derive);
+				break;
+			case DS_TYPE_ABSOLUTE:
+				v.absolute = (absolute_t) ntohll (v.absolute);
+				break;
+			default:
+				return (-1);
+		}
+		vl->values[i] = v;
+	}
+
+	vl->values_len = (int) values_num;
+	return (0);
+} /* }}} int pb_parse_values */
+
+int handle_putbulk (FILE *fh, const char *buffer, size_t buffer_size) /* {{{ */
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t *values = NULL;
+	size_t values_size = 0;
+	const data_set_t *ds = NULL;
+	int values_submitted = 0;
+
+	DEBUG ("utils_cmd_putbulk: handle_putbulk (fh = %p, buffer_size = %zu);",
+			(void *) fh, buffer_size);
+
+	while (buffer_size > 0)
+	{
+		uint16_t tmp16;
+		uint16_t part_type;
+		size_t part_size;
+		int status = 0;
+
+		if (buffer_size < PART_HEADER_SIZE)
+		{
+			sfree (values);
+			print_to_socket (fh, "-1 Truncated part header after %i %s.\n",
+					values_submitted,
+					(values_submitted == 1) ? "value" : "values");
+			return (-1);
+		}
+
+		memcpy (&tmp16, buffer, sizeof (tmp16));
+		part_type = ntohs (tmp16);
+		memcpy (&tmp16, buffer + sizeof (tmp16), sizeof (tmp16));
+		part_size = (size_t) ntohs (tmp16);
+
+		if ((part_size < PART_HEADER_SIZE) || (part_size > buffer_size))
+		{
+			sfree (values);
+			print_to_socket (fh, "-1 Invalid part size after %i %s.\n",
+					values_submitted,
+					(values_submitted == 1) ? "value" : "values");
+			return (-1);
+		}
+
+		switch (part_type)
+		{
+			case TYPE_HOST:
+				status = pb_parse_string (buffer, part_size,
+						vl.host, sizeof (vl.host));
+				break;
+			case TYPE_PLUGIN:
+				status = pb_parse_string (buffer, part_size,
+						vl.plugin, sizeof (vl.plugin));
+				break;
+			case TYPE_PLUGIN_INSTANCE:
+				status = pb_parse_string (buffer, part_size,
+						vl.plugin_instance, sizeof (vl.plugin_instance));
+				break;
+			case TYPE_TYPE:
+				status = pb_parse_string (buffer, part_size,
+						vl.type, sizeof (vl.type));
+				/* Look up the data set once per type change rather than
+				 * once per value list. */
+				ds = NULL;
+				break;
+			case TYPE_TYPE_INSTANCE:
+				status = pb_parse_string (buffer, part_size,
+						vl.type_instance, sizeof (vl.type_instance));
+				break;
+			case TYPE_TIME:
+			case TYPE_TIME_HR:
+			case TYPE_INTERVAL:
+			case TYPE_INTERVAL_HR:
+			{
+				uint64_t tmp = 0;
+				status = pb_parse_number (buffer, part_size, &tmp);
+				if (status != 0)
+					break;
+				if (part_type == TYPE_TIME)
+					vl.time = TIME_T_TO_CDTIME_T (tmp);
+				else if (part_type == TYPE_TIME_HR)
+					vl.time = (cdtime_t) tmp;
+				else if (part_type == TYPE_INTERVAL)
+					vl.interval = TIME_T_TO_CDTIME_T (tmp);
+				else
+					vl.interval = (cdtime_t) tmp;
+				break;
+			}
+			case TYPE_VALUES:
+				if (ds == NULL)
+				{
+					ds = plugin_get_ds (vl.type);
+					if (ds == NULL)
+					{
+						sfree (values);
+						print_to_socket (fh, "-1 Type `%s' isn't defined.\n",
+								vl.type);
+						return (-1);
+					}
+				}
+
+				if (values_size < (size_t) ds->ds_num)
+				{
+					value_t *tmp = realloc (values,
+							ds->ds_num * sizeof (*values));
+					if (tmp == NULL)
+					{
+						sfree (values);
+						print_to_socket (fh, "-1 realloc failed.\n");
+						return (-1);
+					}
+					values = tmp;
+					values_size = (size_t) ds->ds_num;
+				}
+				vl.values = values;
+
+				status = pb_parse_values (buffer, part_size, ds, &vl);
+				if (status != 0)
+					break;
+
+				plugin_dispatch_values (&vl);
+				values_submitted++;
+				break;
+			default:
+				/* Ignore unknown parts, like the network plugin does. */
+				DEBUG ("handle_putbulk: Unknown part type: 0x%04hx",
+						part_type);
+				break;
+		}
+
+		if (status != 0)
+		{
+			sfree (values);
+			print_to_socket (fh, "-1 Parsing part of type 0x%04hx failed "
+					"after %i %s.\n", part_type, values_submitted,
+					(values_submitted == 1) ? "value" : "values");
+			return (-1);
+		}
+
+		buffer += part_size;
+		buffer_size -= part_size;
+	} /* while (buffer_size > 0) */
+
+	sfree (values);
+
+	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+			values_submitted,
+			(values_submitted == 1) ? "value has" : "values have");
+
+	return (0);
+} /* }}} int handle_putbulk */
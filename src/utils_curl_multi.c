@@ -0,0 +1,574 @@
+/**
+ * collectd - src/utils_curl_multi.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_curl_multi.h"
+
+#include <pthread.h>
+
+/* curl_multi_wait() and the connection limits appeared in libcurl 7.28.0 and
+ * 7.30.0, respectively. */
+#define UCM_HAVE_MULTI_WAIT (LIBCURL_VERSION_NUM >= 0x071e00)
+
+struct ucm_worker_s;
+typedef struct ucm_worker_s ucm_worker_t;
+
+/* Per easy handle state. Created when a handle is submitted for the first
+ * time and kept until the handle is canceled, so that the handle sticks to
+ * one worker and thus to one connection cache. */
+struct ucm_request_s;
+typedef struct ucm_request_s ucm_request_t;
+struct ucm_request_s /* {{{ */
+{
+  CURL *curl;
+  ucm_worker_t *worker;
+
+  enum {
+    UCM_IDLE,
+    UCM_QUEUED,
+    UCM_ACTIVE
+  } state;
+  _Bool canceled;
+
+  ucm_callback_t callback;
+  void *user_data;
+  cdtime_t timeout;
+
+  /* Link in the worker's queue or cancel list. */
+  ucm_request_t *next;
+}; /* }}} */
+
+struct ucm_worker_s /* {{{ */
+{
+  ucm_t *ucm;
+
+  /* Only ever used by the worker thread. */
+  CURLM *multi;
+  size_t maxconnects;
+
+  pthread_t thread;
+  _Bool thread_running;
+  int pipe[2];
+
+  /* Protected by the engine's lock. */
+  ucm_request_t *queue_head;
+  ucm_request_t *queue_tail;
+  ucm_request_t *cancel;
+  size_t handles_num;
+}; /* }}} */
+
+struct ucm_s /* {{{ */
+{
+  char *name;
+  int max_connections;
+
+  /* Protects "requests", the workers' queues and "shutdown". "cond" is
+   * signaled whenever a canceled request has been released. */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  c_avl_tree_t *requests;
+  _Bool shutdown;
+
+  ucm_worker_t *workers;
+  size_t workers_num;
+}; /* }}} */
+
+static int ucm_compare (void const *a, void const *b) /* {{{ */
+{
+  if (a < b)
+    return (-1);
+  else if (a > b)
+    return (1);
+  return (0);
+} /* }}} int ucm_compare */
+
+static void ucm_wakeup (ucm_worker_t *w) /* {{{ */
+{
+  char c = 0;
+
+  /* The pipe is non-blocking; if it is full, the worker is awake anyway. */
+  if (write (w->pipe[1], &c, sizeof (c)) < 0)
+    return;
+} /* }}} void ucm_wakeup */
+
+/* Picks a worker based on the host part of "url", so that all requests to one
+ * host end up in the same connection cache. */
+static ucm_worker_t *ucm_select_worker (ucm_t *ucm, char const *url) /* {{{ */
+{
+  char const *ptr;
+  unsigned int hash = 0;
+
+  if (ucm->workers_num == 1)
+    return (ucm->workers);
+
+  ptr = strstr (url, "://");
+  ptr = (ptr != NULL) ? ptr + 3 : url;
+
+  for (; (*ptr != 0) && (strchr ("/?#", *ptr) == NULL); ptr++)
+    hash = (hash * 31) + (unsigned int) tolower ((int) *ptr);
+
+  return (ucm->workers + (hash % ucm->workers_num));
+} /* }}} ucm_worker_t *ucm_select_worker */
+
+static void ucm_release (ucm_t *ucm, ucm_request_t *req) /* {{{ */
+{
+  c_avl_remove (ucm->requests, req->curl, NULL, NULL);
+  req->worker->handles_num--;
+  sfree (req);
+} /* }}} void ucm_release */
+
+static void ucm_worker_add (ucm_worker_t *w, ucm_request_t *req) /* {{{ */
+{
+  CURLMcode status;
+
+  curl_easy_setopt (req->curl, CURLOPT_PRIVATE, req);
+  curl_easy_setopt (req->curl, CURLOPT_TIMEOUT_MS,
+      (long) CDTIME_T_TO_MS (req->timeout));
+
+  status = curl_multi_add_handle (w->multi, req->curl);
+  if (status == CURLM_OK)
+    return;
+
+  ERROR ("%s: curl_multi_add_handle failed: %s",
+      w->ucm->name, curl_multi_strerror (status));
+
+  req->callback (req->curl, CURLE_FAILED_INIT, req->user_data);
+
+  pthread_mutex_lock (&w->ucm->lock);
+  if (!req->canceled)
+    req->state = UCM_IDLE;
+  pthread_mutex_unlock (&w->ucm->lock);
+} /* }}} void ucm_worker_add */
+
+static void ucm_worker_done (ucm_worker_t *w) /* {{{ */
+{
+  CURLMsg *msg;
+  int left;
+
+  while ((msg = curl_multi_info_read (w->multi, &left)) != NULL)
+  {
+    ucm_request_t *req = NULL;
+    CURL *curl;
+    CURLcode result;
+
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    /* "msg" is invalidated by curl_multi_remove_handle. */
+    curl = msg->easy_handle;
+    result = msg->data.result;
+
+    curl_easy_getinfo (curl, CURLINFO_PRIVATE, (char **) &req);
+    curl_multi_remove_handle (w->multi, curl);
+    if (req == NULL)
+      continue;
+
+    req->callback (curl, result, req->user_data);
+
+    /* A canceled request is on the cancel list and released from there. */
+    pthread_mutex_lock (&w->ucm->lock);
+    if (!req->canceled)
+      req->state = UCM_IDLE;
+    pthread_mutex_unlock (&w->ucm->lock);
+  }
+} /* }}} void ucm_worker_done */
+
+static void *ucm_worker (void *arg) /* {{{ */
+{
+  ucm_worker_t *w = arg;
+  ucm_t *ucm = w->ucm;
+
+  while (42)
+  {
+#if UCM_HAVE_MULTI_WAIT
+    struct curl_waitfd wfd = { w->pipe[0], CURL_WAIT_POLLIN, 0 };
+#endif
+    ucm_request_t *queue;
+    ucm_request_t *cancel;
+    ucm_request_t *req;
+    size_t maxconnects;
+    char buffer[64];
+    int running = 0;
+#if UCM_HAVE_MULTI_WAIT
+    int numfds = 0;
+#endif
+
+    while (read (w->pipe[0], buffer, sizeof (buffer)) > 0)
+      /* drain */;
+
+    pthread_mutex_lock (&ucm->lock);
+    if (ucm->shutdown)
+    {
+      pthread_mutex_unlock (&ucm->lock);
+      break;
+    }
+    queue = w->queue_head;
+    w->queue_head = w->queue_tail = NULL;
+    for (req = queue; req != NULL; req = req->next)
+      req->state = UCM_ACTIVE;
+    cancel = w->cancel;
+    w->cancel = NULL;
+    maxconnects = w->handles_num;
+    pthread_mutex_unlock (&ucm->lock);
+
+    while (cancel != NULL)
+    {
+      req = cancel;
+      cancel = req->next;
+
+      /* This is a no-op if the transfer has already completed. */
+      curl_multi_remove_handle (w->multi, req->curl);
+
+      pthread_mutex_lock (&ucm->lock);
+      ucm_release (ucm, req);
+      pthread_cond_broadcast (&ucm->cond);
+      pthread_mutex_unlock (&ucm->lock);
+    }
+
+    /* Keep one connection per handle in the cache, so connections survive
+     * from one interval to the next instead of being evicted by libcurl's
+     * default limit, which only accounts for the handles currently in
+     * flight. */
+    if ((ucm->max_connections > 0)
+        && (maxconnects > (size_t) ucm->max_connections))
+      maxconnects = (size_t) ucm->max_connections;
+    if (maxconnects > w->maxconnects)
+    {
+      curl_multi_setopt (w->multi, CURLMOPT_MAXCONNECTS, (long) maxconnects);
+      w->maxconnects = maxconnects;
+    }
+
+    while (queue != NULL)
+    {
+      req = queue;
+      queue = req->next;
+      req->next = NULL;
+
+      ucm_worker_add (w, req);
+    }
+
+    curl_multi_perform (w->multi, &running);
+    ucm_worker_done (w);
+
+#if UCM_HAVE_MULTI_WAIT
+    curl_multi_wait (w->multi, &wfd, 1, /* timeout = */ 1000, &numfds);
+#endif
+  }
+
+  return ((void *) 0);
+} /* }}} void *ucm_worker */
+
+int ucm_config_option (ucm_options_t *opts, oconfig_item_t *ci) /* {{{ */
+{
+  int *ptr = NULL;
+  int min = 0;
+  int status;
+
+  if (strcasecmp ("Asynchronous", ci->key) == 0)
+    return (cf_util_get_boolean (ci, &opts->enabled));
+  else if (strcasecmp ("Threads", ci->key) == 0)
+  {
+    ptr = &opts->threads;
+    min = 1;
+  }
+  else if (strcasecmp ("MaxConnections", ci->key) == 0)
+    ptr = &opts->max_connections;
+  else if (strcasecmp ("MaxConnectionsPerHost", ci->key) == 0)
+    ptr = &opts->max_host_connections;
+  else
+    return (1);
+
+  status = cf_util_get_int (ci, ptr);
+  if (status != 0)
+    return (status);
+
+  if (*ptr < min)
+  {
+    WARNING ("curl multi utils: `%s' must be at least %i.", ci->key, min);
+    *ptr = min;
+  }
+
+  return (0);
+} /* }}} int ucm_config_option */
+
+ucm_t *ucm_create (char const *name, ucm_options_t const *opts) /* {{{ */
+{
+  ucm_t *ucm;
+  size_t i;
+
+#if !UCM_HAVE_MULTI_WAIT
+  ERROR ("%s: Asynchronous operation requires libcurl 7.30.0 or later.",
+      name);
+  return (NULL);
+#endif
+
+  ucm = calloc (1, sizeof (*ucm));
+  if (ucm == NULL)
+    return (NULL);
+
+  ucm->name = strdup (name);
+  ucm->max_connections = opts->max_connections;
+  pthread_mutex_init (&ucm->lock, /* attr = */ NULL);
+  pthread_cond_init (&ucm->cond, /* attr = */ NULL);
+  ucm->requests = c_avl_create (ucm_compare);
+
+  ucm->workers_num = (opts->threads > 0) ? (size_t) opts->threads : 1;
+  ucm->workers = calloc (ucm->workers_num, sizeof (*ucm->workers));
+
+  if ((ucm->name == NULL) || (ucm->requests == NULL)
+      || (ucm->workers == NULL))
+  {
+    ERROR ("%s: Allocating the curl multi engine failed.", name);
+    ucm_destroy (ucm);
+    return (NULL);
+  }
+
+  for (i = 0; i < ucm->workers_num; i++)
+  {
+    ucm_worker_t *w = ucm->workers + i;
+    char errbuf[1024];
+    int status;
+
+    w->ucm = ucm;
+    w->pipe[0] = w->pipe[1] = -1;
+
+    w->multi = curl_multi_init ();
+    if (w->multi == NULL)
+    {
+      ERROR ("%s: curl_multi_init failed.", name);
+      ucm_destroy (ucm);
+      return (NULL);
+    }
+
+#if UCM_HAVE_MULTI_WAIT
+    if (opts->max_host_connections > 0)
+      curl_multi_setopt (w->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+          (long) opts->max_host_connections);
+    /* The total limit is spread evenly over the workers. */
+    if (opts->max_connections > 0)
+      curl_multi_setopt (w->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+          (long) ((opts->max_connections + ucm->workers_num - 1)
+            / ucm->workers_num));
+#endif
+
+    if ((pipe (w->pipe) != 0)
+        || (fcntl (w->pipe[0], F_SETFL, O_NONBLOCK) != 0)
+        || (fcntl (w->pipe[1], F_SETFL, O_NONBLOCK) != 0))
+    {
+      ERROR ("%s: Creating the wakeup pipe failed: %s", name,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      ucm_destroy (ucm);
+      return (NULL);
+    }
+
+    status = plugin_thread_create (&w->thread, /* attr = */ NULL,
+        ucm_worker, w);
+    if (status != 0)
+    {
+      ERROR ("%s: Starting a curl multi worker failed: %s", name,
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      ucm_destroy (ucm);
+      return (NULL);
+    }
+    w->thread_running = 1;
+  }
+
+  return (ucm);
+} /* }}} ucm_t *ucm_create */
+
+void ucm_destroy (ucm_t *ucm) /* {{{ */
+{
+  ucm_request_t *req;
+  void *key;
+  size_t i;
+
+  if (ucm == NULL)
+    return;
+
+  pthread_mutex_lock (&ucm->lock);
+  ucm->shutdown = 1;
+  pthread_mutex_unlock (&ucm->lock);
+
+  for (i = 0; i < ucm->workers_num; i++)
+  {
+    ucm_worker_t *w = ucm->workers + i;
+
+    if (!w->thread_running)
+      continue;
+
+    ucm_wakeup (w);
+    pthread_join (w->thread, /* retval = */ NULL);
+    w->thread_running = 0;
+  }
+
+  /* All workers have stopped, so the multi handles may be used from here. */
+  if (ucm->requests != NULL)
+  {
+    while (c_avl_pick (ucm->requests, &key, (void *) &req) == 0)
+    {
+      if (req->state == UCM_ACTIVE)
+        curl_multi_remove_handle (req->worker->multi, req->curl);
+      sfree (req);
+    }
+    c_avl_destroy (ucm->requests);
+  }
+
+  for (i = 0; (ucm->workers != NULL) && (i < ucm->workers_num); i++)
+  {
+    ucm_worker_t *w = ucm->workers + i;
+
+    if (w->multi != NULL)
+      curl_multi_cleanup (w->multi);
+    if (w->pipe[0] >= 0)
+      close (w->pipe[0]);
+    if (w->pipe[1] >= 0)
+      close (w->pipe[1]);
+  }
+
+  pthread_cond_destroy (&ucm->cond);
+  pthread_mutex_destroy (&ucm->lock);
+  sfree (ucm->workers);
+  sfree (ucm->name);
+  sfree (ucm);
+} /* }}} void ucm_destroy */
+
+int ucm_submit (ucm_t *ucm, CURL *curl, char const *url, /* {{{ */
+    cdtime_t timeout, ucm_callback_t callback, void *user_data)
+{
+  ucm_request_t *req = NULL;
+  ucm_worker_t *w;
+  _Bool wakeup;
+
+  pthread_mutex_lock (&ucm->lock);
+
+  if (c_avl_get (ucm->requests, curl, (void *) &req) != 0)
+  {
+    req = calloc (1, sizeof (*req));
+    if (req == NULL)
+    {
+      pthread_mutex_unlock (&ucm->lock);
+      ERROR ("%s: calloc failed.", ucm->name);
+      return (ENOMEM);
+    }
+    req->curl = curl;
+    req->worker = ucm_select_worker (ucm, url);
+    req->state = UCM_IDLE;
+
+    if (c_avl_insert (ucm->requests, curl, req) != 0)
+    {
+      pthread_mutex_unlock (&ucm->lock);
+      ERROR ("%s: c_avl_insert failed.", ucm->name);
+      sfree (req);
+      return (-1);
+    }
+    req->worker->handles_num++;
+  }
+
+  if ((req->state != UCM_IDLE) || req->canceled)
+  {
+    pthread_mutex_unlock (&ucm->lock);
+    return (EBUSY);
+  }
+
+  req->callback = callback;
+  req->user_data = user_data;
+  req->timeout = timeout;
+  req->state = UCM_QUEUED;
+  req->next = NULL;
+
+  w = req->worker;
+  wakeup = (w->queue_head == NULL);
+  if (w->queue_tail == NULL)
+    w->queue_head = req;
+  else
+    w->queue_tail->next = req;
+  w->queue_tail = req;
+
+  pthread_mutex_unlock (&ucm->lock);
+
+  if (wakeup)
+    ucm_wakeup (w);
+
+  return (0);
+} /* }}} int ucm_submit */
+
+void ucm_cancel (ucm_t *ucm, CURL *curl) /* {{{ */
+{
+  ucm_request_t *req = NULL;
+  ucm_worker_t *w;
+
+  pthread_mutex_lock (&ucm->lock);
+
+  if (c_avl_get (ucm->requests, curl, (void *) &req) != 0)
+  {
+    pthread_mutex_unlock (&ucm->lock);
+    return;
+  }
+  w = req->worker;
+
+  if (req->state == UCM_QUEUED)
+  {
+    ucm_request_t *prev = NULL;
+    ucm_request_t *ptr;
+
+    for (ptr = w->queue_head; ptr != req; ptr = ptr->next)
+      prev = ptr;
+
+    if (prev == NULL)
+      w->queue_head = req->next;
+    else
+      prev->next = req->next;
+    if (w->queue_tail == req)
+      w->queue_tail = prev;
+  }
+
+  if (req->state != UCM_ACTIVE)
+  {
+    ucm_release (ucm, req);
+    pthread_mutex_unlock (&ucm->lock);
+    return;
+  }
+
+  /* The transfer is in flight. Only the worker may touch its multi handle, so
+   * hand the request over and wait until the worker has released it. */
+  if (!req->canceled)
+  {
+    req->canceled = 1;
+    req->next = w->cancel;
+    w->cancel = req;
+    ucm_wakeup (w);
+  }
+
+  while (c_avl_get (ucm->requests, curl, NULL) == 0)
+    pthread_cond_wait (&ucm->cond, &ucm->lock);
+
+  pthread_mutex_unlock (&ucm->lock);
+} /* }}} void ucm_cancel */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
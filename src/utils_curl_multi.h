@@ -0,0 +1,100 @@
+/**
+ * collectd - src/utils_curl_multi.h
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#ifndef UTILS_CURL_MULTI_H
+#define UTILS_CURL_MULTI_H 1
+
+#include "collectd.h"
+#include "configfile.h"
+#include "utils_time.h"
+
+#include <curl/curl.h>
+
+/*
+ * Asynchronous fetch engine for the curl based plugins.
+ *
+ * Instead of blocking a read thread in curl_easy_perform(), a plugin submits
+ * its (fully configured) easy handle to the engine and returns. A small number
+ * of worker threads, each owning a curl_multi handle, drive all transfers and
+ * call the plugin's completion callback once a transfer is done. Data is
+ * handed to the handle's CURLOPT_WRITEFUNCTION as it arrives, i.e. from the
+ * worker thread, so parsers may consume the response incrementally.
+ *
+ * Requests are distributed over the workers by host name, so all transfers to
+ * one host share one connection cache: connections are kept alive and reused
+ * between intervals, and the number of parallel connections per host can be
+ * limited.
+ */
+
+struct ucm_s;
+typedef struct ucm_s ucm_t;
+
+struct ucm_options_s
+{
+  _Bool enabled;
+  int threads;
+  int max_connections;
+  int max_host_connections;
+};
+typedef struct ucm_options_s ucm_options_t;
+
+#define UCM_OPTIONS_INIT { 0, 1, 0, 4 }
+
+/* Called from a worker thread when a transfer has finished. "status" is the
+ * result of the transfer as curl_easy_perform() would have returned it. The
+ * handle may be submitted again from within the callback. */
+typedef void (*ucm_callback_t) (CURL *curl, CURLcode status, void *user_data);
+
+/* Handles the engine's options ("Asynchronous", "Threads", "MaxConnections"
+ * and "MaxConnectionsPerHost") in a plugin's configuration block. Returns zero
+ * if the option was handled, a positive value if "ci" is not one of the
+ * engine's options and a negative value on error. */
+int ucm_config_option (ucm_options_t *opts, oconfig_item_t *ci);
+
+/* "name" is used in log messages only. */
+ucm_t *ucm_create (char const *name, ucm_options_t const *opts);
+
+/* Stops all workers. Transfers still in flight are aborted without calling
+ * their callbacks. */
+void ucm_destroy (ucm_t *ucm);
+
+/* Queues "curl" for transfer. "url" selects the worker and must be the URL
+ * the handle has been configured with. If "timeout" is non-zero, the transfer
+ * is aborted after this time. Returns EBUSY if the handle is still in flight
+ * from an earlier submission, zero on success and another non-zero value on
+ * failure. EBUSY only means that this interval is skipped: read callbacks
+ * should return zero in that case, so the daemon doesn't back off. */
+int ucm_submit (ucm_t *ucm, CURL *curl, char const *url, cdtime_t timeout,
+    ucm_callback_t callback, void *user_data);
+
+/* Removes "curl" from the engine. If a callback for the handle is currently
+ * running, waits for it to return. After this returns the engine no longer
+ * references the handle or its user data. */
+void ucm_cancel (ucm_t *ucm, CURL *curl);
+
+#endif /* UTILS_CURL_MULTI_H */
+
+/* vim: set sw=2 sts=2 et : */
@@ -27,12 +27,36 @@
 
 #include "utils_format_graphite.h"
 #include "utils_cache.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
 
 #define GRAPHITE_FORBIDDEN " \t\"\\:!/()\n\r"
 
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
+/* Converts "v" to decimal without going through snprintf. Returns the
+ * number of characters written; "ret" must hold at least 21 bytes. */
+static size_t gr_format_uint (char *ret, uint64_t v)
+{
+    char tmp[24];
+    size_t len = 0;
+    size_t i;
+
+    do
+    {
+        tmp[len++] = (char) ('0' + (v % 10));
+        v /= 10;
+    } while (v != 0);
+
+    for (i = 0; i < len; i++)
+        ret[i] = tmp[len - 1 - i];
+    ret[len] = 0;
+
+    return (len);
+}
+
 static int gr_format_values (char *ret, size_t ret_len,
         int ds_num, const data_set_t *ds, const value_list_t *vl,
         gauge_t const *rates)
@@ -41,8 +65,7 @@ static int gr_format_values (char *ret, size_t ret_len,
     int status;
 
     assert (0 == strcmp (ds->type, vl->type));
-
-    memset (ret, 0, ret_len);
+    assert (ret_len > 21);
 
 #define BUFFER_ADD(...) do { \
     status = ssnprintf (ret + offset, ret_len - offset, \
@@ -64,11 +87,14 @@ static int gr_format_values (char *ret, size_t ret_len,
     else if (rates != NULL)
         BUFFER_ADD ("%f", rates[ds_num]);
     else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD ("%llu", vl->values[ds_num].counter);
-    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
+        gr_format_uint (ret, (uint64_t) vl->values[ds_num].counter);
+    else if ((ds->ds[ds_num].type == DS_TYPE_DERIVE)
+            && (vl->values[ds_num].derive < 0))
         BUFFER_ADD ("%"PRIi64, vl->values[ds_num].derive);
+    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
+        gr_format_uint (ret, (uint64_t) vl->values[ds_num].derive);
     else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD ("%"PRIu64, vl->values[ds_num].absolute);
+        gr_format_uint (ret, vl->values[ds_num].absolute);
     else
     {
         ERROR ("gr_format_values plugin: Unknown data source type: %i",
@@ -182,6 +208,88 @@ static void escape_graphite_string (char *buffer, char escape_char)
 		*head = escape_char;
 }
 
+/* Formats the escaped metric path of data source "ds_num" into "key". */
+static int gr_format_key (char *key, size_t key_size, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl, int ds_num,
+    char const *prefix, char const *postfix, char const escape_char,
+    unsigned int flags)
+{
+    char const *ds_name = NULL;
+    int status;
+
+    if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
+        || (ds->ds_num > 1))
+      ds_name = ds->ds[ds_num].name;
+
+    /* Copy the identifier to `key' and escape it. */
+    status = gr_format_name (key, (int) key_size, vl, ds_name,
+                prefix, postfix, escape_char, flags);
+    if (status != 0)
+        return (status);
+
+    escape_graphite_string (key, escape_char);
+    return (0);
+} /* }}} int gr_format_key */
+
+/* Appends "<key> <value> <time>\r\n" to "buffer". */
+static int gr_append_message (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *buffer_pos, char const *key, size_t key_len,
+    data_set_t const *ds, value_list_t const *vl, int ds_num,
+    gauge_t const *rates)
+{
+    char values[512];
+    size_t values_len;
+    char timestamp[32];
+    size_t timestamp_len;
+    size_t message_len;
+    char *ptr;
+    int status;
+
+    /* Convert the values to an ASCII representation and put that into
+     * `values'. */
+    status = gr_format_values (values, sizeof (values), ds_num, ds, vl, rates);
+    if (status != 0)
+    {
+        ERROR ("format_graphite: error with gr_format_values");
+        return (status);
+    }
+    values_len = strlen (values);
+
+    timestamp_len = gr_format_uint (timestamp,
+            (uint64_t) (unsigned int) CDTIME_T_TO_TIME_T (vl->time));
+
+    /* Compute the graphite command */
+    message_len = key_len + 1 + values_len + 1 + timestamp_len + 2;
+    if (message_len >= 1024) {
+        ERROR ("format_graphite: message buffer too small: "
+                "Need %zu bytes.", message_len + 1);
+        return (-ENOMEM);
+    }
+
+    /* Append it in case we got multiple data set */
+    if ((*buffer_pos + message_len) >= buffer_size)
+    {
+        ERROR ("format_graphite: target buffer too small");
+        return (-ENOMEM);
+    }
+
+    ptr = buffer + *buffer_pos;
+    memcpy (ptr, key, key_len);
+    ptr += key_len;
+    *(ptr++) = ' ';
+    memcpy (ptr, values, values_len);
+    ptr += values_len;
+    *(ptr++) = ' ';
+    memcpy (ptr, timestamp, timestamp_len);
+    ptr += timestamp_len;
+    *(ptr++) = '\r';
+    *(ptr++) = '\n';
+    *ptr = 0;
+
+    *buffer_pos += message_len;
+    return (0);
+} /* }}} int gr_append_message */
+
 int format_graphite (char *buffer, size_t buffer_size,
     data_set_t const *ds, value_list_t const *vl,
     char const *prefix, char const *postfix, char const escape_char,
@@ -189,7 +297,7 @@ int format_graphite (char *buffer, size_t buffer_size,
 {
     int status = 0;
     int i;
-    int buffer_pos = 0;
+    size_t buffer_pos = 0;
 
     gauge_t *rates = NULL;
     if (flags & GRAPHITE_STORE_RATES)
@@ -197,18 +305,9 @@ int format_graphite (char *buffer, size_t buffer_size,
 
     for (i = 0; i < ds->ds_num; i++)
     {
-        char const *ds_name = NULL;
-        char        key[10*DATA_MAX_NAME_LEN];
-        char        values[512];
-        size_t      message_len;
-        char        message[1024];
-
-        if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
-            || (ds->ds_num > 1))
-          ds_name = ds->ds[i].name;
-
-        /* Copy the identifier to `key' and escape it. */
-        status = gr_format_name (key, sizeof (key), vl, ds_name,
+        char key[10*DATA_MAX_NAME_LEN];
+
+        status = gr_format_key (key, sizeof (key), ds, vl, i,
                     prefix, postfix, escape_char, flags);
         if (status != 0)
         {
@@ -217,42 +316,370 @@ int format_graphite (char *buffer, size_t buffer_size,
             return (status);
         }
 
-        escape_graphite_string (key, escape_char);
-        /* Convert the values to an ASCII representation and put that into
-         * `values'. */
-        status = gr_format_values (values, sizeof (values), i, ds, vl, rates);
+        status = gr_append_message (buffer, buffer_size, &buffer_pos,
+                key, strlen (key), ds, vl, i, rates);
         if (status != 0)
         {
-            ERROR ("format_graphite: error with gr_format_values");
             sfree (rates);
             return (status);
         }
+    }
+    sfree (rates);
+    return (status);
+} /* int format_graphite */
 
-        /* Compute the graphite command */
-        message_len = (size_t) ssnprintf (message, sizeof (message),
-                "%s %s %u\r\n",
-                key,
-                values,
-                (unsigned int) CDTIME_T_TO_TIME_T (vl->time));
-        if (message_len >= sizeof (message)) {
-            ERROR ("format_graphite: message buffer too small: "
-                    "Need %zu bytes.", message_len + 1);
-            sfree (rates);
+/*
+ * Name cache
+ *
+ * Escaping the identifier is the most expensive part of formatting a value
+ * list, and the result is the same every time a value list with the same
+ * identifier is written. The cache keeps the escaped metric paths of
+ * recently written identifiers. The formatting options are fixed when the
+ * cache is created, so a changed configuration means creating a new cache.
+ * The least recently used entry is evicted when the cache is full.
+ */
+struct graphite_cache_entry_s;
+typedef struct graphite_cache_entry_s graphite_cache_entry_t;
+struct graphite_cache_entry_s
+{
+    /* Identifier: host, plugin, plugin instance, type and type instance
+     * separated by null bytes. */
+    char *id;
+    size_t id_len;
+
+    /* Escaped metric path of each data source. */
+    char **keys;
+    size_t *keys_len;
+    int keys_num;
+
+    /* Names of the data sources the keys were formatted for. */
+    char (*ds_names)[DATA_MAX_NAME_LEN];
+
+    graphite_cache_entry_t *prev;
+    graphite_cache_entry_t *next;
+};
+
+struct graphite_cache_s
+{
+    char *prefix;
+    char *postfix;
+    char escape_char;
+    unsigned int flags;
+
+    size_t max_size;
+    size_t size;
+
+    c_avl_tree_t *tree;
+    /* Most recently used first. */
+    graphite_cache_entry_t *head;
+    graphite_cache_entry_t *tail;
+
+    pthread_mutex_t lock;
+};
+
+static int gr_cache_compare (void const *a, void const *b) /* {{{ */
+{
+    graphite_cache_entry_t const *ea = a;
+    graphite_cache_entry_t const *eb = b;
+    int status;
+
+    status = memcmp (ea->id, eb->id,
+            (ea->id_len < eb->id_len) ? ea->id_len : eb->id_len);
+    if (status != 0)
+        return (status);
+
+    if (ea->id_len == eb->id_len)
+        return (0);
+    return ((ea->id_len < eb->id_len) ? -1 : 1);
+} /* }}} int gr_cache_compare */
+
+static size_t gr_cache_id (char *buffer, size_t buffer_size, /* {{{ */
+        value_list_t const *vl)
+{
+    char const *parts[] = { vl->host, vl->plugin, vl->plugin_instance,
+        vl->type, vl->type_instance };
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < STATIC_ARRAY_SIZE (parts); i++)
+    {
+        size_t len = strnlen (parts[i], DATA_MAX_NAME_LEN);
+
+        /* Each part is shorter than DATA_MAX_NAME_LEN. */
+        assert ((pos + len + 1) <= buffer_size);
+        memcpy (buffer + pos, parts[i], len);
+        pos += len;
+        buffer[pos] = 0;
+        pos++;
+    }
+
+    return (pos);
+} /* }}} size_t gr_cache_id */
+
+static void gr_cache_entry_free (graphite_cache_entry_t *entry) /* {{{ */
+{
+    int i;
+
+    if (entry == NULL)
+        return;
+
+    for (i = 0; i < entry->keys_num; i++)
+        sfree (entry->keys[i]);
+    sfree (entry->keys);
+    sfree (entry->keys_len);
+    sfree (entry->ds_names);
+    sfree (entry->id);
+    sfree (entry);
+} /* }}} void gr_cache_entry_free */
+
+static void gr_cache_unlink (graphite_cache_t *cache, /* {{{ */
+        graphite_cache_entry_t *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+} /* }}} void gr_cache_unlink */
+
+static void gr_cache_push_front (graphite_cache_t *cache, /* {{{ */
+        graphite_cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = entry;
+    cache->head = entry;
+    if (cache->tail == NULL)
+        cache->tail = entry;
+} /* }}} void gr_cache_push_front */
+
+/* Formats the keys of all data sources. */
+static int gr_cache_entry_fill (graphite_cache_t *cache, /* {{{ */
+        graphite_cache_entry_t *entry,
+        data_set_t const *ds, value_list_t const *vl)
+{
+    int i;
+
+    entry->keys = calloc ((size_t) ds->ds_num, sizeof (*entry->keys));
+    entry->keys_len = calloc ((size_t) ds->ds_num, sizeof (*entry->keys_len));
+    entry->ds_names = calloc ((size_t) ds->ds_num, sizeof (*entry->ds_names));
+    if ((entry->keys == NULL) || (entry->keys_len == NULL)
+            || (entry->ds_names == NULL))
+        return (-ENOMEM);
+    entry->keys_num = ds->ds_num;
+
+    for (i = 0; i < ds->ds_num; i++)
+    {
+        char key[10*DATA_MAX_NAME_LEN];
+        int status;
+
+        sstrncpy (entry->ds_names[i], ds->ds[i].name,
+                sizeof (entry->ds_names[i]));
+
+        status = gr_format_key (key, sizeof (key), ds, vl, i,
+                cache->prefix, cache->postfix, cache->escape_char,
+                cache->flags);
+        if (status != 0)
+        {
+            ERROR ("format_graphite: error with gr_format_name");
+            return (status);
+        }
+
+        entry->keys[i] = strdup (key);
+        if (entry->keys[i] == NULL)
             return (-ENOMEM);
+        entry->keys_len[i] = strlen (key);
+    }
+
+    return (0);
+} /* }}} int gr_cache_entry_fill */
+
+/* Returns true if the keys of "entry" were formatted for the data sources of
+ * "ds". */
+static _Bool gr_cache_entry_matches (graphite_cache_entry_t const *entry, /* {{{ */
+        data_set_t const *ds)
+{
+    int i;
+
+    if (entry->keys_num != ds->ds_num)
+        return (0);
+
+    for (i = 0; i < ds->ds_num; i++)
+        if (strcmp (entry->ds_names[i], ds->ds[i].name) != 0)
+            return (0);
+
+    return (1);
+} /* }}} _Bool gr_cache_entry_matches */
+
+/* Returns the entry for "vl", creating it if necessary. Must be called with
+ * the cache locked. */
+static graphite_cache_entry_t *gr_cache_get (graphite_cache_t *cache, /* {{{ */
+        data_set_t const *ds, value_list_t const *vl)
+{
+    char id[5 * DATA_MAX_NAME_LEN];
+    graphite_cache_entry_t lookup;
+    graphite_cache_entry_t *entry = NULL;
+
+    memset (&lookup, 0, sizeof (lookup));
+    lookup.id = id;
+    lookup.id_len = gr_cache_id (id, sizeof (id), vl);
+
+    if (c_avl_get (cache->tree, &lookup, (void *) &entry) == 0)
+    {
+        /* The data set may have changed, e.g. after reloading types.db. */
+        if (gr_cache_entry_matches (entry, ds))
+        {
+            gr_cache_unlink (cache, entry);
+            gr_cache_push_front (cache, entry);
+            return (entry);
         }
 
-        /* Append it in case we got multiple data set */
-        if ((buffer_pos + message_len) >= buffer_size)
+        c_avl_remove (cache->tree, entry, NULL, NULL);
+        gr_cache_unlink (cache, entry);
+        gr_cache_entry_free (entry);
+        cache->size--;
+    }
+
+    entry = calloc (1, sizeof (*entry));
+    if (entry == NULL)
+        return (NULL);
+
+    entry->id = malloc (lookup.id_len);
+    if (entry->id == NULL)
+    {
+        sfree (entry);
+        return (NULL);
+    }
+    memcpy (entry->id, id, lookup.id_len);
+    entry->id_len = lookup.id_len;
+
+    if (gr_cache_entry_fill (cache, entry, ds, vl) != 0)
+    {
+        gr_cache_entry_free (entry);
+        return (NULL);
+    }
+
+    if (c_avl_insert (cache->tree, entry, entry) != 0)
+    {
+        gr_cache_entry_free (entry);
+        return (NULL);
+    }
+    gr_cache_push_front (cache, entry);
+    cache->size++;
+
+    /* Evict the least recently used entry. */
+    while ((cache->size > cache->max_size) && (cache->tail != NULL))
+    {
+        graphite_cache_entry_t *old = cache->tail;
+
+        c_avl_remove (cache->tree, old, NULL, NULL);
+        gr_cache_unlink (cache, old);
+        gr_cache_entry_free (old);
+        cache->size--;
+    }
+
+    return (entry);
+} /* }}} graphite_cache_entry_t *gr_cache_get */
+
+graphite_cache_t *graphite_cache_create (char const *prefix, /* {{{ */
+        char const *postfix, char escape_char, unsigned int flags,
+        size_t max_size)
+{
+    graphite_cache_t *cache;
+
+    cache = calloc (1, sizeof (*cache));
+    if (cache == NULL)
+        return (NULL);
+
+    cache->prefix = strdup ((prefix != NULL) ? prefix : "");
+    cache->postfix = strdup ((postfix != NULL) ? postfix : "");
+    cache->tree = c_avl_create (gr_cache_compare);
+    if ((cache->prefix == NULL) || (cache->postfix == NULL)
+            || (cache->tree == NULL))
+    {
+        graphite_cache_destroy (cache);
+        return (NULL);
+    }
+
+    cache->escape_char = escape_char;
+    cache->flags = flags;
+    cache->max_size = (max_size > 0) ? max_size : 1;
+    pthread_mutex_init (&cache->lock, /* attr = */ NULL);
+
+    return (cache);
+} /* }}} graphite_cache_t *graphite_cache_create */
+
+void graphite_cache_destroy (graphite_cache_t *cache) /* {{{ */
+{
+    graphite_cache_entry_t *entry;
+
+    if (cache == NULL)
+        return;
+
+    if (cache->tree != NULL)
+    {
+        /* All entries are on the list, too. */
+        while ((entry = cache->head) != NULL)
         {
-            ERROR ("format_graphite: target buffer too small");
-            sfree (rates);
-            return (-ENOMEM);
+            gr_cache_unlink (cache, entry);
+            gr_cache_entry_free (entry);
         }
-        memcpy((void *) (buffer + buffer_pos), message, message_len);
-        buffer_pos += message_len;
+        c_avl_destroy (cache->tree);
+        pthread_mutex_destroy (&cache->lock);
     }
+
+    sfree (cache->prefix);
+    sfree (cache->postfix);
+    sfree (cache);
+} /* }}} void graphite_cache_destroy */
+
+int format_graphite_cached (graphite_cache_t *cache, /* {{{ */
+        char *buffer, size_t buffer_size,
+        data_set_t const *ds, value_list_t const *vl)
+{
+    graphite_cache_entry_t *entry;
+    gauge_t *rates = NULL;
+    size_t buffer_pos = 0;
+    int status = 0;
+    int i;
+
+    if (cache == NULL)
+        return (-EINVAL);
+
+    if (cache->flags & GRAPHITE_STORE_RATES)
+      rates = uc_get_rate (ds, vl);
+
+    pthread_mutex_lock (&cache->lock);
+
+    entry = gr_cache_get (cache, ds, vl);
+    if (entry == NULL)
+    {
+        pthread_mutex_unlock (&cache->lock);
+        sfree (rates);
+        /* Fall back to formatting the name every time. */
+        return (format_graphite (buffer, buffer_size, ds, vl, cache->prefix,
+                    cache->postfix, cache->escape_char, cache->flags));
+    }
+
+    for (i = 0; i < ds->ds_num; i++)
+    {
+        status = gr_append_message (buffer, buffer_size, &buffer_pos,
+                entry->keys[i], entry->keys_len[i], ds, vl, i, rates);
+        if (status != 0)
+            break;
+    }
+
+    pthread_mutex_unlock (&cache->lock);
     sfree (rates);
     return (status);
-} /* int format_graphite */
+} /* }}} int format_graphite_cached */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
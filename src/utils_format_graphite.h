@@ -35,4 +35,22 @@ int format_graphite (char *buffer,
     const char *postfix, const char escape_char,
     unsigned int flags);
 
+/* Number of identifiers a name cache holds by default. */
+#define GRAPHITE_CACHE_SIZE_DEFAULT 16384
+
+struct graphite_cache_s;
+typedef struct graphite_cache_s graphite_cache_t;
+
+/* Creates a cache of escaped metric paths for the given formatting options.
+ * If the options change, a new cache has to be created. */
+graphite_cache_t *graphite_cache_create (const char *prefix,
+    const char *postfix, char escape_char, unsigned int flags,
+    size_t max_size);
+void graphite_cache_destroy (graphite_cache_t *cache);
+
+/* Same as format_graphite() with the options of "cache". */
+int format_graphite_cached (graphite_cache_t *cache,
+    char *buffer, size_t buffer_size,
+    const data_set_t *ds, const value_list_t *vl);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
@@ -31,91 +31,328 @@
 #include "utils_cache.h"
 #include "utils_format_json.h"
 
-static int json_escape_string (char *buffer, size_t buffer_size, /* {{{ */
-    const char *string)
+/*
+ * The formatting functions below append to a "format_json_stream_t". A stream
+ * either owns a buffer that grows as needed, or wraps a buffer supplied by the
+ * caller, in which case running out of space is an error (-ENOMEM). Numbers
+ * are formatted without going through the printf machinery where possible;
+ * the output is the same as that of "%g", "%.3f", "%"PRIi64 etc.
+ */
+
+/* Makes sure "len" more bytes plus the terminating null byte fit. */
+static int json_reserve (format_json_stream_t *s, size_t len) /* {{{ */
 {
-  size_t src_pos;
-  size_t dst_pos;
+  size_t new_size;
+  char *tmp;
 
-  if ((buffer == NULL) || (string == NULL))
-    return (-EINVAL);
+  if ((s->fill + len + 1) <= s->size)
+    return (0);
 
-  if (buffer_size < 3)
+  if (s->fixed)
     return (-ENOMEM);
 
-  dst_pos = 0;
+  new_size = (s->size > 0) ? s->size : 1024;
+  while ((s->fill + len + 1) > new_size)
+    new_size *= 2;
 
-#define BUFFER_ADD(c) do { \
-  if (dst_pos >= (buffer_size - 1)) { \
-    buffer[buffer_size - 1] = 0; \
-    return (-ENOMEM); \
-  } \
-  buffer[dst_pos] = (c); \
-  dst_pos++; \
-} while (0)
+  tmp = realloc (s->data, new_size);
+  if (tmp == NULL)
+    return (-ENOMEM);
+  s->data = tmp;
+  s->size = new_size;
+
+  return (0);
+} /* }}} int json_reserve */
+
+static int json_add_raw (format_json_stream_t *s, /* {{{ */
+    const char *str, size_t len)
+{
+  int status;
+
+  status = json_reserve (s, len);
+  if (status != 0)
+    return (status);
+
+  memcpy (s->data + s->fill, str, len);
+  s->fill += len;
+  s->data[s->fill] = 0;
+  return (0);
+} /* }}} int json_add_raw */
+
+#define json_add_literal(s, str) json_add_raw ((s), (str), sizeof (str) - 1)
+
+static int json_add_str (format_json_stream_t *s, const char *str) /* {{{ */
+{
+  return (json_add_raw (s, str, strlen (str)));
+} /* }}} int json_add_str */
 
-  /* Escape special characters */
-  BUFFER_ADD ('"');
-  for (src_pos = 0; string[src_pos] != 0; src_pos++)
+static int json_add_printf (format_json_stream_t *s, /* {{{ */
+    const char *format, ...)
+{
+  va_list ap;
+  int status;
+
+  va_start (ap, format);
+  status = vsnprintf (NULL, 0, format, ap);
+  va_end (ap);
+  if (status < 1)
+    return (-1);
+
+  status = json_reserve (s, (size_t) status);
+  if (status != 0)
+    return (status);
+
+  va_start (ap, format);
+  status = vsnprintf (s->data + s->fill, s->size - s->fill, format, ap);
+  va_end (ap);
+  if (status < 1)
+    return (-1);
+
+  s->fill += (size_t) status;
+  return (0);
+} /* }}} int json_add_printf */
+
+/* Adds "string" enclosed in double quotes. Quotes and backslashes are escaped,
+ * control characters replaced by question marks. */
+static int json_add_string (format_json_stream_t *s, /* {{{ */
+    const char *string)
+{
+  size_t len = strlen (string);
+  size_t i;
+  char *ptr;
+  int status;
+
+  /* Worst case: every character is escaped. */
+  status = json_reserve (s, 2 * len + 2);
+  if (status != 0)
+    return (status);
+
+  ptr = s->data + s->fill;
+  *(ptr++) = '"';
+  for (i = 0; i < len; i++)
   {
-    if ((string[src_pos] == '"')
-        || (string[src_pos] == '\\'))
+    if ((string[i] == '"') || (string[i] == '\\'))
     {
-      BUFFER_ADD ('\\');
-      BUFFER_ADD (string[src_pos]);
+      *(ptr++) = '\\';
+      *(ptr++) = string[i];
     }
-    else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD ('?');
+    else if (string[i] <= 0x001F)
+      *(ptr++) = '?';
     else
-      BUFFER_ADD (string[src_pos]);
-  } /* for */
-  BUFFER_ADD ('"');
-  buffer[dst_pos] = 0;
-
-#undef BUFFER_ADD
+      *(ptr++) = string[i];
+  }
+  *(ptr++) = '"';
+  *ptr = 0;
 
+  s->fill = (size_t) (ptr - s->data);
   return (0);
-} /* }}} int json_escape_string */
+} /* }}} int json_add_string */
+
+static int json_add_uint64 (format_json_stream_t *s, uint64_t v) /* {{{ */
+{
+  char buffer[24];
+  char *ptr = buffer + sizeof (buffer);
+
+  do
+  {
+    *(--ptr) = (char) ('0' + (v % 10));
+    v /= 10;
+  } while (v != 0);
+
+  return (json_add_raw (s, ptr, (size_t) ((buffer + sizeof (buffer)) - ptr)));
+} /* }}} int json_add_uint64 */
+
+static int json_add_int64 (format_json_stream_t *s, int64_t v) /* {{{ */
+{
+  int status;
+
+  if (v >= 0)
+    return (json_add_uint64 (s, (uint64_t) v));
+
+  status = json_add_literal (s, "-");
+  if (status != 0)
+    return (status);
+  return (json_add_uint64 (s, ((uint64_t) (-(v + 1))) + 1));
+} /* }}} int json_add_int64 */
+
+/* Formats "v" like printf's "%g", i.e. with six significant digits. Values
+ * that are too close to a rounding boundary to be sure about the last digit,
+ * and very large or small values, are left to snprintf. */
+static int json_add_gauge (format_json_stream_t *s, double v) /* {{{ */
+{
+  static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16 };
+  char buffer[32];
+  char digits[6];
+  char *ptr = buffer;
+  double a = fabs (v);
+  double m;
+  double r;
+  int64_t n;
+  int exp;
+  int i;
+  int last;
+
+  if (a == 0.0)
+    return (signbit (v) ? json_add_literal (s, "-0")
+        : json_add_literal (s, "0"));
+
+  /* Integers with up to six digits are printed as is. */
+  if ((a < 1e6) && (a == floor (a)))
+    return (json_add_int64 (s, (int64_t) v));
+
+  if ((a < 1e-5) || (a >= 1e15))
+    return (json_add_printf (s, "%g", v));
+
+  /* Find the decimal exponent and scale the value to six digits. Powers of
+   * ten up to 1e22 are exact, so this is off by at most one ulp. */
+  for (exp = -5; (exp < 14) && (a >= 10.0 * ((exp < 0)
+          ? 1.0 / powers[-exp] : powers[exp])); exp++)
+    /* do nothing */;
+
+  m = 0.0;
+  for (i = 0; i < 3; i++)
+  {
+    if (exp <= 5)
+      m = a * powers[5 - exp];
+    else
+      m = a / powers[exp - 5];
+
+    if (m < 100000.0)
+      exp--;
+    else if (m >= 1000000.0)
+      exp++;
+    else
+      break;
+  }
+
+  r = floor (m + 0.5);
+  if ((m < 100000.0) || (m >= 1000000.0)
+      || (fabs ((m - floor (m)) - 0.5) < 1e-7))
+    return (json_add_printf (s, "%g", v));
+
+  n = (int64_t) r;
+  if (n >= 1000000)
+  {
+    n /= 10;
+    exp++;
+  }
+
+  for (i = 5; i >= 0; i--)
+  {
+    digits[i] = (char) ('0' + (n % 10));
+    n /= 10;
+  }
+
+  /* Trailing zeros are removed. */
+  for (last = 5; (last > 0) && (digits[last] == '0'); last--)
+    /* do nothing */;
+
+  if (v < 0)
+    *(ptr++) = '-';
+
+  if ((exp < -4) || (exp >= 6))
+  {
+    *(ptr++) = digits[0];
+    if (last > 0)
+    {
+      *(ptr++) = '.';
+      for (i = 1; i <= last; i++)
+        *(ptr++) = digits[i];
+    }
+    *(ptr++) = 'e';
+    *(ptr++) = (exp < 0) ? '-' : '+';
+    if (exp < 0)
+      exp = -exp;
+    *(ptr++) = (char) ('0' + exp / 10);
+    *(ptr++) = (char) ('0' + exp % 10);
+  }
+  else if (exp >= 0)
+  {
+    for (i = 0; i <= exp; i++)
+      *(ptr++) = digits[i];
+    if (last > exp)
+    {
+      *(ptr++) = '.';
+      for (i = exp + 1; i <= last; i++)
+        *(ptr++) = digits[i];
+    }
+  }
+  else
+  {
+    *(ptr++) = '0';
+    *(ptr++) = '.';
+    for (i = exp + 1; i < 0; i++)
+      *(ptr++) = '0';
+    for (i = 0; i <= last; i++)
+      *(ptr++) = digits[i];
+  }
+
+  return (json_add_raw (s, buffer, (size_t) (ptr - buffer)));
+} /* }}} int json_add_gauge */
+
+/* Formats "t" like "%.3f" of CDTIME_T_TO_DOUBLE (t). Rounding is done on the
+ * exact binary fraction, half to even, like the C library does. */
+static int json_add_time (format_json_stream_t *s, cdtime_t t) /* {{{ */
+{
+  char buffer[4];
+  double d = (double) t;
+  uint64_t bits;
+  uint64_t seconds;
+  uint64_t rem;
+  uint64_t ms;
+  int status;
+
+  if (d >= 9223372036854775808.0)
+    return (json_add_printf (s, "%.3f", CDTIME_T_TO_DOUBLE (t)));
+
+  bits = (uint64_t) d;
+  seconds = bits >> 30;
+  rem = (bits & 0x3fffffff) * 1000;
+  ms = rem >> 30;
+  rem &= 0x3fffffff;
+  if ((rem > 0x20000000) || ((rem == 0x20000000) && ((ms % 2) == 1)))
+    ms++;
+  if (ms == 1000)
+  {
+    seconds++;
+    ms = 0;
+  }
+
+  status = json_add_uint64 (s, seconds);
+  if (status != 0)
+    return (status);
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
+  buffer[0] = '.';
+  buffer[1] = (char) ('0' + ms / 100);
+  buffer[2] = (char) ('0' + (ms / 10) % 10);
+  buffer[3] = (char) ('0' + ms % 10);
+  return (json_add_raw (s, buffer, sizeof (buffer)));
+} /* }}} int json_add_time */
+
+static int values_to_json (format_json_stream_t *s, /* {{{ */
                 const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  size_t offset = 0;
   int i;
   gauge_t *rates = NULL;
+  int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
+  status = json_add_literal (s, "[");
+  for (i = 0; (status == 0) && (i < ds->ds_num); i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
+    {
+      status = json_add_literal (s, ",");
+      if (status != 0)
+        break;
+    }
 
     if (ds->ds[i].type == DS_TYPE_GAUGE)
     {
       if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD ("%g", vl->values[i].gauge);
+        status = json_add_gauge (s, vl->values[i].gauge);
       else
-        BUFFER_ADD ("null");
+        status = json_add_literal (s, "null");
     }
     else if (store_rates)
     {
@@ -124,137 +361,94 @@ static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
       if (rates == NULL)
       {
         WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
         return (-1);
       }
 
       if(isfinite (rates[i]))
-        BUFFER_ADD ("%g", rates[i]);
+        status = json_add_gauge (s, rates[i]);
       else
-        BUFFER_ADD ("null");
+        status = json_add_literal (s, "null");
     }
     else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
+      status = json_add_uint64 (s, (uint64_t) vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
+      status = json_add_int64 (s, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
+      status = json_add_uint64 (s, vl->values[i].absolute);
     else
     {
       ERROR ("format_json: Unknown data source type: %i",
           ds->ds[i].type);
-      sfree (rates);
-      return (-1);
+      status = -1;
     }
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
 
-#undef BUFFER_ADD
+  if (status == 0)
+    status = json_add_literal (s, "]");
 
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
-  return (0);
+  sfree (rates);
+  return (status);
 } /* }}} int values_to_json */
 
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int dstypes_to_json (format_json_stream_t *s, /* {{{ */
                 const data_set_t *ds)
 {
-  size_t offset = 0;
   int i;
+  int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
+  status = json_add_literal (s, "[");
+  for (i = 0; (status == 0) && (i < ds->ds_num); i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
+      status = json_add_literal (s, ",");
+    if (status == 0)
+      status = json_add_literal (s, "\"");
+    if (status == 0)
+      status = json_add_str (s, DS_TYPE_TO_STRING (ds->ds[i].type));
+    if (status == 0)
+      status = json_add_literal (s, "\"");
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
 
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
-
-  return (0);
+  if (status == 0)
+    status = json_add_literal (s, "]");
+  return (status);
 } /* }}} int dstypes_to_json */
 
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int dsnames_to_json (format_json_stream_t *s, /* {{{ */
                 const data_set_t *ds)
 {
-  size_t offset = 0;
   int i;
+  int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
+  status = json_add_literal (s, "[");
+  for (i = 0; (status == 0) && (i < ds->ds_num); i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
+      status = json_add_literal (s, ",");
+    if (status == 0)
+      status = json_add_literal (s, "\"");
+    if (status == 0)
+      status = json_add_str (s, ds->ds[i].name);
+    if (status == 0)
+      status = json_add_literal (s, "\"");
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
 
-  return (0);
+  if (status == 0)
+    status = json_add_literal (s, "]");
+  return (status);
 } /* }}} int dsnames_to_json */
 
-static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
+/* Adds ",\"meta\":{...}". Nothing is added if none of the entries can be
+ * represented. */
+static int meta_data_to_json (format_json_stream_t *s, /* {{{ */
     meta_data_t *meta)
 {
-  size_t offset = 0;
+  size_t fill_orig = s->fill;
   char **keys = NULL;
   int keys_num;
-  int status;
+  int status = 0;
   int i;
 
-  buffer[0] = 0;
-
-  if (meta == NULL)
-    return (EINVAL);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   keys_num = meta_data_toc (meta, &keys);
   if (keys_num == 0)
   {
@@ -262,110 +456,118 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
     return (0);
   }
 
+  status = json_add_literal (s, ",\"meta\":");
   for (i = 0; i < keys_num; ++i)
   {
     int type;
     char *key = keys[i];
+    size_t fill_key = s->fill;
+
+    /* All entries get a leading comma, the first one is replaced below. */
+    if (status == 0)
+      status = json_add_literal (s, ",\"");
+    if (status == 0)
+      status = json_add_str (s, key);
+    if (status == 0)
+      status = json_add_literal (s, "\":");
 
     type = meta_data_type (meta, key);
-    if (type == MD_TYPE_STRING)
+    if (status != 0)
+      ; /* don't add anything else */
+    else if (type == MD_TYPE_STRING)
     {
       char *value = NULL;
       if (meta_data_get_string (meta, key, &value) == 0)
       {
-        char temp[512] = "";
-        json_escape_string (temp, sizeof (temp), value);
+        status = json_add_string (s, value);
         sfree (value);
-        BUFFER_ADD (",\"%s\":%s", key, temp);
       }
+      else
+        s->fill = fill_key;
     }
     else if (type == MD_TYPE_SIGNED_INT)
     {
       int64_t value = 0;
       if (meta_data_get_signed_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIi64, key, value);
+        status = json_add_int64 (s, value);
+      else
+        s->fill = fill_key;
     }
     else if (type == MD_TYPE_UNSIGNED_INT)
     {
       uint64_t value = 0;
       if (meta_data_get_unsigned_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIu64, key, value);
+        status = json_add_uint64 (s, value);
+      else
+        s->fill = fill_key;
     }
     else if (type == MD_TYPE_DOUBLE)
     {
       double value = 0.0;
       if (meta_data_get_double (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%f", key, value);
+        status = json_add_printf (s, "%f", value);
+      else
+        s->fill = fill_key;
     }
     else if (type == MD_TYPE_BOOLEAN)
     {
       _Bool value = 0;
       if (meta_data_get_boolean (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%s", key, value ? "true" : "false");
+        status = value ? json_add_literal (s, "true")
+          : json_add_literal (s, "false");
+      else
+        s->fill = fill_key;
     }
+    else
+      s->fill = fill_key;
 
     free (key);
   } /* for (keys) */
   free (keys);
 
-  if (offset <= 0)
-    return (ENOENT);
-
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD ("}");
+  if (status != 0)
+    return (status);
 
-#undef BUFFER_ADD
+  /* No entries could be added. */
+  if (s->fill == (fill_orig + strlen (",\"meta\":")))
+  {
+    s->fill = fill_orig;
+    s->data[s->fill] = 0;
+    return (ENOENT);
+  }
 
-  return (0);
+  s->data[fill_orig + strlen (",\"meta\":")] = '{'; /* replace leading ',' */
+  return (json_add_literal (s, "}"));
 } /* }}} int meta_data_to_json */
 
-static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int value_list_to_json (format_json_stream_t *s, /* {{{ */
                 const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[512];
-  size_t offset = 0;
   int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
+#define BUFFER_ADD(call) do { \
+  status = (call); \
+  if (status != 0) \
+    return (status); \
 } while (0)
 
   /* All value lists have a leading comma. The first one will be replaced with
    * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
-
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
-
-  status = dstypes_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
-
-  status = dsnames_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
-
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+  BUFFER_ADD (json_add_literal (s, ",{\"values\":"));
+  BUFFER_ADD (values_to_json (s, ds, vl, store_rates));
+  BUFFER_ADD (json_add_literal (s, ",\"dstypes\":"));
+  BUFFER_ADD (dstypes_to_json (s, ds));
+  BUFFER_ADD (json_add_literal (s, ",\"dsnames\":"));
+  BUFFER_ADD (dsnames_to_json (s, ds));
+
+  BUFFER_ADD (json_add_literal (s, ",\"time\":"));
+  BUFFER_ADD (json_add_time (s, vl->time));
+  BUFFER_ADD (json_add_literal (s, ",\"interval\":"));
+  BUFFER_ADD (json_add_time (s, vl->interval));
 
 #define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = json_escape_string (temp, sizeof (temp), (value)); \
-  if (status != 0) \
-    return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
+  BUFFER_ADD (json_add_literal (s, ",\"" key "\":")); \
+  BUFFER_ADD (json_add_string (s, (value))); \
 } while (0)
 
   BUFFER_ADD_KEYVAL ("host", vl->host);
@@ -375,46 +577,81 @@ static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
   BUFFER_ADD_KEYVAL ("type_instance", vl->type_instance);
 
   if (vl->meta != NULL)
-  {
-    char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
-    status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
-    if (status != 0)
-      return (status);
+    BUFFER_ADD (meta_data_to_json (s, vl->meta));
 
-    BUFFER_ADD (",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
-
-  BUFFER_ADD ("}");
+  BUFFER_ADD (json_add_literal (s, "}"));
 
 #undef BUFFER_ADD_KEYVAL
 #undef BUFFER_ADD
 
-  DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
-
   return (0);
 } /* }}} int value_list_to_json */
 
-static int format_json_value_list_nocheck (char *buffer, /* {{{ */
-    size_t *ret_buffer_fill, size_t *ret_buffer_free,
-    const data_set_t *ds, const value_list_t *vl,
-    int store_rates, size_t temp_size)
+/*
+ * Streams
+ */
+void format_json_stream_init (format_json_stream_t *s) /* {{{ */
+{
+  memset (s, 0, sizeof (*s));
+} /* }}} void format_json_stream_init */
+
+void format_json_stream_reset (format_json_stream_t *s) /* {{{ */
+{
+  s->fill = 0;
+  if (s->data != NULL)
+    s->data[0] = 0;
+} /* }}} void format_json_stream_reset */
+
+void format_json_stream_destroy (format_json_stream_t *s) /* {{{ */
+{
+  if (!s->fixed)
+    sfree (s->data);
+  memset (s, 0, sizeof (*s));
+} /* }}} void format_json_stream_destroy */
+
+int format_json_stream_value_list (format_json_stream_t *s, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[temp_size];
+  size_t fill_orig;
   int status;
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  if ((s == NULL) || (ds == NULL) || (vl == NULL))
+    return (-EINVAL);
+
+  fill_orig = s->fill;
+  status = value_list_to_json (s, ds, vl, store_rates);
   if (status != 0)
+  {
+    /* Don't leave a partial value list behind. */
+    s->fill = fill_orig;
+    if (s->data != NULL)
+      s->data[s->fill] = 0;
     return (status);
-  temp_size = strlen (temp);
+  }
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  DEBUG ("format_json: value_list_to_json: buffer = %s;",
+      s->data + fill_orig);
+  return (0);
+} /* }}} int format_json_stream_value_list */
+
+int format_json_stream_finalize (format_json_stream_t *s) /* {{{ */
+{
+  int status;
+
+  if ((s == NULL) || (s->fill == 0) || (s->data[0] != ','))
+    return (-EINVAL);
 
+  status = json_add_literal (s, "]");
+  if (status != 0)
+    return (status);
+
+  s->data[0] = '[';
   return (0);
-} /* }}} int format_json_value_list_nocheck */
+} /* }}} int format_json_stream_finalize */
 
+/*
+ * Fixed size buffer interface
+ */
 int format_json_initialize (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free)
 {
@@ -471,6 +708,9 @@ int format_json_value_list (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free,
     const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
+  format_json_stream_t s;
+  int status;
+
   if ((buffer == NULL)
       || (ret_buffer_fill == NULL) || (ret_buffer_free == NULL)
       || (ds == NULL) || (vl == NULL))
@@ -479,9 +719,21 @@ int format_json_value_list (char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return (-ENOMEM);
 
-  return (format_json_value_list_nocheck (buffer,
-        ret_buffer_fill, ret_buffer_free, ds, vl,
-        store_rates, (*ret_buffer_free) - 2));
+  /* Format directly into the caller's buffer, keeping two bytes for the
+   * closing bracket added by `format_json_finalize'. */
+  s.data = buffer;
+  s.size = (*ret_buffer_fill) + (*ret_buffer_free) - 2;
+  s.fill = *ret_buffer_fill;
+  s.fixed = 1;
+
+  status = format_json_stream_value_list (&s, ds, vl, store_rates);
+  if (status != 0)
+    return (status);
+
+  (*ret_buffer_free) -= s.fill - (*ret_buffer_fill);
+  (*ret_buffer_fill) = s.fill;
+
+  return (0);
 } /* }}} int format_json_value_list */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
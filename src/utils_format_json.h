@@ -30,6 +30,26 @@
 #include "collectd.h"
 #include "plugin.h"
 
+/* Output buffer that grows as needed. The formatted value lists are in
+ * "data", "fill" bytes long and null terminated. */
+struct format_json_stream_s
+{
+  char *data;
+  size_t size;
+  size_t fill;
+  _Bool fixed; /* "data" is owned by the caller and cannot grow */
+};
+typedef struct format_json_stream_s format_json_stream_t;
+
+void format_json_stream_init (format_json_stream_t *s);
+/* Discards the content but keeps the buffer for reuse. */
+void format_json_stream_reset (format_json_stream_t *s);
+void format_json_stream_destroy (format_json_stream_t *s);
+int format_json_stream_value_list (format_json_stream_t *s,
+    const data_set_t *ds, const value_list_t *vl, int store_rates);
+int format_json_stream_finalize (format_json_stream_t *s);
+
+/* Interface formatting into a fixed size buffer. */
 int format_json_initialize (char *buffer,
     size_t *ret_buffer_fill, size_t *ret_buffer_free);
 int format_json_value_list (char *buffer,
@@ -0,0 +1,403 @@
+/**
+ * collectd - src/utils_procfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_procfile.h"
+
+#define PROCFILE_BUFFER_SIZE 4096
+
+/*
+ * Private data types
+ */
+typedef struct procfile_key_s
+{
+  size_t offset; /* into key_buffer */
+  size_t length;
+  int slot;
+} procfile_key_t;
+
+struct procfile_s
+{
+  char *path;
+  int fd;
+
+  char *buffer;
+  size_t buffer_size;
+
+  size_t *lines; /* offsets into buffer */
+  size_t lines_num;
+  size_t lines_size;
+
+  /* Index; callback is NULL if the file is not indexed. */
+  procfile_slot_callback_t callback;
+  void *user_data;
+  size_t key_field;
+
+  procfile_key_t *keys;
+  size_t keys_num;
+  size_t keys_size;
+  char *key_buffer;
+  size_t key_buffer_size;
+};
+
+/*
+ * Private functions
+ */
+static int pf_is_space (char c) /* {{{ */
+{
+  return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'));
+} /* }}} int pf_is_space */
+
+static int pf_grow (void **ptr, size_t *size, size_t need, /* {{{ */
+    size_t elem_size)
+{
+  size_t new_size;
+  void *tmp;
+
+  if (*size >= need)
+    return (0);
+
+  new_size = (*size > 0) ? *size : 16;
+  while (new_size < need)
+    new_size *= 2;
+
+  tmp = realloc (*ptr, new_size * elem_size);
+  if (tmp == NULL)
+    return (ENOMEM);
+
+  *ptr = tmp;
+  *size = new_size;
+  return (0);
+} /* }}} int pf_grow */
+
+/* Reads the whole file into the buffer and NUL-terminates it. */
+static int pf_read_buffer (procfile_t *pf, size_t *ret_fill) /* {{{ */
+{
+  size_t fill = 0;
+
+  while (42)
+  {
+    ssize_t status;
+
+    if ((pf->buffer_size - fill) < 2)
+    {
+      char *tmp = realloc (pf->buffer, 2 * pf->buffer_size);
+      if (tmp == NULL)
+        return (ENOMEM);
+      pf->buffer = tmp;
+      pf->buffer_size *= 2;
+    }
+
+    status = pread (pf->fd, pf->buffer + fill,
+        pf->buffer_size - fill - 1, (off_t) fill);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (errno);
+    }
+    else if (status == 0)
+      break;
+
+    fill += (size_t) status;
+  }
+
+  pf->buffer[fill] = 0;
+  *ret_fill = fill;
+  return (0);
+} /* }}} int pf_read_buffer */
+
+static int pf_split_lines (procfile_t *pf, size_t fill) /* {{{ */
+{
+  char *ptr = pf->buffer;
+  char *end = pf->buffer + fill;
+
+  pf->lines_num = 0;
+  while (ptr < end)
+  {
+    char *eol;
+
+    if (pf_grow ((void *) &pf->lines, &pf->lines_size, pf->lines_num + 1,
+          sizeof (*pf->lines)) != 0)
+      return (ENOMEM);
+    pf->lines[pf->lines_num] = (size_t) (ptr - pf->buffer);
+    pf->lines_num++;
+
+    eol = memchr (ptr, '\n', (size_t) (end - ptr));
+    if (eol == NULL)
+      break;
+    *eol = 0;
+    ptr = eol + 1;
+  }
+
+  return (0);
+} /* }}} int pf_split_lines */
+
+/* Returns a pointer to the key of a line and stores its length in
+ * "ret_length". The key is not NUL-terminated. */
+static char const *pf_find_key (char const *line, size_t field, /* {{{ */
+    size_t *ret_length)
+{
+  char const *key;
+  size_t i;
+
+  for (i = 0; ; i++)
+  {
+    while (pf_is_space (*line))
+      line++;
+    if (*line == 0)
+    {
+      *ret_length = 0;
+      return (line);
+    }
+
+    key = line;
+    while ((*line != 0) && !pf_is_space (*line))
+    {
+      if ((i == field) && (*line == ':'))
+      {
+        line++;
+        break;
+      }
+      line++;
+    }
+
+    if (i == field)
+    {
+      *ret_length = (size_t) (line - key);
+      return (key);
+    }
+  }
+} /* }}} char const *pf_find_key */
+
+static _Bool pf_index_is_valid (procfile_t *pf) /* {{{ */
+{
+  size_t i;
+
+  if (pf->keys_num != pf->lines_num)
+    return (0);
+
+  for (i = 0; i < pf->lines_num; i++)
+  {
+    char const *key;
+    size_t length;
+
+    key = pf_find_key (pf->buffer + pf->lines[i], pf->key_field, &length);
+    if ((length != pf->keys[i].length)
+        || (memcmp (key, pf->key_buffer + pf->keys[i].offset, length) != 0))
+      return (0);
+  }
+
+  return (1);
+} /* }}} _Bool pf_index_is_valid */
+
+static int pf_index_rebuild (procfile_t *pf) /* {{{ */
+{
+  size_t offset = 0;
+  size_t i;
+
+  pf->keys_num = 0;
+  if (pf_grow ((void *) &pf->keys, &pf->keys_size, pf->lines_num,
+        sizeof (*pf->keys)) != 0)
+    return (ENOMEM);
+
+  /* Copy all keys first: the key buffer may move while it grows. */
+  for (i = 0; i < pf->lines_num; i++)
+  {
+    char const *key;
+    size_t length;
+
+    key = pf_find_key (pf->buffer + pf->lines[i], pf->key_field, &length);
+    if (pf_grow ((void *) &pf->key_buffer, &pf->key_buffer_size,
+          offset + length + 1, 1) != 0)
+      return (ENOMEM);
+
+    memcpy (pf->key_buffer + offset, key, length);
+    pf->key_buffer[offset + length] = 0;
+
+    pf->keys[i].offset = offset;
+    pf->keys[i].length = length;
+    pf->keys[i].slot = -1;
+    offset += length + 1;
+  }
+  pf->keys_num = pf->lines_num;
+
+  for (i = 0; i < pf->keys_num; i++)
+    pf->keys[i].slot = (*pf->callback) (pf->key_buffer + pf->keys[i].offset,
+        i, pf->user_data);
+
+  return (0);
+} /* }}} int pf_index_rebuild */
+
+/*
+ * Public functions
+ */
+procfile_t *procfile_open_indexed (char const *path, /* {{{ */
+    size_t key_field, procfile_slot_callback_t callback, void *user_data)
+{
+  procfile_t *pf;
+
+  pf = calloc (1, sizeof (*pf));
+  if (pf == NULL)
+    return (NULL);
+  pf->fd = -1;
+
+  pf->path = strdup (path);
+  pf->buffer_size = PROCFILE_BUFFER_SIZE;
+  pf->buffer = malloc (pf->buffer_size);
+  if ((pf->path == NULL) || (pf->buffer == NULL))
+  {
+    procfile_close (pf);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  pf->fd = open (path, O_RDONLY);
+  if (pf->fd < 0)
+  {
+    int status = errno;
+    procfile_close (pf);
+    errno = status;
+    return (NULL);
+  }
+
+  pf->callback = callback;
+  pf->user_data = user_data;
+  pf->key_field = key_field;
+
+  return (pf);
+} /* }}} procfile_t *procfile_open_indexed */
+
+procfile_t *procfile_open (char const *path) /* {{{ */
+{
+  return (procfile_open_indexed (path, 0, NULL, NULL));
+} /* }}} procfile_t *procfile_open */
+
+void procfile_close (procfile_t *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return;
+
+  if (pf->fd >= 0)
+    close (pf->fd);
+
+  sfree (pf->path);
+  sfree (pf->buffer);
+  sfree (pf->lines);
+  sfree (pf->keys);
+  sfree (pf->key_buffer);
+  sfree (pf);
+} /* }}} void procfile_close */
+
+char const *procfile_path (procfile_t const *pf) /* {{{ */
+{
+  return (pf->path);
+} /* }}} char const *procfile_path */
+
+int procfile_read (procfile_t *pf) /* {{{ */
+{
+  size_t fill = 0;
+  int status;
+
+  pf->lines_num = 0;
+
+  status = pf_read_buffer (pf, &fill);
+  if ((status != 0) && (status != ENOMEM))
+  {
+    /* The file may have been replaced, e.g. after a module was reloaded.
+     * Open it again and retry once. */
+    int fd = open (pf->path, O_RDONLY);
+    if (fd < 0)
+      return (errno);
+
+    close (pf->fd);
+    pf->fd = fd;
+    status = pf_read_buffer (pf, &fill);
+  }
+  if (status != 0)
+    return (status);
+
+  status = pf_split_lines (pf, fill);
+  if (status != 0)
+    return (status);
+
+  if ((pf->callback != NULL) && !pf_index_is_valid (pf))
+  {
+    status = pf_index_rebuild (pf);
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int procfile_read */
+
+size_t procfile_lines_num (procfile_t const *pf) /* {{{ */
+{
+  return (pf->lines_num);
+} /* }}} size_t procfile_lines_num */
+
+char *procfile_line (procfile_t *pf, size_t line) /* {{{ */
+{
+  if (line >= pf->lines_num)
+    return (NULL);
+  return (pf->buffer + pf->lines[line]);
+} /* }}} char *procfile_line */
+
+int procfile_slot (procfile_t const *pf, size_t line) /* {{{ */
+{
+  if ((pf->callback == NULL) || (line >= pf->keys_num))
+    return (-1);
+  return (pf->keys[line].slot);
+} /* }}} int procfile_slot */
+
+int procfile_split (char *string, char **fields, size_t size) /* {{{ */
+{
+  size_t i = 0;
+  char *ptr = string;
+
+  while (i < size)
+  {
+    while (pf_is_space (*ptr))
+      ptr++;
+    if (*ptr == 0)
+      break;
+
+    fields[i] = ptr;
+    i++;
+
+    while ((*ptr != 0) && !pf_is_space (*ptr))
+      ptr++;
+    if (*ptr == 0)
+      break;
+    *ptr = 0;
+    ptr++;
+  }
+
+  return ((int) i);
+} /* }}} int procfile_split */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
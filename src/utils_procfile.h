@@ -0,0 +1,80 @@
+/**
+ * collectd - src/utils_procfile.h
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#ifndef UTILS_PROCFILE_H
+#define UTILS_PROCFILE_H 1
+
+#include "collectd.h"
+
+/*
+ * Reader for line based files such as the ones in /proc.
+ *
+ * The file is kept open and each read starts over at offset zero, using a
+ * buffer that is reused between reads. Lines and fields are split in place,
+ * nothing is copied.
+ *
+ * Optionally, each line is mapped to a "slot" by a callback. The key of a line
+ * is its "key_field"th (counting from zero) whitespace separated field, up to
+ * and including the first colon, so "eth0:123" yields the key "eth0:". The
+ * mapping is remembered and only rebuilt when the sequence of keys, i.e. the
+ * shape of the file, changes.
+ */
+
+struct procfile_s;
+typedef struct procfile_s procfile_t;
+
+/* Returns the slot of the line with the given key, or a negative value if the
+ * line is of no interest. When the index is rebuilt, the callback is called
+ * for every line in order, starting with line zero. */
+typedef int (*procfile_slot_callback_t) (char const *key, size_t line,
+    void *user_data);
+
+/* Returns NULL and sets errno if the file cannot be opened. */
+procfile_t *procfile_open (char const *path);
+procfile_t *procfile_open_indexed (char const *path, size_t key_field,
+    procfile_slot_callback_t callback, void *user_data);
+void procfile_close (procfile_t *pf);
+
+char const *procfile_path (procfile_t const *pf);
+
+/* Re-reads the file. Returns zero on success and an errno value otherwise.
+ * Previously returned lines are invalidated. */
+int procfile_read (procfile_t *pf);
+
+size_t procfile_lines_num (procfile_t const *pf);
+
+/* Returns the line without its newline. The line may be modified, e.g. by
+ * procfile_split(), until the next call to procfile_read(). */
+char *procfile_line (procfile_t *pf, size_t line);
+
+/* Returns the slot of the line, or -1 if the file is not indexed. */
+int procfile_slot (procfile_t const *pf, size_t line);
+
+/* Splits "string" at whitespace in place, like strsplit(). Returns the number
+ * of fields stored in "fields". */
+int procfile_split (char *string, char **fields, size_t size);
+
+#endif /* UTILS_PROCFILE_H */
@@ -0,0 +1,1577 @@
+/**
+ * collectd - src/utils_tsfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_tsfile.h"
+
+#include <sys/mman.h>
+#include <dirent.h>
+
+#define TSF_BLOCK_MAGIC   0x42465354 /* "TSFB" */
+#define TSF_INDEX_MAGIC   0x49465354 /* "TSFI" */
+#define TSF_TRAILER_MAGIC 0x45465354 /* "TSFE" */
+
+/* Block header:
+ *   u32 magic, u32 block size, u16 identifier length, u16 number of values,
+ *   u32 number of points, i64 first time, i64 last time,
+ * followed by one byte per data source type, the identifier, and the time
+ * and value columns, each prefixed with its length in bits (u32). */
+#define TSF_BLOCK_HEADER_SIZE 32
+
+/* Index: u32 magic, u32 flags, u32 number of entries, u32 size of the string
+ * table, the entries, and the string table. Each entry consists of
+ *   u32 identifier offset, u32 identifier length, u64 block offset,
+ *   i64 first time, i64 last time,
+ * sorted by identifier and offset. The index is followed by the trailer:
+ *   u64 index offset, u32 magic. */
+#define TSF_INDEX_HEADER_SIZE 16
+#define TSF_INDEX_ENTRY_SIZE  32
+#define TSF_TRAILER_SIZE      12
+
+#define TSF_FLAG_COMPACTED 0x01
+
+/*
+ * Private data types
+ */
+typedef struct tsf_bitbuf_s
+{
+  uint8_t *data;
+  size_t size; /* bytes allocated */
+  size_t bits; /* bits used */
+} tsf_bitbuf_t;
+
+typedef struct tsf_bitreader_s
+{
+  uint8_t const *data;
+  size_t bits;
+  size_t pos;
+} tsf_bitreader_t;
+
+typedef struct tsf_column_s
+{
+  tsf_bitbuf_t buffer;
+  uint64_t prev;
+  int leading; /* < 0 if there is no previous window */
+  int trailing;
+} tsf_column_t;
+
+struct tsf_series_s
+{
+  char *identifier;
+  int *ds_types;
+  size_t values_num;
+
+  uint32_t points_num;
+  int64_t time_first;
+  int64_t time_last;
+  int64_t time_delta;
+  tsf_bitbuf_t times;
+  tsf_column_t *columns;
+};
+
+typedef struct tsf_index_entry_s
+{
+  char *identifier;
+  uint64_t offset;
+  int64_t first;
+  int64_t last;
+} tsf_index_entry_t;
+
+struct tsf_segment_s
+{
+  char *filename;
+  int fd;
+  uint64_t size;
+  /* End of the data in the file, which is beyond "size" after a failed
+   * write. */
+  uint64_t file_size;
+  uint32_t flags;
+
+  tsf_index_entry_t *index;
+  size_t index_num;
+  size_t index_size;
+
+  uint8_t *buffer;
+  size_t buffer_size;
+};
+
+/* A read-only mapping of a segment file. */
+typedef struct tsf_map_s
+{
+  uint8_t const *data;
+  size_t size;
+  size_t data_end; /* end of the blocks */
+
+  uint8_t const *index; /* NULL if the segment has no valid index */
+  uint32_t index_num;
+  uint8_t const *strings;
+  uint32_t strings_size;
+  uint32_t flags;
+} tsf_map_t;
+
+/*
+ * Byte order helpers
+ */
+static void tsf_put_u16 (uint8_t *p, uint16_t v) /* {{{ */
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+} /* }}} void tsf_put_u16 */
+
+static void tsf_put_u32 (uint8_t *p, uint32_t v) /* {{{ */
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    p[i] = (uint8_t) (v >> (8 * i));
+} /* }}} void tsf_put_u32 */
+
+static void tsf_put_u64 (uint8_t *p, uint64_t v) /* {{{ */
+{
+  int i;
+  for (i = 0; i < 8; i++)
+    p[i] = (uint8_t) (v >> (8 * i));
+} /* }}} void tsf_put_u64 */
+
+static uint16_t tsf_get_u16 (uint8_t const *p) /* {{{ */
+{
+  return ((uint16_t) (p[0] | (p[1] << 8)));
+} /* }}} uint16_t tsf_get_u16 */
+
+static uint32_t tsf_get_u32 (uint8_t const *p) /* {{{ */
+{
+  uint32_t v = 0;
+  int i;
+  for (i = 3; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return (v);
+} /* }}} uint32_t tsf_get_u32 */
+
+static uint64_t tsf_get_u64 (uint8_t const *p) /* {{{ */
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 7; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return (v);
+} /* }}} uint64_t tsf_get_u64 */
+
+/*
+ * Bit streams
+ */
+static int tsf_bitbuf_write (tsf_bitbuf_t *b, uint64_t value, int nbits) /* {{{ */
+{
+  if ((b->bits + nbits) > (8 * b->size))
+  {
+    size_t new_size = (b->size > 0) ? (2 * b->size) : 64;
+    uint8_t *tmp;
+
+    while ((b->bits + nbits) > (8 * new_size))
+      new_size *= 2;
+
+    tmp = realloc (b->data, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    memset (tmp + b->size, 0, new_size - b->size);
+    b->data = tmp;
+    b->size = new_size;
+  }
+
+  /* Most significant bit first, filling up the current byte each time. */
+  while (nbits > 0)
+  {
+    int free_bits = 8 - (int) (b->bits % 8);
+    int n = (nbits < free_bits) ? nbits : free_bits;
+    uint8_t chunk = (uint8_t) ((value >> (nbits - n)) & ((1u << n) - 1));
+
+    b->data[b->bits / 8] |= (uint8_t) (chunk << (free_bits - n));
+    b->bits += n;
+    nbits -= n;
+  }
+
+  return (0);
+} /* }}} int tsf_bitbuf_write */
+
+static void tsf_bitbuf_reset (tsf_bitbuf_t *b) /* {{{ */
+{
+  if (b->data != NULL)
+    memset (b->data, 0, (b->bits + 7) / 8);
+  b->bits = 0;
+} /* }}} void tsf_bitbuf_reset */
+
+static int tsf_bitreader_read (tsf_bitreader_t *r, int nbits, /* {{{ */
+    uint64_t *ret)
+{
+  uint64_t v = 0;
+
+  if ((r->pos + nbits) > r->bits)
+    return (-1);
+
+  while (nbits > 0)
+  {
+    int avail = 8 - (int) (r->pos % 8);
+    int n = (nbits < avail) ? nbits : avail;
+    uint8_t chunk = (uint8_t) ((r->data[r->pos / 8] >> (avail - n))
+        & ((1u << n) - 1));
+
+    v = (v << n) | chunk;
+    r->pos += n;
+    nbits -= n;
+  }
+
+  *ret = v;
+  return (0);
+} /* }}} int tsf_bitreader_read */
+
+static int tsf_clz64 (uint64_t v) /* {{{ */
+{
+  int n = 0;
+  while ((n < 64) && ((v & (((uint64_t) 1) << 63)) == 0))
+  {
+    v <<= 1;
+    n++;
+  }
+  return (n);
+} /* }}} int tsf_clz64 */
+
+static int tsf_ctz64 (uint64_t v) /* {{{ */
+{
+  int n = 0;
+  while ((n < 64) && ((v & 1) == 0))
+  {
+    v >>= 1;
+    n++;
+  }
+  return (n);
+} /* }}} int tsf_ctz64 */
+
+static int64_t tsf_sign_extend (uint64_t v, int nbits) /* {{{ */
+{
+  if ((nbits < 64) && ((v >> (nbits - 1)) & 1))
+    v |= ~((uint64_t) 0) << nbits;
+  return ((int64_t) v);
+} /* }}} int64_t tsf_sign_extend */
+
+/*
+ * Time column: delta-of-delta encoding
+ *   '0'                 delta unchanged
+ *   '10'   +  7 bits    dod in [-64, 63]
+ *   '110'  +  9 bits    dod in [-256, 255]
+ *   '1110' + 12 bits    dod in [-2048, 2047]
+ *   '1111' + 64 bits    anything else
+ */
+static int tsf_time_append (tsf_series_t *s, int64_t t) /* {{{ */
+{
+  tsf_bitbuf_t *b = &s->times;
+  int64_t delta;
+  int64_t dod;
+  int status;
+
+  if (s->points_num == 0)
+  {
+    s->time_first = t;
+    s->time_last = t;
+    s->time_delta = 0;
+    return (tsf_bitbuf_write (b, (uint64_t) t, 64));
+  }
+
+  delta = t - s->time_last;
+  dod = delta - s->time_delta;
+  s->time_last = t;
+  s->time_delta = delta;
+
+  if (dod == 0)
+    return (tsf_bitbuf_write (b, 0, 1));
+  else if ((dod >= -64) && (dod <= 63))
+    status = tsf_bitbuf_write (b, 0x02, 2)
+      || tsf_bitbuf_write (b, (uint64_t) dod, 7);
+  else if ((dod >= -256) && (dod <= 255))
+    status = tsf_bitbuf_write (b, 0x06, 3)
+      || tsf_bitbuf_write (b, (uint64_t) dod, 9);
+  else if ((dod >= -2048) && (dod <= 2047))
+    status = tsf_bitbuf_write (b, 0x0e, 4)
+      || tsf_bitbuf_write (b, (uint64_t) dod, 12);
+  else
+    status = tsf_bitbuf_write (b, 0x0f, 4)
+      || tsf_bitbuf_write (b, (uint64_t) dod, 64);
+
+  return (status ? ENOMEM : 0);
+} /* }}} int tsf_time_append */
+
+static int tsf_time_next (tsf_bitreader_t *r, _Bool first, /* {{{ */
+    int64_t *time, int64_t *delta)
+{
+  static int const widths[] = { 7, 9, 12, 64 };
+  uint64_t bits;
+  int prefix;
+
+  if (first)
+  {
+    if (tsf_bitreader_read (r, 64, &bits) != 0)
+      return (-1);
+    *time = (int64_t) bits;
+    *delta = 0;
+    return (0);
+  }
+
+  /* Count the leading ones of the control prefix. */
+  for (prefix = 0; prefix < 4; prefix++)
+  {
+    if (tsf_bitreader_read (r, 1, &bits) != 0)
+      return (-1);
+    if (bits == 0)
+      break;
+  }
+
+  if (prefix > 0)
+  {
+    if (tsf_bitreader_read (r, widths[prefix - 1], &bits) != 0)
+      return (-1);
+    *delta += tsf_sign_extend (bits, widths[prefix - 1]);
+  }
+
+  *time += *delta;
+  return (0);
+} /* }}} int tsf_time_next */
+
+/*
+ * Value columns: XOR encoding
+ *   '0'                             same value as before
+ *   '10' + meaningful bits          XOR fits into the previous window
+ *   '11' + 5 bits leading zeros
+ *        + 6 bits length - 1
+ *        + meaningful bits          new window
+ */
+static int tsf_column_append (tsf_column_t *c, uint64_t v, _Bool first) /* {{{ */
+{
+  uint64_t xor;
+  int leading;
+  int trailing;
+  int length;
+  int status;
+
+  if (first)
+  {
+    c->prev = v;
+    c->leading = -1;
+    c->trailing = 0;
+    return (tsf_bitbuf_write (&c->buffer, v, 64));
+  }
+
+  xor = v ^ c->prev;
+  c->prev = v;
+
+  if (xor == 0)
+    return (tsf_bitbuf_write (&c->buffer, 0, 1));
+
+  leading = tsf_clz64 (xor);
+  trailing = tsf_ctz64 (xor);
+  if (leading > 31)
+    leading = 31;
+
+  if ((c->leading >= 0) && (leading >= c->leading)
+      && (trailing >= c->trailing))
+  {
+    length = 64 - c->leading - c->trailing;
+    status = tsf_bitbuf_write (&c->buffer, 0x02, 2)
+      || tsf_bitbuf_write (&c->buffer, xor >> c->trailing, length);
+  }
+  else
+  {
+    length = 64 - leading - trailing;
+    status = tsf_bitbuf_write (&c->buffer, 0x03, 2)
+      || tsf_bitbuf_write (&c->buffer, (uint64_t) leading, 5)
+      || tsf_bitbuf_write (&c->buffer, (uint64_t) (length - 1), 6)
+      || tsf_bitbuf_write (&c->buffer, xor >> trailing, length);
+    c->leading = leading;
+    c->trailing = trailing;
+  }
+
+  return (status ? ENOMEM : 0);
+} /* }}} int tsf_column_append */
+
+static int tsf_column_next (tsf_bitreader_t *r, _Bool first, /* {{{ */
+    tsf_column_t *state)
+{
+  uint64_t bits;
+  int length;
+
+  if (first)
+  {
+    state->leading = -1;
+    state->trailing = 0;
+    return (tsf_bitreader_read (r, 64, &state->prev));
+  }
+
+  if (tsf_bitreader_read (r, 1, &bits) != 0)
+    return (-1);
+  if (bits == 0)
+    return (0);
+
+  if (tsf_bitreader_read (r, 1, &bits) != 0)
+    return (-1);
+  if (bits != 0)
+  {
+    uint64_t leading;
+    uint64_t len;
+
+    if ((tsf_bitreader_read (r, 5, &leading) != 0)
+        || (tsf_bitreader_read (r, 6, &len) != 0))
+      return (-1);
+
+    state->leading = (int) leading;
+    state->trailing = 64 - (int) leading - ((int) len + 1);
+    if (state->trailing < 0)
+      return (-1);
+  }
+  else if (state->leading < 0)
+    return (-1);
+
+  length = 64 - state->leading - state->trailing;
+  if (tsf_bitreader_read (r, length, &bits) != 0)
+    return (-1);
+
+  state->prev ^= bits << state->trailing;
+  return (0);
+} /* }}} int tsf_column_next */
+
+static uint64_t tsf_value_to_bits (value_t v, int ds_type) /* {{{ */
+{
+  uint64_t bits;
+
+  switch (ds_type)
+  {
+    case DS_TYPE_GAUGE:
+      assert (sizeof (bits) == sizeof (v.gauge));
+      memcpy (&bits, &v.gauge, sizeof (bits));
+      return (bits);
+    case DS_TYPE_DERIVE:
+      return ((uint64_t) v.derive);
+    case DS_TYPE_ABSOLUTE:
+      return ((uint64_t) v.absolute);
+    default:
+      return ((uint64_t) v.counter);
+  }
+} /* }}} uint64_t tsf_value_to_bits */
+
+static value_t tsf_bits_to_value (uint64_t bits, int ds_type) /* {{{ */
+{
+  value_t v;
+
+  memset (&v, 0, sizeof (v));
+  switch (ds_type)
+  {
+    case DS_TYPE_GAUGE:
+      memcpy (&v.gauge, &bits, sizeof (v.gauge));
+      break;
+    case DS_TYPE_DERIVE:
+      v.derive = (derive_t) bits;
+      break;
+    case DS_TYPE_ABSOLUTE:
+      v.absolute = (absolute_t) bits;
+      break;
+    default:
+      v.counter = (counter_t) bits;
+  }
+
+  return (v);
+} /* }}} value_t tsf_bits_to_value */
+
+/*
+ * Series
+ */
+tsf_series_t *tsf_series_create (char const *identifier, /* {{{ */
+    int const *ds_types, size_t values_num)
+{
+  tsf_series_t *s;
+
+  if ((identifier == NULL) || (ds_types == NULL) || (values_num == 0)
+      || (values_num > UINT16_MAX) || (strlen (identifier) > UINT16_MAX))
+    return (NULL);
+
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
+    return (NULL);
+
+  s->identifier = strdup (identifier);
+  s->ds_types = calloc (values_num, sizeof (*s->ds_types));
+  s->columns = calloc (values_num, sizeof (*s->columns));
+  if ((s->identifier == NULL) || (s->ds_types == NULL)
+      || (s->columns == NULL))
+  {
+    tsf_series_destroy (s);
+    return (NULL);
+  }
+
+  memcpy (s->ds_types, ds_types, values_num * sizeof (*s->ds_types));
+  s->values_num = values_num;
+
+  return (s);
+} /* }}} tsf_series_t *tsf_series_create */
+
+void tsf_series_destroy (tsf_series_t *s) /* {{{ */
+{
+  size_t i;
+
+  if (s == NULL)
+    return;
+
+  if (s->columns != NULL)
+    for (i = 0; i < s->values_num; i++)
+      sfree (s->columns[i].buffer.data);
+
+  sfree (s->columns);
+  sfree (s->times.data);
+  sfree (s->ds_types);
+  sfree (s->identifier);
+  sfree (s);
+} /* }}} void tsf_series_destroy */
+
+static void tsf_series_reset (tsf_series_t *s) /* {{{ */
+{
+  size_t i;
+
+  tsf_bitbuf_reset (&s->times);
+  for (i = 0; i < s->values_num; i++)
+    tsf_bitbuf_reset (&s->columns[i].buffer);
+  s->points_num = 0;
+} /* }}} void tsf_series_reset */
+
+int tsf_series_append (tsf_series_t *s, cdtime_t time, /* {{{ */
+    value_t const *values)
+{
+  _Bool first;
+  size_t i;
+  int status;
+
+  if ((s == NULL) || (values == NULL))
+    return (EINVAL);
+
+  if (s->points_num == UINT32_MAX)
+    return (ENOSPC);
+
+  first = (s->points_num == 0);
+
+  status = tsf_time_append (s, (int64_t) CDTIME_T_TO_MS (time));
+  for (i = 0; (status == 0) && (i < s->values_num); i++)
+    status = tsf_column_append (&s->columns[i],
+        tsf_value_to_bits (values[i], s->ds_types[i]), first);
+
+  if (status != 0)
+  {
+    /* The bit streams are inconsistent now. Drop the pending points rather
+     * than writing a corrupt block. */
+    tsf_series_reset (s);
+    return (status);
+  }
+
+  s->points_num++;
+  return (0);
+} /* }}} int tsf_series_append */
+
+size_t tsf_series_points (tsf_series_t const *s) /* {{{ */
+{
+  return ((s != NULL) ? (size_t) s->points_num : 0);
+} /* }}} size_t tsf_series_points */
+
+size_t tsf_series_values_num (tsf_series_t const *s) /* {{{ */
+{
+  return ((s != NULL) ? s->values_num : 0);
+} /* }}} size_t tsf_series_values_num */
+
+/*
+ * Blocks
+ */
+/* Checks the block at "data" and returns its size in "ret_size". */
+static int tsf_block_check (uint8_t const *data, size_t avail, /* {{{ */
+    uint32_t *ret_size)
+{
+  uint32_t size;
+  uint16_t identifier_len;
+  uint16_t values_num;
+
+  if (avail < TSF_BLOCK_HEADER_SIZE)
+    return (-1);
+  if (tsf_get_u32 (data) != TSF_BLOCK_MAGIC)
+    return (-1);
+
+  size = tsf_get_u32 (data + 4);
+  identifier_len = tsf_get_u16 (data + 8);
+  values_num = tsf_get_u16 (data + 10);
+
+  if ((size > avail) || (size < (TSF_BLOCK_HEADER_SIZE + values_num
+          + identifier_len + 4 * (1 + (size_t) values_num))))
+    return (-1);
+
+  *ret_size = size;
+  return (0);
+} /* }}} int tsf_block_check */
+
+static int tsf_block_identifier_cmp (uint8_t const *block, /* {{{ */
+    char const *identifier)
+{
+  uint16_t len = tsf_get_u16 (block + 8);
+  uint16_t values_num = tsf_get_u16 (block + 10);
+  char const *ptr = (char const *) block + TSF_BLOCK_HEADER_SIZE + values_num;
+
+  if ((strlen (identifier) != len) || (strncmp (identifier, ptr, len) != 0))
+    return (-1);
+  return (0);
+} /* }}} int tsf_block_identifier_cmp */
+
+/* Calls "callback" for all points of the (checked) block in [start, end]. */
+static int tsf_block_decode (uint8_t const *block, uint32_t size, /* {{{ */
+    int64_t start, int64_t end,
+    tsf_read_callback_t callback, void *user_data)
+{
+  uint16_t identifier_len = tsf_get_u16 (block + 8);
+  uint16_t values_num = tsf_get_u16 (block + 10);
+  uint32_t points_num = tsf_get_u32 (block + 12);
+  uint8_t const *ptr;
+  uint8_t const *block_end = block + size;
+
+  tsf_bitreader_t times;
+  tsf_bitreader_t *readers;
+  tsf_column_t *states;
+  int *ds_types;
+  value_t *values;
+  int64_t time = 0;
+  int64_t delta = 0;
+  uint32_t i;
+  size_t j;
+  int status = 0;
+
+  if (((int64_t) tsf_get_u64 (block + 24) < start)
+      || ((int64_t) tsf_get_u64 (block + 16) > end))
+    return (0);
+
+  readers = calloc (values_num, sizeof (*readers));
+  states = calloc (values_num, sizeof (*states));
+  ds_types = calloc (values_num, sizeof (*ds_types));
+  values = calloc (values_num, sizeof (*values));
+  if ((readers == NULL) || (states == NULL) || (ds_types == NULL)
+      || (values == NULL))
+  {
+    status = ENOMEM;
+    goto out;
+  }
+
+  ptr = block + TSF_BLOCK_HEADER_SIZE;
+  for (j = 0; j < values_num; j++)
+    ds_types[j] = (int) ptr[j];
+  ptr += values_num + identifier_len;
+
+  /* Set up one reader per column. */
+  for (j = 0; j <= values_num; j++)
+  {
+    tsf_bitreader_t *r = (j == 0) ? &times : &readers[j - 1];
+
+    if ((ptr + 4) > block_end)
+    {
+      status = -1;
+      goto out;
+    }
+    r->bits = tsf_get_u32 (ptr);
+    r->data = ptr + 4;
+    r->pos = 0;
+    ptr += 4 + (r->bits + 7) / 8;
+    if (ptr > block_end)
+    {
+      status = -1;
+      goto out;
+    }
+  }
+
+  for (i = 0; i < points_num; i++)
+  {
+    if (tsf_time_next (&times, /* first = */ (i == 0), &time, &delta) != 0)
+    {
+      status = -1;
+      goto out;
+    }
+
+    for (j = 0; j < values_num; j++)
+    {
+      if (tsf_column_next (&readers[j], /* first = */ (i == 0),
+            &states[j]) != 0)
+      {
+        status = -1;
+        goto out;
+      }
+      values[j] = tsf_bits_to_value (states[j].prev, ds_types[j]);
+    }
+
+    if ((time < start) || (time > end))
+      continue;
+
+    status = (*callback) (MS_TO_CDTIME_T (time), values, ds_types,
+        values_num, user_data);
+    if (status != 0)
+      break;
+  }
+
+out:
+  if (status < 0)
+    ERROR ("utils_tsfile: Block is corrupt.");
+  sfree (readers);
+  sfree (states);
+  sfree (ds_types);
+  sfree (values);
+  return (status);
+} /* }}} int tsf_block_decode */
+
+/*
+ * Mapped segments
+ */
+static void tsf_map_close (tsf_map_t *m) /* {{{ */
+{
+  if ((m->data != NULL) && (m->size > 0))
+    munmap ((void *) m->data, m->size);
+  memset (m, 0, sizeof (*m));
+} /* }}} void tsf_map_close */
+
+static int tsf_map_open (char const *filename, tsf_map_t *m) /* {{{ */
+{
+  struct stat statbuf;
+  void *data;
+  int fd;
+
+  memset (m, 0, sizeof (*m));
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return (-1);
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  if (statbuf.st_size == 0)
+  {
+    close (fd);
+    return (0);
+  }
+
+  data = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: mmap (%s) failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  m->data = data;
+  m->size = (size_t) statbuf.st_size;
+  m->data_end = m->size;
+
+  /* Look for a valid index. */
+  if (m->size >= (TSF_INDEX_HEADER_SIZE + TSF_TRAILER_SIZE))
+  {
+    uint8_t const *trailer = m->data + m->size - TSF_TRAILER_SIZE;
+    uint64_t index_offset = tsf_get_u64 (trailer);
+    uint8_t const *index;
+    uint32_t index_num;
+    uint32_t strings_size;
+
+    if ((tsf_get_u32 (trailer + 8) != TSF_TRAILER_MAGIC)
+        || (index_offset > (m->size - TSF_TRAILER_SIZE
+            - TSF_INDEX_HEADER_SIZE)))
+      return (0);
+
+    index = m->data + index_offset;
+    index_num = tsf_get_u32 (index + 8);
+    strings_size = tsf_get_u32 (index + 12);
+    if ((tsf_get_u32 (index) != TSF_INDEX_MAGIC)
+        || ((index_offset + TSF_INDEX_HEADER_SIZE
+            + ((uint64_t) index_num) * TSF_INDEX_ENTRY_SIZE + strings_size)
+          != (m->size - TSF_TRAILER_SIZE)))
+      return (0);
+
+    m->flags = tsf_get_u32 (index + 4);
+    m->index_num = index_num;
+    m->index = index + TSF_INDEX_HEADER_SIZE;
+    m->strings = m->index + ((size_t) index_num) * TSF_INDEX_ENTRY_SIZE;
+    m->strings_size = strings_size;
+    m->data_end = (size_t) index_offset;
+  }
+
+  return (0);
+} /* }}} int tsf_map_open */
+
+/* Compares "identifier" with the identifier of index entry "i". */
+static int tsf_map_entry_cmp (tsf_map_t const *m, uint32_t i, /* {{{ */
+    char const *identifier)
+{
+  uint8_t const *entry = m->index + ((size_t) i) * TSF_INDEX_ENTRY_SIZE;
+  uint32_t offset = tsf_get_u32 (entry);
+  uint32_t len = tsf_get_u32 (entry + 4);
+  char const *str;
+  int status;
+
+  if (((uint64_t) offset + len) > m->strings_size)
+    return (-1);
+  str = (char const *) m->strings + offset;
+
+  status = strncmp (identifier, str, len);
+  if (status != 0)
+    return (status);
+  return ((identifier[len] != 0) ? 1 : 0);
+} /* }}} int tsf_map_entry_cmp */
+
+/* Calls "callback" for the blocks of "identifier" in [start, end], using the
+ * index if there is one. */
+static int tsf_map_read (tsf_map_t const *m, char const *identifier, /* {{{ */
+    int64_t start, int64_t end,
+    tsf_read_callback_t callback, void *user_data)
+{
+  uint32_t block_size;
+  size_t offset;
+  int status = 0;
+
+  if (m->index != NULL)
+  {
+    uint32_t lo = 0;
+    uint32_t hi = m->index_num;
+
+    /* Find the first entry for "identifier". */
+    while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (tsf_map_entry_cmp (m, mid, identifier) > 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    for (; lo < m->index_num; lo++)
+    {
+      uint8_t const *entry = m->index + ((size_t) lo) * TSF_INDEX_ENTRY_SIZE;
+      uint64_t block_offset = tsf_get_u64 (entry + 8);
+
+      if (tsf_map_entry_cmp (m, lo, identifier) != 0)
+        break;
+      if (((int64_t) tsf_get_u64 (entry + 24) < start)
+          || ((int64_t) tsf_get_u64 (entry + 16) > end))
+        continue;
+
+      if ((block_offset >= m->data_end)
+          || (tsf_block_check (m->data + block_offset,
+              m->data_end - block_offset, &block_size) != 0))
+        return (-1);
+
+      status = tsf_block_decode (m->data + block_offset, block_size,
+          start, end, callback, user_data);
+      if (status != 0)
+        return (status);
+    }
+
+    return (0);
+  }
+
+  /* No index: the segment is still being written. Scan all blocks and stop
+   * at the first incomplete one. */
+  for (offset = 0; offset < m->data_end; offset += block_size)
+  {
+    if (tsf_block_check (m->data + offset, m->data_end - offset,
+          &block_size) != 0)
+      break;
+
+    if (tsf_block_identifier_cmp (m->data + offset, identifier) != 0)
+      continue;
+
+    status = tsf_block_decode (m->data + offset, block_size, start, end,
+        callback, user_data);
+    if (status != 0)
+      break;
+  }
+
+  return (status);
+} /* }}} int tsf_map_read */
+
+/*
+ * Segment writer
+ */
+static int tsf_segment_add_index (tsf_segment_t *seg, /* {{{ */
+    char const *identifier, uint64_t offset, int64_t first, int64_t last)
+{
+  tsf_index_entry_t *entry;
+
+  if (seg->index_num >= seg->index_size)
+  {
+    size_t new_size = (seg->index_size > 0) ? (2 * seg->index_size) : 64;
+    tsf_index_entry_t *tmp;
+
+    tmp = realloc (seg->index, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (ENOMEM);
+    seg->index = tmp;
+    seg->index_size = new_size;
+  }
+
+  entry = seg->index + seg->index_num;
+  entry->identifier = strdup (identifier);
+  if (entry->identifier == NULL)
+    return (ENOMEM);
+  entry->offset = offset;
+  entry->first = first;
+  entry->last = last;
+  seg->index_num++;
+
+  return (0);
+} /* }}} int tsf_segment_add_index */
+
+static void tsf_segment_free (tsf_segment_t *seg) /* {{{ */
+{
+  size_t i;
+
+  if (seg == NULL)
+    return;
+
+  if (seg->fd >= 0)
+    close (seg->fd);
+  for (i = 0; i < seg->index_num; i++)
+    sfree (seg->index[i].identifier);
+  sfree (seg->index);
+  sfree (seg->buffer);
+  sfree (seg->filename);
+  sfree (seg);
+} /* }}} void tsf_segment_free */
+
+static int tsf_pwrite (int fd, uint8_t const *buffer, size_t size, /* {{{ */
+    uint64_t offset)
+{
+  while (size > 0)
+  {
+    ssize_t status = pwrite (fd, buffer, size, (off_t) offset);
+
+    if ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+      continue;
+    if (status < 0)
+      return (-1);
+
+    buffer += status;
+    size -= (size_t) status;
+    offset += (uint64_t) status;
+  }
+
+  return (0);
+} /* }}} int tsf_pwrite */
+
+/* Replaces "filename" with a copy of its first "size" bytes and returns a
+ * read-write descriptor of the copy. Readers may have mapped the file, and
+ * truncating it would make them crash with SIGBUS when accessing the removed
+ * pages. Like with compaction, they keep using the old file instead. */
+static int tsf_file_shrink (char const *filename, int fd, /* {{{ */
+    uint64_t size)
+{
+  char tmpfile[PATH_MAX];
+  uint8_t buffer[65536];
+  uint64_t offset = 0;
+  int tmp_fd;
+
+  ssnprintf (tmpfile, sizeof (tmpfile), "%s.new", filename);
+  tmp_fd = open (tmpfile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (tmp_fd < 0)
+    return (-1);
+
+  while (offset < size)
+  {
+    size_t len = sizeof (buffer);
+    ssize_t status;
+
+    if ((size - offset) < (uint64_t) len)
+      len = (size_t) (size - offset);
+
+    status = pread (fd, buffer, len, (off_t) offset);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if ((status <= 0)
+        || (tsf_pwrite (tmp_fd, buffer, (size_t) status, offset) != 0))
+      break;
+    offset += (uint64_t) status;
+  }
+
+  if ((offset != size) || (fsync (tmp_fd) != 0)
+      || (rename (tmpfile, filename) != 0))
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: Shrinking %s to %"PRIu64" bytes failed: %s",
+        filename, size, sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (tmp_fd);
+    unlink (tmpfile);
+    return (-1);
+  }
+
+  return (tmp_fd);
+} /* }}} int tsf_file_shrink */
+
+tsf_segment_t *tsf_segment_open (char const *filename) /* {{{ */
+{
+  tsf_segment_t *seg;
+  tsf_map_t m;
+  uint32_t block_size;
+  size_t offset;
+
+  seg = calloc (1, sizeof (*seg));
+  if (seg == NULL)
+    return (NULL);
+  seg->fd = -1;
+
+  seg->filename = strdup (filename);
+  if (seg->filename == NULL)
+  {
+    tsf_segment_free (seg);
+    return (NULL);
+  }
+
+  seg->fd = open (filename, O_RDWR | O_CREAT, 0644);
+  if (seg->fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: open (%s) failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    tsf_segment_free (seg);
+    return (NULL);
+  }
+
+  /* Rebuild the index from the existing blocks. This also drops the old index
+   * and any partially written block at the end. */
+  if (tsf_map_open (filename, &m) != 0)
+  {
+    tsf_segment_free (seg);
+    return (NULL);
+  }
+
+  for (offset = 0; offset < m.data_end; offset += block_size)
+  {
+    uint8_t const *block = m.data + offset;
+    char identifier[UINT16_MAX + 1];
+    uint16_t len;
+
+    if (tsf_block_check (block, m.data_end - offset, &block_size) != 0)
+      break;
+
+    len = tsf_get_u16 (block + 8);
+    memcpy (identifier, block + TSF_BLOCK_HEADER_SIZE
+        + tsf_get_u16 (block + 10), len);
+    identifier[len] = 0;
+
+    if (tsf_segment_add_index (seg, identifier, offset,
+          (int64_t) tsf_get_u64 (block + 16),
+          (int64_t) tsf_get_u64 (block + 24)) != 0)
+    {
+      tsf_map_close (&m);
+      tsf_segment_free (seg);
+      return (NULL);
+    }
+  }
+  seg->size = offset;
+  seg->file_size = offset;
+
+  if (offset != m.size)
+  {
+    int fd;
+
+    if (m.index == NULL)
+      WARNING ("utils_tsfile: Truncating incomplete segment %s "
+          "to %zu bytes.", filename, offset);
+
+    fd = tsf_file_shrink (filename, seg->fd, (uint64_t) offset);
+    if (fd < 0)
+    {
+      tsf_map_close (&m);
+      tsf_segment_free (seg);
+      return (NULL);
+    }
+    close (seg->fd);
+    seg->fd = fd;
+  }
+  tsf_map_close (&m);
+
+  return (seg);
+} /* }}} tsf_segment_t *tsf_segment_open */
+
+int tsf_segment_write (tsf_segment_t *seg, tsf_series_t *s) /* {{{ */
+{
+  size_t identifier_len;
+  size_t size;
+  uint8_t *ptr;
+  size_t i;
+  int status;
+
+  if ((seg == NULL) || (s == NULL))
+    return (EINVAL);
+  if (s->points_num == 0)
+    return (0);
+
+  identifier_len = strlen (s->identifier);
+  size = TSF_BLOCK_HEADER_SIZE + s->values_num + identifier_len
+    + 4 + (s->times.bits + 7) / 8;
+  for (i = 0; i < s->values_num; i++)
+    size += 4 + (s->columns[i].buffer.bits + 7) / 8;
+
+  if (size > UINT32_MAX)
+    return (EFBIG);
+
+  if (size > seg->buffer_size)
+  {
+    uint8_t *tmp = realloc (seg->buffer, size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    seg->buffer = tmp;
+    seg->buffer_size = size;
+  }
+
+  ptr = seg->buffer;
+  tsf_put_u32 (ptr, TSF_BLOCK_MAGIC);
+  tsf_put_u32 (ptr + 4, (uint32_t) size);
+  tsf_put_u16 (ptr + 8, (uint16_t) identifier_len);
+  tsf_put_u16 (ptr + 10, (uint16_t) s->values_num);
+  tsf_put_u32 (ptr + 12, s->points_num);
+  tsf_put_u64 (ptr + 16, (uint64_t) s->time_first);
+  tsf_put_u64 (ptr + 24, (uint64_t) s->time_last);
+  ptr += TSF_BLOCK_HEADER_SIZE;
+
+  for (i = 0; i < s->values_num; i++)
+    *(ptr++) = (uint8_t) s->ds_types[i];
+  memcpy (ptr, s->identifier, identifier_len);
+  ptr += identifier_len;
+
+  for (i = 0; i <= s->values_num; i++)
+  {
+    tsf_bitbuf_t *b = (i == 0) ? &s->times : &s->columns[i - 1].buffer;
+    size_t bytes = (b->bits + 7) / 8;
+
+    tsf_put_u32 (ptr, (uint32_t) b->bits);
+    if (bytes > 0)
+      memcpy (ptr + 4, b->data, bytes);
+    ptr += 4 + bytes;
+  }
+
+  if (tsf_pwrite (seg->fd, seg->buffer, size, seg->size) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: Writing to %s failed: %s", seg->filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    /* The next block overwrites the partial one; anything left beyond it is
+     * removed when the segment is closed. */
+    if ((seg->size + size) > seg->file_size)
+      seg->file_size = seg->size + size;
+    return (-1);
+  }
+
+  status = tsf_segment_add_index (seg, s->identifier, seg->size,
+      s->time_first, s->time_last);
+  seg->size += size;
+  if (seg->size > seg->file_size)
+    seg->file_size = seg->size;
+  if (status != 0)
+    return (status);
+
+  tsf_series_reset (s);
+  return (0);
+} /* }}} int tsf_segment_write */
+
+static int tsf_index_entry_compare (void const *a, void const *b) /* {{{ */
+{
+  tsf_index_entry_t const *e0 = a;
+  tsf_index_entry_t const *e1 = b;
+  int status;
+
+  status = strcmp (e0->identifier, e1->identifier);
+  if (status != 0)
+    return (status);
+  else if (e0->offset < e1->offset)
+    return (-1);
+  else if (e0->offset > e1->offset)
+    return (1);
+  return (0);
+} /* }}} int tsf_index_entry_compare */
+
+int tsf_segment_close (tsf_segment_t *seg) /* {{{ */
+{
+  size_t strings_size = 0;
+  size_t size;
+  uint8_t *buffer;
+  uint8_t *entry;
+  uint8_t *strings;
+  size_t i;
+  int status;
+
+  if (seg == NULL)
+    return (EINVAL);
+
+  qsort (seg->index, seg->index_num, sizeof (*seg->index),
+      tsf_index_entry_compare);
+
+  /* Identifiers of consecutive entries are stored only once. */
+  for (i = 0; i < seg->index_num; i++)
+    if ((i == 0) || (strcmp (seg->index[i - 1].identifier,
+            seg->index[i].identifier) != 0))
+      strings_size += strlen (seg->index[i].identifier);
+
+  size = TSF_INDEX_HEADER_SIZE + seg->index_num * TSF_INDEX_ENTRY_SIZE
+    + strings_size + TSF_TRAILER_SIZE;
+  buffer = calloc (1, size);
+  if (buffer == NULL)
+  {
+    tsf_segment_free (seg);
+    return (ENOMEM);
+  }
+
+  tsf_put_u32 (buffer, TSF_INDEX_MAGIC);
+  tsf_put_u32 (buffer + 4, seg->flags);
+  tsf_put_u32 (buffer + 8, (uint32_t) seg->index_num);
+  tsf_put_u32 (buffer + 12, (uint32_t) strings_size);
+
+  entry = buffer + TSF_INDEX_HEADER_SIZE;
+  strings = entry + seg->index_num * TSF_INDEX_ENTRY_SIZE;
+  strings_size = 0;
+  for (i = 0; i < seg->index_num; i++)
+  {
+    size_t len = strlen (seg->index[i].identifier);
+
+    if ((i == 0) || (strcmp (seg->index[i - 1].identifier,
+            seg->index[i].identifier) != 0))
+    {
+      memcpy (strings + strings_size, seg->index[i].identifier, len);
+      strings_size += len;
+    }
+
+    tsf_put_u32 (entry, (uint32_t) (strings_size - len));
+    tsf_put_u32 (entry + 4, (uint32_t) len);
+    tsf_put_u64 (entry + 8, seg->index[i].offset);
+    tsf_put_u64 (entry + 16, (uint64_t) seg->index[i].first);
+    tsf_put_u64 (entry + 24, (uint64_t) seg->index[i].last);
+    entry += TSF_INDEX_ENTRY_SIZE;
+  }
+
+  tsf_put_u64 (buffer + size - TSF_TRAILER_SIZE, seg->size);
+  tsf_put_u32 (buffer + size - TSF_TRAILER_SIZE + 8, TSF_TRAILER_MAGIC);
+
+  status = tsf_pwrite (seg->fd, buffer, size, seg->size);
+  if (status == 0)
+    status = fsync (seg->fd);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: Writing the index of %s failed: %s", seg->filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+  else if (seg->file_size > (seg->size + size))
+  {
+    /* The trailer has to be at the end of the file. */
+    int fd = tsf_file_shrink (seg->filename, seg->fd, seg->size + size);
+    if (fd < 0)
+      status = -1;
+    else
+      close (fd);
+  }
+
+  sfree (buffer);
+  tsf_segment_free (seg);
+  return (status);
+} /* }}} int tsf_segment_close */
+
+int tsf_segment_info (char const *filename, /* {{{ */
+    cdtime_t *ret_first, cdtime_t *ret_last, _Bool *ret_compacted)
+{
+  tsf_map_t m;
+  int64_t first = INT64_MAX;
+  int64_t last = INT64_MIN;
+  uint32_t i;
+
+  if (tsf_map_open (filename, &m) != 0)
+    return (-1);
+
+  if (m.index == NULL)
+  {
+    tsf_map_close (&m);
+    return (ENOENT);
+  }
+
+  for (i = 0; i < m.index_num; i++)
+  {
+    uint8_t const *entry = m.index + ((size_t) i) * TSF_INDEX_ENTRY_SIZE;
+    int64_t t;
+
+    t = (int64_t) tsf_get_u64 (entry + 16);
+    if (t < first)
+      first = t;
+    t = (int64_t) tsf_get_u64 (entry + 24);
+    if (t > last)
+      last = t;
+  }
+
+  if (m.index_num == 0)
+    first = last = 0;
+
+  *ret_first = MS_TO_CDTIME_T (first);
+  *ret_last = MS_TO_CDTIME_T (last);
+  *ret_compacted = (m.flags & TSF_FLAG_COMPACTED) ? 1 : 0;
+
+  tsf_map_close (&m);
+  return (0);
+} /* }}} int tsf_segment_info */
+
+/*
+ * Compaction
+ */
+static int tsf_compact_append (cdtime_t time, /* {{{ */
+    value_t const *values,
+    __attribute__((unused)) int const *ds_types,
+    __attribute__((unused)) size_t values_num,
+    void *user_data)
+{
+  return (tsf_series_append (user_data, time, values));
+} /* }}} int tsf_compact_append */
+
+int tsf_segment_compact (char const *filename) /* {{{ */
+{
+  char tmpfile[PATH_MAX];
+  c_avl_tree_t *tree;
+  c_avl_iterator_t *iter;
+  tsf_segment_t *seg;
+  tsf_series_t *s;
+  char *key;
+  tsf_map_t m;
+  uint32_t block_size;
+  size_t offset;
+  int status = 0;
+
+  if (tsf_map_open (filename, &m) != 0)
+    return (-1);
+
+  tree = c_avl_create ((void *) strcmp);
+  if (tree == NULL)
+  {
+    tsf_map_close (&m);
+    return (ENOMEM);
+  }
+
+  /* Blocks are stored in the order they were written, so appending them in
+   * file order keeps the points of each series sorted. */
+  for (offset = 0; offset < m.data_end; offset += block_size)
+  {
+    uint8_t const *block = m.data + offset;
+    char identifier[UINT16_MAX + 1];
+    uint16_t identifier_len;
+    uint16_t values_num;
+    int *ds_types;
+    uint16_t i;
+
+    if (tsf_block_check (block, m.data_end - offset, &block_size) != 0)
+      break;
+
+    identifier_len = tsf_get_u16 (block + 8);
+    values_num = tsf_get_u16 (block + 10);
+    memcpy (identifier, block + TSF_BLOCK_HEADER_SIZE + values_num,
+        identifier_len);
+    identifier[identifier_len] = 0;
+
+    if (c_avl_get (tree, identifier, (void *) &s) != 0)
+    {
+      ds_types = calloc (values_num, sizeof (*ds_types));
+      if (ds_types == NULL)
+      {
+        status = ENOMEM;
+        break;
+      }
+      for (i = 0; i < values_num; i++)
+        ds_types[i] = (int) block[TSF_BLOCK_HEADER_SIZE + i];
+
+      s = tsf_series_create (identifier, ds_types, values_num);
+      sfree (ds_types);
+      if (s == NULL)
+      {
+        status = ENOMEM;
+        break;
+      }
+      if (c_avl_insert (tree, s->identifier, s) != 0)
+      {
+        tsf_series_destroy (s);
+        status = -1;
+        break;
+      }
+    }
+    else if (s->values_num != values_num)
+    {
+      ERROR ("utils_tsfile: The number of values of \"%s\" changed within "
+          "segment %s.", identifier, filename);
+      status = -1;
+      break;
+    }
+
+    status = tsf_block_decode (block, block_size, INT64_MIN, INT64_MAX,
+        tsf_compact_append, s);
+    if (status != 0)
+      break;
+  }
+  tsf_map_close (&m);
+
+  if (status == 0)
+  {
+    ssnprintf (tmpfile, sizeof (tmpfile), "%s.tmp", filename);
+    unlink (tmpfile);
+
+    seg = tsf_segment_open (tmpfile);
+    if (seg == NULL)
+      status = -1;
+  }
+
+  if (status == 0)
+  {
+    iter = c_avl_get_iterator (tree);
+    while ((status == 0)
+        && (c_avl_iterator_next (iter, (void *) &key, (void *) &s) == 0))
+      status = tsf_segment_write (seg, s);
+    c_avl_iterator_destroy (iter);
+
+    seg->flags |= TSF_FLAG_COMPACTED;
+    if (status == 0)
+      status = tsf_segment_close (seg);
+    else
+      tsf_segment_close (seg);
+
+    if (status == 0)
+      status = rename (tmpfile, filename);
+    if (status != 0)
+    {
+      ERROR ("utils_tsfile: Compacting %s failed.", filename);
+      unlink (tmpfile);
+    }
+  }
+
+  while (c_avl_pick (tree, (void *) &key, (void *) &s) == 0)
+    tsf_series_destroy (s);
+  c_avl_destroy (tree);
+
+  return (status);
+} /* }}} int tsf_segment_compact */
+
+/*
+ * Reading
+ */
+static int tsf_segment_name_compare (void const *a, void const *b) /* {{{ */
+{
+  char const *n0 = *((char * const *) a);
+  char const *n1 = *((char * const *) b);
+  unsigned long long t0 = strtoull (n0, NULL, 10);
+  unsigned long long t1 = strtoull (n1, NULL, 10);
+
+  if (t0 < t1)
+    return (-1);
+  else if (t0 > t1)
+    return (1);
+  return (strcmp (n0, n1));
+} /* }}} int tsf_segment_name_compare */
+
+int tsf_read (char const *datadir, char const *identifier, /* {{{ */
+    cdtime_t start, cdtime_t end,
+    tsf_read_callback_t callback, void *user_data)
+{
+  DIR *dh;
+  struct dirent *de;
+  char **names = NULL;
+  size_t names_num = 0;
+  size_t i;
+  int status = 0;
+
+  if ((datadir == NULL) || (identifier == NULL) || (callback == NULL))
+    return (EINVAL);
+
+  dh = opendir (datadir);
+  if (dh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsfile: opendir (%s) failed: %s", datadir,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  while ((de = readdir (dh)) != NULL)
+  {
+    size_t len = strlen (de->d_name);
+    char **tmp;
+
+    if ((len <= strlen (TSF_SEGMENT_SUFFIX))
+        || (strcmp (de->d_name + len - strlen (TSF_SEGMENT_SUFFIX),
+            TSF_SEGMENT_SUFFIX) != 0))
+      continue;
+
+    tmp = realloc (names, (names_num + 1) * sizeof (*names));
+    if (tmp == NULL)
+    {
+      status = ENOMEM;
+      break;
+    }
+    names = tmp;
+
+    names[names_num] = strdup (de->d_name);
+    if (names[names_num] == NULL)
+    {
+      status = ENOMEM;
+      break;
+    }
+    names_num++;
+  }
+  closedir (dh);
+
+  /* Segment names start with their creation time. */
+  if (names_num > 0)
+    qsort (names, names_num, sizeof (*names), tsf_segment_name_compare);
+
+  for (i = 0; (status == 0) && (i < names_num); i++)
+  {
+    char filename[PATH_MAX];
+    tsf_map_t m;
+
+    ssnprintf (filename, sizeof (filename), "%s/%s", datadir, names[i]);
+
+    /* The segment may have been removed by compaction or retention. */
+    if (tsf_map_open (filename, &m) != 0)
+      continue;
+
+    status = tsf_map_read (&m, identifier,
+        (int64_t) CDTIME_T_TO_MS (start), (int64_t) CDTIME_T_TO_MS (end),
+        callback, user_data);
+    tsf_map_close (&m);
+  }
+
+  for (i = 0; i < names_num; i++)
+    sfree (names[i]);
+  sfree (names);
+
+  return (status);
+} /* }}} int tsf_read */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
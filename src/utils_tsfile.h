@@ -0,0 +1,88 @@
+/**
+ * collectd - src/utils_tsfile.h
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#ifndef UTILS_TSFILE_H
+#define UTILS_TSFILE_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/*
+ * Columnar time series segments.
+ *
+ * A segment file is a sequence of blocks, each holding a run of points of one
+ * identifier, followed by an index once the segment has been closed. Within a
+ * block, the times and each data source are stored as separate columns: times
+ * (in milliseconds) are delta-of-delta encoded, values are XOR encoded as
+ * described in "Gorilla: A Fast, Scalable, In-Memory Time Series Database".
+ * All integers are stored in little endian byte order.
+ */
+
+#define TSF_SEGMENT_SUFFIX ".tsf"
+
+struct tsf_series_s;
+typedef struct tsf_series_s tsf_series_t;
+
+struct tsf_segment_s;
+typedef struct tsf_segment_s tsf_segment_t;
+
+/* Called for each point found by tsf_read(). "ds_types" has the DS_TYPE_*
+ * of each value. A non-zero return value stops the iteration. */
+typedef int (*tsf_read_callback_t) (cdtime_t time,
+    value_t const *values, int const *ds_types, size_t values_num,
+    void *user_data);
+
+/* Series: compresses points in memory until they are written to a segment. */
+tsf_series_t *tsf_series_create (char const *identifier,
+    int const *ds_types, size_t values_num);
+void tsf_series_destroy (tsf_series_t *s);
+int tsf_series_append (tsf_series_t *s, cdtime_t time, value_t const *values);
+size_t tsf_series_points (tsf_series_t const *s);
+size_t tsf_series_values_num (tsf_series_t const *s);
+
+/* Segment writer. Opening an existing segment continues appending to it; a
+ * missing or damaged index is rebuilt from the blocks. */
+tsf_segment_t *tsf_segment_open (char const *filename);
+/* Writes the points of "s" as one block and resets the series. */
+int tsf_segment_write (tsf_segment_t *seg, tsf_series_t *s);
+/* Writes the index and closes the file. */
+int tsf_segment_close (tsf_segment_t *seg);
+
+/* Returns the time range of a closed segment. Returns ENOENT if the segment
+ * has no index, i.e. it is still being written or was not closed properly. */
+int tsf_segment_info (char const *filename,
+    cdtime_t *ret_first, cdtime_t *ret_last, _Bool *ret_compacted);
+
+/* Rewrites a segment so that each identifier is stored in a single block. */
+int tsf_segment_compact (char const *filename);
+
+/* Calls "callback" for all points of "identifier" in [start, end] stored in
+ * the segments below "datadir". */
+int tsf_read (char const *datadir, char const *identifier,
+    cdtime_t start, cdtime_t end,
+    tsf_read_callback_t callback, void *user_data);
+
+#endif /* UTILS_TSFILE_H */
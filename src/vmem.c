@@ -27,6 +27,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #if KERNEL_LINUX
 static const char *config_keys[] =
@@ -36,6 +37,54 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int verbose_output = 0;
+
+/* Slots of the /proc/vmstat lines we're interested in. */
+enum
+{
+  VMSTAT_NR,
+  VMSTAT_PGPGIN,
+  VMSTAT_PGPGOUT,
+  VMSTAT_PSWPIN,
+  VMSTAT_PSWPOUT,
+  VMSTAT_PGFAULT,
+  VMSTAT_PGMAJFAULT,
+  /* Only collected with verbose output: */
+  VMSTAT_PGALLOC,
+  VMSTAT_PGREFILL,
+  VMSTAT_PGSTEAL,
+  VMSTAT_PGSCAN_KSWAPD,
+  VMSTAT_PGSCAN_DIRECT,
+  VMSTAT_PGFREE,
+  VMSTAT_PGACTIVATE,
+  VMSTAT_PGDEACTIVATE,
+  VMSTAT_MAX
+};
+
+static struct
+{
+  char const *key;
+  _Bool is_prefix;
+  _Bool verbose;
+} vmstat_keys[VMSTAT_MAX] =
+{
+  [VMSTAT_NR]            = { "nr_",            1, 0 },
+  [VMSTAT_PGPGIN]        = { "pgpgin",         0, 0 },
+  [VMSTAT_PGPGOUT]       = { "pgpgout",        0, 0 },
+  [VMSTAT_PSWPIN]        = { "pswpin",         0, 0 },
+  [VMSTAT_PSWPOUT]       = { "pswpout",        0, 0 },
+  [VMSTAT_PGFAULT]       = { "pgfault",        0, 0 },
+  [VMSTAT_PGMAJFAULT]    = { "pgmajfault",     0, 0 },
+  [VMSTAT_PGALLOC]       = { "pgalloc_",       1, 1 },
+  [VMSTAT_PGREFILL]      = { "pgrefill_",      1, 1 },
+  [VMSTAT_PGSTEAL]       = { "pgsteal_",       1, 1 },
+  [VMSTAT_PGSCAN_KSWAPD] = { "pgscan_kswapd_", 1, 1 },
+  [VMSTAT_PGSCAN_DIRECT] = { "pgscan_direct_", 1, 1 },
+  [VMSTAT_PGFREE]        = { "pgfree",         0, 1 },
+  [VMSTAT_PGACTIVATE]    = { "pgactivate",     0, 1 },
+  [VMSTAT_PGDEACTIVATE]  = { "pgdeactivate",   0, 1 }
+};
+
+static procfile_t *proc_vmstat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -95,6 +144,38 @@ static int vmem_config (const char *key, const char *value)
   return (0);
 } /* int vmem_config */
 
+#if KERNEL_LINUX
+static int vmem_slot (char const *key, /* {{{ */
+    size_t __attribute__((unused)) line,
+    void __attribute__((unused)) *user_data)
+{
+  int i;
+
+  for (i = 0; i < VMSTAT_MAX; i++)
+  {
+    if (vmstat_keys[i].verbose && (verbose_output == 0))
+      continue;
+
+    if (vmstat_keys[i].is_prefix)
+    {
+      if (strncmp (vmstat_keys[i].key, key, strlen (vmstat_keys[i].key)) == 0)
+        return (i);
+    }
+    else if (strcmp (vmstat_keys[i].key, key) == 0)
+      return (i);
+  }
+
+  return (-1);
+} /* }}} int vmem_slot */
+
+static int vmem_shutdown (void) /* {{{ */
+{
+  procfile_close (proc_vmstat);
+  proc_vmstat = NULL;
+  return (0);
+} /* }}} int vmem_shutdown */
+#endif /* KERNEL_LINUX */
+
 static int vmem_read (void)
 {
 #if KERNEL_LINUX
@@ -110,32 +191,52 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  size_t i;
+  int status;
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  if (proc_vmstat == NULL)
+  {
+    proc_vmstat = procfile_open_indexed ("/proc/vmstat",
+        /* key field = */ 0, vmem_slot, /* user data = */ NULL);
+    if (proc_vmstat == NULL)
+    {
+      char errbuf[1024];
+      ERROR ("vmem plugin: open (/proc/vmstat) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+  }
+
+  status = procfile_read (proc_vmstat);
+  if (status != 0)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
-	sstrerror (errno, errbuf, sizeof (errbuf)));
+    ERROR ("vmem plugin: Reading /proc/vmstat failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  for (i = 0; i < procfile_lines_num (proc_vmstat); i++)
   {
     char *fields[4];
     int fields_num;
-    char *key;
+    char *inst;
     char *endptr;
     derive_t counter;
     gauge_t gauge;
+    int slot;
+
+    slot = procfile_slot (proc_vmstat, i);
+    if (slot < 0)
+      continue;
 
-    fields_num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+    fields_num = procfile_split (procfile_line (proc_vmstat, i),
+        fields, STATIC_ARRAY_SIZE (fields));
     if (fields_num != 2)
       continue;
 
-    key = fields[0];
+    /* For prefixed keys, the remainder is the instance. */
+    inst = fields[0] + strlen (vmstat_keys[slot].key);
 
     endptr = NULL;
     counter = strtoll (fields[1], &endptr, 10);
@@ -147,122 +248,114 @@ static int vmem_read (void)
     if (fields[1] == endptr)
       continue;
 
-    /* 
-     * Number of pages
-     *
-     * The total number of {inst} pages, e. g dirty pages.
-     */
-    if (strncmp ("nr_", key, strlen ("nr_")) == 0)
+    switch (slot)
     {
-      char *inst = key + strlen ("nr_");
-      value_t value = { .gauge = gauge };
-      submit_one (NULL, "vmpage_number", inst, value);
-    }
-
-    /* 
-     * Page in and page outs. For memory and swap.
-     */
-    else if (strcmp ("pgpgin", key) == 0)
-    {
-      pgpgin = counter;
-      pgpgvalid |= 0x01;
-    }
-    else if (strcmp ("pgpgout", key) == 0)
-    {
-      pgpgout = counter;
-      pgpgvalid |= 0x02;
-    }
-    else if (strcmp ("pswpin", key) == 0)
-    {
-      pswpin = counter;
-      pswpvalid |= 0x01;
-    }
-    else if (strcmp ("pswpout", key) == 0)
-    {
-      pswpout = counter;
-      pswpvalid |= 0x02;
-    }
-
-    /*
-     * Pagefaults
-     */
-    else if (strcmp ("pgfault", key) == 0)
-    {
-      pgfault = counter;
-      pgfaultvalid |= 0x01;
-    }
-    else if (strcmp ("pgmajfault", key) == 0)
-    {
-      pgmajfault = counter;
-      pgfaultvalid |= 0x02;
-    }
-
-    /*
-     * Skip the other statistics if verbose output is disabled.
-     */
-    else if (verbose_output == 0)
-      continue;
-
-    /*
-     * Number of page allocations, refills, steals and scans. This is collected
-     * ``per zone'', i. e. for DMA, DMA32, normal and possibly highmem.
-     */
-    else if (strncmp ("pgalloc_", key, strlen ("pgalloc_")) == 0)
-    {
-      char *inst = key + strlen ("pgalloc_");
-      value_t value  = { .derive = counter };
-      submit_one (inst, "vmpage_action", "alloc", value);
-    }
-    else if (strncmp ("pgrefill_", key, strlen ("pgrefill_")) == 0)
-    {
-      char *inst = key + strlen ("pgrefill_");
-      value_t value  = { .derive = counter };
-      submit_one (inst, "vmpage_action", "refill", value);
-    }
-    else if (strncmp ("pgsteal_", key, strlen ("pgsteal_")) == 0)
-    {
-      char *inst = key + strlen ("pgsteal_");
-      value_t value  = { .derive = counter };
-      submit_one (inst, "vmpage_action", "steal", value);
-    }
-    else if (strncmp ("pgscan_kswapd_", key, strlen ("pgscan_kswapd_")) == 0)
-    {
-      char *inst = key + strlen ("pgscan_kswapd_");
-      value_t value  = { .derive = counter };
-      submit_one (inst, "vmpage_action", "scan_kswapd", value);
-    }
-    else if (strncmp ("pgscan_direct_", key, strlen ("pgscan_direct_")) == 0)
-    {
-      char *inst = key + strlen ("pgscan_direct_");
-      value_t value  = { .derive = counter };
-      submit_one (inst, "vmpage_action", "scan_direct", value);
-    }
-
-    /*
-     * Page action
-     *
-     * number of pages moved to the active or inactive lists and freed, i. e.
-     * removed from either list.
-     */
-    else if (strcmp ("pgfree", key) == 0)
-    {
-      value_t value  = { .derive = counter };
-      submit_one (NULL, "vmpage_action", "free", value);
-    }
-    else if (strcmp ("pgactivate", key) == 0)
-    {
-      value_t value  = { .derive = counter };
-      submit_one (NULL, "vmpage_action", "activate", value);
-    }
-    else if (strcmp ("pgdeactivate", key) == 0)
-    {
-      value_t value  = { .derive = counter };
-      submit_one (NULL, "vmpage_action", "deactivate", value);
-    }
-  } /* while (fgets) */
-
-  fclose (fh);
-  fh = NULL;
+      /*
+       * Number of pages
+       *
+       * The total number of {inst} pages, e. g dirty pages.
+       */
+      case VMSTAT_NR:
+      {
+        value_t value = { .gauge = gauge };
+        submit_one (NULL, "vmpage_number", inst, value);
+        break;
+      }
+
+      /*
+       * Page in and page outs. For memory and swap.
+       */
+      case VMSTAT_PGPGIN:
+        pgpgin = counter;
+        pgpgvalid |= 0x01;
+        break;
+      case VMSTAT_PGPGOUT:
+        pgpgout = counter;
+        pgpgvalid |= 0x02;
+        break;
+      case VMSTAT_PSWPIN:
+        pswpin = counter;
+        pswpvalid |= 0x01;
+        break;
+      case VMSTAT_PSWPOUT:
+        pswpout = counter;
+        pswpvalid |= 0x02;
+        break;
+
+      /*
+       * Pagefaults
+       */
+      case VMSTAT_PGFAULT:
+        pgfault = counter;
+        pgfaultvalid |= 0x01;
+        break;
+      case VMSTAT_PGMAJFAULT:
+        pgmajfault = counter;
+        pgfaultvalid |= 0x02;
+        break;
+
+      /*
+       * Number of page allocations, refills, steals and scans. This is
+       * collected ``per zone'', i. e. for DMA, DMA32, normal and possibly
+       * highmem.
+       */
+      case VMSTAT_PGALLOC:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (inst, "vmpage_action", "alloc", value);
+        break;
+      }
+      case VMSTAT_PGREFILL:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (inst, "vmpage_action", "refill", value);
+        break;
+      }
+      case VMSTAT_PGSTEAL:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (inst, "vmpage_action", "steal", value);
+        break;
+      }
+      case VMSTAT_PGSCAN_KSWAPD:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (inst, "vmpage_action", "scan_kswapd", value);
+        break;
+      }
+      case VMSTAT_PGSCAN_DIRECT:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (inst, "vmpage_action", "scan_direct", value);
+        break;
+      }
+
+      /*
+       * Page action
+       *
+       * number of pages moved to the active or inactive lists and freed, i.
+       * e. removed from either list.
+       */
+      case VMSTAT_PGFREE:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (NULL, "vmpage_action", "free", value);
+        break;
+      }
+      case VMSTAT_PGACTIVATE:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (NULL, "vmpage_action", "activate", value);
+        break;
+      }
+      case VMSTAT_PGDEACTIVATE:
+      {
+        value_t value  = { .derive = counter };
+        submit_one (NULL, "vmpage_action", "deactivate", value);
+        break;
+      }
+    } /* switch (slot) */
+  } /* for (i) */
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
@@ -282,6 +375,9 @@ void module_register (void)
   plugin_register_config ("vmem", vmem_config,
       config_keys, config_keys_num);
   plugin_register_read ("vmem", vmem_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown ("vmem", vmem_shutdown);
+#endif
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 ts=8 : */
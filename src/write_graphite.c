@@ -56,6 +56,7 @@
 
 #include <sys/socket.h>
 #include <netdb.h>
+#include <poll.h>
 
 #ifndef WG_DEFAULT_NODE
 # define WG_DEFAULT_NODE "localhost"
@@ -86,13 +87,47 @@
 # define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (1)
 #endif
 
+#ifndef WG_MAX_RECONNECT_INTERVAL
+# define WG_MAX_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (60)
+#endif
+
+#ifndef WG_DEFAULT_BUFFER_SIZE
+# define WG_DEFAULT_BUFFER_SIZE 65536
+#endif
+
+#ifndef WG_SHUTDOWN_TIMEOUT
+# define WG_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T (2)
+#endif
+
 /*
  * Private variables
  */
-struct wg_callback
+/* One connection to the carbon daemon. Lines are collected in "buffer" and
+ * written without blocking whenever a packet's worth has accumulated. If the
+ * daemon doesn't keep up, or while the connection is down, up to
+ * "buffer_size" bytes are kept; further lines are dropped. */
+struct wg_connection
 {
     int      sock_fd;
+    _Bool    connecting;
+    pthread_mutex_t lock;
+
+    char    *buffer;
+    size_t   buffer_fill;
+    cdtime_t buffer_init_time;
+    _Bool    partial_line;
 
+    cdtime_t next_connect_time;
+    cdtime_t reconnect_interval;
+    unsigned int seed;
+
+    derive_t dropped;
+    c_complain_t init_complaint;
+    c_complain_t drop_complaint;
+};
+
+struct wg_callback
+{
     char    *name;
 
     char    *node;
@@ -104,93 +139,169 @@ struct wg_callback
     char     escape_char;
 
     unsigned int format_flags;
+    graphite_cache_t *name_cache;
 
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
-    cdtime_t send_buf_init_time;
+    _Bool    use_udp;
+    size_t   buffer_size;
+    _Bool    report_stats;
 
-    pthread_mutex_t send_lock;
-    c_complain_t init_complaint;
-    cdtime_t last_connect_time;
+    struct wg_connection *conns;
+    int      conns_num;
 };
 
 
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
+/* Jump consistent hash by Lamping and Veach: maps "key" to one of "buckets"
+ * buckets, moving as few keys as possible when the number of buckets
+ * changes. */
+static int wg_jump_hash (uint64_t key, int buckets)
 {
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
+    int64_t b = -1;
+    int64_t j = 0;
+
+    while (j < buckets)
+    {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t) ((double) (b + 1)
+                * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+    }
+    return ((int) b);
 }
 
-static int wg_send_buffer (struct wg_callback *cb)
+/* Selects the connection for a value list. All metrics of a value list share
+ * its identifier, so hashing the identifier keeps every metric on one
+ * connection and in order. */
+static struct wg_connection *wg_select_connection (struct wg_callback *cb,
+        const value_list_t *vl)
 {
-    ssize_t status = 0;
+    const char *parts[] = { vl->host, vl->plugin, vl->plugin_instance,
+        vl->type, vl->type_instance };
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
 
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
-    if (status < 0)
+    if (cb->conns_num <= 1)
+        return (cb->conns);
+
+    /* FNV-1a */
+    for (i = 0; i < STATIC_ARRAY_SIZE (parts); i++)
     {
-        const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
+        const unsigned char *ptr;
 
-        if (cb->log_send_errors)
+        for (ptr = (const unsigned char *) parts[i]; *ptr != 0; ptr++)
         {
-            char errbuf[1024];
-            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
-                    cb->node, cb->service, protocol,
-                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+            hash ^= (uint64_t) *ptr;
+            hash *= 1099511628211ULL;
         }
+        hash ^= (uint64_t) '/';
+        hash *= 1099511628211ULL;
+    }
 
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
+    return (cb->conns + wg_jump_hash (hash, cb->conns_num));
+}
 
-        return (-1);
+static void wg_close_connection (struct wg_callback *cb,
+        struct wg_connection *c)
+{
+    if (c->sock_fd >= 0)
+    {
+        close (c->sock_fd);
+        c->sock_fd = -1;
     }
 
-    return (0);
+    /* The unsent data is sent again after reconnecting. If a line was only
+     * sent in part, the rest of it would be garbage on the new connection. */
+    if (!cb->use_udp && c->partial_line)
+    {
+        char *eol = memchr (c->buffer, '\n', c->buffer_fill);
+        size_t skip = (eol != NULL) ? (size_t) (eol - c->buffer) + 1
+            : c->buffer_fill;
+
+        memmove (c->buffer, c->buffer + skip, c->buffer_fill - skip);
+        c->buffer_fill -= skip;
+    }
+    c->partial_line = 0;
+
+    /* Reconnect after a randomized, exponentially growing interval, so that
+     * a failing carbon daemon isn't hammered by all connections at once. */
+    c->next_connect_time = cdtime () + (cdtime_t) (((double) c->reconnect_interval)
+            * (0.5 + ((double) rand_r (&c->seed)) / ((double) RAND_MAX)));
+    c->reconnect_interval *= 2;
+    if (c->reconnect_interval > WG_MAX_RECONNECT_INTERVAL)
+        c->reconnect_interval = WG_MAX_RECONNECT_INTERVAL;
 }
 
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+/* Writes as much of the buffer as possible without blocking.
+ * NOTE: You must hold c->lock when calling this function! */
+static int wg_send_buffer (struct wg_callback *cb, struct wg_connection *c)
 {
-    int status;
+    size_t offset = 0;
+    ssize_t status = 0;
 
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
+    while (offset < c->buffer_fill)
+    {
+        status = send (c->sock_fd, c->buffer + offset,
+                c->buffer_fill - offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        offset += (size_t) status;
+    }
 
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
+    if ((status < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
     {
-        cdtime_t now;
+        const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
 
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
+        if (cb->log_send_errors)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
+                    cb->node, cb->service, protocol,
+                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+        }
+
+        /* A datagram that couldn't be sent is lost. What has been sent of
+         * a stream is removed, so it's not sent again after reconnecting. */
+        if (cb->use_udp)
+            c->buffer_fill = 0;
+        else if (offset > 0)
+        {
+            c->partial_line = (c->buffer[offset - 1] != '\n');
+            memmove (c->buffer, c->buffer + offset, c->buffer_fill - offset);
+            c->buffer_fill -= offset;
+        }
+
+        wg_close_connection (cb, c);
+        return (-1);
     }
 
-    if (cb->send_buf_fill <= 0)
+    if (offset > 0)
     {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
+        c->partial_line = (c->buffer[offset - 1] != '\n');
+        memmove (c->buffer, c->buffer + offset, c->buffer_fill - offset);
+        c->buffer_fill -= offset;
+        c->buffer_init_time = cdtime ();
     }
 
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
-
-    return (status);
+    return (0);
 }
 
-static int wg_callback_init (struct wg_callback *cb)
+/* Establishes the connection if it is down. c->lock is released while
+ * resolving and connecting, so other writers can keep buffering; they get
+ * EAGAIN until the connection is up.
+ * NOTE: You must hold c->lock when calling this function! */
+static int wg_connect (struct wg_callback *cb, struct wg_connection *c)
 {
     struct addrinfo ai_hints;
     struct addrinfo *ai_list;
     struct addrinfo *ai_ptr;
     cdtime_t now;
+    int sock_fd = -1;
     int status;
 
     const char *node = cb->node ? cb->node : WG_DEFAULT_NODE;
@@ -199,15 +310,19 @@ static int wg_callback_init (struct wg_callback *cb)
 
     char connerr[1024] = "";
 
-    if (cb->sock_fd > 0)
+    if (c->sock_fd >= 0)
         return (0);
+    if (c->connecting)
+        return (EAGAIN);
 
-    /* Don't try to reconnect too often. By default, one reconnection attempt
-     * is made per second. */
+    /* Don't try to reconnect too often. The interval grows with every
+     * failed attempt. */
     now = cdtime ();
-    if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+    if (now < c->next_connect_time)
         return (EAGAIN);
-    cb->last_connect_time = now;
+
+    c->connecting = 1;
+    pthread_mutex_unlock (&c->lock);
 
     memset (&ai_hints, 0, sizeof (ai_hints));
 #ifdef AI_ADDRCONFIG
@@ -227,29 +342,32 @@ static int wg_callback_init (struct wg_callback *cb)
     {
         ERROR ("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
                 node, service, protocol, gai_strerror (status));
+        pthread_mutex_lock (&c->lock);
+        c->connecting = 0;
+        wg_close_connection (cb, c);
         return (-1);
     }
 
     assert (ai_list != NULL);
     for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
     {
-        cb->sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
                 ai_ptr->ai_protocol);
-        if (cb->sock_fd < 0) {
+        if (sock_fd < 0) {
             char errbuf[1024];
             snprintf (connerr, sizeof (connerr), "failed to open socket: %s",
                     sstrerror (errno, errbuf, sizeof (errbuf)));
             continue;
         }
 
-        status = connect (cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        status = connect (sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
         if (status != 0)
         {
             char errbuf[1024];
             snprintf (connerr, sizeof (connerr), "failed to connect to remote "
                     "host: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
-            close (cb->sock_fd);
-            cb->sock_fd = -1;
+            close (sock_fd);
+            sock_fd = -1;
             continue;
         }
 
@@ -258,46 +376,94 @@ static int wg_callback_init (struct wg_callback *cb)
 
     freeaddrinfo (ai_list);
 
-    if (cb->sock_fd < 0)
+    pthread_mutex_lock (&c->lock);
+    c->connecting = 0;
+    c->sock_fd = sock_fd;
+
+    if (c->sock_fd < 0)
     {
         if (connerr[0] == '\0')
             /* this should not happen but try to get a message anyway */
             sstrerror (errno, connerr, sizeof (connerr));
-        c_complain (LOG_ERR, &cb->init_complaint,
+        c_complain (LOG_ERR, &c->init_complaint,
                   "write_graphite plugin: Connecting to %s:%s via %s failed. "
                   "The last error was: %s", node, service, protocol, connerr);
+        wg_close_connection (cb, c);
         return (-1);
     }
     else
     {
-        c_release (LOG_INFO, &cb->init_complaint,
+        c_release (LOG_INFO, &c->init_complaint,
                 "write_graphite plugin: Successfully connected to %s:%s via %s.",
                 node, service, protocol);
     }
 
-    wg_reset_buffer (cb);
-
+    c->reconnect_interval = WG_MIN_RECONNECT_INTERVAL;
     return (0);
 }
 
+/* Sends the buffer, waiting up to "timeout" for the daemon to accept it. Used
+ * when shutting down. NOTE: You must hold c->lock when calling this
+ * function! */
+static void wg_drain_buffer (struct wg_callback *cb, struct wg_connection *c,
+        cdtime_t timeout)
+{
+    cdtime_t end = cdtime () + timeout;
+
+    c->next_connect_time = 0;
+    while (c->buffer_fill > 0)
+    {
+        struct pollfd pfd;
+        cdtime_t now;
+
+        if ((wg_connect (cb, c) != 0) || (wg_send_buffer (cb, c) != 0))
+            break;
+        if (c->buffer_fill == 0)
+            break;
+
+        now = cdtime ();
+        if (now >= end)
+            break;
+
+        memset (&pfd, 0, sizeof (pfd));
+        pfd.fd = c->sock_fd;
+        pfd.events = POLLOUT;
+        (void) poll (&pfd, 1, (int) CDTIME_T_TO_MS (end - now));
+    }
+}
+
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
+    int i;
 
     if (data == NULL)
         return;
 
     cb = data;
 
-    pthread_mutex_lock (&cb->send_lock);
-
-    wg_flush_nolock (/* timeout = */ 0, cb);
-
-    if (cb->sock_fd >= 0)
+    for (i = 0; (cb->conns != NULL) && (i < cb->conns_num); i++)
     {
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
+        struct wg_connection *c = cb->conns + i;
+
+        pthread_mutex_lock (&c->lock);
+        if (c->buffer_fill > 0)
+            wg_drain_buffer (cb, c, WG_SHUTDOWN_TIMEOUT);
+        if (c->buffer_fill > 0)
+            WARNING ("write_graphite plugin: Dropping %zu bytes which could "
+                    "not be sent to %s:%s.", c->buffer_fill,
+                    cb->node ? cb->node : WG_DEFAULT_NODE,
+                    cb->service ? cb->service : WG_DEFAULT_SERVICE);
+        if (c->sock_fd >= 0)
+        {
+            close (c->sock_fd);
+            c->sock_fd = -1;
+        }
+        sfree (c->buffer);
+        pthread_mutex_unlock (&c->lock);
+        pthread_mutex_destroy (&c->lock);
     }
+    sfree (cb->conns);
 
     sfree(cb->name);
     sfree(cb->node);
@@ -305,8 +471,7 @@ static void wg_callback_free (void *data)
     sfree(cb->service);
     sfree(cb->prefix);
     sfree(cb->postfix);
-
-    pthread_mutex_destroy (&cb->send_lock);
+    graphite_cache_destroy (cb->name_cache);
 
     sfree(cb);
 }
@@ -316,81 +481,92 @@ static int wg_flush (cdtime_t timeout,
         user_data_t *user_data)
 {
     struct wg_callback *cb;
-    int status;
+    int status = 0;
+    int i;
 
     if (user_data == NULL)
         return (-EINVAL);
 
     cb = user_data->data;
 
-    pthread_mutex_lock (&cb->send_lock);
-
-    if (cb->sock_fd < 0)
+    for (i = 0; i < cb->conns_num; i++)
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
+        struct wg_connection *c = cb->conns + i;
+
+        pthread_mutex_lock (&c->lock);
+
+        /* timeout == 0  => flush unconditionally */
+        if ((c->buffer_fill > 0)
+                && ((timeout == 0)
+                    || ((c->buffer_init_time + timeout) <= cdtime ())))
         {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
+            /* An error message has already been printed on failure. */
+            if ((wg_connect (cb, c) != 0) || (wg_send_buffer (cb, c) != 0))
+                status = -1;
         }
-    }
 
-    status = wg_flush_nolock (timeout, cb);
-    pthread_mutex_unlock (&cb->send_lock);
+        pthread_mutex_unlock (&c->lock);
+    }
 
     return (status);
 }
 
-static int wg_send_message (char const *message, struct wg_callback *cb)
+static int wg_send_message (char const *message, struct wg_callback *cb,
+        struct wg_connection *c)
 {
-    int status;
     size_t message_len;
+    size_t limit;
 
     message_len = strlen (message);
 
-    pthread_mutex_lock (&cb->send_lock);
+    /* A datagram must not exceed the size of a packet. */
+    limit = cb->use_udp ? WG_SEND_BUF_SIZE : cb->buffer_size;
 
-    if (cb->sock_fd < 0)
-    {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
-    }
+    pthread_mutex_lock (&c->lock);
 
-    if (message_len >= cb->send_buf_free)
+    if ((c->buffer_fill + message_len > limit)
+            && (wg_connect (cb, c) == 0))
+        wg_send_buffer (cb, c);
+
+    if (c->buffer_fill + message_len > limit)
     {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
-        if (status != 0)
-        {
-            pthread_mutex_unlock (&cb->send_lock);
-            return (status);
-        }
+        c->dropped++;
+        c_complain (LOG_WARNING, &c->drop_complaint,
+                "write_graphite plugin: The buffer for %s:%s is full. "
+                "Values will be dropped until the connection recovers.",
+                cb->node ? cb->node : WG_DEFAULT_NODE,
+                cb->service ? cb->service : WG_DEFAULT_SERVICE);
+        pthread_mutex_unlock (&c->lock);
+        return (-1);
     }
 
-    /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
-
-    /* `message_len + 1' because `message_len' does not include the
-     * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
-            message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
+    if (c->buffer_fill == 0)
+        c->buffer_init_time = cdtime ();
+    memcpy (c->buffer + c->buffer_fill, message, message_len);
+    c->buffer_fill += message_len;
 
     DEBUG ("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
             cb->node,
             cb->service,
             cb->protocol,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
+            c->buffer_fill, limit,
+            100.0 * ((double) c->buffer_fill) / ((double) limit),
             message);
 
-    pthread_mutex_unlock (&cb->send_lock);
+    /* Send once a packet's worth has accumulated. Without a connection the
+     * data stays in the buffer until reconnecting succeeds. */
+    if ((c->buffer_fill >= WG_SEND_BUF_SIZE) && (wg_connect (cb, c) == 0))
+    {
+        wg_send_buffer (cb, c);
+        if (c->buffer_fill < limit / 2)
+            c_release (LOG_INFO, &c->drop_complaint,
+                    "write_graphite plugin: The buffer for %s:%s is "
+                    "draining again.",
+                    cb->node ? cb->node : WG_DEFAULT_NODE,
+                    cb->service ? cb->service : WG_DEFAULT_SERVICE);
+    }
+
+    pthread_mutex_unlock (&c->lock);
 
     return (0);
 }
@@ -409,13 +585,17 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
     }
 
     memset (buffer, 0, sizeof (buffer));
-    status = format_graphite (buffer, sizeof (buffer), ds, vl,
-            cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
+    if (cb->name_cache != NULL)
+        status = format_graphite_cached (cb->name_cache,
+                buffer, sizeof (buffer), ds, vl);
+    else
+        status = format_graphite (buffer, sizeof (buffer), ds, vl,
+                cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
     if (status != 0) /* error message has been printed already. */
         return (status);
 
     /* Send the message to graphite */
-    status = wg_send_message (buffer, cb);
+    status = wg_send_message (buffer, cb, wg_select_connection (cb, vl));
     if (status != 0) /* error message has been printed already. */
         return (status);
 
@@ -438,6 +618,51 @@ static int wg_write (const data_set_t *ds, const value_list_t *vl,
     return (status);
 }
 
+static int wg_read (user_data_t *user_data)
+{
+    struct wg_callback *cb = user_data->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    int i;
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_graphite", sizeof (vl.plugin));
+    sstrncpy (vl.plugin_instance,
+            (cb->name != NULL) ? cb->name
+            : ((cb->node != NULL) ? cb->node : WG_DEFAULT_NODE),
+            sizeof (vl.plugin_instance));
+
+    for (i = 0; i < cb->conns_num; i++)
+    {
+        struct wg_connection *c = cb->conns + i;
+        size_t copy_fill;
+        derive_t copy_dropped;
+
+        pthread_mutex_lock (&c->lock);
+        copy_fill = c->buffer_fill;
+        copy_dropped = c->dropped;
+        pthread_mutex_unlock (&c->lock);
+
+        /* Bytes waiting to be sent */
+        values[0].gauge = (gauge_t) copy_fill;
+        sstrncpy (vl.type, "bytes", sizeof (vl.type));
+        ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+                "backlog-%i", i);
+        plugin_dispatch_values (&vl);
+
+        /* Lines dropped because the buffer was full */
+        values[0].derive = copy_dropped;
+        sstrncpy (vl.type, "total_values", sizeof (vl.type));
+        ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+                "dropped-%i", i);
+        plugin_dispatch_values (&vl);
+    }
+
+    return (0);
+}
+
 static int config_set_char (char *dest,
         oconfig_item_t *ci)
 {
@@ -484,7 +709,6 @@ static int wg_config_node (oconfig_item_t *ci)
         return (-1);
     }
     memset (cb, 0, sizeof (*cb));
-    cb->sock_fd = -1;
     cb->name = NULL;
     cb->node = NULL;
     cb->service = NULL;
@@ -494,6 +718,8 @@ static int wg_config_node (oconfig_item_t *ci)
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->format_flags = GRAPHITE_STORE_RATES;
+    cb->buffer_size = WG_DEFAULT_BUFFER_SIZE;
+    cb->conns_num = 1;
 
     /* FIXME: Legacy configuration syntax. */
     if (strcasecmp ("Carbon", ci->key) != 0)
@@ -506,9 +732,6 @@ static int wg_config_node (oconfig_item_t *ci)
         }
     }
 
-    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
-    C_COMPLAIN_INIT (&cb->init_complaint);
-
     for (i = 0; i < ci->children_num; i++)
     {
         oconfig_item_t *child = ci->children + i;
@@ -546,6 +769,32 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("Connections", child->key) == 0)
+        {
+            status = cf_util_get_int (child, &cb->conns_num);
+            if ((status == 0) && (cb->conns_num < 1))
+            {
+                ERROR ("write_graphite plugin: The \"Connections\" option "
+                        "must be at least 1.");
+                status = -1;
+            }
+        }
+        else if (strcasecmp ("BufferSize", child->key) == 0)
+        {
+            int tmp = 0;
+
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < WG_SEND_BUF_SIZE))
+            {
+                ERROR ("write_graphite plugin: The \"BufferSize\" option "
+                        "must be at least %i.", WG_SEND_BUF_SIZE);
+                status = -1;
+            }
+            else if (status == 0)
+                cb->buffer_size = (size_t) tmp;
+        }
+        else if (strcasecmp ("ReportStats", child->key) == 0)
+            cf_util_get_boolean (child, &cb->report_stats);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -563,6 +812,49 @@ static int wg_config_node (oconfig_item_t *ci)
         return (status);
     }
 
+    cb->use_udp = (cb->protocol != NULL)
+        && (strcasecmp ("UDP", cb->protocol) == 0);
+    /* A datagram is never larger than a packet. */
+    if (cb->use_udp)
+        cb->buffer_size = WG_SEND_BUF_SIZE;
+
+    cb->conns = calloc ((size_t) cb->conns_num, sizeof (*cb->conns));
+    if (cb->conns == NULL)
+    {
+        ERROR ("write_graphite plugin: calloc failed.");
+        wg_callback_free (cb);
+        return (-1);
+    }
+    for (i = 0; i < cb->conns_num; i++)
+    {
+        struct wg_connection *c = cb->conns + i;
+
+        c->sock_fd = -1;
+        pthread_mutex_init (&c->lock, /* attr = */ NULL);
+        c->reconnect_interval = WG_MIN_RECONNECT_INTERVAL;
+        c->seed = (unsigned int) (cdtime () ^ (cdtime_t) i);
+        C_COMPLAIN_INIT (&c->init_complaint);
+        C_COMPLAIN_INIT (&c->drop_complaint);
+    }
+    /* Initialized separately so wg_callback_free never sees a connection
+     * without a lock. */
+    for (i = 0; i < cb->conns_num; i++)
+    {
+        cb->conns[i].buffer = malloc (cb->buffer_size);
+        if (cb->conns[i].buffer == NULL)
+        {
+            ERROR ("write_graphite plugin: malloc failed.");
+            wg_callback_free (cb);
+            return (-1);
+        }
+    }
+
+    /* Without the cache, names are escaped on every write. */
+    cb->name_cache = graphite_cache_create (cb->prefix, cb->postfix,
+            cb->escape_char, cb->format_flags, GRAPHITE_CACHE_SIZE_DEFAULT);
+    if (cb->name_cache == NULL)
+        WARNING ("write_graphite plugin: Creating the name cache failed.");
+
     /* FIXME: Legacy configuration syntax. */
     if (cb->name == NULL)
         ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s/%s",
@@ -581,6 +873,10 @@ static int wg_config_node (oconfig_item_t *ci)
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
 
+    if (cb->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                wg_read, /* interval = */ NULL, &user_data);
+
     return (0);
 }
 
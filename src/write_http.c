@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 
 #if HAVE_PTHREAD_H
@@ -35,13 +36,50 @@
 
 #include <curl/curl.h>
 
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 # define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
 
+#ifndef WRITE_HTTP_DEFAULT_RETRY_QUEUE_SIZE
+# define WRITE_HTTP_DEFAULT_RETRY_QUEUE_SIZE 16
+#endif
+
+/* Time to wait for outstanding requests when shutting down. */
+#ifndef WRITE_HTTP_SHUTDOWN_TIMEOUT
+# define WRITE_HTTP_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T (10)
+#endif
+
 /*
  * Private variables
  */
+/* A buffer waiting to be sent by the sender thread. */
+struct wh_batch_s;
+typedef struct wh_batch_s wh_batch_t;
+struct wh_batch_s
+{
+        char  *data;
+        size_t size;
+        _Bool  compressed;
+
+        int      attempts;
+        cdtime_t next_attempt;
+
+        wh_batch_t *next;
+};
+
+/* A request handled by the sender thread's multi handle. */
+struct wh_request_s
+{
+        CURL *curl;
+        wh_batch_t *batch;
+        char curl_errbuf[CURL_ERROR_SIZE];
+};
+typedef struct wh_request_s wh_request_t;
+
 struct wh_callback_s
 {
         char *name;
@@ -64,8 +102,14 @@ struct wh_callback_s
 #define WH_FORMAT_JSON    1
         int format;
 
+#define WH_COMPRESS_NONE    0
+#define WH_COMPRESS_GZIP    1
+#define WH_COMPRESS_DEFLATE 2
+        int compression;
+
         CURL *curl;
         char curl_errbuf[CURL_ERROR_SIZE];
+        struct curl_slist *headers;
 
         char  *send_buffer;
         size_t send_buffer_size;
@@ -74,6 +118,27 @@ struct wh_callback_s
         cdtime_t send_buffer_init_time;
 
         pthread_mutex_t send_lock;
+
+        /* Asynchronous mode: if max_requests is greater than zero, full
+         * buffers are queued and sent by a separate thread with up to
+         * max_requests requests in flight. */
+        int max_requests;
+        int retry_queue_size;
+
+        wh_batch_t *queue_head;
+        wh_batch_t *queue_tail;
+        int queue_len;
+        c_complain_t queue_complaint;
+
+        CURLM *multi;
+        wh_request_t *requests;
+        int requests_active;
+
+        pthread_t sender_thread;
+        _Bool sender_running;
+        _Bool sender_shutdown;
+        pthread_mutex_t queue_lock;
+        pthread_cond_t queue_cond;
 };
 typedef struct wh_callback_s wh_callback_t;
 
@@ -92,11 +157,78 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
         }
 } /* }}} wh_reset_buffer */
 
+#if HAVE_ZLIB
+/* Compresses "in" into a newly allocated buffer, using the gzip or the zlib
+ * format. */
+static int wh_compress (int method, char const *in, size_t in_size, /* {{{ */
+                char **ret_data, size_t *ret_size)
+{
+        z_stream zs;
+        char *out;
+        size_t out_size;
+        int status;
+
+        memset (&zs, 0, sizeof (zs));
+        status = deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        (method == WH_COMPRESS_GZIP) ? (MAX_WBITS + 16) : MAX_WBITS,
+                        /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+        if (status != Z_OK)
+        {
+                ERROR ("write_http plugin: deflateInit2 failed with status %i.",
+                                status);
+                return (-1);
+        }
+
+        out_size = (size_t) deflateBound (&zs, (uLong) in_size);
+        out = malloc (out_size);
+        if (out == NULL)
+        {
+                deflateEnd (&zs);
+                return (-ENOMEM);
+        }
+
+        zs.next_in = (Bytef *) in;
+        zs.avail_in = (uInt) in_size;
+        zs.next_out = (Bytef *) out;
+        zs.avail_out = (uInt) out_size;
+
+        status = deflate (&zs, Z_FINISH);
+        if (status != Z_STREAM_END)
+        {
+                ERROR ("write_http plugin: deflate failed with status %i.",
+                                status);
+                deflateEnd (&zs);
+                sfree (out);
+                return (-1);
+        }
+
+        *ret_data = out;
+        *ret_size = (size_t) zs.total_out;
+        deflateEnd (&zs);
+
+        return (0);
+} /* }}} int wh_compress */
+#endif
+
 static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
 {
+        char *data = cb->send_buffer;
+        size_t size = cb->send_buffer_fill;
         int status = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+#if HAVE_ZLIB
+        if (cb->compression != WH_COMPRESS_NONE)
+        {
+                status = wh_compress (cb->compression,
+                                cb->send_buffer, cb->send_buffer_fill,
+                                &data, &size);
+                if (status != 0)
+                        return (status);
+        }
+#endif
+
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, data);
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE, (long) size);
         status = curl_easy_perform (cb->curl);
         if (status != CURLE_OK)
         {
@@ -104,9 +236,400 @@ static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
                                 "status %i: %s",
                                 status, cb->curl_errbuf);
         }
+
+        if (data != cb->send_buffer)
+                sfree (data);
         return (status);
 } /* }}} wh_send_buffer */
 
+/*
+ * Asynchronous mode
+ */
+static void wh_batch_free (wh_batch_t *batch) /* {{{ */
+{
+        if (batch == NULL)
+                return;
+
+        sfree (batch->data);
+        sfree (batch);
+} /* }}} void wh_batch_free */
+
+/* Moves the content of the send buffer to the end of the queue. If the
+ * queue is full, the oldest batch is dropped. */
+static int wh_queue_buffer (wh_callback_t *cb) /* {{{ */
+{
+        wh_batch_t *batch;
+
+        batch = calloc (1, sizeof (*batch));
+        if (batch == NULL)
+                return (-ENOMEM);
+
+        batch->data = malloc (cb->send_buffer_fill);
+        if (batch->data == NULL)
+        {
+                sfree (batch);
+                return (-ENOMEM);
+        }
+        memcpy (batch->data, cb->send_buffer, cb->send_buffer_fill);
+        batch->size = cb->send_buffer_fill;
+
+        pthread_mutex_lock (&cb->queue_lock);
+
+        while ((cb->queue_len >= cb->retry_queue_size)
+                        && (cb->queue_head != NULL))
+        {
+                wh_batch_t *old = cb->queue_head;
+
+                cb->queue_head = old->next;
+                if (cb->queue_head == NULL)
+                        cb->queue_tail = NULL;
+                cb->queue_len--;
+
+                c_complain (LOG_WARNING, &cb->queue_complaint,
+                                "write_http plugin: <%s>: The retry queue is full. "
+                                "Dropping the oldest batch (%zu bytes).",
+                                cb->location, old->size);
+                wh_batch_free (old);
+        }
+
+        if (cb->queue_tail != NULL)
+                cb->queue_tail->next = batch;
+        else
+                cb->queue_head = batch;
+        cb->queue_tail = batch;
+        cb->queue_len++;
+
+        pthread_cond_signal (&cb->queue_cond);
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        return (0);
+} /* }}} int wh_queue_buffer */
+
+/* Starts sending "batch" using the free request slot "req". */
+static int wh_request_start (wh_callback_t *cb, /* {{{ */
+                wh_request_t *req, wh_batch_t *batch)
+{
+        CURLMcode status;
+
+        batch->attempts++;
+
+#if HAVE_ZLIB
+        if ((cb->compression != WH_COMPRESS_NONE) && !batch->compressed)
+        {
+                char *data = NULL;
+                size_t size = 0;
+
+                if (wh_compress (cb->compression, batch->data, batch->size,
+                                        &data, &size) != 0)
+                        return (-1);
+
+                sfree (batch->data);
+                batch->data = data;
+                batch->size = size;
+                batch->compressed = 1;
+        }
+#endif
+
+        if (req->curl == NULL)
+        {
+                req->curl = curl_easy_duphandle (cb->curl);
+                if (req->curl == NULL)
+                {
+                        ERROR ("write_http plugin: curl_easy_duphandle failed.");
+                        return (-1);
+                }
+                curl_easy_setopt (req->curl, CURLOPT_ERRORBUFFER,
+                                req->curl_errbuf);
+                curl_easy_setopt (req->curl, CURLOPT_PRIVATE, req);
+        }
+
+        req->curl_errbuf[0] = 0;
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDS, batch->data);
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDSIZE, (long) batch->size);
+
+        status = curl_multi_add_handle (cb->multi, req->curl);
+        if (status != CURLM_OK)
+        {
+                ERROR ("write_http plugin: curl_multi_add_handle failed: %s",
+                                curl_multi_strerror (status));
+                return (-1);
+        }
+
+        req->batch = batch;
+        cb->requests_active++;
+
+        return (0);
+} /* }}} int wh_request_start */
+
+/* Puts a failed batch back at the front of the queue so it is the next one
+ * to be sent. This only keeps the batches in order if max_requests is one;
+ * otherwise the batches sent while this one was in flight have overtaken it
+ * already. Must be called with queue_lock held. */
+static void wh_requeue_batch (wh_callback_t *cb, wh_batch_t *batch) /* {{{ */
+{
+        cdtime_t delay;
+
+        if (cb->sender_shutdown || (cb->queue_len >= cb->retry_queue_size))
+        {
+                c_complain (LOG_WARNING, &cb->queue_complaint,
+                                "write_http plugin: <%s>: Dropping a batch of "
+                                "%zu bytes after %i attempt(s).",
+                                cb->location, batch->size, batch->attempts);
+                wh_batch_free (batch);
+                return;
+        }
+
+        /* Wait one second after the first failure, doubling up to a minute. */
+        delay = TIME_T_TO_CDTIME_T (1) << ((batch->attempts < 6)
+                        ? (batch->attempts - 1) : 5);
+        if (delay > TIME_T_TO_CDTIME_T (60))
+                delay = TIME_T_TO_CDTIME_T (60);
+        batch->next_attempt = cdtime () + delay;
+
+        batch->next = cb->queue_head;
+        cb->queue_head = batch;
+        if (cb->queue_tail == NULL)
+                cb->queue_tail = batch;
+        cb->queue_len++;
+} /* }}} void wh_requeue_batch */
+
+/* Handles requests that have completed. */
+static void wh_requests_done (wh_callback_t *cb) /* {{{ */
+{
+        CURLMsg *msg;
+        int msgs_left = 0;
+
+        while ((msg = curl_multi_info_read (cb->multi, &msgs_left)) != NULL)
+        {
+                wh_request_t *req = NULL;
+                wh_batch_t *batch;
+                long response_code = 0;
+                _Bool retry = 0;
+
+                if (msg->msg != CURLMSG_DONE)
+                        continue;
+
+                curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE,
+                                (char **) &req);
+                curl_easy_getinfo (msg->easy_handle, CURLINFO_RESPONSE_CODE,
+                                &response_code);
+                curl_multi_remove_handle (cb->multi, msg->easy_handle);
+                cb->requests_active--;
+
+                batch = req->batch;
+                req->batch = NULL;
+
+                if (msg->data.result != CURLE_OK)
+                {
+                        ERROR ("write_http plugin: <%s>: Request failed with "
+                                        "status %i: %s", cb->location,
+                                        (int) msg->data.result, req->curl_errbuf);
+                        retry = 1;
+                }
+                else if ((response_code >= 500) || (response_code == 429))
+                {
+                        ERROR ("write_http plugin: <%s>: Server responded with "
+                                        "status %li.", cb->location, response_code);
+                        retry = 1;
+                }
+                else if (response_code >= 400)
+                {
+                        /* The server won't accept this batch, don't retry. */
+                        ERROR ("write_http plugin: <%s>: Server responded with "
+                                        "status %li. Dropping the batch.",
+                                        cb->location, response_code);
+                }
+
+                pthread_mutex_lock (&cb->queue_lock);
+                if (retry)
+                        wh_requeue_batch (cb, batch);
+                else
+                {
+                        if (cb->queue_len == 0)
+                                c_release (LOG_INFO, &cb->queue_complaint,
+                                                "write_http plugin: <%s>: The "
+                                                "retry queue is empty again.",
+                                                cb->location);
+                        wh_batch_free (batch);
+                }
+                pthread_mutex_unlock (&cb->queue_lock);
+        }
+} /* }}} void wh_requests_done */
+
+static void *wh_sender_thread (void *arg) /* {{{ */
+{
+        wh_callback_t *cb = arg;
+        cdtime_t shutdown_deadline = 0;
+        int i;
+
+        pthread_mutex_lock (&cb->queue_lock);
+        while (42)
+        {
+                cdtime_t now = cdtime ();
+                int running = 0;
+
+                if (cb->sender_shutdown)
+                {
+                        if (shutdown_deadline == 0)
+                                shutdown_deadline = now + WRITE_HTTP_SHUTDOWN_TIMEOUT;
+
+                        if (((cb->queue_head == NULL) && (cb->requests_active == 0))
+                                        || (now >= shutdown_deadline))
+                                break;
+                }
+
+                /* Start as many requests as possible. Batches waiting for a
+                 * retry keep the ones behind them waiting, too, so with a
+                 * single request slot they are delivered in order. */
+                for (i = 0; (i < cb->max_requests) && (cb->queue_head != NULL); i++)
+                {
+                        wh_batch_t *batch = cb->queue_head;
+
+                        if (cb->requests[i].batch != NULL)
+                                continue;
+                        if (!cb->sender_shutdown && (batch->next_attempt > now))
+                                break;
+
+                        cb->queue_head = batch->next;
+                        if (cb->queue_head == NULL)
+                                cb->queue_tail = NULL;
+                        cb->queue_len--;
+                        batch->next = NULL;
+
+                        if (wh_request_start (cb, cb->requests + i, batch) != 0)
+                        {
+                                wh_requeue_batch (cb, batch);
+                                break;
+                        }
+                }
+
+                if (cb->requests_active == 0)
+                {
+                        struct timespec ts_wait;
+
+                        /* Nothing in flight: wait for new data, until the next
+                         * retry is due, or for shutdown. */
+                        if (cb->queue_head != NULL)
+                                CDTIME_T_TO_TIMESPEC (cb->queue_head->next_attempt,
+                                                &ts_wait);
+                        else
+                                CDTIME_T_TO_TIMESPEC (now + TIME_T_TO_CDTIME_T (1),
+                                                &ts_wait);
+                        if (!cb->sender_shutdown)
+                                pthread_cond_timedwait (&cb->queue_cond,
+                                                &cb->queue_lock, &ts_wait);
+                        continue;
+                }
+
+                pthread_mutex_unlock (&cb->queue_lock);
+
+                curl_multi_perform (cb->multi, &running);
+                wh_requests_done (cb);
+                if (cb->requests_active > 0)
+                        curl_multi_wait (cb->multi, NULL, 0,
+                                        /* timeout_ms = */ 50, NULL);
+
+                pthread_mutex_lock (&cb->queue_lock);
+        }
+
+        /* Give up on whatever is left. */
+        for (i = 0; i < cb->max_requests; i++)
+        {
+                wh_request_t *req = cb->requests + i;
+
+                if (req->batch == NULL)
+                        continue;
+
+                curl_multi_remove_handle (cb->multi, req->curl);
+                wh_batch_free (req->batch);
+                req->batch = NULL;
+                cb->requests_active--;
+        }
+        while (cb->queue_head != NULL)
+        {
+                wh_batch_t *batch = cb->queue_head;
+                cb->queue_head = batch->next;
+                wh_batch_free (batch);
+        }
+        cb->queue_tail = NULL;
+        cb->queue_len = 0;
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        return ((void *) 0);
+} /* }}} void *wh_sender_thread */
+
+static int wh_sender_start (wh_callback_t *cb) /* {{{ */
+{
+        int status;
+
+        cb->requests = calloc ((size_t) cb->max_requests, sizeof (*cb->requests));
+        if (cb->requests == NULL)
+        {
+                ERROR ("write_http plugin: calloc failed.");
+                return (-1);
+        }
+
+        cb->multi = curl_multi_init ();
+        if (cb->multi == NULL)
+        {
+                ERROR ("write_http plugin: curl_multi_init failed.");
+                return (-1);
+        }
+
+        status = plugin_thread_create (&cb->sender_thread, /* attr = */ NULL,
+                        wh_sender_thread, cb);
+        if (status != 0)
+        {
+                char errbuf[1024];
+                ERROR ("write_http plugin: pthread_create failed: %s",
+                                sstrerror (status, errbuf, sizeof (errbuf)));
+                return (-1);
+        }
+        cb->sender_running = 1;
+
+        return (0);
+} /* }}} int wh_sender_start */
+
+static void wh_sender_stop (wh_callback_t *cb) /* {{{ */
+{
+        int i;
+
+        if (cb->sender_running)
+        {
+                pthread_mutex_lock (&cb->queue_lock);
+                cb->sender_shutdown = 1;
+                pthread_cond_broadcast (&cb->queue_cond);
+                pthread_mutex_unlock (&cb->queue_lock);
+
+                pthread_join (cb->sender_thread, /* retval = */ NULL);
+                cb->sender_running = 0;
+        }
+
+        /* Batches queued before the sender thread was started. */
+        while (cb->queue_head != NULL)
+        {
+                wh_batch_t *batch = cb->queue_head;
+                cb->queue_head = batch->next;
+                wh_batch_free (batch);
+        }
+        cb->queue_tail = NULL;
+        cb->queue_len = 0;
+
+        if (cb->requests != NULL)
+        {
+                for (i = 0; i < cb->max_requests; i++)
+                        if (cb->requests[i].curl != NULL)
+                                curl_easy_cleanup (cb->requests[i].curl);
+                sfree (cb->requests);
+        }
+
+        if (cb->multi != NULL)
+        {
+                curl_multi_cleanup (cb->multi);
+                cb->multi = NULL;
+        }
+} /* }}} void wh_sender_stop */
+
 static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 {
         struct curl_slist *headers;
@@ -130,8 +653,13 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
                 headers = curl_slist_append (headers, "Content-Type: application/json");
         else
                 headers = curl_slist_append (headers, "Content-Type: text/plain");
+        if (cb->compression == WH_COMPRESS_GZIP)
+                headers = curl_slist_append (headers, "Content-Encoding: gzip");
+        else if (cb->compression == WH_COMPRESS_DEFLATE)
+                headers = curl_slist_append (headers, "Content-Encoding: deflate");
         headers = curl_slist_append (headers, "Expect:");
         curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, headers);
+        cb->headers = headers;
 
         curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
         curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
@@ -179,6 +707,9 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 
         wh_reset_buffer (cb);
 
+        if ((cb->max_requests > 0) && !cb->sender_running)
+                return (wh_sender_start (cb));
+
         return (0);
 } /* }}} int wh_callback_init */
 
@@ -209,7 +740,10 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         return (0);
                 }
 
-                status = wh_send_buffer (cb);
+                if (cb->max_requests > 0)
+                        status = wh_queue_buffer (cb);
+                else
+                        status = wh_send_buffer (cb);
                 wh_reset_buffer (cb);
         }
         else if (cb->format == WH_FORMAT_JSON)
@@ -231,7 +765,10 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         return (status);
                 }
 
-                status = wh_send_buffer (cb);
+                if (cb->max_requests > 0)
+                        status = wh_queue_buffer (cb);
+                else
+                        status = wh_send_buffer (cb);
                 wh_reset_buffer (cb);
         }
         else
@@ -285,13 +822,21 @@ static void wh_callback_free (void *data) /* {{{ */
 
         cb = data;
 
-        wh_flush_nolock (/* timeout = */ 0, cb);
+        if (cb->send_buffer != NULL)
+                wh_flush_nolock (/* timeout = */ 0, cb);
+
+        wh_sender_stop (cb);
 
         if (cb->curl != NULL)
         {
                 curl_easy_cleanup (cb->curl);
                 cb->curl = NULL;
         }
+        if (cb->headers != NULL)
+        {
+                curl_slist_free_all (cb->headers);
+                cb->headers = NULL;
+        }
         sfree (cb->name);
         sfree (cb->location);
         sfree (cb->user);
@@ -304,6 +849,10 @@ static void wh_callback_free (void *data) /* {{{ */
         sfree (cb->clientkeypass);
         sfree (cb->send_buffer);
 
+        pthread_cond_destroy (&cb->queue_cond);
+        pthread_mutex_destroy (&cb->queue_lock);
+        pthread_mutex_destroy (&cb->send_lock);
+
         sfree (cb);
 } /* }}} void wh_callback_free */
 
@@ -495,6 +1044,42 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
         return (0);
 } /* }}} int config_set_format */
 
+static int config_set_compression (wh_callback_t *cb, /* {{{ */
+                oconfig_item_t *ci)
+{
+        char *string = NULL;
+        int status;
+
+        status = cf_util_get_string (ci, &string);
+        if (status != 0)
+                return (status);
+
+        if (strcasecmp ("None", string) == 0)
+                cb->compression = WH_COMPRESS_NONE;
+        else if (strcasecmp ("Gzip", string) == 0)
+                cb->compression = WH_COMPRESS_GZIP;
+        else if (strcasecmp ("Deflate", string) == 0)
+                cb->compression = WH_COMPRESS_DEFLATE;
+        else
+        {
+                ERROR ("write_http plugin: Invalid compression: %s", string);
+                status = -1;
+        }
+        sfree (string);
+
+#if !HAVE_ZLIB
+        if ((status == 0) && (cb->compression != WH_COMPRESS_NONE))
+        {
+                ERROR ("write_http plugin: The \"Compression\" option requires "
+                                "zlib, which wasn't available at compile time.");
+                cb->compression = WH_COMPRESS_NONE;
+                status = -1;
+        }
+#endif
+
+        return (status);
+} /* }}} int config_set_compression */
+
 static int wh_config_node (oconfig_item_t *ci) /* {{{ */
 {
         wh_callback_t *cb;
@@ -514,8 +1099,14 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         cb->verify_host = 1;
         cb->format = WH_FORMAT_COMMAND;
         cb->sslversion = CURL_SSLVERSION_DEFAULT;
+        cb->compression = WH_COMPRESS_NONE;
+        cb->max_requests = 0;
+        cb->retry_queue_size = WRITE_HTTP_DEFAULT_RETRY_QUEUE_SIZE;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+        pthread_mutex_init (&cb->queue_lock, /* attr = */ NULL);
+        pthread_cond_init (&cb->queue_cond, /* attr = */ NULL);
+        C_COMPLAIN_INIT (&cb->queue_complaint);
 
         cf_util_get_string (ci, &cb->name);
 
@@ -581,6 +1172,12 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                         cf_util_get_boolean (child, &cb->store_rates);
                 else if (strcasecmp ("BufferSize", child->key) == 0)
                         cf_util_get_int (child, &buffer_size);
+                else if (strcasecmp ("Compression", child->key) == 0)
+                        config_set_compression (cb, child);
+                else if (strcasecmp ("MaxConcurrentRequests", child->key) == 0)
+                        cf_util_get_int (child, &cb->max_requests);
+                else if (strcasecmp ("RetryQueueSize", child->key) == 0)
+                        cf_util_get_int (child, &cb->retry_queue_size);
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -596,6 +1193,21 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                 return (-1);
         }
 
+        if (cb->max_requests < 0)
+        {
+                ERROR ("write_http plugin: Ignoring invalid "
+                                "MaxConcurrentRequests setting (%d).",
+                                cb->max_requests);
+                cb->max_requests = 0;
+        }
+        if (cb->retry_queue_size < 1)
+        {
+                ERROR ("write_http plugin: Ignoring invalid "
+                                "RetryQueueSize setting (%d).",
+                                cb->retry_queue_size);
+                cb->retry_queue_size = WRITE_HTTP_DEFAULT_RETRY_QUEUE_SIZE;
+        }
+
         /* Determine send_buffer_size. */
         cb->send_buffer_size = WRITE_HTTP_DEFAULT_BUFFER_SIZE;
         if (buffer_size >= 1024)
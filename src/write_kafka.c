@@ -39,6 +39,21 @@
 #include <pthread.h>
 #include <zlib.h>
 
+#define KAFKA_METADATA_TIMEOUT_MS 1000
+#define KAFKA_METADATA_INTERVAL   TIME_T_TO_CDTIME_T (60)
+#define KAFKA_SHUTDOWN_TIMEOUT_MS 2000
+
+/* Value lists collected for one Kafka message. The buffer is handed over to
+ * librdkafka when the batch is sent. */
+struct kafka_batch_s {
+    char                        *data;
+    size_t                       size;
+    size_t                       fill;
+    int                          values_num;
+    cdtime_t                     first_value;
+};
+typedef struct kafka_batch_s kafka_batch_t;
+
 struct kafka_topic_context {
 #define KAFKA_FORMAT_JSON        0
 #define KAFKA_FORMAT_COMMAND     1
@@ -49,12 +64,31 @@ struct kafka_topic_context {
     rd_kafka_topic_conf_t       *conf;
     rd_kafka_topic_t            *topic;
     rd_kafka_t                  *kafka;
-    int                          has_key;
+#define KAFKA_KEY_RANDOM         0
+#define KAFKA_KEY_FIXED          1
+#define KAFKA_KEY_IDENTIFIER     2
+    int                          key_mode;
     u_int32_t                    key;
     char                        *prefix;
     char                        *postfix;
     char                         escape_char;
+    graphite_cache_t            *name_cache;
     char                        *topic_name;
+
+    /* Batching: one batch per partition when keyed by identifier, a single
+     * batch otherwise. */
+    size_t                       batch_size;
+    cdtime_t                     batch_timeout;
+    kafka_batch_t               *batches;
+    int32_t                      batches_num;
+    cdtime_t                     metadata_time;
+    pthread_mutex_t              lock;
+
+    /* Delivery reports */
+    _Bool                        report_stats;
+    pthread_mutex_t              stats_lock;
+    derive_t                     stats_delivered;
+    derive_t                     stats_failed;
 };
 
 static int kafka_write(const data_set_t *, const value_list_t *, user_data_t *);
@@ -71,82 +105,481 @@ static void kafka_log(const rd_kafka_t *rkt, int level,
 }
 #endif
 
+/* Jump consistent hash by Lamping and Veach: maps "key" to one of "buckets"
+ * buckets. When the number of buckets grows, only the keys which have to
+ * move to the new buckets change. */
+static int32_t kafka_jump_hash(uint64_t key, int32_t buckets) /* {{{ */
+{
+    int64_t b = -1;
+    int64_t j = 0;
+
+    while (j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t) ((double) (b + 1)
+                * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+    }
+    return (int32_t) b;
+} /* }}} int32_t kafka_jump_hash */
+
+/* FNV-1a hash of the identifier of "vl", folded to the 32 bits of a
+ * message key. */
+static u_int32_t kafka_identifier_hash(const value_list_t *vl) /* {{{ */
+{
+    const char *parts[] = { vl->host, vl->plugin, vl->plugin_instance,
+        vl->type, vl->type_instance };
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < STATIC_ARRAY_SIZE(parts); i++) {
+        const unsigned char *ptr;
+
+        for (ptr = (const unsigned char *) parts[i]; *ptr != 0; ptr++) {
+            hash ^= (uint64_t) *ptr;
+            hash *= 1099511628211ULL;
+        }
+        hash ^= (uint64_t) '/';
+        hash *= 1099511628211ULL;
+    }
+    return (u_int32_t) (hash ^ (hash >> 32));
+} /* }}} u_int32_t kafka_identifier_hash */
+
 static int32_t kafka_partition(const rd_kafka_topic_t *rkt,
                                const void *keydata, size_t keylen,
                                int32_t partition_cnt, void *p, void *m)
 {
-    u_int32_t key = *((u_int32_t *)keydata );
-    u_int32_t target = key % partition_cnt;
+    struct kafka_topic_context *ctx = p;
+    u_int32_t key;
+    u_int32_t target;
     int32_t   i = partition_cnt;
 
+    if ((keydata == NULL) || (keylen < sizeof(key))) {
+        /* Messages without a key may go to any available partition. */
+        key = rand();
+    } else if (ctx->key_mode == KAFKA_KEY_IDENTIFIER) {
+        /* Keep series on their partition, even if it is unavailable for
+         * now. */
+        return kafka_jump_hash((uint64_t) *((u_int32_t *)keydata),
+                               partition_cnt);
+    } else {
+        key = *((u_int32_t *)keydata);
+    }
+    target = key % partition_cnt;
+
     while (--i > 0 && !rd_kafka_topic_partition_available(rkt, target)) {
         target = (target + 1) % partition_cnt;
     }
     return target;
 }
 
-static int kafka_write(const data_set_t *ds, /* {{{ */
-	      const value_list_t *vl,
-	      user_data_t *ud)
+static void kafka_delivery_report(rd_kafka_t *rk, /* {{{ */
+                                  void *payload, size_t len,
+                                  rd_kafka_resp_err_t err,
+                                  void *opaque, void *msg_opaque)
 {
-	int			 status = 0;
-    u_int32_t    key;
-    char         buffer[8192];
-    size_t bfree = sizeof(buffer);
-    size_t bfill = 0;
-    size_t blen = 0;
-	struct kafka_topic_context	*ctx = ud->data;
+    struct kafka_topic_context *ctx = opaque;
+    derive_t values_num = (derive_t) (intptr_t) msg_opaque;
 
-    if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
-        return EINVAL;
+    if (ctx == NULL)
+        return;
 
-    bzero(buffer, sizeof(buffer));
+    pthread_mutex_lock(&ctx->stats_lock);
+    if (err == RD_KAFKA_RESP_ERR_NO_ERROR)
+        ctx->stats_delivered += values_num;
+    else
+        ctx->stats_failed += values_num;
+    pthread_mutex_unlock(&ctx->stats_lock);
+
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR)
+        ERROR("write_kafka plugin: Delivering a message with %"PRIi64
+              " value(s) to topic \"%s\" failed: %s",
+              (int64_t) values_num, ctx->topic_name, rd_kafka_err2str(err));
+} /* }}} void kafka_delivery_report */
+
+/* Formats "vl" as a single message into "buffer". */
+static int kafka_format(struct kafka_topic_context *ctx, /* {{{ */
+                        char *buffer, size_t buffer_size,
+                        const data_set_t *ds, const value_list_t *vl)
+{
+    int status;
 
     switch (ctx->format) {
     case KAFKA_FORMAT_COMMAND:
-        status = create_putval(buffer, sizeof(buffer), ds, vl);
+        status = create_putval(buffer, buffer_size, ds, vl);
         if (status != 0) {
             ERROR("write_kafka plugin: create_putval failed with status %i.",
                   status);
             return status;
         }
-        blen = strlen(buffer);
-        break;
-    case KAFKA_FORMAT_JSON:
-
-        format_json_initialize(buffer, &bfill, &bfree);
-        format_json_value_list(buffer, &bfill, &bfree, ds, vl,
-                               ctx->store_rates);
-        format_json_finalize(buffer, &bfill, &bfree);
-        blen = strlen(buffer);
         break;
     case KAFKA_FORMAT_GRAPHITE:
-        status = format_graphite(buffer, sizeof(buffer), ds, vl,
-                                 ctx->prefix, ctx->postfix, ctx->escape_char,
-                                 ctx->graphite_flags);
+        if (ctx->name_cache != NULL)
+            status = format_graphite_cached(ctx->name_cache,
+                                            buffer, buffer_size, ds, vl);
+        else
+            status = format_graphite(buffer, buffer_size, ds, vl,
+                                     ctx->prefix, ctx->postfix,
+                                     ctx->escape_char, ctx->graphite_flags);
         if (status != 0) {
             ERROR("write_kafka plugin: format_graphite failed with status %i.",
                   status);
             return status;
         }
-        blen = strlen(buffer);
         break;
     default:
         ERROR("write_kafka plugin: invalid format %i.", ctx->format);
         return -1;
     }
 
+    return 0;
+} /* }}} int kafka_format */
+
+/* Sends the batch and hands its buffer over to librdkafka.
+ * ctx->lock must be held. */
+static int kafka_batch_send(struct kafka_topic_context *ctx, /* {{{ */
+                            int32_t index)
+{
+    kafka_batch_t *b = ctx->batches + index;
+    int32_t partition = RD_KAFKA_PARTITION_UA;
+    u_int32_t key;
+    void *keydata = &key;
+    size_t keylen = sizeof(key);
+    int status = 0;
+
+    if (b->values_num == 0)
+        return 0;
+
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        format_json_stream_t s = { b->data, b->size, b->fill, 0 };
+
+        status = format_json_stream_finalize(&s);
+        b->data = s.data;
+        b->size = s.size;
+        b->fill = s.fill;
+        if (status != 0) {
+            ERROR("write_kafka plugin: Finalizing the JSON message failed "
+                  "with status %i. Dropping %i value(s).",
+                  status, b->values_num);
+            sfree(b->data);
+
+            pthread_mutex_lock(&ctx->stats_lock);
+            ctx->stats_failed += (derive_t) b->values_num;
+            pthread_mutex_unlock(&ctx->stats_lock);
+
+            b->size = 0;
+            b->fill = 0;
+            b->values_num = 0;
+            return -1;
+        }
+    }
+
+    if (ctx->key_mode == KAFKA_KEY_FIXED)
+        key = ctx->key;
+    else if (ctx->key_mode == KAFKA_KEY_IDENTIFIER)
+        key = (u_int32_t) index;
+    else
+        key = rand();
+
+    if ((ctx->key_mode == KAFKA_KEY_IDENTIFIER) && (ctx->batches_num > 1)) {
+        partition = index;
+    } else if (ctx->key_mode == KAFKA_KEY_IDENTIFIER) {
+        /* The partition count is unknown, so all series share one batch.
+         * Without a key, the partitioner picks any available partition
+         * instead of pinning the batch to partition 0. */
+        keydata = NULL;
+        keylen = 0;
+    }
+
+    if (rd_kafka_produce(ctx->topic, partition, RD_KAFKA_MSG_F_FREE,
+                         b->data, b->fill, keydata, keylen,
+                         (void *) (intptr_t) b->values_num) != 0) {
+        ERROR("write_kafka plugin: Producing a message with %i value(s) "
+              "failed: %s", b->values_num,
+              rd_kafka_err2str(rd_kafka_errno2err(errno)));
+        sfree(b->data);
+
+        pthread_mutex_lock(&ctx->stats_lock);
+        ctx->stats_failed += (derive_t) b->values_num;
+        pthread_mutex_unlock(&ctx->stats_lock);
+        status = -1;
+    }
+
+    /* The buffer belongs to librdkafka now. */
+    b->data = NULL;
+    b->size = 0;
+    b->fill = 0;
+    b->values_num = 0;
+    return status;
+} /* }}} int kafka_batch_send */
+
+/* ctx->lock must be held. */
+static int kafka_batch_flush_nolock(struct kafka_topic_context *ctx, /* {{{ */
+                                    cdtime_t timeout)
+{
+    cdtime_t now = cdtime();
+    int status = 0;
+    int32_t i;
+
+    for (i = 0; i < ctx->batches_num; i++) {
+        kafka_batch_t *b = ctx->batches + i;
+
+        if ((b->values_num == 0)
+                || ((timeout > 0) && ((b->first_value + timeout) > now)))
+            continue;
+        if (kafka_batch_send(ctx, i) != 0)
+            status = -1;
+    }
+    return status;
+} /* }}} int kafka_batch_flush_nolock */
+
+/* Makes sure there is one batch per partition when messages are keyed by
+ * identifier. The partition count is looked up periodically, so added
+ * partitions are picked up. The lookup may block for a while, so it is done
+ * without holding ctx->lock. */
+static void kafka_batch_update_partitions(struct kafka_topic_context *ctx) /* {{{ */
+{
+    const struct rd_kafka_metadata *md = NULL;
+    kafka_batch_t *tmp;
+    int32_t partition_cnt = -1;
+    cdtime_t now = cdtime();
+
+    if (ctx->key_mode != KAFKA_KEY_IDENTIFIER)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    if ((ctx->metadata_time + KAFKA_METADATA_INTERVAL) > now) {
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+    ctx->metadata_time = now;
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (rd_kafka_metadata(ctx->kafka, /* all_topics = */ 0, ctx->topic,
+                          &md, KAFKA_METADATA_TIMEOUT_MS)
+            != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        WARNING("write_kafka plugin: Looking up the partitions of topic "
+                "\"%s\" failed.", ctx->topic_name);
+        return;
+    }
+    if ((md->topic_cnt == 1) && (md->topics[0].err == RD_KAFKA_RESP_ERR_NO_ERROR))
+        partition_cnt = md->topics[0].partition_cnt;
+    rd_kafka_metadata_destroy(md);
+
+    if (partition_cnt < 1)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (partition_cnt == ctx->batches_num) {
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    kafka_batch_flush_nolock(ctx, /* timeout = */ 0);
+    tmp = realloc(ctx->batches, partition_cnt * sizeof(*ctx->batches));
+    if (tmp == NULL) {
+        ERROR("write_kafka plugin: realloc failed.");
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+    if (partition_cnt > ctx->batches_num)
+        memset(tmp + ctx->batches_num, 0,
+               (partition_cnt - ctx->batches_num) * sizeof(*tmp));
+    ctx->batches = tmp;
+    ctx->batches_num = partition_cnt;
+    pthread_mutex_unlock(&ctx->lock);
+} /* }}} void kafka_batch_update_partitions */
+
+static int kafka_batch_add(struct kafka_topic_context *ctx, /* {{{ */
+                           const data_set_t *ds, const value_list_t *vl)
+{
+    kafka_batch_t *b;
+    int32_t index = 0;
+    int status = 0;
+
+    kafka_batch_update_partitions(ctx);
+
+    pthread_mutex_lock(&ctx->lock);
+    if ((ctx->key_mode == KAFKA_KEY_IDENTIFIER) && (ctx->batches_num > 1))
+        index = kafka_jump_hash((uint64_t) kafka_identifier_hash(vl),
+                                ctx->batches_num);
+    b = ctx->batches + index;
+
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        /* Format straight into the batch buffer. */
+        format_json_stream_t s = { b->data, b->size, b->fill, 0 };
+
+        status = format_json_stream_value_list(&s, ds, vl, ctx->store_rates);
+        b->data = s.data;
+        b->size = s.size;
+        b->fill = s.fill;
+        if (status != 0)
+            ERROR("write_kafka plugin: Formatting JSON failed with "
+                  "status %i.", status);
+    } else {
+        char buffer[8192];
+        size_t len;
+
+        status = kafka_format(ctx, buffer, sizeof(buffer), ds, vl);
+        if (status == 0) {
+            len = strlen(buffer);
+            if (ctx->format == KAFKA_FORMAT_COMMAND)
+                buffer[len++] = '\n';
+
+            if (b->size < b->fill + len) {
+                size_t new_size = (b->size > 0) ? b->size : 1024;
+                char *tmp;
+
+                while (new_size < b->fill + len)
+                    new_size *= 2;
+                tmp = realloc(b->data, new_size);
+                if (tmp == NULL) {
+                    ERROR("write_kafka plugin: realloc failed.");
+                    status = ENOMEM;
+                } else {
+                    b->data = tmp;
+                    b->size = new_size;
+                }
+            }
+            if (status == 0) {
+                memcpy(b->data + b->fill, buffer, len);
+                b->fill += len;
+            }
+        }
+    }
+
+    if (status == 0) {
+        if (b->values_num == 0)
+            b->first_value = cdtime();
+        b->values_num++;
+
+        if ((b->fill >= ctx->batch_size)
+                || ((b->first_value + ctx->batch_timeout) <= cdtime()))
+            status = kafka_batch_send(ctx, index);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return status;
+} /* }}} int kafka_batch_add */
+
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char __attribute__((unused)) *identifier,
+                       user_data_t *ud)
+{
+    struct kafka_topic_context *ctx = ud->data;
+    int status;
+
+    pthread_mutex_lock(&ctx->lock);
+    status = kafka_batch_flush_nolock(ctx, timeout);
+    pthread_mutex_unlock(&ctx->lock);
+
+    rd_kafka_poll(ctx->kafka, 0);
+    return status;
+} /* }}} int kafka_flush */
+
+/* Sends batches which have been waiting for too long, serves delivery
+ * reports and dispatches statistics. */
+static int kafka_read(user_data_t *ud) /* {{{ */
+{
+    struct kafka_topic_context *ctx = ud->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    derive_t copy_delivered;
+    derive_t copy_failed;
+
+    if (ctx->batch_size > 0) {
+        pthread_mutex_lock(&ctx->lock);
+        kafka_batch_flush_nolock(ctx, ctx->batch_timeout);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    rd_kafka_poll(ctx->kafka, 0);
+
+    if (!ctx->report_stats)
+        return 0;
+
+    pthread_mutex_lock(&ctx->stats_lock);
+    copy_delivered = ctx->stats_delivered;
+    copy_failed = ctx->stats_failed;
+    pthread_mutex_unlock(&ctx->stats_lock);
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy(vl.host, hostname_g, sizeof(vl.host));
+    sstrncpy(vl.plugin, "write_kafka", sizeof(vl.plugin));
+    sstrncpy(vl.plugin_instance, ctx->topic_name, sizeof(vl.plugin_instance));
+
+    /* Number of messages waiting to be delivered */
+    values[0].gauge = (gauge_t) rd_kafka_outq_len(ctx->kafka);
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    plugin_dispatch_values(&vl);
+
+    /* Number of values delivered and lost */
+    values[0].derive = copy_delivered;
+    sstrncpy(vl.type, "total_values", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "delivered", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    values[0].derive = copy_failed;
+    sstrncpy(vl.type_instance, "failed", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    return 0;
+} /* }}} int kafka_read */
+
+static int kafka_write(const data_set_t *ds, /* {{{ */
+	      const value_list_t *vl,
+	      user_data_t *ud)
+{
+	int			 status = 0;
+    u_int32_t    key;
+    char         buffer[8192];
+    size_t bfree = sizeof(buffer);
+    size_t bfill = 0;
+    size_t blen = 0;
+	struct kafka_topic_context	*ctx = ud->data;
+
+    if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
+        return EINVAL;
+
+    if (ctx->batch_size > 0) {
+        status = kafka_batch_add(ctx, ds, vl);
+        rd_kafka_poll(ctx->kafka, 0);
+        return status;
+    }
+
+    buffer[0] = 0;
+
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        format_json_initialize(buffer, &bfill, &bfree);
+        format_json_value_list(buffer, &bfill, &bfree, ds, vl,
+                               ctx->store_rates);
+        format_json_finalize(buffer, &bfill, &bfree);
+    } else {
+        status = kafka_format(ctx, buffer, sizeof(buffer), ds, vl);
+        if (status != 0)
+            return status;
+    }
+    blen = strlen(buffer);
+
     /*
      * We partition our stream by metric name
      */
-    if (ctx->has_key)
+    if (ctx->key_mode == KAFKA_KEY_FIXED)
         key = ctx->key;
+    else if (ctx->key_mode == KAFKA_KEY_IDENTIFIER)
+        key = kafka_identifier_hash(vl);
     else
         key = rand();
 
-    rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
-                     RD_KAFKA_MSG_F_COPY, buffer, blen,
-                     &key, sizeof(key), NULL);
+    /* A single value list is small; copying it is cheaper than allocating
+     * a buffer that librdkafka would have to free. */
+    if (rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
+                         RD_KAFKA_MSG_F_COPY, buffer, blen,
+                         &key, sizeof(key), (void *) (intptr_t) 1) != 0) {
+        pthread_mutex_lock(&ctx->stats_lock);
+        ctx->stats_failed++;
+        pthread_mutex_unlock(&ctx->stats_lock);
+    }
+    rd_kafka_poll(ctx->kafka, 0);
 
 	return status;
 } /* }}} int kafka_write */
@@ -154,16 +587,37 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
 	struct kafka_topic_context *ctx = p;
+    int32_t i;
 
 	if (ctx == NULL)
 		return;
 
+    pthread_mutex_lock(&ctx->lock);
+    kafka_batch_flush_nolock(ctx, /* timeout = */ 0);
+    pthread_mutex_unlock(&ctx->lock);
+
+    /* Give queued messages a moment to be delivered. */
+    if (ctx->kafka != NULL) {
+        for (i = 0; (i < KAFKA_SHUTDOWN_TIMEOUT_MS / 100)
+                && (rd_kafka_outq_len(ctx->kafka) > 0); i++)
+            rd_kafka_poll(ctx->kafka, 100);
+    }
+
     if (ctx->topic_name != NULL)
         sfree(ctx->topic_name);
     if (ctx->topic != NULL)
         rd_kafka_topic_destroy(ctx->topic);
     if (ctx->conf != NULL)
         rd_kafka_topic_conf_destroy(ctx->conf);
+    if (ctx->kafka != NULL)
+        rd_kafka_destroy(ctx->kafka);
+    graphite_cache_destroy(ctx->name_cache);
+
+    for (i = 0; i < ctx->batches_num; i++)
+        sfree(ctx->batches[i].data);
+    sfree(ctx->batches);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_mutex_destroy(&ctx->stats_lock);
 
     sfree(ctx);
 } /* }}} void kafka_topic_context_free */
@@ -189,12 +643,27 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
     tctx->escape_char = '.';
     tctx->store_rates = 1;
     tctx->format = KAFKA_FORMAT_JSON;
+    tctx->key_mode = KAFKA_KEY_RANDOM;
+    tctx->batch_size = 0;
+    tctx->batch_timeout = 0;
+    pthread_mutex_init(&tctx->lock, /* attr = */ NULL);
+    pthread_mutex_init(&tctx->stats_lock, /* attr = */ NULL);
+
+    if ((tctx->batches = calloc(1, sizeof(*tctx->batches))) == NULL) {
+        sfree(tctx);
+        ERROR ("write_kafka plugin: calloc failed.");
+        return;
+    }
+    tctx->batches_num = 1;
 
 #ifdef HAVE_LIBRDKAFKA_LOG_CB
     rd_kafka_conf_set_log_cb(conf, kafka_log);
 #endif
+    rd_kafka_conf_set_dr_cb(conf, kafka_delivery_report);
+    rd_kafka_conf_set_opaque(conf, tctx);
     if ((tctx->kafka = rd_kafka_new(RD_KAFKA_PRODUCER, conf,
                                     errbuf, sizeof(errbuf))) == NULL) {
+        sfree(tctx->batches);
         sfree(tctx);
         ERROR("write_kafka plugin: cannot create kafka handle.");
         return;
@@ -206,6 +675,7 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 
     if ((tctx->conf = rd_kafka_topic_conf_new()) == NULL) {
         rd_kafka_destroy(tctx->kafka);
+        sfree(tctx->batches);
         sfree(tctx);
         ERROR ("write_kafka plugin: cannot create topic configuration.");
         return;
@@ -262,8 +732,10 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
                 break;
             }
 
-            if (strcasecmp(tmp_buf, "Random") != 0) {
-                tctx->has_key = 1;
+            if (strcasecmp(tmp_buf, "Identifier") == 0) {
+                tctx->key_mode = KAFKA_KEY_IDENTIFIER;
+            } else if (strcasecmp(tmp_buf, "Random") != 0) {
+                tctx->key_mode = KAFKA_KEY_FIXED;
                 tctx->key = crc32_buffer((u_char *)tmp_buf, strlen(tmp_buf));
             }
             sfree(tmp_buf);
@@ -291,6 +763,18 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 
             sfree(key);
 
+        } else if (strcasecmp ("BatchSize", child->key) == 0) {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp >= 0))
+                tctx->batch_size = (size_t) tmp;
+
+        } else if (strcasecmp ("BatchTimeout", child->key) == 0) {
+            status = cf_util_get_cdtime (child, &tctx->batch_timeout);
+
+        } else if (strcasecmp ("ReportStats", child->key) == 0) {
+            status = cf_util_get_boolean (child, &tctx->report_stats);
+
         } else if (strcasecmp ("StoreRates", child->key) == 0) {
             status = cf_util_get_boolean (child, &tctx->store_rates);
             (void) cf_util_get_flag (child, &tctx->graphite_flags,
@@ -324,6 +808,15 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
             break;
     }
 
+    if (tctx->format == KAFKA_FORMAT_GRAPHITE) {
+        tctx->name_cache = graphite_cache_create(tctx->prefix, tctx->postfix,
+                                                 tctx->escape_char,
+                                                 tctx->graphite_flags,
+                                                 GRAPHITE_CACHE_SIZE_DEFAULT);
+        if (tctx->name_cache == NULL)
+            WARNING("write_kafka plugin: Creating the name cache failed.");
+    }
+
     rd_kafka_topic_conf_set_partitioner_cb(tctx->conf, kafka_partition);
     rd_kafka_topic_conf_set_opaque(tctx->conf, tctx);
 
@@ -347,6 +840,26 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 				callback_name, status);
         goto errout;
     }
+
+    /* The write callback owns the context; the others only borrow it. The
+     * read callback sends stale batches and serves delivery reports. */
+    ud.free_func = NULL;
+    if (tctx->batch_size > 0) {
+        if (tctx->batch_timeout == 0)
+            tctx->batch_timeout = plugin_get_interval();
+        plugin_register_flush(callback_name, kafka_flush, &ud);
+    }
+    if ((tctx->batch_size > 0) || tctx->report_stats) {
+        struct timespec interval;
+        struct timespec *interval_ptr = NULL;
+
+        if (tctx->batch_size > 0) {
+            CDTIME_T_TO_TIMESPEC(tctx->batch_timeout, &interval);
+            interval_ptr = &interval;
+        }
+        plugin_register_complex_read(/* group = */ NULL, callback_name,
+                                     kafka_read, interval_ptr, &ud);
+    }
     return;
  errout:
     if (conf != NULL)
@@ -359,6 +872,8 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         free(tctx->topic_name);
     if (tctx->conf != NULL)
         rd_kafka_topic_conf_destroy(tctx->conf);
+    graphite_cache_destroy(tctx->name_cache);
+    sfree(tctx->batches);
     sfree(tctx);
 } /* }}} int kafka_config_topic */
 
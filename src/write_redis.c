@@ -33,6 +33,24 @@
 #include <sys/time.h>
 #include <hiredis/hiredis.h>
 
+#define WR_POOL_SIZE_DEFAULT 1
+#define WR_MAX_BATCH_SIZE_DEFAULT 1
+
+/* One connection of a node's pool. Commands are appended to the
+ * connection's output buffer and the replies are read in one go when the
+ * batch is flushed, so a batch costs a single round trip. */
+struct wr_conn_s
+{
+  redisContext *conn;
+  _Bool busy;
+
+  int values_num;
+  int replies_num;
+  _Bool multi_sent;
+  cdtime_t first_value;
+};
+typedef struct wr_conn_s wr_conn_t;
+
 struct wr_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -41,19 +59,221 @@ struct wr_node_s
   int port;
   struct timeval timeout;
 
-  redisContext *conn;
+  int max_batch_size;
+  cdtime_t flush_interval;
+  _Bool transaction;
+
+  wr_conn_t *pool;
+  int pool_size;
   pthread_mutex_t lock;
+  pthread_cond_t cond;
 };
 typedef struct wr_node_s wr_node_t;
 
 /*
  * Functions
  */
+/* Returns an idle connection of the pool, marked busy. Connections that are
+ * already established and have a pending batch are preferred, so batches
+ * fill up and new connections are only opened when writers compete. */
+static wr_conn_t *wr_conn_get (wr_node_t *node) /* {{{ */
+{
+  wr_conn_t *ret = NULL;
+  int i;
+
+  pthread_mutex_lock (&node->lock);
+  while (ret == NULL)
+  {
+    for (i = 0; i < node->pool_size; i++)
+    {
+      wr_conn_t *c = node->pool + i;
+
+      if (c->busy)
+        continue;
+
+      if ((ret == NULL)
+          || ((ret->conn == NULL) && (c->conn != NULL))
+          || ((ret->values_num == 0) && (c->values_num > 0)))
+        ret = c;
+    }
+
+    if (ret == NULL)
+      pthread_cond_wait (&node->cond, &node->lock);
+  }
+  ret->busy = 1;
+  pthread_mutex_unlock (&node->lock);
+
+  return (ret);
+} /* }}} wr_conn_t *wr_conn_get */
+
+static void wr_conn_put (wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  pthread_mutex_lock (&node->lock);
+  c->busy = 0;
+  pthread_cond_signal (&node->cond);
+  pthread_mutex_unlock (&node->lock);
+} /* }}} void wr_conn_put */
+
+static int wr_connect (wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  if (c->conn != NULL)
+    return (0);
+
+  c->conn = redisConnectWithTimeout ((char *)node->host, node->port, node->timeout);
+  if ((c->conn == NULL) || (c->conn->err != 0))
+  {
+    ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
+        (node->host != NULL) ? node->host : "localhost",
+        (node->port != 0) ? node->port : 6379,
+        (c->conn != NULL) ? c->conn->errstr : "unknown error");
+    if (c->conn != NULL)
+    {
+      redisFree (c->conn);
+      c->conn = NULL;
+    }
+    return (-1);
+  }
+
+  c->values_num = 0;
+  c->replies_num = 0;
+  c->multi_sent = 0;
+  return (0);
+} /* }}} int wr_connect */
+
+static void wr_disconnect (wr_conn_t *c) /* {{{ */
+{
+  if (c->conn != NULL)
+  {
+    redisFree (c->conn);
+    c->conn = NULL;
+  }
+  c->values_num = 0;
+  c->replies_num = 0;
+  c->multi_sent = 0;
+} /* }}} void wr_disconnect */
+
+/* Sends the pending batch of "c" and reads all replies. */
+static int wr_conn_flush (wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  redisReply *rr;
+  int errors = 0;
+  char errmsg[256] = "";
+  int i;
+
+  if ((c->conn == NULL) || (c->replies_num == 0))
+  {
+    /* None of the commands made it into the buffer. */
+    c->values_num = 0;
+    c->replies_num = 0;
+    c->multi_sent = 0;
+    return (0);
+  }
+
+  /* Without "MULTI", "EXEC" would only produce an error. */
+  if (c->multi_sent
+      && (redisAppendCommand (c->conn, "EXEC") == REDIS_OK))
+    c->replies_num++;
+
+  for (i = 0; i < c->replies_num; i++)
+  {
+    size_t j;
+
+    rr = NULL;
+    if (redisGetReply (c->conn, (void **) &rr) != REDIS_OK)
+    {
+      ERROR ("write_redis plugin: Sending %i value(s) to node \"%s\" "
+          "failed: %s", c->values_num, node->name, c->conn->errstr);
+      if (rr != NULL)
+        freeReplyObject (rr);
+      wr_disconnect (c);
+      return (-1);
+    }
+
+    if (rr->type == REDIS_REPLY_ERROR)
+    {
+      if (errors == 0)
+        sstrncpy (errmsg, rr->str, sizeof (errmsg));
+      errors++;
+    }
+    else if (rr->type == REDIS_REPLY_ARRAY) /* reply to EXEC */
+    {
+      for (j = 0; j < rr->elements; j++)
+      {
+        if (rr->element[j]->type != REDIS_REPLY_ERROR)
+          continue;
+        if (errors == 0)
+          sstrncpy (errmsg, rr->element[j]->str, sizeof (errmsg));
+        errors++;
+      }
+    }
+
+    freeReplyObject (rr);
+  }
+
+  if (errors > 0)
+    WARNING ("write_redis plugin: %i of %i command(s) sent to node \"%s\" "
+        "failed. The first error was: %s",
+        errors, c->replies_num, node->name, errmsg);
+
+  c->values_num = 0;
+  c->replies_num = 0;
+  c->multi_sent = 0;
+  return (0);
+} /* }}} int wr_conn_flush */
+
+/* Flushes the batches of all idle connections which are older than
+ * "timeout". Connections in use are flushed by their writer. */
+static int wr_flush_idle (wr_node_t *node, cdtime_t timeout) /* {{{ */
+{
+  cdtime_t now = cdtime ();
+  int status = 0;
+  int i;
+
+  for (i = 0; i < node->pool_size; i++)
+  {
+    wr_conn_t *c = node->pool + i;
+    _Bool do_flush = 0;
+
+    pthread_mutex_lock (&node->lock);
+    if (!c->busy && (c->values_num > 0)
+        && ((timeout == 0) || ((c->first_value + timeout) <= now)))
+    {
+      c->busy = 1;
+      do_flush = 1;
+    }
+    pthread_mutex_unlock (&node->lock);
+
+    if (!do_flush)
+      continue;
+
+    if (wr_conn_flush (node, c) != 0)
+      status = -1;
+    wr_conn_put (node, c);
+  }
+
+  return (status);
+} /* }}} int wr_flush_idle */
+
+static int wr_flush (cdtime_t timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier,
+    user_data_t *ud)
+{
+  return (wr_flush_idle (ud->data, timeout));
+} /* }}} int wr_flush */
+
+static int wr_read (user_data_t *ud) /* {{{ */
+{
+  wr_node_t *node = ud->data;
+
+  return (wr_flush_idle (node, node->flush_interval));
+} /* }}} int wr_read */
+
 static int wr_write (const data_set_t *ds, /* {{{ */
     const value_list_t *vl,
     user_data_t *ud)
 {
   wr_node_t *node = ud->data;
+  wr_conn_t *c;
   char ident[512];
   char key[512];
   char value[512];
@@ -61,7 +281,6 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   size_t value_size;
   char *value_ptr;
   int status;
-  redisReply   *rr;
   int i;
 
   status = FORMAT_VL (ident, sizeof (ident), vl);
@@ -106,48 +325,71 @@ static int wr_write (const data_set_t *ds, /* {{{ */
 
 #undef APPEND
 
-  pthread_mutex_lock (&node->lock);
+  c = wr_conn_get (node);
 
-  if (node->conn == NULL)
+  status = wr_connect (node, c);
+  if (status != 0)
   {
-    node->conn = redisConnectWithTimeout ((char *)node->host, node->port, node->timeout);
-    if (node->conn == NULL)
+    wr_conn_put (node, c);
+    return (status);
+  }
+
+  /* The commands are only buffered here; they are sent and their replies
+   * read when the batch is flushed. */
+  if (node->transaction && (c->values_num == 0))
+  {
+    if (redisAppendCommand (c->conn, "MULTI") != REDIS_OK)
+      WARNING ("write_redis plugin: MULTI command error.");
+    else
     {
-      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
+      c->replies_num++;
+      c->multi_sent = 1;
     }
   }
 
-  assert (node->conn != NULL);
-  rr = redisCommand (node->conn, "ZADD %s %s %s", key, time, value);
-  if (rr==NULL)
-    WARNING("ZADD command error. key:%s", key);
+  if (redisAppendCommand (c->conn, "ZADD %s %s %s", key, time, value) != REDIS_OK)
+    WARNING ("ZADD command error. key:%s", key);
+  else
+    c->replies_num++;
 
-  rr = redisCommand (node->conn, "SADD collectd/values %s", ident);
-  if (rr==NULL)
-    WARNING("SADD command error. ident:%s", ident);
+  if (redisAppendCommand (c->conn, "SADD collectd/values %s", ident) != REDIS_OK)
+    WARNING ("SADD command error. ident:%s", ident);
+  else
+    c->replies_num++;
 
-  pthread_mutex_unlock (&node->lock);
+  if (c->values_num == 0)
+    c->first_value = cdtime ();
+  c->values_num++;
 
-  return (0);
+  status = 0;
+  if ((c->values_num >= node->max_batch_size)
+      || ((c->first_value + node->flush_interval) <= cdtime ()))
+    status = wr_conn_flush (node, c);
+
+  wr_conn_put (node, c);
+
+  return (status);
 } /* }}} int wr_write */
 
 static void wr_config_free (void *ptr) /* {{{ */
 {
   wr_node_t *node = ptr;
+  int i;
 
   if (node == NULL)
     return;
 
-  if (node->conn != NULL)
+  for (i = 0; (node->pool != NULL) && (i < node->pool_size); i++)
   {
-    redisFree (node->conn);
-    node->conn = NULL;
+    wr_conn_t *c = node->pool + i;
+
+    wr_conn_flush (node, c);
+    wr_disconnect (c);
   }
+  sfree (node->pool);
 
+  pthread_cond_destroy (&node->cond);
+  pthread_mutex_destroy (&node->lock);
   sfree (node->host);
   sfree (node);
 } /* }}} void wr_config_free */
@@ -167,13 +409,18 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
   node->port = 0;
   node->timeout.tv_sec = 0;
   node->timeout.tv_usec = 1000;
-  node->conn = NULL;
+  node->max_batch_size = WR_MAX_BATCH_SIZE_DEFAULT;
+  node->flush_interval = 0;
+  node->transaction = 0;
+  node->pool = NULL;
+  node->pool_size = WR_POOL_SIZE_DEFAULT;
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
+  pthread_cond_init (&node->cond, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
   if (status != 0)
   {
-    sfree (node);
+    wr_config_free (node);
     return (status);
   }
 
@@ -196,6 +443,14 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int (child, &timeout);
       if (status == 0) node->timeout.tv_usec = timeout;
     }
+    else if (strcasecmp ("MaxBatchSize", child->key) == 0)
+      status = cf_util_get_int (child, &node->max_batch_size);
+    else if (strcasecmp ("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->flush_interval);
+    else if (strcasecmp ("Transaction", child->key) == 0)
+      status = cf_util_get_boolean (child, &node->transaction);
+    else if (strcasecmp ("PoolSize", child->key) == 0)
+      status = cf_util_get_int (child, &node->pool_size);
     else
       WARNING ("write_redis plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -204,6 +459,27 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  if (node->max_batch_size < 1)
+    node->max_batch_size = 1;
+  if (node->pool_size < 1)
+  {
+    WARNING ("write_redis plugin: PoolSize must be at least 1.");
+    node->pool_size = 1;
+  }
+  if ((node->max_batch_size > 1) && (node->flush_interval == 0))
+    node->flush_interval = plugin_get_interval ();
+
+  if (status == 0)
+  {
+    node->pool = calloc ((size_t) node->pool_size, sizeof (*node->pool));
+    if (node->pool == NULL)
+    {
+      ERROR ("write_redis plugin: calloc failed.");
+      node->pool_size = 0;
+      status = ENOMEM;
+    }
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -215,11 +491,26 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     ud.free_func = wr_config_free;
 
     status = plugin_register_write (cb_name, wr_write, &ud);
-  }
 
-  if (status != 0)
-    wr_config_free (node);
+    /* The write callback owns the node; the flush and read callbacks,
+     * which send out incomplete batches, only borrow it. */
+    if ((status == 0) && (node->max_batch_size > 1))
+    {
+      struct timespec interval;
+
+      CDTIME_T_TO_TIMESPEC (node->flush_interval, &interval);
+      ud.free_func = NULL;
+      plugin_register_flush (cb_name, wr_flush, &ud);
+      plugin_register_complex_read (/* group = */ NULL, cb_name, wr_read,
+          &interval, &ud);
+    }
+    else if (status != 0)
+      wr_config_free (node);
+
+    return (status);
+  }
 
+  wr_config_free (node);
   return (status);
 } /* }}} int wr_config_node */
 
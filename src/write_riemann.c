@@ -31,6 +31,7 @@
 #include "common.h"
 #include "configfile.h"
 #include "utils_cache.h"
+#include "utils_latency.h"
 #include "riemann.pb-c.h"
 
 #include <sys/socket.h>
@@ -44,16 +45,43 @@
 #define RIEMANN_PORT		"5555"
 #define RIEMANN_TTL_FACTOR      2.0
 #define RIEMANN_BATCH_MAX      8192
+#define RIEMANN_ACK_TIMEOUT    TIME_T_TO_CDTIME_T (10)
+#define RIEMANN_DRAIN_TIMEOUT  TIME_T_TO_CDTIME_T (2)
+#define RIEMANN_ARENA_CHUNK    4096
+#define RIEMANN_ARENAS_MAX       16
 
 int write_riemann_threshold_check(const data_set_t *, const value_list_t *, int *);
 
+/* Arenas hold the protobuf structures and strings of one message. Resetting
+ * an arena releases everything at once and keeps the memory for the next
+ * message, so building a message doesn't cost a malloc per field. */
+struct riemann_chunk_s;
+typedef struct riemann_chunk_s riemann_chunk_t;
+struct riemann_chunk_s
+{
+	riemann_chunk_t *next;
+	size_t size;
+	size_t fill;
+};
+
+struct riemann_arena_s;
+typedef struct riemann_arena_s riemann_arena_t;
+struct riemann_arena_s
+{
+	riemann_chunk_t *chunks;
+	size_t used;
+	riemann_arena_t *next;
+};
+
+#define RIEMANN_ALIGN(n) (((n) + 15) & ~((size_t) 15))
+
 struct riemann_host {
 	char			*name;
 	char			*event_service_prefix;
 #define F_CONNECT	 0x01
 	uint8_t			 flags;
 	pthread_mutex_t	 lock;
-    _Bool            batch_mode;
+	_Bool            batch_mode;
 	_Bool            notifications;
 	_Bool            check_thresholds;
 	_Bool			 store_rates;
@@ -63,63 +91,220 @@ struct riemann_host {
 	_Bool			 use_tcp;
 	int			     s;
 	double			 ttl_factor;
-    Msg             *batch_msg;
-    cdtime_t         batch_init;
-    int              batch_max;
+	int              batch_max;
+	cdtime_t         batch_init;
+	riemann_arena_t *batch_arena;
+	Event          **batch_events;
+	size_t           batch_events_num;
+	size_t           batch_events_size;
+	size_t           batch_size;
+	/* Pipelining: at most "max_in_flight" messages are sent without having
+	 * been acknowledged. The send times of those messages are kept in a ring
+	 * buffer, acknowledgements are read by a separate thread. */
+	int              max_in_flight;
+	int              in_flight;
+	cdtime_t        *send_times;
+	int              send_times_head;
+	pthread_cond_t   ack_cond;
+	int              readers_num;
+	unsigned int     generation;
+	u_char          *send_buffer;
+	size_t           send_buffer_size;
+	pthread_mutex_t  arena_lock;
+	riemann_arena_t *arenas;
+	size_t           arenas_num;
+	_Bool            report_stats;
+	latency_counter_t *stats_latency;
+	derive_t         stats_sent;
+	derive_t         stats_failed;
 	int			     reference_count;
 };
 
+struct riemann_reader_s
+{
+	struct riemann_host *host;
+	int fd;
+	unsigned int generation;
+};
+typedef struct riemann_reader_s riemann_reader_t;
+
 static char	**riemann_tags;
 static size_t	  riemann_tags_num;
 static char	**riemann_attrs;
 static size_t     riemann_attrs_num;
 
-static void riemann_event_protobuf_free (Event *event) /* {{{ */
+static void *riemann_arena_alloc (riemann_arena_t *a, size_t size) /* {{{ */
 {
-	size_t i;
+	riemann_chunk_t *c = a->chunks;
+	char *ptr;
 
-	if (event == NULL)
-		return;
+	size = RIEMANN_ALIGN (size);
+	if ((c == NULL) || ((c->size - c->fill) < size))
+	{
+		size_t chunk_size = RIEMANN_ARENA_CHUNK;
+
+		while (chunk_size < size)
+			chunk_size *= 2;
+
+		c = malloc (RIEMANN_ALIGN (sizeof (*c)) + chunk_size);
+		if (c == NULL)
+		{
+			ERROR ("write_riemann plugin: malloc failed.");
+			return (NULL);
+		}
+		c->size = chunk_size;
+		c->fill = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+
+	ptr = ((char *) c) + RIEMANN_ALIGN (sizeof (*c)) + c->fill;
+	c->fill += size;
+	a->used += size;
+
+	memset (ptr, 0, size);
+	return (ptr);
+} /* }}} void *riemann_arena_alloc */
+
+static char *riemann_arena_strdup (riemann_arena_t *a, char const *s) /* {{{ */
+{
+	size_t len = strlen (s) + 1;
+	char *ptr;
 
-	sfree (event->state);
-	sfree (event->service);
-	sfree (event->host);
-	sfree (event->description);
+	ptr = riemann_arena_alloc (a, len);
+	if (ptr != NULL)
+		memcpy (ptr, s, len);
+	return (ptr);
+} /* }}} char *riemann_arena_strdup */
 
-	strarray_free (event->tags, event->n_tags);
-	event->tags = NULL;
-	event->n_tags = 0;
+static void riemann_arena_reset (riemann_arena_t *a) /* {{{ */
+{
+	riemann_chunk_t *c;
+	size_t size;
+
+	if ((a->chunks == NULL) || (a->chunks->next == NULL))
+	{
+		if (a->chunks != NULL)
+			a->chunks->fill = 0;
+		a->used = 0;
+		return;
+	}
+
+	/* The last message needed more than one chunk. Replace the chunks with a
+	 * single one big enough for the whole message. */
+	size = RIEMANN_ARENA_CHUNK;
+	while (size < a->used)
+		size *= 2;
 
-	for (i = 0; i < event->n_attributes; i++)
+	while (a->chunks != NULL)
 	{
-		sfree (event->attributes[i]->key);
-		sfree (event->attributes[i]->value);
-		sfree (event->attributes[i]);
+		c = a->chunks;
+		a->chunks = c->next;
+		sfree (c);
 	}
-	sfree (event->attributes);
-	event->n_attributes = 0;
+	a->used = 0;
 
-	sfree (event);
-} /* }}} void riemann_event_protobuf_free */
+	c = malloc (RIEMANN_ALIGN (sizeof (*c)) + size);
+	if (c == NULL)
+		return;
+	c->size = size;
+	c->fill = 0;
+	c->next = NULL;
+	a->chunks = c;
+} /* }}} void riemann_arena_reset */
 
-static void riemann_msg_protobuf_free(Msg *msg) /* {{{ */
+static void riemann_arena_destroy (riemann_arena_t *a) /* {{{ */
 {
-	size_t i;
+	riemann_chunk_t *c;
 
-	if (msg == NULL)
+	if (a == NULL)
 		return;
 
-	for (i = 0; i < msg->n_events; i++)
+	while (a->chunks != NULL)
+	{
+		c = a->chunks;
+		a->chunks = c->next;
+		sfree (c);
+	}
+	sfree (a);
+} /* }}} void riemann_arena_destroy */
+
+static riemann_arena_t *riemann_arena_get (struct riemann_host *host) /* {{{ */
+{
+	riemann_arena_t *a;
+
+	pthread_mutex_lock (&host->arena_lock);
+	a = host->arenas;
+	if (a != NULL)
+	{
+		host->arenas = a->next;
+		host->arenas_num--;
+		a->next = NULL;
+	}
+	pthread_mutex_unlock (&host->arena_lock);
+
+	if (a == NULL)
+	{
+		a = calloc (1, sizeof (*a));
+		if (a == NULL)
+			ERROR ("write_riemann plugin: calloc failed.");
+	}
+	return (a);
+} /* }}} riemann_arena_t *riemann_arena_get */
+
+static void riemann_arena_put (struct riemann_host *host, /* {{{ */
+		riemann_arena_t *a)
+{
+	riemann_arena_reset (a);
+
+	pthread_mutex_lock (&host->arena_lock);
+	if (host->arenas_num < RIEMANN_ARENAS_MAX)
 	{
-		riemann_event_protobuf_free (msg->events[i]);
-		msg->events[i] = NULL;
+		a->next = host->arenas;
+		host->arenas = a;
+		host->arenas_num++;
+		a = NULL;
 	}
+	pthread_mutex_unlock (&host->arena_lock);
 
-	sfree (msg->events);
-	msg->n_events = 0;
+	riemann_arena_destroy (a);
+} /* }}} void riemann_arena_put */
 
-	sfree (msg);
-} /* }}} void riemann_msg_protobuf_free */
+static void *riemann_ack_thread (void *arg);
+
+/* host->lock must be held when calling this function. */
+static int riemann_reader_start (struct riemann_host *host) /* {{{ */
+{
+	riemann_reader_t *r;
+	pthread_t thread;
+	int status;
+
+	r = malloc (sizeof (*r));
+	if (r == NULL)
+	{
+		ERROR ("write_riemann plugin: malloc failed.");
+		return (ENOMEM);
+	}
+	r->host = host;
+	r->fd = host->s;
+	r->generation = host->generation;
+
+	status = plugin_thread_create (&thread, /* attr = */ NULL,
+			riemann_ack_thread, r);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("write_riemann plugin: Starting the acknowledgement "
+				"thread failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		sfree (r);
+		return (status);
+	}
+	pthread_detach (thread);
+
+	host->readers_num++;
+	return (0);
+} /* }}} int riemann_reader_start */
 
 /* host->lock must be held when calling this function. */
 static int riemann_connect(struct riemann_host *host) /* {{{ */
@@ -176,6 +361,14 @@ static int riemann_connect(struct riemann_host *host) /* {{{ */
 				node, service);
 		return -1;
 	}
+
+	if (host->use_tcp && (host->max_in_flight > 0)
+			&& (riemann_reader_start (host) != 0)) {
+		close (host->s);
+		host->s = -1;
+		host->flags &= ~F_CONNECT;
+		return -1;
+	}
 	return 0;
 } /* }}} int riemann_connect */
 
@@ -185,47 +378,221 @@ static int riemann_disconnect (struct riemann_host *host) /* {{{ */
 	if ((host->flags & F_CONNECT) == 0)
 		return (0);
 
-	close (host->s);
+	if (host->use_tcp && (host->max_in_flight > 0))
+	{
+		/* The acknowledgement thread owns the socket. Shutting it down
+		 * wakes the thread up, which then closes the socket. */
+		shutdown (host->s, SHUT_RDWR);
+
+		if (host->in_flight > 0)
+		{
+			WARNING ("write_riemann plugin: Disconnecting from %s:%s "
+					"with %i unacknowledged message(s). "
+					"These may have been lost.",
+					(host->node != NULL) ? host->node : RIEMANN_HOST,
+					(host->service != NULL) ? host->service : RIEMANN_PORT,
+					host->in_flight);
+			host->stats_failed += (derive_t) host->in_flight;
+		}
+		host->in_flight = 0;
+		host->send_times_head = 0;
+		host->generation++;
+		pthread_cond_broadcast (&host->ack_cond);
+	}
+	else
+	{
+		close (host->s);
+	}
+
 	host->s = -1;
 	host->flags &= ~F_CONNECT;
 
 	return (0);
 } /* }}} int riemann_disconnect */
 
-static int riemann_send_msg (struct riemann_host *host, const Msg *msg) /* {{{ */
+/* Reads one acknowledgement from "fd". Returns zero if a message was read,
+ * "ok" is set to false if Riemann reported an error. */
+static int riemann_read_ack (struct riemann_host const *host, /* {{{ */
+		int fd, _Bool *ok)
 {
 	int status = 0;
-	u_char *buffer = NULL;
-	size_t  buffer_len;
+	Msg *msg = NULL;
+	uint32_t header;
+	size_t size;
+	u_char small_buffer[256];
+	u_char *buffer = small_buffer;
+
+	status = (int) sread (fd, &header, 4);
+	if (status != 0)
+		return -1;
+
+	/* Acknowledges are typically small and fit the buffer on the stack. */
+	size = ntohl(header);
+	if (size > sizeof (small_buffer))
+	{
+		buffer = malloc (size);
+		if (buffer == NULL)
+		{
+			ERROR ("write_riemann plugin: malloc failed.");
+			return ENOMEM;
+		}
+	}
+
+	status = (int) sread (fd, buffer, size);
+	if (status == 0)
+		msg = msg__unpack (NULL, size, buffer);
+
+	if (buffer != small_buffer)
+		sfree (buffer);
 
-	status = riemann_connect (host);
 	if (status != 0)
 		return status;
+	if (msg == NULL)
+		return -1;
+
+	*ok = msg->ok ? 1 : 0;
+	if (!msg->ok)
+		ERROR ("write_riemann plugin: Sending to Riemann at %s:%s acknowledgement message reported error: %s",
+				(host->node != NULL) ? host->node : RIEMANN_HOST,
+				(host->service != NULL) ? host->service : RIEMANN_PORT,
+				msg->error);
+
+	msg__free_unpacked (msg, NULL);
+	return 0;
+} /* }}} int riemann_read_ack */
+
+/* Reads the acknowledgements of one connection in pipelined mode. Exits when
+ * the connection fails or has been replaced. */
+static void *riemann_ack_thread (void *arg) /* {{{ */
+{
+	riemann_reader_t *r = arg;
+	struct riemann_host *host = r->host;
+	int fd = r->fd;
+	unsigned int generation = r->generation;
+	int status;
+
+	sfree (r);
+
+	while (42)
+	{
+		_Bool ok = 1;
+
+		status = riemann_read_ack (host, fd, &ok);
+
+		pthread_mutex_lock (&host->lock);
+		if ((status != 0) || (host->generation != generation))
+			break;
+
+		if (host->in_flight > 0)
+		{
+			cdtime_t sent = host->send_times[host->send_times_head];
+
+			host->send_times_head = (host->send_times_head + 1)
+				% host->max_in_flight;
+			host->in_flight--;
+
+			if (host->stats_latency != NULL)
+				latency_counter_add (host->stats_latency,
+						cdtime () - sent);
+		}
+		if (!ok)
+			host->stats_failed++;
+
+		pthread_cond_broadcast (&host->ack_cond);
+		pthread_mutex_unlock (&host->lock);
+	}
+
+	/* host->lock is held here. */
+	if (host->generation == generation)
+		riemann_disconnect (host);
+
+	close (fd);
+	host->readers_num--;
+	pthread_cond_broadcast (&host->ack_cond);
+	pthread_mutex_unlock (&host->lock);
+
+	return (NULL);
+} /* }}} void *riemann_ack_thread */
+
+/* Connects if necessary and, in pipelined mode, waits until another message
+ * may be sent. This may temporarily release host->lock while waiting for
+ * acknowledgements, so state protected by the lock must be examined after
+ * this function returns. host->lock must be held. */
+static int riemann_send_prepare (struct riemann_host *host) /* {{{ */
+{
+	while (42)
+	{
+		unsigned int generation;
+		struct timespec ts;
+		int status;
+
+		status = riemann_connect (host);
+		if (status != 0)
+			return (status);
+
+		if ((!host->use_tcp) || (host->max_in_flight <= 0)
+				|| (host->in_flight < host->max_in_flight))
+			return (0);
+
+		generation = host->generation;
+		CDTIME_T_TO_TIMESPEC (cdtime () + RIEMANN_ACK_TIMEOUT, &ts);
+		status = pthread_cond_timedwait (&host->ack_cond, &host->lock, &ts);
+		if ((status == ETIMEDOUT)
+				&& (host->generation == generation)
+				&& (host->in_flight >= host->max_in_flight))
+		{
+			ERROR ("write_riemann plugin: Riemann at %s:%s did not "
+					"acknowledge any message within %.0f seconds. "
+					"Reconnecting.",
+					(host->node != NULL) ? host->node : RIEMANN_HOST,
+					(host->service != NULL) ? host->service : RIEMANN_PORT,
+					CDTIME_T_TO_DOUBLE (RIEMANN_ACK_TIMEOUT));
+			riemann_disconnect (host);
+			return (-1);
+		}
+	}
+} /* }}} int riemann_send_prepare */
+
+/* Sends "msg" and, in TCP mode, waits for or accounts for its
+ * acknowledgement. Disconnects on errors. riemann_send_prepare() must have
+ * been called and host->lock must be held. */
+static int riemann_send_msg (struct riemann_host *host, const Msg *msg) /* {{{ */
+{
+	int status = 0;
+	size_t  buffer_len;
+	cdtime_t start;
 
 	buffer_len = msg__get_packed_size(msg);
 
 	if (host->use_tcp)
 		buffer_len += 4;
 
-	buffer = malloc (buffer_len);
-	if (buffer == NULL) {
-		ERROR ("write_riemann plugin: malloc failed.");
-		return ENOMEM;
+	if (host->send_buffer_size < buffer_len)
+	{
+		u_char *tmp;
+
+		tmp = realloc (host->send_buffer, buffer_len);
+		if (tmp == NULL) {
+			ERROR ("write_riemann plugin: realloc failed.");
+			return ENOMEM;
+		}
+		host->send_buffer = tmp;
+		host->send_buffer_size = buffer_len;
 	}
-	memset (buffer, 0, buffer_len);
 
 	if (host->use_tcp)
 	{
 		uint32_t length = htonl ((uint32_t) (buffer_len - 4));
-		memcpy (buffer, &length, 4);
-		msg__pack(msg, buffer + 4);
+		memcpy (host->send_buffer, &length, 4);
+		msg__pack(msg, host->send_buffer + 4);
 	}
 	else
 	{
-		msg__pack(msg, buffer);
+		msg__pack(msg, host->send_buffer);
 	}
 
-	status = (int) swrite (host->s, buffer, buffer_len);
+	start = cdtime ();
+	status = (int) swrite (host->s, host->send_buffer, buffer_len);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -233,55 +600,50 @@ static int riemann_send_msg (struct riemann_host *host, const Msg *msg) /* {{{ *
 				(host->node != NULL) ? host->node : RIEMANN_HOST,
 				(host->service != NULL) ? host->service : RIEMANN_PORT,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		sfree (buffer);
+		host->stats_failed++;
+		riemann_disconnect (host);
 		return -1;
 	}
+	host->stats_sent++;
 
-	sfree (buffer);
-	return 0;
-} /* }}} int riemann_send_msg */
-
-static int riemann_recv_ack(struct riemann_host *host) /* {{{ */
-{
-	int status = 0;
-	Msg *msg = NULL;
-	uint32_t header;
-
-	status = (int) sread (host->s, &header, 4);
-
-	if (status != 0)
-		return -1;
-
-	size_t size = ntohl(header);
-
-	// Buffer on the stack since acknowledges are typically small.
-	u_char buffer[size];
-	memset (buffer, 0, size);
-
-	status = (int) sread (host->s, buffer, size);
-
-	if (status != 0)
-		return status;
+	if (!host->use_tcp)
+		return 0;
 
-	msg = msg__unpack (NULL, size, buffer);
+	if (host->max_in_flight > 0)
+	{
+		int idx = (host->send_times_head + host->in_flight)
+			% host->max_in_flight;
 
-	if (msg == NULL)
-		return -1;
+		host->send_times[idx] = start;
+		host->in_flight++;
+		return 0;
+	}
 
-	if (!msg->ok)
+	/*
+	 * Without pipelining, wait for the acknowledgement right away.
+	 */
 	{
-		ERROR ("write_riemann plugin: Sending to Riemann at %s:%s acknowledgement message reported error: %s",
-				(host->node != NULL) ? host->node : RIEMANN_HOST,
-				(host->service != NULL) ? host->service : RIEMANN_PORT,
-				msg->error);
+		_Bool ok = 1;
 
-		msg__free_unpacked(msg, NULL);
-		return -1;
+		status = riemann_read_ack (host, host->s, &ok);
+		if (status != 0)
+		{
+			host->stats_failed++;
+			riemann_disconnect (host);
+			return status;
+		}
+		if (host->stats_latency != NULL)
+			latency_counter_add (host->stats_latency, cdtime () - start);
+		if (!ok)
+		{
+			host->stats_failed++;
+			riemann_disconnect (host);
+			return -1;
+		}
 	}
 
-	msg__free_unpacked (msg, NULL);
 	return 0;
-} /* }}} int riemann_recv_ack */
+} /* }}} int riemann_send_msg */
 
 /**
  * Function to send messages (Msg) to riemann.
@@ -293,112 +655,116 @@ static int riemann_send(struct riemann_host *host, Msg const *msg) /* {{{ */
 	int status = 0;
 	pthread_mutex_lock (&host->lock);
 
-	status = riemann_send_msg(host, msg);
-	if (status != 0) {
-		riemann_disconnect (host);
-		pthread_mutex_unlock (&host->lock);
-		return status;
-	}
+	status = riemann_send_prepare (host);
+	if (status == 0)
+		status = riemann_send_msg (host, msg);
 
-	/*
-	 * For TCP we need to receive message acknowledgemenent.
-	 */
-	if (host->use_tcp)
+	pthread_mutex_unlock (&host->lock);
+	return status;
+} /* }}} int riemann_send */
+
+/* Allocates an event with room for "attrs_max" attributes and "tags_max"
+ * tags. */
+static Event *riemann_event_create (riemann_arena_t *a, /* {{{ */
+		size_t attrs_max, size_t tags_max)
+{
+	Event *event;
+
+	event = riemann_arena_alloc (a, sizeof (*event));
+	if (event == NULL)
+		return (NULL);
+	event__init (event);
+
+	if (attrs_max > 0)
 	{
-		status = riemann_recv_ack(host);
+		event->attributes = riemann_arena_alloc (a,
+				attrs_max * sizeof (*event->attributes));
+		if (event->attributes == NULL)
+			return (NULL);
+	}
 
-		if (status != 0)
-		{
-			riemann_disconnect (host);
-			pthread_mutex_unlock (&host->lock);
-			return status;
-		}
+	if (tags_max > 0)
+	{
+		event->tags = riemann_arena_alloc (a,
+				tags_max * sizeof (*event->tags));
+		if (event->tags == NULL)
+			return (NULL);
 	}
 
-	pthread_mutex_unlock (&host->lock);
-	return 0;
-} /* }}} int riemann_send */
+	return (event);
+} /* }}} Event *riemann_event_create */
 
-static int riemann_event_add_tag (Event *event, char const *tag) /* {{{ */
+/* Tags, attribute keys and the globally configured attributes live until
+ * shutdown and are referenced rather than copied. */
+static void riemann_event_add_tag (Event *event, char const *tag) /* {{{ */
 {
-	return (strarray_add (&event->tags, &event->n_tags, tag));
-} /* }}} int riemann_event_add_tag */
+	event->tags[event->n_tags] = (char *) tag;
+	event->n_tags++;
+} /* }}} void riemann_event_add_tag */
 
-static int riemann_event_add_attribute(Event *event, /* {{{ */
-		char const *key, char const *value)
+static int riemann_event_add_attribute(riemann_arena_t *a, /* {{{ */
+		Event *event, char const *key, char const *value, _Bool copy)
 {
-	Attribute **new_attributes;
-	Attribute *a;
+	Attribute *attr;
 
-	new_attributes = realloc (event->attributes,
-			sizeof (*event->attributes) * (event->n_attributes + 1));
-	if (new_attributes == NULL)
-	{
-		ERROR ("write_riemann plugin: realloc failed.");
+	attr = riemann_arena_alloc (a, sizeof (*attr));
+	if (attr == NULL)
 		return (ENOMEM);
-	}
-	event->attributes = new_attributes;
+	attribute__init (attr);
 
-	a = malloc (sizeof (*a));
-	if (a == NULL)
+	attr->key = (char *) key;
+	if ((value != NULL) && copy)
 	{
-		ERROR ("write_riemann plugin: malloc failed.");
-		return (ENOMEM);
+		attr->value = riemann_arena_strdup (a, value);
+		if (attr->value == NULL)
+			return (ENOMEM);
+	}
+	else
+	{
+		attr->value = (char *) value;
 	}
-	attribute__init (a);
-
-	a->key = strdup (key);
-	if (value != NULL)
-		a->value = strdup (value);
 
-	event->attributes[event->n_attributes] = a;
+	event->attributes[event->n_attributes] = attr;
 	event->n_attributes++;
 
 	return (0);
 } /* }}} int riemann_event_add_attribute */
 
 static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ */
-		notification_t const *n)
+		riemann_arena_t *a, notification_t const *n)
 {
 	Msg *msg;
 	Event *event;
 	char service_buffer[6 * DATA_MAX_NAME_LEN];
 	char const *severity;
 	notification_meta_t *meta;
+	size_t attrs_max;
+	int status = 0;
 	int i;
 
-	msg = malloc (sizeof (*msg));
+	msg = riemann_arena_alloc (a, sizeof (*msg));
 	if (msg == NULL)
-	{
-		ERROR ("write_riemann plugin: malloc failed.");
 		return (NULL);
-	}
-	memset (msg, 0, sizeof (*msg));
 	msg__init (msg);
 
-	msg->events = malloc (sizeof (*msg->events));
+	msg->events = riemann_arena_alloc (a, sizeof (*msg->events));
 	if (msg->events == NULL)
-	{
-		ERROR ("write_riemann plugin: malloc failed.");
-		sfree (msg);
 		return (NULL);
-	}
 
-	event = malloc (sizeof (*event));
+	attrs_max = 6 + riemann_attrs_num / 2;
+	for (meta = n->meta; meta != NULL; meta = meta->next)
+		attrs_max++;
+
+	event = riemann_event_create (a, attrs_max, riemann_tags_num + 1);
 	if (event == NULL)
-	{
-		ERROR ("write_riemann plugin: malloc failed.");
-		sfree (msg->events);
-		sfree (msg);
 		return (NULL);
-	}
-	memset (event, 0, sizeof (*event));
-	event__init (event);
 
 	msg->events[0] = event;
 	msg->n_events = 1;
 
-	event->host = strdup (n->host);
+	event->host = riemann_arena_strdup (a, n->host);
+	if (event->host == NULL)
+		return (NULL);
 	event->time = CDTIME_T_TO_TIME_T (n->time);
 	event->has_time = 1;
 
@@ -409,27 +775,30 @@ static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ *
 		case NOTIF_FAILURE:	severity = "critical"; break;
 		default:		severity = "unknown";
 	}
-	event->state = strdup (severity);
+	event->state = (char *) severity;
 
 	riemann_event_add_tag (event, "notification");
 	if (n->host[0] != 0)
-		riemann_event_add_attribute (event, "host", n->host);
+		status |= riemann_event_add_attribute (a, event, "host",
+				n->host, 1);
 	if (n->plugin[0] != 0)
-		riemann_event_add_attribute (event, "plugin", n->plugin);
+		status |= riemann_event_add_attribute (a, event, "plugin",
+				n->plugin, 1);
 	if (n->plugin_instance[0] != 0)
-		riemann_event_add_attribute (event, "plugin_instance",
-				n->plugin_instance);
+		status |= riemann_event_add_attribute (a, event, "plugin_instance",
+				n->plugin_instance, 1);
 
 	if (n->type[0] != 0)
-		riemann_event_add_attribute (event, "type", n->type);
+		status |= riemann_event_add_attribute (a, event, "type",
+				n->type, 1);
 	if (n->type_instance[0] != 0)
-		riemann_event_add_attribute (event, "type_instance",
-				n->type_instance);
+		status |= riemann_event_add_attribute (a, event, "type_instance",
+				n->type_instance, 1);
 
 	for (i = 0; i < riemann_attrs_num; i += 2)
-		riemann_event_add_attribute(event,
+		status |= riemann_event_add_attribute (a, event,
 					    riemann_attrs[i],
-					    riemann_attrs[i +1]);
+					    riemann_attrs[i +1], 0);
 
 	for (i = 0; i < riemann_tags_num; i++)
 		riemann_event_add_tag (event, riemann_tags[i]);
@@ -437,10 +806,13 @@ static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ *
 	format_name (service_buffer, sizeof (service_buffer),
 			/* host = */ "", n->plugin, n->plugin_instance,
 			n->type, n->type_instance);
-	event->service = strdup (&service_buffer[1]);
+	event->service = riemann_arena_strdup (a, &service_buffer[1]);
+	if (event->service == NULL)
+		return (NULL);
 
 	if (n->message[0] != 0)
-		riemann_event_add_attribute (event, "description", n->message);
+		status |= riemann_event_add_attribute (a, event, "description",
+				n->message, 1);
 
 	/* Pull in values from threshold and add extra attributes */
 	for (meta = n->meta; meta != NULL; meta = meta->next)
@@ -453,11 +825,15 @@ static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ *
 		}
 
 		if (meta->type == NM_TYPE_STRING) {
-			riemann_event_add_attribute (event, meta->name, meta->nm_value.nm_string);
+			status |= riemann_event_add_attribute (a, event,
+					meta->name, meta->nm_value.nm_string, 1);
 			continue;
 		}
 	}
 
+	if (status != 0)
+		return (NULL);
+
 	DEBUG ("write_riemann plugin: Successfully created protobuf for notification: "
 			"host = \"%s\", service = \"%s\", state = \"%s\"",
 			event->host, event->service, event->state);
@@ -465,6 +841,7 @@ static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ *
 } /* }}} Msg *riemann_notification_to_protobuf */
 
 static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{ */
+		riemann_arena_t *a,
 		data_set_t const *ds,
 		value_list_t const *vl, size_t index,
 					 gauge_t const *rates,
@@ -474,34 +851,33 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 	char name_buffer[5 * DATA_MAX_NAME_LEN];
 	char service_buffer[6 * DATA_MAX_NAME_LEN];
 	double ttl;
+	int ret = 0;
 	int i;
 
-	event = malloc (sizeof (*event));
+	event = riemann_event_create (a, 7 + riemann_attrs_num / 2,
+			riemann_tags_num);
 	if (event == NULL)
-	{
-		ERROR ("write_riemann plugin: malloc failed.");
 		return (NULL);
-	}
-	memset (event, 0, sizeof (*event));
-	event__init (event);
 
-	event->host = strdup (vl->host);
+	event->host = riemann_arena_strdup (a, vl->host);
+	if (event->host == NULL)
+		return (NULL);
 	event->time = CDTIME_T_TO_TIME_T (vl->time);
 	event->has_time = 1;
 
 	if (host->check_thresholds) {
 		switch (status) {
 			case STATE_OKAY:
-				event->state = strdup("ok");
+				event->state = "ok";
 				break;
 			case STATE_ERROR:
-				event->state = strdup("critical");
+				event->state = "critical";
 				break;
 			case STATE_WARNING:
-				event->state = strdup("warning");
+				event->state = "warning";
 				break;
 			case STATE_MISSING:
-				event->state = strdup("unknown");
+				event->state = "unknown";
 				break;
 		}
 	}
@@ -510,15 +886,15 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 	event->ttl = (float) ttl;
 	event->has_ttl = 1;
 
-	riemann_event_add_attribute (event, "plugin", vl->plugin);
+	ret |= riemann_event_add_attribute (a, event, "plugin", vl->plugin, 1);
 	if (vl->plugin_instance[0] != 0)
-		riemann_event_add_attribute (event, "plugin_instance",
-				vl->plugin_instance);
+		ret |= riemann_event_add_attribute (a, event, "plugin_instance",
+				vl->plugin_instance, 1);
 
-	riemann_event_add_attribute (event, "type", vl->type);
+	ret |= riemann_event_add_attribute (a, event, "type", vl->type, 1);
 	if (vl->type_instance[0] != 0)
-		riemann_event_add_attribute (event, "type_instance",
-				vl->type_instance);
+		ret |= riemann_event_add_attribute (a, event, "type_instance",
+				vl->type_instance, 1);
 
 	if ((ds->ds[index].type != DS_TYPE_GAUGE) && (rates != NULL))
 	{
@@ -526,29 +902,35 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 
 		ssnprintf (ds_type, sizeof (ds_type), "%s:rate",
 				DS_TYPE_TO_STRING(ds->ds[index].type));
-		riemann_event_add_attribute (event, "ds_type", ds_type);
+		ret |= riemann_event_add_attribute (a, event, "ds_type",
+				ds_type, 1);
 	}
 	else
 	{
-		riemann_event_add_attribute (event, "ds_type",
-				DS_TYPE_TO_STRING(ds->ds[index].type));
+		ret |= riemann_event_add_attribute (a, event, "ds_type",
+				DS_TYPE_TO_STRING(ds->ds[index].type), 0);
 	}
-	riemann_event_add_attribute (event, "ds_name", ds->ds[index].name);
+	ret |= riemann_event_add_attribute (a, event, "ds_name",
+			ds->ds[index].name, 0);
 	{
 		char ds_index[DATA_MAX_NAME_LEN];
 
 		ssnprintf (ds_index, sizeof (ds_index), "%zu", index);
-		riemann_event_add_attribute (event, "ds_index", ds_index);
+		ret |= riemann_event_add_attribute (a, event, "ds_index",
+				ds_index, 1);
 	}
 
 	for (i = 0; i < riemann_attrs_num; i += 2)
-		riemann_event_add_attribute(event,
+		ret |= riemann_event_add_attribute (a, event,
 					    riemann_attrs[i],
-					    riemann_attrs[i +1]);
+					    riemann_attrs[i +1], 0);
 
 	for (i = 0; i < riemann_tags_num; i++)
 		riemann_event_add_tag (event, riemann_tags[i]);
 
+	if (ret != 0)
+		return (NULL);
+
 	if (ds->ds[index].type == DS_TYPE_GAUGE)
 	{
 		event->has_metric_d = 1;
@@ -591,7 +973,9 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 					host->event_service_prefix, &name_buffer[1]);
 	}
 
-	event->service = strdup (service_buffer);
+	event->service = riemann_arena_strdup (a, service_buffer);
+	if (event->service == NULL)
+		return (NULL);
 
 	DEBUG ("write_riemann plugin: Successfully created protobuf for metric: "
 			"host = \"%s\", service = \"%s\"",
@@ -599,87 +983,117 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 	return (event);
 } /* }}} Event *riemann_value_to_protobuf */
 
-static Msg *riemann_value_list_to_protobuf (struct riemann_host const *host, /* {{{ */
-					    data_set_t const *ds,
-					    value_list_t const *vl,
-					    int *statuses)
+/* Creates one event per data source and stores them in "events", which must
+ * have room for vl->values_len pointers. */
+static int riemann_value_list_to_events (struct riemann_host const *host, /* {{{ */
+					 riemann_arena_t *a,
+					 data_set_t const *ds,
+					 value_list_t const *vl,
+					 int *statuses,
+					 Event **events)
 {
-	Msg *msg;
 	size_t i;
 	gauge_t *rates = NULL;
 
-	/* Initialize the Msg structure. */
-	msg = malloc (sizeof (*msg));
-	if (msg == NULL)
-	{
-		ERROR ("write_riemann plugin: malloc failed.");
-		return (NULL);
-	}
-	memset (msg, 0, sizeof (*msg));
-	msg__init (msg);
-
-	/* Set up events. First, the list of pointers. */
-	msg->n_events = (size_t) vl->values_len;
-	msg->events = calloc (msg->n_events, sizeof (*msg->events));
-	if (msg->events == NULL)
-	{
-		ERROR ("write_riemann plugin: calloc failed.");
-		riemann_msg_protobuf_free (msg);
-		return (NULL);
-	}
-
 	if (host->store_rates)
 	{
 		rates = uc_get_rate (ds, vl);
 		if (rates == NULL)
 		{
 			ERROR ("write_riemann plugin: uc_get_rate failed.");
-			riemann_msg_protobuf_free (msg);
-			return (NULL);
+			return (-1);
 		}
 	}
 
-	for (i = 0; i < msg->n_events; i++)
+	for (i = 0; i < vl->values_len; i++)
 	{
-		msg->events[i] = riemann_value_to_protobuf (host, ds, vl,
-							    (int) i, rates, statuses[i]);
-		if (msg->events[i] == NULL)
+		events[i] = riemann_value_to_protobuf (host, a, ds, vl,
+							    i, rates, statuses[i]);
+		if (events[i] == NULL)
 		{
-			riemann_msg_protobuf_free (msg);
+			ERROR ("write_riemann plugin: Creating the event failed.");
 			sfree (rates);
-			return (NULL);
+			return (-1);
 		}
 	}
 
 	sfree (rates);
+	return (0);
+} /* }}} int riemann_value_list_to_events */
+
+static Msg *riemann_value_list_to_protobuf (struct riemann_host const *host, /* {{{ */
+					    riemann_arena_t *a,
+					    data_set_t const *ds,
+					    value_list_t const *vl,
+					    int *statuses)
+{
+	Msg *msg;
+
+	/* Initialize the Msg structure. */
+	msg = riemann_arena_alloc (a, sizeof (*msg));
+	if (msg == NULL)
+		return (NULL);
+	msg__init (msg);
+
+	/* Set up events. First, the list of pointers. */
+	msg->n_events = (size_t) vl->values_len;
+	msg->events = riemann_arena_alloc (a,
+			msg->n_events * sizeof (*msg->events));
+	if (msg->events == NULL)
+		return (NULL);
+
+	if (riemann_value_list_to_events (host, a, ds, vl, statuses,
+				msg->events) != 0)
+		return (NULL);
+
 	return (msg);
 } /* }}} Msg *riemann_value_list_to_protobuf */
 
+/* Number of bytes needed to encode "n" as a varint. */
+static size_t riemann_varint_size (size_t n) /* {{{ */
+{
+	size_t size = 1;
+
+	while (n >= 0x80)
+	{
+		n >>= 7;
+		size++;
+	}
+	return (size);
+} /* }}} size_t riemann_varint_size */
 
 /*
  * Always call while holding host->lock !
  */
-static int riemann_batch_flush_nolock (cdtime_t timeout,
+static int riemann_batch_flush_nolock (cdtime_t timeout, /* {{{ */
                                        struct riemann_host *host)
 {
-    cdtime_t    now;
-    int         status = 0;
+	Msg msg;
+	int status = 0;
 
-    if (timeout > 0) {
-        now = cdtime ();
-        if ((host->batch_init + timeout) > now)
-            return status;
-    }
-    riemann_send_msg(host, host->batch_msg);
-    riemann_msg_protobuf_free(host->batch_msg);
+	if (timeout > 0) {
+		if ((host->batch_init + timeout) > cdtime ())
+			return status;
+	}
 
-	if (host->use_tcp && ((status = riemann_recv_ack(host)) != 0))
-        riemann_disconnect (host);
+	/* In pipelined mode this may wait for acknowledgements, during which
+	 * other threads may add to or flush the batch. */
+	status = riemann_send_prepare (host);
+	if ((status == 0) && (host->batch_events_num > 0)) {
+		msg__init (&msg);
+		msg.events = host->batch_events;
+		msg.n_events = host->batch_events_num;
+		status = riemann_send_msg (host, &msg);
+	}
 
-    host->batch_init = cdtime();
-    host->batch_msg = NULL;
-    return status;
-}
+	/* The batch is dropped on errors, as it has been before. */
+	if (host->batch_arena != NULL)
+		riemann_arena_reset (host->batch_arena);
+	host->batch_events_num = 0;
+	host->batch_size = 0;
+	host->batch_init = cdtime();
+	return status;
+} /* }}} int riemann_batch_flush_nolock */
 
 static int riemann_batch_flush (cdtime_t timeout,
         const char *identifier __attribute__((unused)),
@@ -707,73 +1121,93 @@ static int riemann_batch_add_value_list (struct riemann_host *host, /* {{{ */
                                          value_list_t const *vl,
                                          int *statuses)
 {
+	Event **events;
 	size_t i;
-    Event **events;
-    Msg *msg;
-    size_t len;
-    int ret;
-
-    msg = riemann_value_list_to_protobuf (host, ds, vl, statuses);
-    if (msg == NULL)
-        return -1;
-
-    pthread_mutex_lock(&host->lock);
-
-    if (host->batch_msg == NULL) {
-        host->batch_msg = msg;
-    } else {
-        len = msg->n_events + host->batch_msg->n_events;
-        events = realloc(host->batch_msg->events,
-                         (len * sizeof(*host->batch_msg->events)));
-        if (events == NULL) {
-            pthread_mutex_unlock(&host->lock);
-            ERROR ("write_riemann plugin: out of memory");
-            riemann_msg_protobuf_free (msg);
-            return -1;
-        }
-        host->batch_msg->events = events;
-
-        for (i = host->batch_msg->n_events; i < len; i++)
-            host->batch_msg->events[i] = msg->events[i - host->batch_msg->n_events];
-
-        host->batch_msg->n_events = len;
-        sfree (msg->events);
-        msg->n_events = 0;
-        sfree (msg);
-    }
+	int ret;
 
-	len = msg__get_packed_size(host->batch_msg);
-    ret = 0;
-    if (len >= host->batch_max) {
-        ret = riemann_batch_flush_nolock(0, host);
-    }
+	pthread_mutex_lock(&host->lock);
 
-    pthread_mutex_unlock(&host->lock);
-    return ret;
+	if (host->batch_arena == NULL) {
+		host->batch_arena = calloc (1, sizeof (*host->batch_arena));
+		if (host->batch_arena == NULL) {
+			pthread_mutex_unlock(&host->lock);
+			ERROR ("write_riemann plugin: calloc failed.");
+			return -1;
+		}
+	}
+
+	if (host->batch_events_size < host->batch_events_num + vl->values_len) {
+		size_t new_size = 2 * host->batch_events_size;
+
+		if (new_size < host->batch_events_num + vl->values_len)
+			new_size = host->batch_events_num + vl->values_len;
+
+		events = realloc (host->batch_events,
+				new_size * sizeof (*host->batch_events));
+		if (events == NULL) {
+			pthread_mutex_unlock(&host->lock);
+			ERROR ("write_riemann plugin: out of memory");
+			return -1;
+		}
+		host->batch_events = events;
+		host->batch_events_size = new_size;
+	}
+
+	events = host->batch_events + host->batch_events_num;
+	ret = riemann_value_list_to_events (host, host->batch_arena, ds, vl,
+			statuses, events);
+	if (ret != 0) {
+		pthread_mutex_unlock(&host->lock);
+		return -1;
+	}
+
+	/* Keep track of the packed size of the batch: each event is
+	 * encoded as a one byte field tag, its length and its content. */
+	for (i = 0; i < vl->values_len; i++) {
+		size_t len = event__get_packed_size (events[i]);
+		host->batch_size += 1 + riemann_varint_size (len) + len;
+	}
+	host->batch_events_num += vl->values_len;
+
+	ret = 0;
+	if (host->batch_size >= host->batch_max) {
+		ret = riemann_batch_flush_nolock(0, host);
+	}
+
+	pthread_mutex_unlock(&host->lock);
+	return ret;
 } /* }}} Msg *riemann_batch_add_value_list */
 
 static int riemann_notification(const notification_t *n, user_data_t *ud) /* {{{ */
 {
 	int			 status;
 	struct riemann_host	*host = ud->data;
+	riemann_arena_t		*a;
 	Msg			*msg;
 
 	if (!host->notifications)
 		return 0;
 
+	a = riemann_arena_get (host);
+	if (a == NULL)
+		return (-1);
+
     /*
      * Never batch for notifications, send them ASAP
      */
-	msg = riemann_notification_to_protobuf (host, n);
+	msg = riemann_notification_to_protobuf (host, a, n);
 	if (msg == NULL)
+	{
+		riemann_arena_put (host, a);
 		return (-1);
+	}
 
 	status = riemann_send (host, msg);
 	if (status != 0)
 		ERROR ("write_riemann plugin: riemann_send failed with status %i",
 				status);
 
-	riemann_msg_protobuf_free (msg);
+	riemann_arena_put (host, a);
 	return (status);
 } /* }}} int riemann_notification */
 
@@ -784,32 +1218,89 @@ static int riemann_write(const data_set_t *ds, /* {{{ */
 	int			 status = 0;
 	int			 statuses[vl->values_len];
 	struct riemann_host	*host = ud->data;
+	riemann_arena_t		*a;
 	Msg			*msg;
 
 	if (host->check_thresholds)
 		write_riemann_threshold_check(ds, vl, statuses);
 
-    if (host->use_tcp == 1 && host->batch_mode) {
-
-        riemann_batch_add_value_list (host, ds, vl, statuses);
-
+	if (host->use_tcp == 1 && host->batch_mode) {
+		riemann_batch_add_value_list (host, ds, vl, statuses);
+		return status;
+	}
 
-    } else {
+	a = riemann_arena_get (host);
+	if (a == NULL)
+		return (-1);
 
-        msg = riemann_value_list_to_protobuf (host, ds, vl, statuses);
-        if (msg == NULL)
-            return (-1);
+	msg = riemann_value_list_to_protobuf (host, a, ds, vl, statuses);
+	if (msg == NULL) {
+		riemann_arena_put (host, a);
+		return (-1);
+	}
 
-        status = riemann_send (host, msg);
-        if (status != 0)
-            ERROR ("write_riemann plugin: riemann_send failed with status %i",
-                   status);
+	status = riemann_send (host, msg);
+	if (status != 0)
+		ERROR ("write_riemann plugin: riemann_send failed with status %i",
+				status);
 
-        riemann_msg_protobuf_free (msg);
-    }
+	riemann_arena_put (host, a);
 	return status;
 } /* }}} int riemann_write */
 
+static int riemann_stats_read (user_data_t *ud) /* {{{ */
+{
+	struct riemann_host *host = ud->data;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	gauge_t copy_in_flight;
+	gauge_t copy_latency;
+	derive_t copy_sent;
+	derive_t copy_failed;
+
+	pthread_mutex_lock (&host->lock);
+	copy_in_flight = (gauge_t) host->in_flight;
+	if (latency_counter_get_num (host->stats_latency) > 0)
+		copy_latency = CDTIME_T_TO_DOUBLE (
+				latency_counter_get_average (host->stats_latency));
+	else
+		copy_latency = NAN;
+	latency_counter_reset (host->stats_latency);
+	copy_sent = host->stats_sent;
+	copy_failed = host->stats_failed;
+	pthread_mutex_unlock (&host->lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "write_riemann", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, host->name, sizeof (vl.plugin_instance));
+
+	/* Number of messages waiting for an acknowledgement */
+	values[0].gauge = copy_in_flight;
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "in_flight", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Average time between sending a message and its acknowledgement */
+	values[0].gauge = copy_latency;
+	sstrncpy (vl.type, "latency", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "ack", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Number of messages sent and lost */
+	values[0].derive = copy_sent;
+	sstrncpy (vl.type, "total_operations", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "sent", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	values[0].derive = copy_failed;
+	sstrncpy (vl.type_instance, "failed", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	return (0);
+} /* }}} int riemann_stats_read */
+
 static void riemann_free(void *p) /* {{{ */
 {
 	struct riemann_host	*host = p;
@@ -826,9 +1317,46 @@ static void riemann_free(void *p) /* {{{ */
 		return;
 	}
 
+	if (host->batch_events_num > 0)
+		riemann_batch_flush_nolock (0, host);
+
+	/* Give outstanding acknowledgements a moment to arrive. */
+	if (host->in_flight > 0)
+	{
+		struct timespec ts;
+
+		CDTIME_T_TO_TIMESPEC (cdtime () + RIEMANN_DRAIN_TIMEOUT, &ts);
+		while ((host->in_flight > 0) && (host->flags & F_CONNECT))
+			if (pthread_cond_timedwait (&host->ack_cond, &host->lock,
+						&ts) == ETIMEDOUT)
+				break;
+	}
+
 	riemann_disconnect (host);
 
+	while (host->readers_num > 0)
+		pthread_cond_wait (&host->ack_cond, &host->lock);
+
+	pthread_mutex_unlock (&host->lock);
+
+	while (host->arenas != NULL)
+	{
+		riemann_arena_t *a = host->arenas;
+		host->arenas = a->next;
+		riemann_arena_destroy (a);
+	}
+	riemann_arena_destroy (host->batch_arena);
+	sfree (host->batch_events);
+	sfree (host->send_buffer);
+	sfree (host->send_times);
+	latency_counter_destroy (host->stats_latency);
+
+	sfree(host->name);
+	sfree(host->event_service_prefix);
+	sfree(host->node);
 	sfree(host->service);
+	pthread_cond_destroy (&host->ack_cond);
+	pthread_mutex_destroy (&host->arena_lock);
 	pthread_mutex_destroy (&host->lock);
 	sfree(host);
 } /* }}} void riemann_free */
@@ -847,6 +1375,8 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 		return ENOMEM;
 	}
 	pthread_mutex_init (&host->lock, NULL);
+	pthread_mutex_init (&host->arena_lock, NULL);
+	pthread_cond_init (&host->ack_cond, NULL);
 	host->reference_count = 1;
 	host->node = NULL;
 	host->service = NULL;
@@ -859,6 +1389,8 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 	host->batch_max = RIEMANN_BATCH_MAX; /* typical MSS */
 	host->batch_init = cdtime();
 	host->ttl_factor = RIEMANN_TTL_FACTOR;
+	host->max_in_flight = 0;
+	host->report_stats = 0;
 
 	status = cf_util_get_string (ci, &host->name);
 	if (status != 0) {
@@ -899,6 +1431,20 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
             status = cf_util_get_int(child, &host->batch_max);
             if (status != 0)
                 break;
+		} else if (strcasecmp ("MaxInFlight", child->key) == 0) {
+			status = cf_util_get_int (child, &host->max_in_flight);
+			if (status != 0)
+				break;
+			if (host->max_in_flight < 0) {
+				WARNING ("write_riemann plugin: \"MaxInFlight\" "
+						"must not be negative. Disabling "
+						"pipelining.");
+				host->max_in_flight = 0;
+			}
+		} else if (strcasecmp ("ReportStats", child->key) == 0) {
+			status = cf_util_get_boolean (child, &host->report_stats);
+			if (status != 0)
+				break;
 		} else if (strcasecmp ("Port", child->key) == 0) {
 			status = cf_util_get_service (child, &host->service);
 			if (status != 0) {
@@ -975,6 +1521,31 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 		return status;
 	}
 
+	if (!host->use_tcp && (host->max_in_flight > 0)) {
+		NOTICE ("write_riemann plugin: \"MaxInFlight\" has no effect "
+				"with the UDP protocol.");
+		host->max_in_flight = 0;
+	}
+
+	if (host->max_in_flight > 0) {
+		host->send_times = calloc ((size_t) host->max_in_flight,
+				sizeof (*host->send_times));
+		if (host->send_times == NULL) {
+			ERROR ("write_riemann plugin: calloc failed.");
+			riemann_free (host);
+			return ENOMEM;
+		}
+	}
+
+	if (host->report_stats) {
+		host->stats_latency = latency_counter_create ();
+		if (host->stats_latency == NULL) {
+			ERROR ("write_riemann plugin: latency_counter_create failed.");
+			riemann_free (host);
+			return ENOMEM;
+		}
+	}
+
 	ssnprintf (callback_name, sizeof (callback_name), "write_riemann/%s",
 			host->name);
 	ud.data = host;
@@ -995,6 +1566,7 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 	else /* success */
 		host->reference_count++;
 
+	ud.free_func = riemann_free;
 	status = plugin_register_notification (callback_name,
 			riemann_notification, &ud);
 	if (status != 0)
@@ -1004,9 +1576,22 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 	else /* success */
 		host->reference_count++;
 
+	if (host->report_stats) {
+		ud.free_func = riemann_free;
+		status = plugin_register_complex_read (/* group = */ NULL,
+				callback_name, riemann_stats_read,
+				/* interval = */ NULL, &ud);
+		if (status != 0)
+			WARNING ("write_riemann plugin: plugin_register_complex_read (\"%s\") "
+					"failed with status %i.",
+					callback_name, status);
+		else /* success */
+			host->reference_count++;
+	}
+
 	if (host->reference_count <= 1)
 	{
-		/* Both callbacks failed => free memory.
+		/* All callbacks failed => free memory.
 		 * We need to unlock here, because riemann_free() will lock.
 		 * This is not a race condition, because we're the only one
 		 * holding a reference. */
@@ -0,0 +1,514 @@
+/**
+ * collectd - src/write_tsfile.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   collectd contributors
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+
+#include "utils_avltree.h"
+#include "utils_tsfile.h"
+
+#include <pthread.h>
+#include <dirent.h>
+
+/*
+ * Private data types
+ */
+/* A series together with whether it was written to in the active segment.
+ * Series which were not are dropped when the segment is rotated. */
+struct ts_series_s
+{
+  tsf_series_t *series;
+  _Bool written;
+};
+typedef struct ts_series_s ts_series_t;
+
+/*
+ * Private variables
+ */
+static char *datadir = NULL;
+static cdtime_t segment_duration = 0;
+static int block_size = 120;
+static cdtime_t retention_time = 0;
+static cdtime_t compaction_interval = 0;
+
+/* Protects the series and the active segment. */
+static pthread_mutex_t ts_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *series_tree = NULL;
+static tsf_segment_t *segment = NULL;
+static char segment_filename[PATH_MAX];
+static cdtime_t segment_end = 0;
+/* Set by ts_shutdown(); writes arriving afterwards are refused. */
+static _Bool write_shutdown = 0;
+
+static pthread_mutex_t compact_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compact_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compact_thread;
+static _Bool compact_thread_running = 0;
+static _Bool do_shutdown = 0;
+
+/* Writes all pending points of all series to the active segment. Must be
+ * called with "ts_lock" held. */
+static int ts_write_all (void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char *key;
+  ts_series_t *s;
+  int status = 0;
+
+  if (segment == NULL)
+    return (0);
+
+  iter = c_avl_get_iterator (series_tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &s) == 0)
+  {
+    if (tsf_series_points (s->series) == 0)
+      continue;
+    if (tsf_segment_write (segment, s->series) != 0)
+      status = -1;
+  }
+  c_avl_iterator_destroy (iter);
+
+  return (status);
+} /* }}} int ts_write_all */
+
+static void ts_series_free (char *key, ts_series_t *s) /* {{{ */
+{
+  sfree (key);
+  if (s == NULL)
+    return;
+  tsf_series_destroy (s->series);
+  sfree (s);
+} /* }}} void ts_series_free */
+
+/* Removes the series which were not written to since the last call, so
+ * series that stopped reporting don't stay in memory forever. Their points
+ * have been written out already. Must be called with "ts_lock" held. */
+static void ts_expire_series (void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char **expired;
+  size_t expired_num = 0;
+  char *key;
+  ts_series_t *s;
+  size_t i;
+
+  if ((series_tree == NULL) || (c_avl_size (series_tree) == 0))
+    return;
+
+  expired = calloc ((size_t) c_avl_size (series_tree), sizeof (*expired));
+  if (expired == NULL)
+    return;
+
+  iter = c_avl_get_iterator (series_tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &s) == 0)
+  {
+    if (s->written)
+      s->written = 0;
+    else
+      expired[expired_num++] = key;
+  }
+  c_avl_iterator_destroy (iter);
+
+  for (i = 0; i < expired_num; i++)
+  {
+    if (c_avl_remove (series_tree, expired[i], (void *) &key,
+          (void *) &s) == 0)
+      ts_series_free (key, s);
+  }
+  sfree (expired);
+
+  DEBUG ("write_tsfile plugin: Dropped %zu inactive series.", expired_num);
+} /* }}} void ts_expire_series */
+
+/* Closes the active segment, if any, and starts a new one if "now" is
+ * non-zero. Must be called with "ts_lock" held. */
+static int ts_rotate (cdtime_t now) /* {{{ */
+{
+  if (segment != NULL)
+  {
+    ts_write_all ();
+    tsf_segment_close (segment);
+    segment = NULL;
+    segment_filename[0] = 0;
+    ts_expire_series ();
+  }
+
+  if (now == 0)
+    return (0);
+
+  ssnprintf (segment_filename, sizeof (segment_filename), "%s/%lu%s",
+      datadir, (unsigned long) CDTIME_T_TO_TIME_T (now), TSF_SEGMENT_SUFFIX);
+
+  segment = tsf_segment_open (segment_filename);
+  if (segment == NULL)
+  {
+    ERROR ("write_tsfile plugin: Opening segment %s failed.",
+        segment_filename);
+    segment_filename[0] = 0;
+    return (-1);
+  }
+
+  segment_end = now + segment_duration;
+  return (0);
+} /* }}} int ts_rotate */
+
+static int ts_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    __attribute__((unused)) user_data_t *user_data)
+{
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  ts_series_t *s = NULL;
+  cdtime_t now;
+  int status;
+
+  if (0 != strcmp (ds->type, vl->type))
+  {
+    ERROR ("write_tsfile plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  status = FORMAT_VL (identifier, sizeof (identifier), vl);
+  if (status != 0)
+    return (status);
+
+  now = cdtime ();
+
+  pthread_mutex_lock (&ts_lock);
+
+  /* Write threads are stopped after the shutdown callbacks have run. A
+   * late value must not open a new segment. */
+  if (write_shutdown)
+  {
+    pthread_mutex_unlock (&ts_lock);
+    return (-1);
+  }
+
+  if ((segment == NULL) || (now >= segment_end))
+  {
+    status = ts_rotate (now);
+    if (status != 0)
+    {
+      pthread_mutex_unlock (&ts_lock);
+      return (status);
+    }
+  }
+
+  if (c_avl_get (series_tree, identifier, (void *) &s) == 0)
+  {
+    /* The data set changed, e.g. after types.db was edited. */
+    if (tsf_series_values_num (s->series) != (size_t) ds->ds_num)
+    {
+      char *key = NULL;
+
+      tsf_segment_write (segment, s->series);
+      c_avl_remove (series_tree, identifier, (void *) &key, NULL);
+      ts_series_free (key, s);
+      s = NULL;
+    }
+  }
+  else
+    s = NULL;
+
+  if (s == NULL)
+  {
+    int ds_types[ds->ds_num];
+    char *key;
+    int i;
+
+    for (i = 0; i < ds->ds_num; i++)
+      ds_types[i] = ds->ds[i].type;
+
+    key = strdup (identifier);
+    s = calloc (1, sizeof (*s));
+    if (s != NULL)
+      s->series = tsf_series_create (identifier, ds_types,
+          (size_t) ds->ds_num);
+    if ((key == NULL) || (s == NULL) || (s->series == NULL)
+        || (c_avl_insert (series_tree, key, s) != 0))
+    {
+      ERROR ("write_tsfile plugin: Creating series \"%s\" failed.",
+          identifier);
+      ts_series_free (key, s);
+      pthread_mutex_unlock (&ts_lock);
+      return (-1);
+    }
+  }
+
+  s->written = 1;
+  status = tsf_series_append (s->series, vl->time, vl->values);
+  if ((status == 0) && (tsf_series_points (s->series) >= (size_t) block_size))
+    status = tsf_segment_write (segment, s->series);
+
+  pthread_mutex_unlock (&ts_lock);
+
+  if (status != 0)
+    ERROR ("write_tsfile plugin: Storing \"%s\" failed with status %i.",
+        identifier, status);
+  return (status);
+} /* }}} int ts_write */
+
+static int ts_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+    const char *identifier,
+    __attribute__((unused)) user_data_t *user_data)
+{
+  ts_series_t *s;
+  int status = 0;
+
+  pthread_mutex_lock (&ts_lock);
+
+  if (segment == NULL)
+    status = 0;
+  else if (identifier == NULL)
+    status = ts_write_all ();
+  else if (c_avl_get (series_tree, identifier, (void *) &s) == 0)
+    status = tsf_segment_write (segment, s->series);
+
+  pthread_mutex_unlock (&ts_lock);
+
+  return (status);
+} /* }}} int ts_flush */
+
+/* Compacts closed segments and removes expired ones. */
+static void ts_compact_all (void) /* {{{ */
+{
+  DIR *dh;
+  struct dirent *de;
+  cdtime_t now = cdtime ();
+
+  dh = opendir (datadir);
+  if (dh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("write_tsfile plugin: opendir (%s) failed: %s", datadir,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return;
+  }
+
+  while ((de = readdir (dh)) != NULL)
+  {
+    char filename[PATH_MAX];
+    size_t len = strlen (de->d_name);
+    cdtime_t first;
+    cdtime_t last;
+    _Bool compacted;
+    _Bool active;
+    int status;
+
+    if ((len <= strlen (TSF_SEGMENT_SUFFIX))
+        || (strcmp (de->d_name + len - strlen (TSF_SEGMENT_SUFFIX),
+            TSF_SEGMENT_SUFFIX) != 0))
+      continue;
+
+    ssnprintf (filename, sizeof (filename), "%s/%s", datadir, de->d_name);
+
+    /* Segments may be rotated while the directory is being processed, so
+     * the active segment is checked for right before each file is touched.
+     * Newly opened segments have no index yet and would be compacted
+     * otherwise. */
+    pthread_mutex_lock (&ts_lock);
+    active = (strcmp (filename, segment_filename) == 0);
+    pthread_mutex_unlock (&ts_lock);
+    if (active)
+      continue;
+
+    status = tsf_segment_info (filename, &first, &last, &compacted);
+    if ((status == 0) && (retention_time > 0)
+        && ((last + retention_time) < now))
+    {
+      DEBUG ("write_tsfile plugin: Removing expired segment %s.", filename);
+      if (unlink (filename) != 0)
+      {
+        char errbuf[1024];
+        ERROR ("write_tsfile plugin: unlink (%s) failed: %s", filename,
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+      }
+      continue;
+    }
+
+    /* Segments without index were not closed properly; compacting them
+     * writes an index, too. */
+    if ((status == 0) && compacted)
+      continue;
+
+    if (tsf_segment_compact (filename) != 0)
+      ERROR ("write_tsfile plugin: Compacting %s failed.", filename);
+  }
+
+  closedir (dh);
+} /* }}} void ts_compact_all */
+
+static void *ts_compact_thread (__attribute__((unused)) void *arg) /* {{{ */
+{
+  pthread_mutex_lock (&compact_lock);
+  while (!do_shutdown)
+  {
+    struct timespec ts_wait;
+
+    CDTIME_T_TO_TIMESPEC (cdtime () + compaction_interval, &ts_wait);
+    pthread_cond_timedwait (&compact_cond, &compact_lock, &ts_wait);
+    if (do_shutdown)
+      break;
+
+    pthread_mutex_unlock (&compact_lock);
+    ts_compact_all ();
+    pthread_mutex_lock (&compact_lock);
+  }
+  pthread_mutex_unlock (&compact_lock);
+
+  return (NULL);
+} /* }}} void *ts_compact_thread */
+
+static int ts_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+      status = cf_util_get_string (child, &datadir);
+    else if (strcasecmp ("SegmentDuration", child->key) == 0)
+      status = cf_util_get_cdtime (child, &segment_duration);
+    else if (strcasecmp ("BlockSize", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &block_size);
+      if ((status == 0) && (block_size < 1))
+      {
+        ERROR ("write_tsfile plugin: BlockSize must be positive.");
+        block_size = 120;
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("RetentionTime", child->key) == 0)
+      status = cf_util_get_cdtime (child, &retention_time);
+    else if (strcasecmp ("CompactionInterval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &compaction_interval);
+    else
+      WARNING ("write_tsfile plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int ts_config */
+
+static int ts_init (void) /* {{{ */
+{
+  char filename[PATH_MAX];
+  int status;
+
+  if (datadir == NULL)
+  {
+    ERROR ("write_tsfile plugin: The \"DataDir\" option is required.");
+    return (-1);
+  }
+
+  /* check_create_dir() creates the parent directories of a file. */
+  ssnprintf (filename, sizeof (filename), "%s/x", datadir);
+  if (check_create_dir (filename) != 0)
+    return (-1);
+
+  if (segment_duration == 0)
+    segment_duration = TIME_T_TO_CDTIME_T (3600);
+  if (compaction_interval == 0)
+    compaction_interval = TIME_T_TO_CDTIME_T (600);
+
+  pthread_mutex_lock (&ts_lock);
+  if (series_tree == NULL)
+    series_tree = c_avl_create ((void *) strcmp);
+  pthread_mutex_unlock (&ts_lock);
+  if (series_tree == NULL)
+  {
+    ERROR ("write_tsfile plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  pthread_mutex_lock (&compact_lock);
+  if (!compact_thread_running)
+  {
+    do_shutdown = 0;
+    status = plugin_thread_create (&compact_thread, /* attr = */ NULL,
+        ts_compact_thread, /* arg = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("write_tsfile plugin: Cannot create compaction thread: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+    }
+    else
+      compact_thread_running = 1;
+  }
+  pthread_mutex_unlock (&compact_lock);
+
+  return (0);
+} /* }}} int ts_init */
+
+static int ts_shutdown (void) /* {{{ */
+{
+  char *key;
+  ts_series_t *s;
+
+  pthread_mutex_lock (&compact_lock);
+  do_shutdown = 1;
+  pthread_cond_broadcast (&compact_cond);
+  pthread_mutex_unlock (&compact_lock);
+
+  if (compact_thread_running)
+  {
+    pthread_join (compact_thread, /* retval = */ NULL);
+    compact_thread_running = 0;
+  }
+
+  pthread_mutex_lock (&ts_lock);
+  write_shutdown = 1;
+  ts_rotate (/* now = */ 0);
+  if (series_tree != NULL)
+  {
+    while (c_avl_pick (series_tree, (void *) &key, (void *) &s) == 0)
+      ts_series_free (key, s);
+    c_avl_destroy (series_tree);
+    series_tree = NULL;
+  }
+  pthread_mutex_unlock (&ts_lock);
+
+  return (0);
+} /* }}} int ts_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("write_tsfile", ts_config);
+  plugin_register_init ("write_tsfile", ts_init);
+  plugin_register_write ("write_tsfile", ts_write, /* user_data = */ NULL);
+  plugin_register_flush ("write_tsfile", ts_flush, /* user_data = */ NULL);
+  plugin_register_shutdown ("write_tsfile", ts_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */